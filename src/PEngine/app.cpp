@@ -32,6 +32,13 @@
 #endif
 #endif
 
+// Longest real time [ms] passed to a single tick, longer pauses are dropped;
+// also the slice of game time ticked at a time in max throughput mode
+#define MAX_TICK_TIME 100
+
+// In max throughput mode, real time [ms] between two drawn frames
+#define MAX_THROUGHPUT_DRAW_TIME 250
+
 
 /*
 FIXME: not bothering to close joysticks because I
@@ -39,8 +46,6 @@ suspect SDL does it for you on quit. Am I right?
 */
 
 
-int PUtil::deblev = DEBUGLEVEL_ENDUSER;
-
 PApp::PApp(const std::string &title, const std::string &name):
         best_times("/players"),
         appname(name), // for ~/.name
@@ -64,6 +69,8 @@ PApp::PApp(const std::string &title, const std::string &name):
     stereo = StereoNone;
     stereoEyeTranslation = 0.0f;
     grabinput = false;
+    timescale = 1.0f;
+    maxthroughput = false;
 }
 
 void PApp::setScreenModeAutoWindow()
@@ -586,6 +593,7 @@ int PApp::run(int argc, char *argv[])
 
   bool active = true, repaint = true, axis_down = false;
   uint32 curtime = SDL_GetTicks() - 1;
+  uint32 lastdrawtime = curtime;
 
   while (1) {
     SDL_Event event;
@@ -671,15 +679,17 @@ int PApp::run(int argc, char *argv[])
 
     sdl_mousemap = SDL_GetMouseState(nullptr, nullptr);
 
-#define TIMESCALE 1.0
-
     uint32 nowtime = SDL_GetTicks();
 
     if (1) {//if (active) {
       uint32 timepassed = nowtime - curtime;
-      if (timepassed > 100) timepassed = 100;
+      if (timepassed > MAX_TICK_TIME) timepassed = MAX_TICK_TIME;
+
+      // game time doesn't follow the clock when running flat out
+      if (maxthroughput) timepassed = MAX_TICK_TIME;
+
       if (timepassed > 0) {
-        float delta = (float)timepassed * 0.001 * TIMESCALE;
+        float delta = (float)timepassed * 0.001f * (maxthroughput ? 1.0f : timescale);
 
         tick(delta);
 
@@ -694,7 +704,15 @@ int PApp::run(int argc, char *argv[])
 
     if (exit_requested) break;
 
-    if (active || repaint) {
+    // running flat out, most frames go undrawn
+    bool drawframe = true;
+
+    if (maxthroughput) {
+      drawframe = (nowtime - lastdrawtime >= MAX_THROUGHPUT_DRAW_TIME);
+      if (drawframe) lastdrawtime = nowtime;
+    }
+
+    if ((active || repaint) && drawframe) {
       switch (stereo) {
         
       case StereoNone: // Normal, non-stereo rendering
@@ -64,8 +64,16 @@ void PConfig::loadConfig()
   cfg_speed_unit = mph;
   cfg_snowflaketype = SnowFlakeType::point;
   cfg_dirteffect = true;
+  cfg_tilecache = 64;
+  cfg_viewradius = 3;
+  cfg_terrainerror = 2.0f;
+  cfg_horizonculling = true;
   cfg_enable_fps = false;
   cfg_enable_ghost = false;
+  cfg_timescale = 1.0f;
+  cfg_maxthroughput = false;
+  cfg_racereport.clear();
+  cfg_savereplays = false;
 
   cfg_datadirs.clear();
 
@@ -80,6 +88,8 @@ void PConfig::loadConfig()
   ctrl.action_name[ActionHandbrake] = std::string("handbrake");
   ctrl.action_name[ActionRecover] = std::string("recover");
   ctrl.action_name[ActionRecoverAtCheckpoint] = std::string("recoveratcheckpoint");
+  ctrl.action_name[ActionRestart] = std::string("restart");
+  ctrl.action_name[ActionRewind] = std::string("rewind");
   ctrl.action_name[ActionCamMode] = std::string("cammode");
   ctrl.action_name[ActionCamLeft] = std::string("camleft");
   ctrl.action_name[ActionCamRight] = std::string("camright");
@@ -339,6 +349,40 @@ void PConfig::loadConfig()
             else
                 cfg_dirteffect = false;
         }
+
+        val = walk->Attribute("tilecache");
+
+        if (val)
+        {
+            cfg_tilecache = atoi(val);
+            CLAMP_LOWER(cfg_tilecache, 1);
+        }
+
+        val = walk->Attribute("viewradius");
+
+        if (val)
+        {
+            cfg_viewradius = atoi(val);
+            CLAMP(cfg_viewradius, 1, 16);
+        }
+
+        val = walk->Attribute("terrainerror");
+
+        if (val)
+        {
+            cfg_terrainerror = atof(val);
+            CLAMP_LOWER(cfg_terrainerror, 0.0f);
+        }
+
+        val = walk->Attribute("horizonculling");
+
+        if (val)
+        {
+            if (!strcmp(val, "yes"))
+                cfg_horizonculling = true;
+            else
+                cfg_horizonculling = false;
+        }
     }
     else
     if (!strcmp(walk->Value(), "datadirectory"))
@@ -403,6 +447,33 @@ void PConfig::loadConfig()
           cfg_enable_ghost = false;
       }
 
+      val = walk->Attribute("timescale");
+      if (val) {
+        cfg_timescale = atof(val);
+        if (cfg_timescale <= 0.0f)
+          cfg_timescale = 1.0f;
+      }
+
+      val = walk->Attribute("maxthroughput");
+      if (val) {
+        if (!strcmp(val, "yes"))
+          cfg_maxthroughput = true;
+        else if (!strcmp(val, "no"))
+          cfg_maxthroughput = false;
+      }
+
+      val = walk->Attribute("racereport");
+      if (val)
+        cfg_racereport = val;
+
+      val = walk->Attribute("savereplays");
+      if (val) {
+        if (!strcmp(val, "yes"))
+          cfg_savereplays = true;
+        else if (!strcmp(val, "no"))
+          cfg_savereplays = false;
+      }
+
       val = walk->Attribute("codriver");
 
       if (val != nullptr)
@@ -630,6 +701,15 @@ void PConfig::storeConfig()
         walk->SetAttribute("dirteffect", "yes");
       else
         walk->SetAttribute("dirteffect", "no");
+
+      walk->SetAttribute("tilecache", cfg_tilecache);
+      walk->SetAttribute("viewradius", cfg_viewradius);
+      walk->SetAttribute("terrainerror", cfg_terrainerror);
+
+      if (cfg_horizonculling)
+        walk->SetAttribute("horizonculling", "yes");
+      else
+        walk->SetAttribute("horizonculling", "no");
     }
     else if (!strcmp(walk->Value(), "parameters")) {
       if (cfg_enable_sound)
@@ -657,6 +737,20 @@ void PConfig::storeConfig()
       else
         walk->SetAttribute("enableghost", "no");
 
+      walk->SetAttribute("timescale", cfg_timescale);
+
+      if (cfg_maxthroughput)
+        walk->SetAttribute("maxthroughput", "yes");
+      else
+        walk->SetAttribute("maxthroughput", "no");
+
+      walk->SetAttribute("racereport", cfg_racereport.c_str());
+
+      if (cfg_savereplays)
+        walk->SetAttribute("savereplays", "yes");
+      else
+        walk->SetAttribute("savereplays", "no");
+
       walk->SetAttribute("codriver", cfg_codrivername.c_str());
 
       walk->SetAttribute("codriversigns", cfg_codriversigns.c_str());
@@ -708,6 +802,26 @@ bool PConfig::getWeather() const
   return cfg_weather;
 }
 
+int PConfig::getTileCache() const
+{
+  return cfg_tilecache;
+}
+
+int PConfig::getViewRadius() const
+{
+  return cfg_viewradius;
+}
+
+float PConfig::getTerrainError() const
+{
+  return cfg_terrainerror;
+}
+
+bool PConfig::getHorizonCulling() const
+{
+  return cfg_horizonculling;
+}
+
 int PConfig::getVideoCx() const
 {
   return cfg_video_cx;
@@ -783,6 +897,26 @@ bool PConfig::getEnableGhost() const
   return cfg_enable_ghost;
 }
 
+float PConfig::getTimeScale() const
+{
+  return cfg_timescale;
+}
+
+bool PConfig::getMaxThroughput() const
+{
+  return cfg_maxthroughput;
+}
+
+const std::string &PConfig::getRaceReport() const
+{
+  return cfg_racereport;
+}
+
+bool PConfig::getSaveReplays() const
+{
+  return cfg_savereplays;
+}
+
 float PConfig::getDrivingassist() const
 {
   return cfg_drivingassist;
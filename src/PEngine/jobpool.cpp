@@ -0,0 +1,155 @@
+
+// jobpool.cpp [pengine]
+
+// License: GPL version 2 (see included gpl.txt)
+
+#include "jobpool.h"
+
+///
+/// @brief constructor, doesn't start any thread yet
+/// @param threads = worker threads besides the caller, 0 means run serially
+///
+PJobPool::PJobPool(unsigned int threads) :
+  threadcount(threads),
+  current(nullptr),
+  remaining(0),
+  batch(0),
+  quit(false)
+{
+}
+
+///
+/// @brief destructor, stops and joins the worker threads
+///
+PJobPool::~PJobPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    quit = true;
+  }
+  wake.notify_all();
+
+  for (unsigned int i=0; i<workers.size(); ++i)
+    workers[i].join();
+}
+
+///
+/// @brief One worker for every core but the one running the caller
+///
+unsigned int PJobPool::getDefaultThreadCount()
+{
+  const unsigned int cores = std::thread::hardware_concurrency();
+
+  return cores > 1 ? cores - 1 : 0;
+}
+
+void PJobPool::start()
+{
+  queues.resize(threadcount + 1);
+  for (unsigned int i=0; i<queues.size(); ++i)
+    queues[i].reset(new Queue());
+
+  for (unsigned int i=0; i<threadcount; ++i)
+    workers.push_back(std::thread(&PJobPool::workerMain, this, i));
+}
+
+///
+/// @brief Runs all the jobs of a batch and waits for them to finish
+/// @param count = number of jobs
+/// @param job = called once for every index from 0 to count - 1
+///
+void PJobPool::parallelFor(unsigned int count, const std::function<void (unsigned int)> &job)
+{
+  if (threadcount == 0 || count < 2) {
+    for (unsigned int i=0; i<count; ++i)
+      job(i);
+    return;
+  }
+
+  if (workers.empty()) start();
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    current = &job;
+    remaining = count;
+
+    // deal the jobs round robin, neighbouring indices go to different threads
+    for (unsigned int i=0; i<count; ++i) {
+      Queue &queue = *queues[i % queues.size()];
+      std::lock_guard<std::mutex> qlock(queue.mutex);
+      if (queue.first == queue.items.size()) {
+        queue.items.clear();
+        queue.first = 0;
+      }
+      queue.items.push_back(i);
+    }
+
+    ++batch;
+  }
+  wake.notify_all();
+
+  while (runOne(threadcount)) { }
+
+  std::unique_lock<std::mutex> lock(mutex);
+  done.wait(lock, [this] { return remaining == 0; });
+  current = nullptr;
+}
+
+///
+/// @brief Thread function of the workers
+/// @param home = index of the worker's own queue
+///
+void PJobPool::workerMain(unsigned int home)
+{
+  unsigned int seen = 0;
+
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      wake.wait(lock, [this, seen] { return quit || batch != seen; });
+      if (quit) return;
+      seen = batch;
+    }
+
+    while (runOne(home)) { }
+  }
+}
+
+///
+/// @brief Runs one job, from the home queue or stolen from another one
+/// @param home = index of the queue to look in first
+/// @retval false if all the queues were empty
+///
+bool PJobPool::runOne(unsigned int home)
+{
+  unsigned int index = 0;
+  bool found = false;
+
+  for (unsigned int i=0; i<queues.size() && !found; ++i) {
+    Queue &queue = *queues[(home + i) % queues.size()];
+    std::lock_guard<std::mutex> qlock(queue.mutex);
+
+    if (queue.first == queue.items.size()) continue;
+
+    // own work from the front, stolen work from the back
+    if (i == 0) {
+      index = queue.items[queue.first++];
+    } else {
+      index = queue.items.back();
+      queue.items.pop_back();
+    }
+    found = true;
+  }
+
+  if (!found) return false;
+
+  (*current)(index);
+
+  if (--remaining == 0) {
+    std::lock_guard<std::mutex> lock(mutex);
+    done.notify_all();
+  }
+
+  return true;
+}
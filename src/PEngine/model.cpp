@@ -22,7 +22,7 @@ PSSModel::~PSSModel()
 }
 
 
-PModel *PSSModel::loadModel(const std::string &name)
+PModel *PModelList::loadModel(const std::string &name)
 {
   PModel *mdl = modlist.find(name);
   if (!mdl) {
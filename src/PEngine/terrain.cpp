@@ -7,6 +7,84 @@
 #include "exception.h"
 #include "main.h"
 #include "pengine.h"
+#include "tilebuilder.h"
+#include <algorithm>
+#include <chrono>
+
+// tiles drawn on each side of the camera tile, see render()
+#define TILE_RADIUS_DEFAULT  3
+#define TILE_RADIUS_MAX     16
+
+// tiles are built in the background around where the camera will be this
+// many seconds later, and this many tiles further than the view radius
+#define TILE_PREDICT_TIME    1.5f
+#define TILE_PREDICT_MARGIN  1
+
+// seconds a frame may spend uploading tiles built in the background
+#define TILE_UPLOAD_BUDGET  0.002f
+
+// the cache must hold at least every tile of one frame, and the tiles built
+// ahead of the camera
+#define TILE_CACHE_MIN(radius)  ((2 * (radius) + 1) * (2 * (radius) + 1) + \
+  (2 * ((radius) + TILE_PREDICT_MARGIN) + 1) * (2 * ((radius) + TILE_PREDICT_MARGIN) + 1) + 15)
+
+// default memory budget of the tile cache, in megabytes
+#define TILE_CACHE_DEFAULT_MB  64
+
+// foliage and road signs are only drawn this many tiles around the camera,
+// whatever the view radius
+#define FOLIAGE_RADIUS  3
+
+// size of the crossed quads of foliage and road signs, times their scale
+#define HMULT   1.0
+#define VMULT   2.0
+
+// places the shared crossed quads of a foliage band for each instance, and
+// drops the instances out of the mesh's range of distances or past their
+// cut; those close to it get a fade, 1 down to 0
+static const char *foliageVertexShader =
+  "#version 110\n"
+  "uniform vec3 lod;\n" // x, y = distances the mesh is drawn from and to, z = fade distance
+  "attribute vec4 placement;\n" // xyz = position, w = angle
+  "attribute vec2 sizing;\n" // x = scale, y = cut
+  "varying float fade;\n"
+  "void main()\n"
+  "{\n"
+  "  float dist = length((gl_ModelViewMatrix * vec4(placement.xyz, 1.0)).xyz);\n"
+  "  fade = clamp((sizing.y - dist) / lod.z, 0.0, 1.0);\n"
+  "  float c = cos(placement.w), s = sin(placement.w);\n"
+  "  vec3 corner = vec3(c * gl_Vertex.x - s * gl_Vertex.y, s * gl_Vertex.x + c * gl_Vertex.y, gl_Vertex.z);\n"
+  "  vec4 eye = gl_ModelViewMatrix * vec4(placement.xyz + corner * sizing.x, 1.0);\n"
+  "  gl_Position = gl_ProjectionMatrix * eye;\n"
+  "  gl_TexCoord[0] = gl_MultiTexCoord0;\n"
+  "  gl_FrontColor = gl_Color;\n"
+  "  gl_FogFragCoord = abs(eye.z);\n"
+  "  if (dist < lod.x || dist >= lod.y || fade <= 0.0)\n"
+  "    gl_Position = vec4(0.0, 0.0, 2.0, 1.0);\n" // all corners clipped away
+  "}\n";
+
+// textures and alpha tests the quads like the fixed pipeline does for baked
+// ones, and fogs them the way the game sets fog up, GL_EXP; fading quads
+// dissolve through a 4x4 ordered dither, so no blending or sorting is needed
+static const char *foliageFragmentShader =
+  "#version 110\n"
+  "uniform sampler2D sprite;\n"
+  "uniform float fogdensity;\n"
+  "varying float fade;\n"
+  "void main()\n"
+  "{\n"
+  "  vec4 color = texture2D(sprite, gl_TexCoord[0].st) * gl_Color;\n"
+  "  vec2 cell = mod(floor(gl_FragCoord.xy), 4.0);\n"
+  "  vec2 fine = mod(cell, 2.0), coarse = floor(cell * 0.5);\n"
+  "  float threshold = (4.0 * mod(2.0 * fine.x + 3.0 * fine.y, 4.0) +\n"
+  "    mod(2.0 * coarse.x + 3.0 * coarse.y, 4.0) + 0.5) / 16.0;\n"
+  "  if (color.a < 0.5 || fade < threshold) discard;\n"
+  "  float fog = clamp(exp(-fogdensity * gl_FogFragCoord), 0.0, 1.0);\n"
+  "  gl_FragColor = vec4(mix(gl_Fog.color.rgb, color.rgb, fog), color.a);\n"
+  "}\n";
+
+// shortest fade, so that bands without one still end cleanly
+#define FOLIAGE_FADE_MIN  0.001f
 
 PTerrain::~PTerrain ()
 {
@@ -16,746 +94,554 @@ PTerrain::~PTerrain ()
 
 void PTerrain::unload()
 {
-  loaded = false;
+  // stop building tiles before the maps they are built from go
+  builder.reset();
 
   tile.clear();
 
-  hmap.clear();
+  if (foliageprogram) {
+    glDeleteProgram(foliageprogram);
+    foliageprogram = 0;
+  }
+
+  PTerrainData::unload();
 }
 
 
 PTerrain::PTerrain (XMLElement *element, const std::string &filepath, PSSTexture &ssTexture,
     const PRigidity &rigidity, bool cfgFoliage, bool cfgRoadsigns) :
-    loaded (false), rigidity(rigidity)
+    PTerrainData (element, filepath, rigidity, cfgFoliage, cfgRoadsigns),
+    tile(TILE_CACHE_MIN(TILE_RADIUS_DEFAULT)),
+    viewradius(TILE_RADIUS_DEFAULT),
+    lodtolerance(0.0f),
+    tilecachebudget(TILE_CACHE_DEFAULT_MB),
+    horizonculling(true),
+    foliageprogram(0)
 {
-  unload();
-
-  std::string heightmap, colormap, terrainmap, roadmap, foliagemap, hudmap;
-
-  scale_hz = 1.0;
-  scale_vt = 1.0;
-
-  const char *val;
+  // load sprites, dropping road signs that can't be drawn
 
-  val = element->Attribute("tilesize");
-  if (val) tilesize = atoi(val);
+  for (unsigned int b = 0; b < foliageband.size(); b++) {
+    if (!foliageband[b].sprite_name.empty())
+      foliageband[b].sprite_tex = ssTexture.loadTexture(foliageband[b].sprite_name);
+  }
 
-  val = element->Attribute("horizontalscale");
-  if (val) scale_hz = atof(val);
+  for (std::vector<road_sign>::iterator rs = roadsigns.begin(); rs != roadsigns.end(); ) {
+    rs->sprite = ssTexture.loadTexture(rs->sprite_name);
 
-  val = element->Attribute("verticalscale");
-  if (val) scale_vt = atof(val);
+    if (rs->sprite == nullptr)
+      rs = roadsigns.erase(rs);
+    else
+      ++rs;
+  }
 
-  val = element->Attribute("heightmap");
-  if (val) heightmap = val;
+  std::string hudmap;
 
-  val = element->Attribute("colormap");
-  if (val) colormap = val;
+  const char *val = element->Attribute("hudmap");
+  if (val) hudmap = val;
 
-  val = element->Attribute("terrainmap");
-  if (val != nullptr) terrainmap = val;
+  // load hud map
 
-  val = element->Attribute("roadmap");
-  if (val != nullptr) roadmap = val;
+  tex_hud_map = nullptr;
 
-  val = element->Attribute("foliagemap");
-  if (val && cfgFoliage) foliagemap = val;
+  if (hudmap.length()) {
+    tex_hud_map = ssTexture.loadTexture(PUtil::assemblePath(hudmap, filepath));
+  }
 
-  val = element->Attribute("hudmap");
-  if (val) hudmap = val;
+  buildLodIndices();
+  initFoliageInstancing();
 
-  XMLElement *node = element->FirstChildElement("blurfilter");
-  std::vector<std::vector<float> > blurfilter;
+  setTileCacheBudget(TILE_CACHE_DEFAULT_MB);
 
-  if (node != nullptr) {
-    for (XMLElement *walk = node->FirstChildElement("row");
-        walk != nullptr;
-        walk = walk->NextSiblingElement("row")) {
-      const char *srow = walk->Attribute("data");
+  builder.reset(new PTileBuilder(PTileBuilder::getDefaultThreadCount(),
+    [this] (PTerrainTileBuild &build) { buildTile(build); }));
+}
 
-      if (srow == nullptr)
-          continue;
+///
+/// @brief Sizes the tile cache to fit in a memory budget
+/// @details The size of a tile is estimated from its vertices, its mipmapped
+///  color map piece and the most foliage its bands could place on it, as
+///  instances or as quads.
+///  All cached tiles are dropped.
+/// @param megabytes = memory budget for the cached tiles
+///
+void PTerrain::setTileCacheBudget(unsigned int megabytes)
+{
+  const int tilesizep1 = tilesize + 1;
 
-      std::stringstream bfrow(srow);
-      float coef;
-      std::vector<float> row;
+  tilecachebudget = megabytes;
 
-      while (bfrow >> coef)
-        row.push_back(coef);
+  size_t tilebytes = tilesizep1 * tilesizep1 * sizeof(vec3f);
+  tilebytes += cmaptilesize * cmaptilesize * 4 * 4 / 3;
 
-      blurfilter.push_back(row);
-    }
-  }
-  else {
-    blurfilter = {
-        {0.03f, 0.12f, 0.03f},
-        {0.12f, 0.40f, 0.12f},
-        {0.03f, 0.12f, 0.03f}
-    };
+  for (unsigned int b = 0; b < foliageband.size(); b++) {
+    if (foliageprogram)
+      tilebytes += foliageband[b].trycount * sizeof(PFoliageInstance);
+    else
+      tilebytes += foliageband[b].trycount * foliageband[b].sprite_count *
+        (4 * sizeof(PVert_tv) + 6 * sizeof(uint32));
   }
 
-  for (XMLElement *walk = element->FirstChildElement();
-    walk; walk = walk->NextSiblingElement()) {
+  size_t capacity = (size_t)megabytes * 1024 * 1024 / tilebytes;
+  CLAMP_LOWER(capacity, (size_t)TILE_CACHE_MIN(viewradius));
 
-    if (strcmp(walk->Value(), "roadsign") == 0 && cfgRoadsigns) {
-      road_sign temprs;
+  tile.setCapacity(capacity);
 
-      val = walk->Attribute("sprite");
-      if (val != nullptr)
-        temprs.sprite = ssTexture.loadTexture(PUtil::assemblePath(val, filepath));
-
-      val = walk->Attribute("scale");
-      if (val != nullptr)
-        temprs.scale = atof(val);
+  if (PUtil::isDebugLevel(DEBUGLEVEL_DEVELOPER))
+    PUtil::outLog() << "Terrain tile cache: " << capacity << " tiles of about "
+      << tilebytes / 1024 << " KiB" << std::endl;
+}
 
-      val = walk->Attribute("spritecount");
-      if (val)
-        temprs.sprite_count = atoi(val);
+///
+/// @brief Sets how far around the camera terrain is drawn
+/// @details The tile cache is sized again, to hold at least all the tiles
+///  of one frame, so all cached tiles are dropped.
+/// @param tiles = tiles drawn on each side of the tile of the camera
+///
+void PTerrain::setViewRadius(int tiles)
+{
+  CLAMP(tiles, 1, TILE_RADIUS_MAX);
 
-      for (XMLElement *walk2 = walk->FirstChildElement();
-          walk2 != nullptr;
-          walk2 = walk2->NextSiblingElement()) {
-        if (strcmp(walk2->Value(), "location") == 0) {
-          float deg = 0;
+  viewradius = tiles;
+  setTileCacheBudget(tilecachebudget);
+}
 
-          val = walk2->Attribute("oridegrees");
-          if (val != nullptr)
-            deg = RADIANS(atof(val));
+///
+/// @brief Builds the index sets tiles are drawn with, see PTerrainLod::build()
+///
+void PTerrain::buildLodIndices()
+{
+  std::vector<uint16> index;
 
-          val = walk2->Attribute("coords");
-          if (val != nullptr) {
-            float x, y;
+  lod.build(tilesize, index);
 
-            if (sscanf(val, "%f, %f", &x, &y) == 2) {
-              temprs.x = x;
-              temprs.y = y;
-              temprs.deg = deg;
+  ind.create(index.size() * sizeof(uint16), PVBuffer::IndexContent, PVBuffer::StaticUsage, index.data());
+}
 
-              if (temprs.sprite != nullptr)
-                roadsigns.push_back(temprs);
-            }
-          }
-        }
-      }
-    }
-    else if (!strcmp(walk->Value(), "foliageband") && cfgFoliage) {
-      PTerrainFoliageBand tfb;
-      tfb.middle = 0.5f;
-      tfb.range = 0.5f;
-      tfb.density = 1.0f;
-      tfb.scale = 1.0f;
-      //tfb.scalemin = 1.0f;
-      //tfb.scalemax = 1.4f;
-      //tfb.model = nullptr;
-      //tfb.modelscale = 1.0f;
-      tfb.sprite_tex = nullptr;
-      tfb.sprite_count = 1;
-
-      val = walk->Attribute("middle");
-      if (val) tfb.middle = atof(val);
-
-      val = walk->Attribute("range");
-      if (val) tfb.range = atof(val);
-
-      val = walk->Attribute("density");
-      if (val) tfb.density = atof(val);
-
-      val = walk->Attribute("scale");
-      if (val) tfb.scale = atof(val);
-
-      /*
-      val = walk->Attribute("scalemin");
-      if (val) tfb.scalemin = atof(val);
-
-      val = walk->Attribute("scalemax");
-      if (val) tfb.scalemax = atof(val);
-        */
-      /*
-      val = walk->Attribute("model");
-      if (val) tfb.model = ssModel.loadModel(PUtil::assemblePath(val, filepath));
-
-      val = walk->Attribute("modelscale");
-      if (val) tfb.modelscale = atof(val);
-      */
-
-      val = walk->Attribute("sprite");
-      if (val) tfb.sprite_tex = ssTexture.loadTexture(PUtil::assemblePath(val, filepath));
-
-      val = walk->Attribute("spritecount");
-      if (val) tfb.sprite_count = atoi(val);
-
-      foliageband.push_back(tfb);
+///
+/// @brief Sets up instanced foliage, if the GL can do it
+/// @details Needs vertex shaders and instanced arrays; without them, or if
+///  the program fails to build, foliage stays baked into quads per tile.
+///  Each band gets one mesh, its crossed quads around the origin, which
+///  the program turns, scales and moves to every instance of a tile in a
+///  single draw.
+///
+void PTerrain::initFoliageInstancing()
+{
+  if (!GLEW_VERSION_2_0 || !GLEW_ARB_instanced_arrays || !GLEW_ARB_draw_instanced)
+    return;
+
+  GLuint vertshader = glCreateShader(GL_VERTEX_SHADER);
+  glShaderSource(vertshader, 1, &foliageVertexShader, nullptr);
+  glCompileShader(vertshader);
+
+  GLuint fragshader = glCreateShader(GL_FRAGMENT_SHADER);
+  glShaderSource(fragshader, 1, &foliageFragmentShader, nullptr);
+  glCompileShader(fragshader);
+
+  GLuint program = glCreateProgram();
+  glAttachShader(program, vertshader);
+  glAttachShader(program, fragshader);
+  glLinkProgram(program);
+
+  // flagged for deletion, they go with the program
+  glDeleteShader(vertshader);
+  glDeleteShader(fragshader);
+
+  GLint linked = GL_FALSE;
+  glGetProgramiv(program, GL_LINK_STATUS, &linked);
+
+  if (!linked) {
+    char log[1024] = "";
+    glGetProgramInfoLog(program, sizeof(log), nullptr, log);
+    PUtil::outLog() << "warning: no instanced foliage, program failed: " << log << std::endl;
+    glDeleteProgram(program);
+    return;
+  }
+
+  foliageprogram = program;
+  foliageplacement = glGetAttribLocation(program, "placement");
+  foliagesizing = glGetAttribLocation(program, "sizing");
+  foliagelod = glGetUniformLocation(program, "lod");
+  foliagefog = glGetUniformLocation(program, "fogdensity");
+
+  glUseProgram(program);
+  glUniform1i(glGetUniformLocation(program, "sprite"), 0);
+  glUseProgram(0);
+
+  std::vector<PVert_tv> vert;
+  std::vector<uint16> index;
+
+  foliagemeshfirst.resize(foliageband.size() * 2);
+  foliagemeshnuminds.resize(foliageband.size() * 2);
+
+  for (unsigned int m = 0; m < foliageband.size() * 2; m++) {
+    const PTerrainFoliageBand &band = foliageband[m / 2];
+
+    foliagemeshfirst[m] = index.size();
+
+    // the same quads as buildTile() bakes, for an angle of 0 and scale of 1;
+    // the far mesh may have fewer
+    float angincr = PI / (float)(m % 2 ? band.lodsprite_count : band.sprite_count);
+    for (float anga = 0.0f; anga < PI - 0.01f; anga += angincr) {
+      uint16 stv = vert.size();
+      PVert_tv tmpv;
+
+      tmpv.xyz = vec3f(cos(anga)*HMULT,sin(anga)*HMULT,0.0f);
+      tmpv.st = vec2f(1.0f,0.0f);
+      vert.push_back(tmpv);
+
+      tmpv.xyz = vec3f(-cos(anga)*HMULT,-sin(anga)*HMULT,0.0f);
+      tmpv.st = vec2f(0.0f,0.0f);
+      vert.push_back(tmpv);
+
+      tmpv.xyz = vec3f(-cos(anga)*HMULT,-sin(anga)*HMULT,VMULT);
+      tmpv.st = vec2f(0.0f,1.0f);
+      vert.push_back(tmpv);
+
+      tmpv.xyz = vec3f(cos(anga)*HMULT,sin(anga)*HMULT,VMULT);
+      tmpv.st = vec2f(1.0f,1.0f);
+      vert.push_back(tmpv);
+
+      index.push_back(stv + 0);
+      index.push_back(stv + 1);
+      index.push_back(stv + 2);
+      index.push_back(stv + 0);
+      index.push_back(stv + 2);
+      index.push_back(stv + 3);
     }
-  }
 
-
-  if (!heightmap.length()) {
-    throw MakePException ("Load failed: terrain has no heightmap");
+    foliagemeshnuminds[m] = index.size() - foliagemeshfirst[m];
   }
 
-  if (!colormap.length()) {
-    throw MakePException ("Load failed: terrain has no colormap");
+  if (!index.empty()) {
+    foliagemesh[0].create(vert.size() * sizeof(PVert_tv), PVBuffer::VertexContent,
+      PVBuffer::StaticUsage, vert.data());
+    foliagemesh[1].create(index.size() * sizeof(uint16), PVBuffer::IndexContent,
+      PVBuffer::StaticUsage, index.data());
   }
 
-  if (tilesize != (tilesize & (-tilesize)) ||
-    tilesize < 4) {
-    throw MakePException ("Load failed: tile size not power of two dimension, or too small");
-  }
+  if (PUtil::isDebugLevel(DEBUGLEVEL_DEVELOPER))
+    PUtil::outLog() << "Terrain foliage is instanced" << std::endl;
+}
 
-  if (scale_hz <= 0.0 || scale_vt == 0.0) {
-    throw MakePException ("Load failed: invalid scale value");
-  }
+///
+/// @brief Builds the CPU side of a tile: vertices, error per detail level,
+///  bounding boxes and the quads of its foliage and road signs
+/// @details Touches no GL state and only reads the terrain, so it may run on
+///  several threads at once.
+/// @param build = tile to fill, posx and posy must be set
+///
+void PTerrain::buildTile(PTerrainTileBuild &build)
+{
+  const int tilex = build.posx;
+  const int tiley = build.posy;
 
-  scale_hz_inv = 1.0 / scale_hz;
-  scale_vt_inv = 1.0 / scale_vt;
-  scale_tile_inv = scale_hz_inv / (float)tilesize;
+  build.mins = vec3f((float)tilex * scale_hz, (float)tiley * scale_hz, 1000000000.0);
+  build.maxs = vec3f((float)(tilex+1) * scale_hz, (float)(tiley+1) * scale_hz, -1000000000.0);
 
-  PImage img;
-  try
-  {
-    img.load (PUtil::assemblePath (heightmap, filepath));
-  }
-  catch (...)
-  {
-    PUtil::outLog() << "Load failed: couldn't open heightmap \"" << heightmap << "\"\n";
-    throw;
-  }
+  int tileoffsety = tiley * tilesize;
+  int tileoffsetx = tilex * tilesize;
+  int tilesizep1 = tilesize + 1;
+
+  build.vert.clear();
+  build.vert.reserve(tilesizep1 * tilesizep1);
 
-  totsize = img.getcx();
-  if (totsize != img.getcy() ||
-    totsize != (totsize & (-totsize)) ||
-    totsize < 16) {
-    throw MakePException ("Load failed: heightmap not square, or not power of two dimension, or too small");
+  for (int y=0; y<tilesizep1; ++y) {
+    int posy = tileoffsety + y;
+    int sampley = posy & totmask;
+    for (int x=0; x<tilesizep1; ++x) {
+      int posx = tileoffsetx + x;
+      int samplex = posx & totmask;
+      vec3f vert = vec3f(
+        (float)posx * scale_hz,
+        (float)posy * scale_hz,
+        (float)hmap[(sampley * totsize) + samplex]);
+      build.vert.push_back(vert);
+      if (build.mins.z > vert.z)
+        build.mins.z = vert.z;
+      if (build.maxs.z < vert.z)
+        build.maxs.z = vert.z;
+    }
   }
 
-  totsizesq = totsize * totsize;
+  // Find how far each detail level is off the heightmap: each vertex
+  // against the triangle of the coarser grid it falls in
 
-  if (tilesize > totsize) tilesize = totsize;
+  const auto height = [&] (int x, int y) -> float {
+    return hmap[((tileoffsety + y) & totmask) * totsize + ((tileoffsetx + x) & totmask)];
+  };
 
-  tilecount = totsize / tilesize;
-  totmask = totsize - 1;
+  build.lod_error.assign(lod.getLevels(), 0.0f);
 
-  //PUtil::outLog() << "img: " << totsize << " squared, " << img.getcc() << " cc\n";
+  for (int level = 1; level < lod.getLevels(); ++level) {
+    const int step = 1 << level;
+    float error = build.lod_error[level - 1];
 
-  hmap.resize(totsizesq);
+    for (int y0 = 0; y0 < tilesize; y0 += step) {
+      for (int x0 = 0; x0 < tilesize; x0 += step) {
+        const float h00 = height(x0, y0), h10 = height(x0 + step, y0);
+        const float h01 = height(x0, y0 + step), h11 = height(x0 + step, y0 + step);
 
-#if 0
-  if (img.getcc() != 1) {
-    if (PUtil::isDebugLevel(DEBUGLEVEL_TEST))
-      PUtil::outLog() << "Warning: heightmap is not single channel\n";
-    int cc = img.getcc();
-    uint8 *dat = img.getData();
-    for (int s=0, d=0; d<totsizesq; s+=cc, d+=1) hmap[d] = dat[s];
-  } else {
-    std::copy(img.getData(), img.getData() + totsize * totsize, &hmap[0]);
-  }
-#else
-  if (img.getcc() != 1) {
-    if (PUtil::isDebugLevel(DEBUGLEVEL_TEST))
-      PUtil::outLog() << "Warning: heightmap is not single channel\n";
-  }
+        for (int y = 0; y <= step; ++y) {
+          for (int x = 0; x <= step; ++x) {
+            const float u = (float)x / (float)step, v = (float)y / (float)step;
+            const float h = u >= v ?
+              h00 + u * (h10 - h00) + v * (h11 - h10) :
+              h00 + v * (h01 - h00) + u * (h11 - h01);
 
-  int cc = img.getcc();
-  uint8 *dat = img.getData();
-
-  for (int y=0; y<totsize; ++y) {
-    for (int x=0; x<totsize; ++x) {
-      float accum = 0.0;
-      for (int yi=0; yi < static_cast<int> (blurfilter.size()); ++yi) {
-        for (int xi=0; xi < static_cast<int> (blurfilter[yi].size()); ++xi) {
-          accum += (float)dat[
-            (((y + yi - (blurfilter.size()-1)/2) & totmask) * totsize +
-            ((x + xi - (blurfilter[yi].size()-1)/2) & totmask)) * cc] * blurfilter[yi][xi];
+            error = std::max(error, fabsf(height(x0 + x, y0 + y) - h));
+          }
         }
       }
-      hmap[y*totsize + x] = accum * scale_vt;
     }
+
+    build.lod_error[level] = error;
   }
-#endif
 
-  img.unload();
+  // Foliage and road signs, as crossed billboards; they grow the box
 
-  try
-  {
-    cmap.load(PUtil::assemblePath(colormap, filepath));
-  }
-  catch (...)
-  {
-    PUtil::outLog() << "Load failed: couldn't open colormap \"" << colormap << "\"\n";
-    throw;
-  }
+  build.objmins = build.mins;
+  build.objmaxs = build.maxs;
 
-  cmaptotsize = cmap.getcx();
-  if (cmaptotsize != cmap.getcy() ||
-    cmaptotsize != (cmaptotsize & (-cmaptotsize)) ||
-    cmaptotsize < tilecount) {
-    throw MakePException ("Load failed: colormap not square, or not power of two dimension, or too small");
-  }
+  const auto addQuads = [&] (const std::vector<PTerrainFoliage> &inst, int sprite_count,
+      PTerrainTileBuild::Quads &quads) {
+    quads.vert.clear();
+    quads.elem.clear();
 
-  cmaptilesize = cmaptotsize / tilecount;
-  cmaptotmask = cmaptotsize - 1;
+    float angincr = PI / (float)sprite_count;
+    for (unsigned int j=0; j<inst.size(); j++) {
+      for (float anga = 0.0f; anga < PI - 0.01f; anga += angincr) {
+        float interang = inst[j].ang + anga;
+        uint32 stv = quads.vert.size();
+        PVert_tv tmpv;
 
-  // load terrain map image
-  try
-  {
-      if (!terrainmap.empty())
-        tmap.load(PUtil::assemblePath(terrainmap, filepath));
-  }
-  catch (...)
-  {
-    PUtil::outLog() << "Load failed: couldn't open terrainmap \"" << terrainmap << "\"\n";
-    throw;
-  }
+        tmpv.xyz = inst[j].pos +
+          vec3f(cos(interang)*HMULT,sin(interang)*HMULT,0.0f) * inst[j].scale;
+        tmpv.st = vec2f(1.0f,0.0f);
+        quads.vert.push_back(tmpv);
 
-    if (tmap.getData() != nullptr && tmap.getcx() != tmap.getcy())
-        throw MakePException("Load failed: terrainmap not square");
+        tmpv.xyz = inst[j].pos +
+          vec3f(-cos(interang)*HMULT,-sin(interang)*HMULT,0.0f) * inst[j].scale;
+        tmpv.st = vec2f(0.0f,0.0f);
+        quads.vert.push_back(tmpv);
 
-    PImage rmap_img;
+        tmpv.xyz = inst[j].pos +
+          vec3f(-cos(interang)*HMULT,-sin(interang)*HMULT,VMULT) * inst[j].scale;
+        tmpv.st = vec2f(0.0f,1.0f/*-1.0f/32.0f*/);
+        quads.vert.push_back(tmpv);
 
-    // load road map image
-    try
-    {
-        if (!roadmap.empty())
-            rmap_img.load(PUtil::assemblePath(roadmap, filepath));
-    }
-    catch (...)
-    {
-        PUtil::outLog() << "Load failed: couldn't open roadmap \"" << roadmap << "\"\n";
-        throw;
+        tmpv.xyz = inst[j].pos +
+          vec3f(cos(interang)*HMULT,sin(interang)*HMULT,VMULT) * inst[j].scale;
+        tmpv.st = vec2f(1.0f,1.0f/*-1.0f/32.0f*/);
+        quads.vert.push_back(tmpv);
+
+        quads.elem.push_back(stv + 0);
+        quads.elem.push_back(stv + 1);
+        quads.elem.push_back(stv + 2);
+        quads.elem.push_back(stv + 0);
+        quads.elem.push_back(stv + 2);
+        quads.elem.push_back(stv + 3);
+      }
     }
 
-    if (rmap_img.getData() != nullptr)
-    {
-        if (rmap_img.getcx() != rmap_img.getcy())
-            throw MakePException("Load failed: roadmap not square");
-        else
-        if (!rmap.load(rmap_img))
-            throw MakePException("Load failed: bad roadmap image");
+    for (const PVert_tv &v : quads.vert) {
+      CLAMP_UPPER(build.objmins.x, v.xyz.x);
+      CLAMP_UPPER(build.objmins.y, v.xyz.y);
+      CLAMP_UPPER(build.objmins.z, v.xyz.z);
+      CLAMP_LOWER(build.objmaxs.x, v.xyz.x);
+      CLAMP_LOWER(build.objmaxs.y, v.xyz.y);
+      CLAMP_LOWER(build.objmaxs.z, v.xyz.z);
     }
+  };
 
-  // calculate foliage try counts for tile size
-
-  for (unsigned int b = 0; b < foliageband.size(); b++) {
-    foliageband[b].trycount =
-      (int) (foliageband[b].density * (float)totsizesq * scale_hz * scale_hz);
-  }
+  build.objs = getTileObjects(tilex, tiley);
 
-  // load foliage map
+  build.foliage.resize(foliageband.size());
+  build.foliageinst.resize(foliageband.size());
 
-  fmap.resize(totsizesq, 0.0f);
+  for (unsigned int b = 0; b < foliageband.size(); b++) {
+    const std::vector<PTerrainFoliage> &inst = build.objs->foliage[b];
 
-  if (foliagemap.length()) {
-    try
-    {
-      img.load(PUtil::assemblePath(foliagemap, filepath));
-    }
-    catch (...)
-    {
-      PUtil::outLog() << "Load failed: couldn't open foliage map \"" << foliagemap << "\"\n";
-      throw;
-    }
+    build.foliage[b].vert.clear();
+    build.foliage[b].elem.clear();
+    build.foliageinst[b].clear();
 
-    if (totsize != img.getcy() ||
-      totsize != img.getcx()) {
-      throw MakePException ("Load failed: foliage map size doesn't match heightmap");
+    if (!foliageprogram) {
+      addQuads(inst, foliageband[b].sprite_count, build.foliage[b]);
+      continue;
     }
 
-    int cc = img.getcc();
-    uint8 *dat = img.getData();
+    build.foliageinst[b].resize(inst.size());
 
-    if (cc != 1) {
-      if (PUtil::isDebugLevel(DEBUGLEVEL_TEST))
-        PUtil::outLog() << "Warning: foliage map is not single channel\n";
-    }
+    for (unsigned int j = 0; j < inst.size(); ++j) {
+      PFoliageInstance &fi = build.foliageinst[b][j];
 
-    for (int i = 0; i < totsizesq; i++) {
-      fmap[i] = (float) dat[i * cc] / 255.0f;
-    }
-  }
+      fi.pos = inst[j].pos;
+      fi.ang = inst[j].ang;
+      fi.scale = inst[j].scale;
+      fi.cut = foliageband[b].getCut(((float)j + 0.5f) / (float)inst.size());
 
-  // load hud map
+      // whichever way the quads turn, they stay within this box
+      const float reach = HMULT * inst[j].scale;
 
-  tex_hud_map = nullptr;
-
-  if (hudmap.length()) {
-    tex_hud_map = ssTexture.loadTexture(PUtil::assemblePath(hudmap, filepath));
-  }
-
-  // prepare shared index buffers
-
-  int tilesizep1 = tilesize + 1;
-
-  numinds = 0;
-
-  PRamFile ramfile;
-  uint16 index;
-  for (int y=0; y<tilesize; ++y) {
-    int add1 = (y+1) * tilesizep1;
-    int add2 = (y+0) * tilesizep1;
-    if (y > 0) {
-      index = 0 + add1;
-      ramfile.write(&index, sizeof(uint16));
-      numinds += 1;
-    }
-    for (int x=0; x<tilesizep1; ++x) {
-      index = x + add1;
-      ramfile.write(&index, sizeof(uint16));
-      index = x + add2;
-      ramfile.write(&index, sizeof(uint16));
-      numinds += 2;
-    }
-    if (y+1 < tilesize) {
-      ramfile.write(&index, sizeof(uint16));
-      numinds += 1;
+      CLAMP_UPPER(build.objmins.x, inst[j].pos.x - reach);
+      CLAMP_UPPER(build.objmins.y, inst[j].pos.y - reach);
+      CLAMP_UPPER(build.objmins.z, inst[j].pos.z);
+      CLAMP_LOWER(build.objmaxs.x, inst[j].pos.x + reach);
+      CLAMP_LOWER(build.objmaxs.y, inst[j].pos.y + reach);
+      CLAMP_LOWER(build.objmaxs.z, inst[j].pos.z + (float)VMULT * inst[j].scale);
     }
   }
 
-  ind.create(ramfile.getSize(), PVBuffer::IndexContent, PVBuffer::StaticUsage, ramfile.getData());
-  ramfile.clear();
+  build.roadsign.resize(roadsigns.size());
 
-  loaded = true;
+  for (unsigned int b = 0; b < roadsigns.size(); ++b)
+    addQuads(build.objs->roadsign[b], roadsigns[b].sprite_count, build.roadsign[b]);
 }
 
 ///
-/// @brief Gets terrain tile for each world position
-/// @param pos = world position
-/// @retval Pointer to terrain tile
+/// @brief Puts a built tile in the cache and gives it its GL buffers and
+///  color map texture
+/// @param build = tile from buildTile()
+/// @retval the cached tile
 ///
-const PTerrainTile *PTerrain::getTileAtPos(const vec3f &pos) const
+PTerrainTile *PTerrain::uploadTile(const PTerrainTileBuild &build)
 {
-  int tilex = pos.x * scale_tile_inv;
-  int tiley = pos.y * scale_tile_inv;
+  // once the cache is full this recycles the least recently used tile
+  PTerrainTile *tileptr = &tile.insert(build.posx, build.posy);
 
-  if (pos.x < 0.0)
-    --tilex;
-  if (pos.y < 0.0)
-    --tiley;
+  tileptr->posx = build.posx;
+  tileptr->posy = build.posy;
 
-  for (std::list<PTerrainTile>::const_iterator iter = tile.begin(); iter != tile.end(); ++iter) {
-    if (iter->posx == tilex && iter->posy == tiley) {
-      return &*iter;
-    }
-  }
-  return nullptr;
-}
+  tileptr->mins = build.mins;
+  tileptr->maxs = build.maxs;
+  tileptr->objmins = build.objmins;
+  tileptr->objmaxs = build.objmaxs;
+  tileptr->lod_error = build.lod_error;
 
-///
-/// @brief Gets vector of objects on tile at world position
-/// @param pos = world position
-/// @retval Pointer to world objects on terrain tile
-///
-const std::vector<PTerrainFoliage> *PTerrain::getFoliageAtPos(const vec3f &pos) const
-{
-  const PTerrainTile *tile = getTileAtPos(pos);
+  tileptr->vert.create(build.vert.size() * sizeof(vec3f),
+    PVBuffer::VertexContent, PVBuffer::StaticUsage, build.vert.data());
+  tileptr->numverts = build.vert.size();
 
-  if (tile) {
-    return &tile->straight;
-  }
-  return nullptr;
-}
+  tileptr->tex.loadPiece(cmap,
+    (build.posx * cmaptilesize) & cmaptotmask, (build.posy * cmaptilesize) & cmaptotmask,
+    cmaptilesize, cmaptilesize, true, true);
 
-PTerrainTile *PTerrain::getTile(int tilex, int tiley)
-{
-  // find the least recently used tile while searching for x,y
-  int best_lru = 0, unused = 0;
-  PTerrainTile *tileptr = nullptr;
-  for (std::list<PTerrainTile>::iterator iter = tile.begin();
-    iter != tile.end(); ++iter) {
-    if (iter->posx == tilex && iter->posy == tiley) {
-      iter->lru_counter = 0;
-      //PUtil::outLog() << "1: " << tilex << " " << tiley << std::endl;
-      return &*iter;
-    }
+  const auto upload = [] (const PTerrainTileBuild::Quads &quads,
+      PVBuffer *buff, int &numvert, int &numelem) {
+    numvert = quads.vert.size();
+    numelem = quads.elem.size();
 
-    if (best_lru < iter->lru_counter) {
-      best_lru = iter->lru_counter;
-      tileptr = &*iter;
+    if (numelem) {
+      buff[0].create(quads.vert.size() * sizeof(PVert_tv),
+        PVBuffer::VertexContent, PVBuffer::StaticUsage, quads.vert.data());
+      buff[1].create(quads.elem.size() * sizeof(uint32),
+        PVBuffer::IndexContent, PVBuffer::StaticUsage, quads.elem.data());
     }
+  };
 
-    if (iter->lru_counter > 1) ++unused;
-  }
-
-  // if there aren't enough unused tiles, create a new one
-
-  if (unused < 10 || best_lru <= 1) {
-    tile.push_back(PTerrainTile());
-    tileptr = &tile.back();
-  }
-
-  tileptr->posx = tilex;
-  tileptr->posy = tiley;
-  tileptr->lru_counter = 0;
-
-  tileptr->mins = vec3f((float)tilex * scale_hz, (float)tiley * scale_hz, 1000000000.0);
-  tileptr->maxs = vec3f((float)(tilex+1) * scale_hz, (float)(tiley+1) * scale_hz, -1000000000.0);
-
-  // TODO: quadtree based thing
+  tileptr->foliage.resize(build.foliage.size());
 
-  //std::vector<bool>
+  for (unsigned int b = 0; b < build.foliage.size(); b++) {
+    PTerrainFoliageSet &set = tileptr->foliage[b];
 
-  static PRamFile ramfile1, ramfile2;
+    set.inst = build.objs->foliage[b];
+    upload(build.foliage[b], set.buff, set.numvert, set.numelem);
 
-  ramfile1.clear();
+    set.numinst = build.foliageinst[b].size();
 
-  int tileoffsety = tiley * tilesize;
-  int tileoffsetx = tilex * tilesize;
-  int tilesizep1 = tilesize + 1;
-  for (int y=0; y<tilesizep1; ++y) {
-    int posy = tileoffsety + y;
-    int sampley = posy & totmask;
-    for (int x=0; x<tilesizep1; ++x) {
-      int posx = tileoffsetx + x;
-      int samplex = posx & totmask;
-      vec3f vert = vec3f(
-        (float)posx * scale_hz,
-        (float)posy * scale_hz,
-        (float)hmap[(sampley * totsize) + samplex]);
-      ramfile1.write(vert, sizeof(vec3f));
-      if (tileptr->mins.z > vert.z)
-        tileptr->mins.z = vert.z;
-      if (tileptr->maxs.z < vert.z)
-        tileptr->maxs.z = vert.z;
+    if (set.numinst) {
+      set.buff[0].create(set.numinst * sizeof(PFoliageInstance),
+        PVBuffer::VertexContent, PVBuffer::StaticUsage, build.foliageinst[b].data());
     }
   }
-  tileptr->vert.create(ramfile1.getSize(), PVBuffer::VertexContent, PVBuffer::StaticUsage, ramfile1.getData());
-
-  //tileptr->maxs.z += 10.0;
-
-  //tileptr->mins = vec3f((float)tilex * scale_hz, (float)tiley * scale_hz, 0.0);
-  //tileptr->maxs = vec3f((float)(tilex+1) * scale_hz, (float)(tiley+1) * scale_hz, 100.0);
 
-  tileptr->numverts = tilesizep1 * tilesizep1;
+  tileptr->roadsignset.resize(build.roadsign.size());
 
-  tileptr->tex.loadPiece(cmap,
-    (tilex * cmaptilesize) & cmaptotmask, (tiley * cmaptilesize) & cmaptotmask,
-    cmaptilesize, cmaptilesize, true, true);
-
-  // Create foliage
-
-  srand(1);
-
-  tileptr->foliage.resize(foliageband.size());
-
-  for (unsigned int b = 0; b < foliageband.size(); b++) {
-
-    tileptr->foliage[b].inst.clear();
+  for (unsigned int b = 0; b < build.roadsign.size(); ++b) {
+    PRoadSignSet &set = tileptr->roadsignset[b];
 
-    // Create foliage instances
-
-    for (int i = 0; i < foliageband[b].trycount; i++) {
-      float rigidityvalue = 0.0f;
-      vec2f ftry = vec2f(
-        (float)((tileptr->posx * tilesize) + rand01 * tilesize) * scale_hz,
-        (float)((tileptr->posy * tilesize) + rand01 * tilesize) * scale_hz);
-
-      float fol = getFoliageLevel(ftry.x, ftry.y);
-
-      if ((1.0 - fabs((fol - foliageband[b].middle) / foliageband[b].range)) < rand01) continue;
+    set.inst = build.objs->roadsign[b];
+    upload(build.roadsign[b], set.buff, set.numvert, set.numelem);
+  }
 
-      tileptr->foliage[b].inst.push_back(PTerrainFoliage());
-      tileptr->foliage[b].inst.back().pos.x = ftry.x;
-      tileptr->foliage[b].inst.back().pos.y = ftry.y;
-      tileptr->foliage[b].inst.back().pos.z = getHeight(ftry.x, ftry.y);
-      tileptr->foliage[b].inst.back().ang = rand01 * PI*2.0f;
-      //tileptr->foliage[b].inst.back().scale = (1.0f + fol * 0.5f) * (rand01 * rand01 + 0.5) * 1.4;
-      //tileptr->foliage[b].inst.back().scale = (foliageband[b].scalemin + fol * 0.5f) * (rand01 * rand01 + 0.5) * foliageband[b].scalemax;
-      tileptr->foliage[b].inst.back().scale = (foliageband[b].scale + fol * 0.5f) * (rand01 * rand01 + 0.5) * 1.4;
+  return tileptr;
+}
 
-      rigidityvalue = rigidity.getRigidity(foliageband[b].sprite_tex->getName());
-      if (rigidityvalue != 0.0f) {
-        tileptr->foliage[b].inst.back().rigidity = rigidityvalue;
-        tileptr->straight.push_back(tileptr->foliage[b].inst.back());
-      }
-    }
+///
+/// @brief Gets a tile, building it now if it isn't cached
+/// @param tilex = tile x coordinate
+/// @param tiley = tile y coordinate
+/// @retval the tile, valid until the next tile goes in the cache
+///
+PTerrainTile *PTerrain::getTile(int tilex, int tiley)
+{
+  PTerrainTile *tileptr = tile.find(tilex, tiley);
+  if (tileptr) return tileptr;
 
-    // Create vertex buffers for rendering
+  return uploadTile(*builder->takeNow(tilex, tiley));
+}
 
-#define HMULT   1.0
-#define VMULT   2.0
+///
+/// @brief Uploads tiles built in the background and asks for the next ones
+/// @details Finished tiles are uploaded until the frame's budget is spent,
+///  the rest wait for the next frame. Then the tiles around where the camera
+///  will be shortly, and not cached yet, are handed to the builder, nearest
+///  the camera first; those of the current view are left to getTile().
+/// @param campos = position of the camera
+/// @param camvel = velocity of the camera
+///
+void PTerrain::prefetchTiles(const vec3f &campos, const vec3f &camvel)
+{
+  const auto tileOf = [this] (float coord) -> int {
+    return (int)floorf(coord * scale_tile_inv);
+  };
 
-    ramfile1.clear();
-    ramfile2.clear();
+  const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
 
-    tileptr->foliage[b].numvert = 0;
-    tileptr->foliage[b].numelem = 0;
+  do {
+    std::unique_ptr<PTerrainTileBuild> build = builder->takeBuilt();
+    if (!build) break;
 
-    float angincr = PI / (float)foliageband[b].sprite_count;
-    for (unsigned int j=0; j<tileptr->foliage[b].inst.size(); j++) {
-      for (float anga = 0.0f; anga < PI - 0.01f; anga += angincr) {
-        float interang = tileptr->foliage[b].inst[j].ang + anga;
-        int stv = tileptr->foliage[b].numvert;
-        PVert_tv tmpv;
+    if (!tile.find(build->posx, build->posy))
+      uploadTile(*build);
+  } while (std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count() <
+    TILE_UPLOAD_BUDGET);
 
-        tmpv.xyz = tileptr->foliage[b].inst[j].pos +
-          vec3f(cos(interang)*HMULT,sin(interang)*HMULT,0.0f) * tileptr->foliage[b].inst[j].scale;
-        tmpv.st = vec2f(1.0f,0.0f);
-        ramfile1.write(&tmpv,sizeof(PVert_tv));
-        tileptr->foliage[b].numvert++;
+  const vec3f ahead = campos + camvel * TILE_PREDICT_TIME;
 
-        tmpv.xyz = tileptr->foliage[b].inst[j].pos +
-          vec3f(-cos(interang)*HMULT,-sin(interang)*HMULT,0.0f) * tileptr->foliage[b].inst[j].scale;
-        tmpv.st = vec2f(0.0f,0.0f);
-        ramfile1.write(&tmpv,sizeof(PVert_tv));
-        tileptr->foliage[b].numvert++;
+  const int ctx = tileOf(campos.x), cty = tileOf(campos.y);
+  const int atx = tileOf(ahead.x), aty = tileOf(ahead.y);
+  const int radius = viewradius + TILE_PREDICT_MARGIN;
 
-        tmpv.xyz = tileptr->foliage[b].inst[j].pos +
-          vec3f(-cos(interang)*HMULT,-sin(interang)*HMULT,VMULT) * tileptr->foliage[b].inst[j].scale;
-        tmpv.st = vec2f(0.0f,1.0f/*-1.0f/32.0f*/);
-        ramfile1.write(&tmpv,sizeof(PVert_tv));
-        tileptr->foliage[b].numvert++;
+  prefetch.clear();
 
-        tmpv.xyz = tileptr->foliage[b].inst[j].pos +
-          vec3f(cos(interang)*HMULT,sin(interang)*HMULT,VMULT) * tileptr->foliage[b].inst[j].scale;
-        tmpv.st = vec2f(1.0f,1.0f/*-1.0f/32.0f*/);
-        ramfile1.write(&tmpv,sizeof(PVert_tv));
-        tileptr->foliage[b].numvert++;
-
-        int ind;
-        ind = stv + 0;
-        ramfile2.write(&ind,sizeof(uint32));
-        tileptr->foliage[b].numelem++;
-        ind = stv + 1;
-        ramfile2.write(&ind,sizeof(uint32));
-        tileptr->foliage[b].numelem++;
-        ind = stv + 2;
-        ramfile2.write(&ind,sizeof(uint32));
-        tileptr->foliage[b].numelem++;
-        ind = stv + 0;
-        ramfile2.write(&ind,sizeof(uint32));
-        tileptr->foliage[b].numelem++;
-        ind = stv + 2;
-        ramfile2.write(&ind,sizeof(uint32));
-        tileptr->foliage[b].numelem++;
-        ind = stv + 3;
-        ramfile2.write(&ind,sizeof(uint32));
-        tileptr->foliage[b].numelem++;
-      }
-    }
+  for (int ty = aty - radius; ty <= aty + radius; ++ty) {
+    for (int tx = atx - radius; tx <= atx + radius; ++tx) {
+      if (abs(tx - ctx) <= viewradius && abs(ty - cty) <= viewradius) continue;
+      if (tile.find(tx, ty)) continue;
 
-    if (tileptr->foliage[b].numelem) {
-      tileptr->foliage[b].buff[0].create(ramfile1.getSize(),
-        PVBuffer::VertexContent, PVBuffer::StaticUsage, ramfile1.getData());
-      tileptr->foliage[b].buff[1].create(ramfile2.getSize(),
-        PVBuffer::IndexContent, PVBuffer::StaticUsage, ramfile2.getData());
+      prefetch.push_back(vec2i(tx, ty));
     }
   }
 
-  tileptr->roadsignset.resize(roadsigns.size());
-
-  for (unsigned int b=0; b < roadsigns.size(); ++b) {
-    float rigidityvalue = 0.0f;
-    vec2f ftry = vec2f(
-      roadsigns[b].x * scale_hz,
-      roadsigns[b].y * scale_hz);
-    vec2f tilemin = vec2f(
-      tileptr->posx * tilesize * scale_hz,
-      tileptr->posy * tilesize * scale_hz);
-    vec2f tilemax = vec2f(
-      (tileptr->posx * tilesize + tilesize) * scale_hz,
-      (tileptr->posy * tilesize + tilesize) * scale_hz);
-
-    if (ftry.x >= tilemin.x && ftry.x <= tilemax.x && ftry.y >= tilemin.y && ftry.y <= tilemax.y) {
-      tileptr->roadsignset[b].inst.clear();
-      tileptr->roadsignset[b].inst.push_back(PTerrainFoliage());
-      tileptr->roadsignset[b].inst.back().pos.x    = ftry.x;
-      tileptr->roadsignset[b].inst.back().pos.y    = ftry.y;
-      tileptr->roadsignset[b].inst.back().pos.z    = getHeight(ftry.x, ftry.y);
-      tileptr->roadsignset[b].inst.back().ang      = roadsigns[b].deg;
-      tileptr->roadsignset[b].inst.back().scale    = roadsigns[b].scale;
-
-      rigidityvalue = rigidity.getRigidity(roadsigns[b].sprite->getName());
-      if (rigidityvalue != 0.0f) {
-        tileptr->roadsignset[b].inst.back().rigidity = rigidityvalue;
-        tileptr->straight.push_back(tileptr->roadsignset[b].inst.back());
-      }
-
-      ramfile1.clear();
-      ramfile2.clear();
-
-      tileptr->roadsignset[b].numvert = 0;
-      tileptr->roadsignset[b].numelem = 0;
-
-      float angincr = PI / (float)roadsigns[b].sprite_count;
-      for (unsigned int j=0; j<tileptr->roadsignset[b].inst.size(); j++) {
-        for (float anga = 0.0f; anga < PI - 0.01f; anga += angincr) {
-          float interang = tileptr->roadsignset[b].inst[j].ang + anga;
-          int stv = tileptr->roadsignset[b].numvert;
-          PVert_tv tmpv;
-
-          tmpv.xyz = tileptr->roadsignset[b].inst[j].pos +
-            vec3f(cos(interang)*HMULT,sin(interang)*HMULT,0.0f) *
-            tileptr->roadsignset[b].inst[j].scale;
-          tmpv.st = vec2f(1.0f,0.0f);
-          ramfile1.write(&tmpv,sizeof(PVert_tv));
-          tileptr->roadsignset[b].numvert++;
-
-          tmpv.xyz = tileptr->roadsignset[b].inst[j].pos +
-            vec3f(-cos(interang)*HMULT,-sin(interang)*HMULT,0.0f) *
-            tileptr->roadsignset[b].inst[j].scale;
-          tmpv.st = vec2f(0.0f,0.0f);
-          ramfile1.write(&tmpv,sizeof(PVert_tv));
-          tileptr->roadsignset[b].numvert++;
-
-          tmpv.xyz = tileptr->roadsignset[b].inst[j].pos +
-            vec3f(-cos(interang)*HMULT,-sin(interang)*HMULT,VMULT) *
-            tileptr->roadsignset[b].inst[j].scale;
-          tmpv.st = vec2f(0.0f,1.0f/*-1.0f/32.0f*/);
-          ramfile1.write(&tmpv,sizeof(PVert_tv));
-          tileptr->roadsignset[b].numvert++;
-
-          tmpv.xyz = tileptr->roadsignset[b].inst[j].pos +
-            vec3f(cos(interang)*HMULT,sin(interang)*HMULT,VMULT) *
-            tileptr->roadsignset[b].inst[j].scale;
-          tmpv.st = vec2f(1.0f,1.0f/*-1.0f/32.0f*/);
-          ramfile1.write(&tmpv,sizeof(PVert_tv));
-          tileptr->roadsignset[b].numvert++;
-
-          int ind;
-          ind = stv + 0;
-          ramfile2.write(&ind,sizeof(uint32));
-          tileptr->roadsignset[b].numelem++;
-          ind = stv + 1;
-          ramfile2.write(&ind,sizeof(uint32));
-          tileptr->roadsignset[b].numelem++;
-          ind = stv + 2;
-          ramfile2.write(&ind,sizeof(uint32));
-          tileptr->roadsignset[b].numelem++;
-          ind = stv + 0;
-          ramfile2.write(&ind,sizeof(uint32));
-          tileptr->roadsignset[b].numelem++;
-          ind = stv + 2;
-          ramfile2.write(&ind,sizeof(uint32));
-          tileptr->roadsignset[b].numelem++;
-          ind = stv + 3;
-          ramfile2.write(&ind,sizeof(uint32));
-          tileptr->roadsignset[b].numelem++;
-        }
-      }
+  std::sort(prefetch.begin(), prefetch.end(), [ctx, cty] (const vec2i &a, const vec2i &b) {
+    return (a.x - ctx) * (a.x - ctx) + (a.y - cty) * (a.y - cty) <
+      (b.x - ctx) * (b.x - ctx) + (b.y - cty) * (b.y - cty);
+  });
 
-      if (tileptr->roadsignset[b].numelem) {
-          tileptr->roadsignset[b].buff[0].create(ramfile1.getSize(),
-            PVBuffer::VertexContent, PVBuffer::StaticUsage, ramfile1.getData());
-          tileptr->roadsignset[b].buff[1].create(ramfile2.getSize(),
-            PVBuffer::IndexContent, PVBuffer::StaticUsage, ramfile2.getData());
-      }
-    }
-  }
-  return tileptr;
+  builder->setRequests(prefetch);
 }
 
-
-void PTerrain::render(const vec3f &campos, const mat44f &camorim)
+void PTerrain::render(const vec3f &campos, const mat44f &camorim, const vec3f &camvel)
 {
   float blah = camorim.row[0][0]; blah = blah; // unused
 
-  // increase all lru counters
-  for (std::list<PTerrainTile>::iterator iter = tile.begin();
-    iter != tile.end(); ++iter) ++iter->lru_counter;
-
   // get frustum
   frustumf frust;
+  mat44f mat_p;
   {
-    mat44f mat_mv, mat_p, mat_c;
+    mat44f mat_mv, mat_c;
 
     glGetFloatv(GL_MODELVIEW_MATRIX, mat_mv);
     glGetFloatv(GL_PROJECTION_MATRIX, mat_p);
@@ -770,21 +656,75 @@ void PTerrain::render(const vec3f &campos, const mat44f &camorim)
   int cty = (int)(campos.y * scale_tile_inv);
   if (campos.y < 0.0) --cty;
 
-  int mintx = ctx - 3,
-    maxtx = ctx + 4,
-    minty = cty - 3,
-    maxty = cty + 4;
+  const int side = 2 * viewradius + 1;
+  const int mintx = ctx - viewradius,
+    minty = cty - viewradius;
+
+  prefetchTiles(campos, camvel);
 
-  // Determine list of tiles to draw
+  // Determine list of tiles to draw, row by row
 
-  std::list<PTerrainTile *> drawtile;
+  drawtile.resize(side * side);
+  drawbounds.resize(side * side);
+  drawlevel.resize(side * side);
 
-  for (int ty = minty; ty < maxty; ++ty) {
-    for (int tx = mintx; tx < maxtx; ++tx) {
-      drawtile.push_back(getTile(tx,ty));
+  for (int ty = 0; ty < side; ++ty) {
+    for (int tx = 0; tx < side; ++tx) {
+      drawtile[ty * side + tx] = getTile(mintx + tx, minty + ty);
+      drawbounds[ty * side + tx] = drawtile[ty * side + tx];
     }
   }
 
+  // Choose the detail level of each tile: the coarsest whose error, seen
+  // from the camera at the nearest point of the tile, is within tolerance
+
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+
+  // pixels covered by one world unit at a distance of one
+  const float pixelscale = (float)viewport[3] * 0.5f * mat_p.row[1][1];
+
+  for (unsigned int i = 0; i < drawtile.size(); ++i) {
+    const PTerrainTile *t = drawtile[i];
+    int level = 0;
+
+    if (lodtolerance > 0.0f) {
+      vec3f nearest = campos;
+      CLAMP(nearest.x, t->mins.x, t->maxs.x);
+      CLAMP(nearest.y, t->mins.y, t->maxs.y);
+      CLAMP(nearest.z, t->mins.z, t->maxs.z);
+
+      const float allowed = lodtolerance * (nearest - campos).length() / pixelscale;
+
+      while (level + 1 < lod.getLevels() && t->lod_error[level + 1] <= allowed)
+        ++level;
+    }
+
+    drawlevel[i] = level;
+  }
+
+  // Skip the passes of tiles out of view, or hidden behind nearer terrain;
+  // the detail levels of all the tiles are kept, for the neighbors
+
+  drawpass.resize(side * side);
+
+  for (unsigned int i = 0; i < drawtile.size(); ++i) {
+    drawpass[i] = 0;
+
+    if (!frust.isAABBOutside(drawtile[i]->mins, drawtile[i]->maxs))
+      drawpass[i] |= PASS_TERRAIN;
+    if (!frust.isAABBOutside(drawtile[i]->objmins, drawtile[i]->objmaxs))
+      drawpass[i] |= PASS_OBJECTS;
+  }
+
+  if (horizonculling)
+    horizon.cull(campos, viewradius, drawbounds, drawpass);
+
+  // Neighbors may only be one level apart, which the index sets can stitch;
+  // refining a tile can make a neighbor too coarse in turn
+
+  PTerrainLod::stitchLevels(drawlevel, side);
+
   // Draw terrain
 
   glEnable(GL_TEXTURE_GEN_S);
@@ -797,28 +737,34 @@ void PTerrain::render(const vec3f &campos, const mat44f &camorim)
 
   glEnableClientState(GL_VERTEX_ARRAY);
 
-  for (std::list<PTerrainTile *>::iterator t = drawtile.begin(); t != drawtile.end(); t++) {
-    //if (frust.isAABBOutside(tileptr->mins, tileptr->maxs))
-    //    glColor3f(1,0,0);
-    //else
-    //    glColor3f(1,1,1);
+  for (int ty = 0; ty < side; ++ty) {
+    for (int tx = 0; tx < side; ++tx) {
+      if (!(drawpass[ty * side + tx] & PASS_TERRAIN))
+        continue;
+
+      PTerrainTile *t = drawtile[ty * side + tx];
+      const int level = drawlevel[ty * side + tx];
 
-    tgens[3] = (float) (- (*t)->posx);
-    tgent[3] = (float) (- (*t)->posy);
+      // sides that meet a coarser tile
+      const int mask = PTerrainLod::getSideMask(drawlevel, side, tx, ty);
 
-    glTexGenfv(GL_S, GL_OBJECT_PLANE, tgens);
-    glTexGenfv(GL_T, GL_OBJECT_PLANE, tgent);
+      tgens[3] = (float) (- t->posx);
+      tgent[3] = (float) (- t->posy);
 
-    // Texture
-    (*t)->tex.bind();
+      glTexGenfv(GL_S, GL_OBJECT_PLANE, tgens);
+      glTexGenfv(GL_T, GL_OBJECT_PLANE, tgent);
 
-    // Vertex buffers
-    (*t)->vert.bind();
-    ind.bind();
-    glVertexPointer(3, GL_FLOAT, sizeof(vec3f), (*t)->vert.getPointer(0));
+      // Texture
+      t->tex.bind();
 
-    glDrawRangeElements(GL_TRIANGLE_STRIP, 0, (*t)->numverts,
-      numinds, GL_UNSIGNED_SHORT, ind.getPointer(0));
+      // Vertex buffers
+      t->vert.bind();
+      ind.bind();
+      glVertexPointer(3, GL_FLOAT, sizeof(vec3f), t->vert.getPointer(0));
+
+      glDrawRangeElements(GL_TRIANGLES, 0, t->numverts - 1, lod.getCount(level, mask),
+        GL_UNSIGNED_SHORT, ind.getPointer(lod.getFirst(level, mask) * sizeof(uint16)));
+    }
   }
 
   glDisableClientState(GL_VERTEX_ARRAY);
@@ -843,11 +789,83 @@ void PTerrain::render(const vec3f &campos, const mat44f &camorim)
   glEnableClientState(GL_TEXTURE_COORD_ARRAY);
   glEnableClientState(GL_VERTEX_ARRAY);
 
+  if (foliageprogram) {
+    GLfloat fogdensity = 0.0f;
+    if (glIsEnabled(GL_FOG))
+      glGetFloatv(GL_FOG_DENSITY, &fogdensity);
+
+    glUseProgram(foliageprogram);
+    glUniform1f(foliagefog, fogdensity);
+    glEnableVertexAttribArray(foliageplacement);
+    glEnableVertexAttribArray(foliagesizing);
+    glVertexAttribDivisorARB(foliageplacement, 1);
+    glVertexAttribDivisorARB(foliagesizing, 1);
+
+    // the meshes of all the bands share these buffers
+    foliagemesh[0].bind();
+    foliagemesh[1].bind();
+
+    glTexCoordPointer(2, GL_FLOAT, sizeof(PVert_tv), foliagemesh[0].getPointer(0));
+    glVertexPointer(3, GL_FLOAT, sizeof(PVert_tv), foliagemesh[0].getPointer(sizeof(float)*2));
+  }
+
   for (unsigned int b = 0; b < foliageband.size(); b++) {
+    const PTerrainFoliageBand &band = foliageband[b];
+
+    band.sprite_tex->bind();
+
+    // the far mesh takes over at lodnear, if it has fewer quads
+    const bool farmesh = band.lodfar > 0.0f && band.lodsprite_count < band.sprite_count;
+
+    for (unsigned int i = 0; i < drawtile.size(); ++i) {
+      PTerrainTile *const *t = &drawtile[i];
+
+      if (!(drawpass[i] & PASS_OBJECTS) ||
+        abs((*t)->posx - ctx) > FOLIAGE_RADIUS || abs((*t)->posy - cty) > FOLIAGE_RADIUS)
+        continue;
+
+      // nearest and furthest the foliage of the tile can be
+      vec3f nearest = campos, furthest;
+      CLAMP(nearest.x, (*t)->objmins.x, (*t)->objmaxs.x);
+      CLAMP(nearest.y, (*t)->objmins.y, (*t)->objmaxs.y);
+      CLAMP(nearest.z, (*t)->objmins.z, (*t)->objmaxs.z);
+      furthest.x = std::max(fabsf(campos.x - (*t)->objmins.x), fabsf(campos.x - (*t)->objmaxs.x));
+      furthest.y = std::max(fabsf(campos.y - (*t)->objmins.y), fabsf(campos.y - (*t)->objmaxs.y));
+      furthest.z = std::max(fabsf(campos.z - (*t)->objmins.z), fabsf(campos.z - (*t)->objmaxs.z));
 
-    foliageband[b].sprite_tex->bind();
+      const float dnear = (nearest - campos).length();
+      const float dfar = furthest.length();
 
-    for (std::list<PTerrainTile *>::iterator t = drawtile.begin(); t != drawtile.end(); t++) {
+      if (band.lodfar > 0.0f && dnear >= band.lodfar)
+        continue;
+
+      if ((*t)->foliage[b].numinst) {
+        (*t)->foliage[b].buff[0].bind(); // instances
+
+        glVertexAttribPointer(foliageplacement, 4, GL_FLOAT, GL_FALSE, sizeof(PFoliageInstance),
+          (*t)->foliage[b].buff[0].getPointer(offsetof(PFoliageInstance, pos)));
+        glVertexAttribPointer(foliagesizing, 2, GL_FLOAT, GL_FALSE, sizeof(PFoliageInstance),
+          (*t)->foliage[b].buff[0].getPointer(offsetof(PFoliageInstance, scale)));
+
+        // those still drawn at the nearest point; the program drops the
+        // others as they pass their cut
+        const int numinst = band.getCount(dnear, (*t)->foliage[b].numinst);
+
+        const float fade = std::max(band.lodfade, FOLIAGE_FADE_MIN);
+
+        for (int mesh = 0; mesh < 2; ++mesh) {
+          const float from = mesh ? band.lodnear : 0.0f;
+          const float to = farmesh && !mesh ? band.lodnear : 1000000000.0f;
+
+          if (!numinst || (mesh && !farmesh) || dnear >= to || dfar < from)
+            continue;
+
+          glUniform3f(foliagelod, from, to, fade);
+
+          glDrawElementsInstancedARB(GL_TRIANGLES, foliagemeshnuminds[b * 2 + mesh], GL_UNSIGNED_SHORT,
+            foliagemesh[1].getPointer(foliagemeshfirst[b * 2 + mesh] * sizeof(uint16)), numinst);
+        }
+      }
 
       if ((*t)->foliage[b].numelem) {
         (*t)->foliage[b].buff[0].bind(); // vert data
@@ -856,9 +874,16 @@ void PTerrain::render(const vec3f &campos, const mat44f &camorim)
         glTexCoordPointer(2, GL_FLOAT, sizeof(PVert_tv), (*t)->foliage[b].buff[0].getPointer(0));
         glVertexPointer(3, GL_FLOAT, sizeof(PVert_tv), (*t)->foliage[b].buff[0].getPointer(sizeof(float)*2));
 
-        glDrawRangeElements(GL_TRIANGLES,
-          0,(*t)->foliage[b].numvert,(*t)->foliage[b].numelem,
-          GL_UNSIGNED_INT,(*t)->foliage[b].buff[1].getPointer(0));
+        // baked quads can only thin out by tile, as seen from its nearest
+        // point, and keep all their quads
+        const int numinst = (*t)->foliage[b].inst.size();
+        const int numelem = (*t)->foliage[b].numelem / numinst *
+          band.getCount(dnear, numinst);
+
+        if (numelem)
+          glDrawRangeElements(GL_TRIANGLES,
+            0,(*t)->foliage[b].numvert,numelem,
+            GL_UNSIGNED_INT,(*t)->foliage[b].buff[1].getPointer(0));
       }
 
       #if 0
@@ -888,13 +913,27 @@ void PTerrain::render(const vec3f &campos, const mat44f &camorim)
     }
   }
 
+  if (foliageprogram) {
+    glVertexAttribDivisorARB(foliageplacement, 0);
+    glVertexAttribDivisorARB(foliagesizing, 0);
+    glDisableVertexAttribArray(foliageplacement);
+    glDisableVertexAttribArray(foliagesizing);
+    glUseProgram(0);
+  }
+
   PVBuffer::unbind();
 
   // draw road signs
   for (unsigned int b=0; b < roadsigns.size(); ++b) {
     roadsigns[b].sprite->bind();
 
-    for (std::list<PTerrainTile *>::iterator t = drawtile.begin(); t != drawtile.end(); t++) {
+    for (unsigned int i = 0; i < drawtile.size(); ++i) {
+      PTerrainTile *const *t = &drawtile[i];
+
+      if (!(drawpass[i] & PASS_OBJECTS) ||
+        abs((*t)->posx - ctx) > FOLIAGE_RADIUS || abs((*t)->posy - cty) > FOLIAGE_RADIUS)
+        continue;
+
       if ((*t)->roadsignset[b].numelem) {
         (*t)->roadsignset[b].buff[0].bind();
         (*t)->roadsignset[b].buff[1].bind();
@@ -0,0 +1,118 @@
+// terraincontact.cpp [pengine]
+
+// License: GPL version 2 (see included gpl.txt)
+
+#include "terraincontact.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+///
+/// @brief Contact information for many points at once
+/// @details The results of calling getContactInfo() for each point, to
+///  rounding. With SSE2 four points go through the wrapping, the choice of
+///  triangle and the normalization together; only fetching the heights is
+///  done one by one.
+/// @param pos = points to query, only x and y are used
+/// @param out = contact information for each point
+/// @param n = number of points
+///
+void PTerrainContact::getContactInfoBatch(const vec3f *pos, ContactInfo *out, size_t n) const
+{
+  size_t i = 0;
+
+#ifdef __SSE2__
+  const int cx = totsize;
+
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 scale = _mm_set1_ps(scale_hz_inv);
+  const __m128 normz = _mm_set1_ps(scale_hz);
+  const __m128i mask = _mm_set1_epi32(totmask);
+  const __m128i onei = _mm_set1_epi32(1);
+
+  alignas(16) int xiw[4], xiw2[4], yiw[4], yiw2[4];
+  alignas(16) float h00[4], h01[4], h10[4], h11[4];
+  alignas(16) float rz[4], rnx[4], rny[4], rnz[4];
+
+  for (; i + 4 <= n; i += 4) {
+    __m128 x = _mm_mul_ps(_mm_set_ps(pos[i+3].x, pos[i+2].x, pos[i+1].x, pos[i].x), scale);
+    __m128 y = _mm_mul_ps(_mm_set_ps(pos[i+3].y, pos[i+2].y, pos[i+1].y, pos[i].y), scale);
+
+    // int part like the scalar code: truncate, then one less if negative
+    // (a true comparison is all ones, that is -1)
+    __m128i xi = _mm_add_epi32(_mm_cvttps_epi32(x), _mm_castps_si128(_mm_cmplt_ps(x, zero)));
+    __m128i yi = _mm_add_epi32(_mm_cvttps_epi32(y), _mm_castps_si128(_mm_cmplt_ps(y, zero)));
+
+    // decimal part
+    x = _mm_sub_ps(x, _mm_cvtepi32_ps(xi));
+    y = _mm_sub_ps(y, _mm_cvtepi32_ps(yi));
+
+    _mm_store_si128((__m128i *)xiw, _mm_and_si128(xi, mask));
+    _mm_store_si128((__m128i *)xiw2, _mm_and_si128(_mm_add_epi32(xi, onei), mask));
+    _mm_store_si128((__m128i *)yiw, _mm_and_si128(yi, mask));
+    _mm_store_si128((__m128i *)yiw2, _mm_and_si128(_mm_add_epi32(yi, onei), mask));
+
+    // SSE2 has no gather
+    for (int k = 0; k < 4; ++k) {
+      h00[k] = data[yiw[k]*cx+xiw[k]];
+      h01[k] = data[yiw[k]*cx+xiw2[k]];
+      h10[k] = data[yiw2[k]*cx+xiw[k]];
+      h11[k] = data[yiw2[k]*cx+xiw2[k]];
+    }
+
+    const __m128 d00 = _mm_load_ps(h00);
+    const __m128 d01 = _mm_load_ps(h01);
+    const __m128 d10 = _mm_load_ps(h10);
+    const __m128 d11 = _mm_load_ps(h11);
+
+    // both triangles are computed, then each lane picks its own;
+    // y can round up to 1, then the scalar code uses the upper edge
+    const __m128 yedge = _mm_cmpge_ps(y, one);
+    const __m128 upper = _mm_or_ps(_mm_cmplt_ps(x, y), yedge);
+
+    const __m128 nx = _mm_or_ps(
+      _mm_and_ps(upper, _mm_sub_ps(d10, d11)),
+      _mm_andnot_ps(upper, _mm_sub_ps(d00, d01)));
+    const __m128 ny = _mm_or_ps(
+      _mm_and_ps(upper, _mm_sub_ps(d00, d10)),
+      _mm_andnot_ps(upper, _mm_sub_ps(d01, d11)));
+
+    const __m128 xv1 = _mm_or_ps(
+      _mm_and_ps(upper, d00),
+      _mm_andnot_ps(upper, _mm_add_ps(d00, _mm_mul_ps(_mm_sub_ps(d01, d00),
+        _mm_div_ps(_mm_sub_ps(x, y), _mm_sub_ps(one, y))))));
+    const __m128 xv2 = _mm_or_ps(
+      _mm_and_ps(upper, _mm_add_ps(d10, _mm_mul_ps(_mm_sub_ps(d11, d10), _mm_div_ps(x, y)))),
+      _mm_andnot_ps(upper, d11));
+
+    __m128 z = _mm_add_ps(xv1, _mm_mul_ps(_mm_sub_ps(xv2, xv1), y));
+    z = _mm_or_ps(
+      _mm_and_ps(yedge, _mm_add_ps(d10, _mm_mul_ps(_mm_sub_ps(d11, d10), x))),
+      _mm_andnot_ps(yedge, z));
+
+    // normalize (nx, ny, scale_hz)
+    const __m128 len = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(
+      _mm_mul_ps(nx, nx), _mm_mul_ps(ny, ny)), _mm_mul_ps(normz, normz)));
+    const __m128 leninv = _mm_div_ps(one, len);
+
+    _mm_store_ps(rz, z);
+    _mm_store_ps(rnx, _mm_mul_ps(nx, leninv));
+    _mm_store_ps(rny, _mm_mul_ps(ny, leninv));
+    _mm_store_ps(rnz, _mm_mul_ps(normz, leninv));
+
+    for (int k = 0; k < 4; ++k) {
+      out[i+k].pos = vec3f(pos[i+k].x, pos[i+k].y, rz[k]);
+      out[i+k].normal = vec3f(rnx[k], rny[k], rnz[k]);
+    }
+  }
+#endif
+
+  // the rest one by one
+  for (; i < n; ++i) {
+    out[i].pos.x = pos[i].x;
+    out[i].pos.y = pos[i].y;
+    getContactInfo(out[i]);
+  }
+}
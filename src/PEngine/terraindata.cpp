@@ -0,0 +1,984 @@
+// terraindata.cpp [pengine]
+
+// Copyright 2004-2006 Jasmine Langridge, jas@jareiko.net
+// License: GPL version 2 (see included gpl.txt)
+
+//
+// GL-free part of the terrain: map loading and foliage/road sign placement
+//
+
+#include "exception.h"
+#include "pengine.h"
+#include "rigidity.h"
+#include "terraindata.h"
+#include <algorithm>
+#include <random>
+#include <sstream>
+
+// how many tiles worth of foliage and road signs are kept around
+#define TILEOBJECTS_CACHE_SIZE  64
+
+// road distances are stored in steps of 1/ROADMAP_DISTANCE_STEPS texel
+#define ROADMAP_DISTANCE_STEPS  4
+
+// instances are placed in random order, so the share of a band drawn is
+// its first instances; instance j of n ranks (j + 0.5) / n
+
+///
+/// @brief Gets the share of the instances of the band drawn at a distance
+/// @param dist = distance from the camera
+/// @retval between 0 and 1
+///
+float PTerrainFoliageBand::getShare(float dist) const
+{
+  if (lodfar <= 0.0f || dist <= lodnear) return 1.0f;
+  if (dist >= lodfar) return 0.0f;
+
+  const float t = (dist - lodnear) / (lodfar - lodnear);
+
+  return powf(1.0f - t, lodfalloff);
+}
+
+///
+/// @brief Gets how many of the instances of the band on a tile are drawn at
+///  a distance
+/// @param dist = distance from the camera
+/// @param count = instances of the band on the tile
+/// @retval the number of first instances drawn
+///
+int PTerrainFoliageBand::getCount(float dist, int count) const
+{
+  const int drawn = (int)ceilf(getShare(dist) * (float)count - 0.5f);
+
+  return std::max(0, std::min(count, drawn));
+}
+
+///
+/// @brief Gets the distance past which an instance of the band isn't
+///  drawn, the inverse of getShare()
+/// @param rank = rank of the instance, between 0 and 1
+/// @retval the distance
+///
+float PTerrainFoliageBand::getCut(float rank) const
+{
+  if (lodfar <= 0.0f) return 1000000000.0f;
+
+  const float t = 1.0f - powf(rank, 1.0f / lodfalloff);
+
+  return lodnear + t * (lodfar - lodnear);
+}
+
+PTerrainData::~PTerrainData ()
+{
+  unload();
+}
+
+
+void PTerrainData::unload()
+{
+  loaded = false;
+
+  {
+    std::lock_guard<std::mutex> lock(tileobjects_mutex);
+    tileobjects.clear();
+  }
+
+  hmap.clear();
+}
+
+
+PTerrainData::PTerrainData (XMLElement *element, const std::string &filepath,
+    const PRigidity &rigidity, bool cfgFoliage, bool cfgRoadsigns) :
+    loaded (false), tileobjects(TILEOBJECTS_CACHE_SIZE), tileobjects_generated(0), tileobjects_maxcell(0), rigidity(rigidity)
+{
+  unload();
+
+  std::string heightmap, colormap, terrainmap, roadmap, foliagemap;
+
+  scale_hz = 1.0;
+  scale_vt = 1.0;
+
+  const char *val;
+
+  val = element->Attribute("tilesize");
+  if (val) tilesize = atoi(val);
+
+  val = element->Attribute("horizontalscale");
+  if (val) scale_hz = atof(val);
+
+  val = element->Attribute("verticalscale");
+  if (val) scale_vt = atof(val);
+
+  val = element->Attribute("heightmap");
+  if (val) heightmap = val;
+
+  val = element->Attribute("colormap");
+  if (val) colormap = val;
+
+  val = element->Attribute("terrainmap");
+  if (val != nullptr) terrainmap = val;
+
+  val = element->Attribute("roadmap");
+  if (val != nullptr) roadmap = val;
+
+  val = element->Attribute("foliagemap");
+  if (val && cfgFoliage) foliagemap = val;
+
+  XMLElement *node = element->FirstChildElement("blurfilter");
+  std::vector<std::vector<float> > blurfilter;
+
+  if (node != nullptr) {
+    for (XMLElement *walk = node->FirstChildElement("row");
+        walk != nullptr;
+        walk = walk->NextSiblingElement("row")) {
+      const char *srow = walk->Attribute("data");
+
+      if (srow == nullptr)
+          continue;
+
+      std::stringstream bfrow(srow);
+      float coef;
+      std::vector<float> row;
+
+      while (bfrow >> coef)
+        row.push_back(coef);
+
+      blurfilter.push_back(row);
+    }
+  }
+  else {
+    blurfilter = {
+        {0.03f, 0.12f, 0.03f},
+        {0.12f, 0.40f, 0.12f},
+        {0.03f, 0.12f, 0.03f}
+    };
+  }
+
+  for (XMLElement *walk = element->FirstChildElement();
+    walk; walk = walk->NextSiblingElement()) {
+
+    if (strcmp(walk->Value(), "roadsign") == 0 && cfgRoadsigns) {
+      road_sign temprs;
+
+      val = walk->Attribute("sprite");
+      if (val != nullptr)
+        temprs.sprite_name = PUtil::assemblePath(val, filepath);
+
+      val = walk->Attribute("scale");
+      if (val != nullptr)
+        temprs.scale = atof(val);
+
+      val = walk->Attribute("spritecount");
+      if (val)
+        temprs.sprite_count = atoi(val);
+
+      for (XMLElement *walk2 = walk->FirstChildElement();
+          walk2 != nullptr;
+          walk2 = walk2->NextSiblingElement()) {
+        if (strcmp(walk2->Value(), "location") == 0) {
+          float deg = 0;
+
+          val = walk2->Attribute("oridegrees");
+          if (val != nullptr)
+            deg = RADIANS(atof(val));
+
+          val = walk2->Attribute("coords");
+          if (val != nullptr) {
+            float x, y;
+
+            if (sscanf(val, "%f, %f", &x, &y) == 2) {
+              temprs.x = x;
+              temprs.y = y;
+              temprs.deg = deg;
+
+              if (!temprs.sprite_name.empty())
+                roadsigns.push_back(temprs);
+            }
+          }
+        }
+      }
+    }
+    else if (!strcmp(walk->Value(), "foliageband") && cfgFoliage) {
+      PTerrainFoliageBand tfb;
+      tfb.middle = 0.5f;
+      tfb.range = 0.5f;
+      tfb.density = 1.0f;
+      tfb.scale = 1.0f;
+      //tfb.scalemin = 1.0f;
+      //tfb.scalemax = 1.4f;
+      //tfb.model = nullptr;
+      //tfb.modelscale = 1.0f;
+      tfb.sprite_tex = nullptr;
+      tfb.sprite_count = 1;
+      tfb.lodnear = 0.0f;
+      tfb.lodfar = 0.0f;
+      tfb.lodfalloff = 1.0f;
+      tfb.lodfade = 0.0f;
+      tfb.lodsprite_count = 0;
+
+      val = walk->Attribute("middle");
+      if (val) tfb.middle = atof(val);
+
+      val = walk->Attribute("range");
+      if (val) tfb.range = atof(val);
+
+      val = walk->Attribute("density");
+      if (val) tfb.density = atof(val);
+
+      val = walk->Attribute("scale");
+      if (val) tfb.scale = atof(val);
+
+      /*
+      val = walk->Attribute("scalemin");
+      if (val) tfb.scalemin = atof(val);
+
+      val = walk->Attribute("scalemax");
+      if (val) tfb.scalemax = atof(val);
+        */
+      /*
+      val = walk->Attribute("model");
+      if (val) tfb.model = ssModel.loadModel(PUtil::assemblePath(val, filepath));
+
+      val = walk->Attribute("modelscale");
+      if (val) tfb.modelscale = atof(val);
+      */
+
+      val = walk->Attribute("sprite");
+      if (val) tfb.sprite_name = PUtil::assemblePath(val, filepath);
+
+      val = walk->Attribute("spritecount");
+      if (val) tfb.sprite_count = atoi(val);
+
+      val = walk->Attribute("lodnear");
+      if (val) tfb.lodnear = atof(val);
+
+      val = walk->Attribute("lodfar");
+      if (val) tfb.lodfar = atof(val);
+
+      val = walk->Attribute("lodfalloff");
+      if (val) tfb.lodfalloff = atof(val);
+
+      val = walk->Attribute("lodfade");
+      if (val) tfb.lodfade = atof(val);
+
+      val = walk->Attribute("lodspritecount");
+      if (val) tfb.lodsprite_count = atoi(val);
+
+      // a band that ends before it starts thinning just stops at lodfar
+      CLAMP_LOWER(tfb.lodfar, 0.0f);
+      CLAMP(tfb.lodnear, 0.0f, tfb.lodfar);
+      CLAMP_LOWER(tfb.lodfalloff, 0.01f);
+      CLAMP_LOWER(tfb.lodfade, 0.0f);
+
+      if (tfb.lodsprite_count < 1 || tfb.lodsprite_count > tfb.sprite_count)
+        tfb.lodsprite_count = tfb.sprite_count;
+
+      foliageband.push_back(tfb);
+    }
+  }
+
+
+  if (!heightmap.length()) {
+    throw MakePException ("Load failed: terrain has no heightmap");
+  }
+
+  if (!colormap.length()) {
+    throw MakePException ("Load failed: terrain has no colormap");
+  }
+
+  if (tilesize != (tilesize & (-tilesize)) ||
+    tilesize < 4) {
+    throw MakePException ("Load failed: tile size not power of two dimension, or too small");
+  }
+
+  if (scale_hz <= 0.0 || scale_vt == 0.0) {
+    throw MakePException ("Load failed: invalid scale value");
+  }
+
+  scale_hz_inv = 1.0 / scale_hz;
+  scale_vt_inv = 1.0 / scale_vt;
+  scale_tile_inv = scale_hz_inv / (float)tilesize;
+
+  PImage img;
+  try
+  {
+    img.load (PUtil::assemblePath (heightmap, filepath));
+  }
+  catch (...)
+  {
+    PUtil::outLog() << "Load failed: couldn't open heightmap \"" << heightmap << "\"\n";
+    throw;
+  }
+
+  totsize = img.getcx();
+  if (totsize != img.getcy() ||
+    totsize != (totsize & (-totsize)) ||
+    totsize < 16) {
+    throw MakePException ("Load failed: heightmap not square, or not power of two dimension, or too small");
+  }
+
+  totsizesq = totsize * totsize;
+
+  if (tilesize > totsize) tilesize = totsize;
+
+  tilecount = totsize / tilesize;
+  totmask = totsize - 1;
+
+  //PUtil::outLog() << "img: " << totsize << " squared, " << img.getcc() << " cc\n";
+
+  hmap.resize(totsizesq);
+
+#if 0
+  if (img.getcc() != 1) {
+    if (PUtil::isDebugLevel(DEBUGLEVEL_TEST))
+      PUtil::outLog() << "Warning: heightmap is not single channel\n";
+    int cc = img.getcc();
+    uint8 *dat = img.getData();
+    for (int s=0, d=0; d<totsizesq; s+=cc, d+=1) hmap[d] = dat[s];
+  } else {
+    std::copy(img.getData(), img.getData() + totsize * totsize, &hmap[0]);
+  }
+#else
+  if (img.getcc() != 1) {
+    if (PUtil::isDebugLevel(DEBUGLEVEL_TEST))
+      PUtil::outLog() << "Warning: heightmap is not single channel\n";
+  }
+
+  int cc = img.getcc();
+  uint8 *dat = img.getData();
+
+  for (int y=0; y<totsize; ++y) {
+    for (int x=0; x<totsize; ++x) {
+      float accum = 0.0;
+      for (int yi=0; yi < static_cast<int> (blurfilter.size()); ++yi) {
+        for (int xi=0; xi < static_cast<int> (blurfilter[yi].size()); ++xi) {
+          accum += (float)dat[
+            (((y + yi - (blurfilter.size()-1)/2) & totmask) * totsize +
+            ((x + xi - (blurfilter[yi].size()-1)/2) & totmask)) * cc] * blurfilter[yi][xi];
+        }
+      }
+      hmap[y*totsize + x] = accum * scale_vt;
+    }
+  }
+#endif
+
+  contact.setField(&hmap[0], totsize, scale_hz);
+
+  img.unload();
+
+  try
+  {
+    cmap.load(PUtil::assemblePath(colormap, filepath));
+  }
+  catch (...)
+  {
+    PUtil::outLog() << "Load failed: couldn't open colormap \"" << colormap << "\"\n";
+    throw;
+  }
+
+  cmaptotsize = cmap.getcx();
+  if (cmaptotsize != cmap.getcy() ||
+    cmaptotsize != (cmaptotsize & (-cmaptotsize)) ||
+    cmaptotsize < tilecount) {
+    throw MakePException ("Load failed: colormap not square, or not power of two dimension, or too small");
+  }
+
+  cmaptilesize = cmaptotsize / tilecount;
+  cmaptotmask = cmaptotsize - 1;
+
+  // load terrain map image
+  PImage tmap_img;
+
+  try
+  {
+      if (!terrainmap.empty())
+        tmap_img.load(PUtil::assemblePath(terrainmap, filepath));
+  }
+  catch (...)
+  {
+    PUtil::outLog() << "Load failed: couldn't open terrainmap \"" << terrainmap << "\"\n";
+    throw;
+  }
+
+    if (tmap_img.getData() != nullptr && tmap_img.getcx() != tmap_img.getcy())
+        throw MakePException("Load failed: terrainmap not square");
+
+    // decoded to terrain types, the image itself isn't kept
+    if (tmap_img.getData() != nullptr && !tmap.load(tmap_img, getMapSize()))
+        PUtil::outLog() << "Warning: terrainmap is not RGB, ignored\n";
+
+    PImage rmap_img;
+
+    // load road map image
+    try
+    {
+        if (!roadmap.empty())
+            rmap_img.load(PUtil::assemblePath(roadmap, filepath));
+    }
+    catch (...)
+    {
+        PUtil::outLog() << "Load failed: couldn't open roadmap \"" << roadmap << "\"\n";
+        throw;
+    }
+
+    if (rmap_img.getData() != nullptr)
+    {
+        if (rmap_img.getcx() != rmap_img.getcy())
+            throw MakePException("Load failed: roadmap not square");
+        else
+        if (!rmap.load(rmap_img, getMapSize()))
+            throw MakePException("Load failed: bad roadmap image");
+    }
+
+  // calculate foliage try counts for tile size
+
+  for (unsigned int b = 0; b < foliageband.size(); b++) {
+    foliageband[b].trycount =
+      (int) (foliageband[b].density * (float)totsizesq * scale_hz * scale_hz);
+  }
+
+  // load foliage map
+
+  fmap.resize(totsizesq, 0.0f);
+
+  if (foliagemap.length()) {
+    try
+    {
+      img.load(PUtil::assemblePath(foliagemap, filepath));
+    }
+    catch (...)
+    {
+      PUtil::outLog() << "Load failed: couldn't open foliage map \"" << foliagemap << "\"\n";
+      throw;
+    }
+
+    if (totsize != img.getcy() ||
+      totsize != img.getcx()) {
+      throw MakePException ("Load failed: foliage map size doesn't match heightmap");
+    }
+
+    int cc = img.getcc();
+    uint8 *dat = img.getData();
+
+    if (cc != 1) {
+      if (PUtil::isDebugLevel(DEBUGLEVEL_TEST))
+        PUtil::outLog() << "Warning: foliage map is not single channel\n";
+    }
+
+    for (int i = 0; i < totsizesq; i++) {
+      fmap[i] = (float) dat[i * cc] / 255.0f;
+    }
+  }
+
+  loaded = true;
+}
+
+///
+/// @brief Reads the road map from a square image.
+/// @param img          Road map, the road is white.
+/// @param ms           Map size.
+/// @returns Whether or not the image could be used.
+///
+bool RoadMap::load(const PImage &img, float ms)
+{
+    bits.clear();
+    distance.clear();
+
+    if (img.getData() == nullptr || img.getcx() != img.getcy() || ms <= 0.0f)
+        return false;
+
+    const int imgsize = img.getcx();
+
+    shift = 0;
+    while ((1 << shift) < imgsize)
+        ++shift;
+
+    const int size = 1 << shift;
+
+    mask = size - 1;
+    scale = size / ms;
+    bits.assign((size * size + 63) / 64, 0);
+
+    for (int y = 0; y < size; ++y)
+        for (int x = 0; x < size; ++x)
+        {
+            // nearest texel of the image, the same one if sizes match
+            const int ix = x * imgsize / size;
+            const int iy = y * imgsize / size;
+            const uint8 *pb = img.getData() + (iy * imgsize + ix) * img.getcc();
+            bool is_road = true;
+
+            for (int i=0; i < img.getcc(); ++i)
+                if (pb[i] != 0xFF) // the road is white
+                {
+                    is_road = false;
+                    break;
+                }
+
+            if (is_road)
+            {
+                const int i = (y << shift) + x;
+
+                bits[i >> 6] |= uint64_t(1) << (i & 63);
+            }
+        }
+
+    return true;
+}
+
+///
+/// @brief Squared distance transform of one row or column.
+/// @details Felzenszwalb and Huttenlocher's lower envelope of parabolas.
+/// @param f            Input squared distances, large for "no seed".
+/// @param d            Output squared distances.
+/// @param n            Number of elements.
+/// @param v, z         Scratch space for n and n + 1 elements.
+///
+static void distanceTransform1D(const float *f, float *d, int n, int *v, float *z)
+{
+    int k = 0;
+
+    v[0] = 0;
+    z[0] = -1e20f;
+    z[1] = 1e20f;
+
+    for (int q = 1; q < n; ++q)
+    {
+        float s = ((f[q] + q * q) - (f[v[k]] + v[k] * v[k])) / (2 * q - 2 * v[k]);
+
+        // z[0] is far enough below any s to stop this
+        while (s <= z[k])
+        {
+            --k;
+            s = ((f[q] + q * q) - (f[v[k]] + v[k] * v[k])) / (2 * q - 2 * v[k]);
+        }
+
+        ++k;
+        v[k] = q;
+        z[k] = s;
+        z[k + 1] = 1e20f;
+    }
+
+    k = 0;
+
+    for (int q = 0; q < n; ++q)
+    {
+        while (z[k + 1] < q)
+            ++k;
+
+        d[q] = (q - v[k]) * (q - v[k]) + f[v[k]];
+    }
+}
+
+///
+/// @brief Squared Euclidean distance of every texel to the nearest seed.
+/// @param seed         Whether each texel is a seed.
+/// @param size         Side of the square grid.
+/// @param out          Output squared distances, in texels.
+///
+static void distanceTransform2D(const std::vector<bool> &seed, int size, std::vector<float> &out)
+{
+    std::vector<float> f(size), d(size), z(size + 1);
+    std::vector<int> v(size);
+
+    out.resize(size * size);
+
+    for (int i = 0; i < size * size; ++i)
+        out[i] = seed[i] ? 0.0f : 1e20f;
+
+    // columns, then rows
+    for (int x = 0; x < size; ++x)
+    {
+        for (int y = 0; y < size; ++y)
+            f[y] = out[y * size + x];
+
+        distanceTransform1D(&f[0], &d[0], size, &v[0], &z[0]);
+
+        for (int y = 0; y < size; ++y)
+            out[y * size + x] = d[y];
+    }
+
+    for (int y = 0; y < size; ++y)
+    {
+        distanceTransform1D(&out[y * size], &d[0], size, &v[0], &z[0]);
+        std::copy(d.begin(), d.end(), out.begin() + y * size);
+    }
+}
+
+///
+/// @brief Precomputes the signed distance to the edge of the road.
+/// @details Off the road it's the distance to the nearest road texel, on the
+///  road it's minus the distance to the nearest texel off the road.
+///
+void RoadMap::buildDistance()
+{
+    if (bits.empty() || !distance.empty())
+        return;
+
+    const int size = 1 << shift;
+    std::vector<bool> road(size * size), offroad(size * size);
+
+    for (int i = 0; i < size * size; ++i)
+    {
+        road[i] = (bits[i >> 6] >> (i & 63)) & 1;
+        offroad[i] = !road[i];
+    }
+
+    std::vector<float> toroad, tooffroad;
+
+    distanceTransform2D(road, size, toroad);
+    distanceTransform2D(offroad, size, tooffroad);
+
+    distance.resize(size * size);
+
+    for (int i = 0; i < size * size; ++i)
+    {
+        float dist = road[i] ? -std::sqrt(tooffroad[i]) : std::sqrt(toroad[i]);
+
+        dist *= ROADMAP_DISTANCE_STEPS;
+        CLAMP(dist, -32767.0f, 32767.0f);
+        distance[i] = static_cast<int16_t> (dist);
+    }
+
+    distance_scale = 1.0f / (ROADMAP_DISTANCE_STEPS * scale);
+}
+
+///
+/// @brief Decodes every texel of the terrain map to its TerrainType.
+/// @details Also maps each whole world coordinate to its texel, rounding the
+///  same way the per-query decoding used to.
+/// @param img          Terrain map, square, with RGB channels.
+/// @param ms           Map size.
+/// @returns Whether or not the image could be used.
+///
+bool TerrainTypeMap::load(const PImage &img, float ms)
+{
+    grid.clear();
+    texel.clear();
+
+    if (img.getData() == nullptr || img.getcc() < 3 || img.getcx() != img.getcy())
+        return false;
+
+    size = img.getcx();
+    mapsize = static_cast<int> (ms);
+
+    if (mapsize < 1)
+        return false;
+
+    grid.resize(size * size);
+
+    for (int i = 0; i < size * size; ++i)
+    {
+        const rgbcolor c(
+            img.getByte(i * img.getcc() + 0),
+            img.getByte(i * img.getcc() + 1),
+            img.getByte(i * img.getcc() + 2));
+
+        grid[i] = static_cast<uint8_t> (PUtil::decideRoadSurface(c));
+    }
+
+    texel.resize(mapsize);
+
+    for (int p = 0; p < mapsize; ++p)
+    {
+        long int t = std::lround(p * size / ms);
+
+        CLAMP_UPPER(t, size - 1);
+        texel[p] = t;
+    }
+
+    return true;
+}
+
+///
+/// @brief Gets the foliage and road signs of a tile, generating them if needed
+/// @param tilex = tile x coordinate
+/// @param tiley = tile y coordinate
+/// @retval Shared pointer to the tile objects
+///
+std::shared_ptr<const PTerrainTileObjects> PTerrainData::getTileObjects(int tilex, int tiley)
+{
+  {
+    std::lock_guard<std::mutex> lock(tileobjects_mutex);
+
+    const std::shared_ptr<const PTerrainTileObjects> *cached = tileobjects.find(tilex, tiley);
+    if (cached) return *cached;
+  }
+
+  // generated outside the lock, so that the simulation doesn't wait on a
+  // tile being built in the background; placement doesn't depend on when
+  // it runs, so if two threads race for a tile either result will do
+  std::shared_ptr<PTerrainTileObjects> objs = std::make_shared<PTerrainTileObjects>();
+  objs->posx = tilex;
+  objs->posy = tiley;
+  generateTileObjects(*objs);
+
+  std::lock_guard<std::mutex> lock(tileobjects_mutex);
+
+  const std::shared_ptr<const PTerrainTileObjects> *cached = tileobjects.find(tilex, tiley);
+  if (cached) return *cached;
+
+  ++tileobjects_generated;
+  tileobjects_maxcell = std::max(tileobjects_maxcell, objs->maxcell);
+
+  // replaces the least recently used tile once the cache is full
+  tileobjects.insert(tilex, tiley) = objs;
+  return objs;
+}
+
+///
+/// @brief Makes room in a query for every object a box could find
+/// @details The bound is the cells a box of that size can overlap, each
+///  holding as many objects as the fullest cell of the tiles generated so
+///  far. Calling this after each query moves the allocation into the query
+///  that generated a fuller tile, rather than a later one.
+/// @param boxsize = largest size of the boxes the query will be used for
+/// @param query = the query to make room in
+///
+void PTerrainData::reserveObjectQuery(const vec3f &boxsize, PTerrainObjectQuery &query)
+{
+  const float tileside = (float)tilesize * scale_hz;
+  const float cellscale = (float)PTerrainTileObjects::gridsize / tileside;
+
+  // a box overlaps one more cell than fit inside it, along each axis
+  const unsigned int cellsx = (unsigned int)(boxsize.x * cellscale) + 2;
+  const unsigned int cellsy = (unsigned int)(boxsize.y * cellscale) + 2;
+
+  unsigned int maxcell;
+  {
+    std::lock_guard<std::mutex> lock(tileobjects_mutex);
+    maxcell = tileobjects_maxcell;
+  }
+
+  const unsigned int capacity = cellsx * cellsy * maxcell;
+
+  if (query.hit.capacity() < capacity)
+    query.hit.reserve(capacity);
+}
+
+///
+/// @brief Counts the tiles whose objects had to be generated
+/// @details Generating a tile allocates, so the simulation only runs without
+///  allocating while this stays the same.
+/// @retval number of tiles generated since loading
+///
+unsigned int PTerrainData::getGeneratedTileCount()
+{
+  std::lock_guard<std::mutex> lock(tileobjects_mutex);
+
+  return tileobjects_generated;
+}
+
+///
+/// @brief Cell of the collision grid along one axis
+/// @param offset = distance from the lower edge of the tile, in cells
+/// @retval cell index, clamped to the grid
+///
+static int getObjectCell(float offset)
+{
+  // also sends NaN to the first cell
+  if (!(offset > 0.0f)) return 0;
+  if (offset >= (float)PTerrainTileObjects::gridsize) return PTerrainTileObjects::gridsize - 1;
+  return (int)offset;
+}
+
+///
+/// @brief Finds the rigid objects touching a box
+/// @details Looks in every tile the box overlaps, so objects just across a
+///  tile border are found too. Only the grid cells under the box are searched.
+/// @param boxmin = lower corner of the box in world coordinates
+/// @param boxmax = upper corner of the box in world coordinates
+/// @param query = filled with the objects found, its previous contents are dropped
+///
+void PTerrainData::findObjects(const vec3f &boxmin, const vec3f &boxmax, PTerrainObjectQuery &query)
+{
+  query.tile.clear();
+  query.hit.clear();
+
+  const int mintx = (int)floor(boxmin.x * scale_tile_inv);
+  const int maxtx = (int)floor(boxmax.x * scale_tile_inv);
+  const int minty = (int)floor(boxmin.y * scale_tile_inv);
+  const int maxty = (int)floor(boxmax.y * scale_tile_inv);
+
+  const float tileside = (float)tilesize * scale_hz;
+  const float cellscale = (float)PTerrainTileObjects::gridsize / tileside;
+
+  for (int ty = minty; ty <= maxty; ++ty) {
+    for (int tx = mintx; tx <= maxtx; ++tx) {
+      std::shared_ptr<const PTerrainTileObjects> objs = getTileObjects(tx, ty);
+
+      if (objs->straight.empty()) continue;
+
+      const unsigned int hits = query.hit.size();
+
+      const int mincx = getObjectCell((boxmin.x - (float)tx * tileside) * cellscale);
+      const int maxcx = getObjectCell((boxmax.x - (float)tx * tileside) * cellscale);
+      const int mincy = getObjectCell((boxmin.y - (float)ty * tileside) * cellscale);
+      const int maxcy = getObjectCell((boxmax.y - (float)ty * tileside) * cellscale);
+
+      for (int cy = mincy; cy <= maxcy; ++cy) {
+        // the cells of a row are contiguous in straight
+        const unsigned int first = objs->cellstart[cy * PTerrainTileObjects::gridsize + mincx];
+        const unsigned int last = objs->cellstart[cy * PTerrainTileObjects::gridsize + maxcx + 1];
+
+        for (unsigned int i = first; i < last; ++i) {
+          const PTerrainFoliage &inst = objs->straight[i];
+
+          // objects are vertical segments from their base up to their scale
+          if (inst.pos.x <= boxmax.x && inst.pos.x >= boxmin.x &&
+              inst.pos.y <= boxmax.y && inst.pos.y >= boxmin.y &&
+              inst.pos.z <= boxmax.z && inst.pos.z + inst.scale >= boxmin.z) {
+            PTerrainObjectQuery::Hit hit;
+            hit.tile = query.tile.size();
+            hit.index = i;
+            query.hit.push_back(hit);
+          }
+        }
+      }
+
+      if (query.hit.size() > hits)
+        query.tile.push_back(std::move(objs));
+    }
+  }
+}
+
+///
+/// @brief Seed of the object placement of a tile
+/// @details The coordinates are mixed so that neighbouring tiles get
+///  unrelated sequences, and the same tile always gets the same seed.
+/// @param tilex = tile x coordinate
+/// @param tiley = tile y coordinate
+/// @retval the seed
+///
+static uint32 getTileSeed(int tilex, int tiley)
+{
+  uint32 h = (uint32)tilex * 0x9E3779B1u ^ (uint32)tiley * 0x85EBCA77u;
+
+  h ^= h >> 16;
+  h *= 0x7FEB352Du;
+  h ^= h >> 15;
+  h *= 0x846CA68Bu;
+  h ^= h >> 16;
+  return h;
+}
+
+///
+/// @brief Places foliage and road signs on a tile
+/// @details Placement is seeded per tile, so a tile always gets the same
+///  objects no matter when or how often it is generated. The generator is
+///  local, and its numbers are used as they come rather than through a
+///  distribution, so that several threads can generate tiles at once and
+///  every platform gets the same objects.
+/// @param objs = tile to fill, posx and posy must be set
+///
+void PTerrainData::generateTileObjects(PTerrainTileObjects &objs)
+{
+  // a seed that is a multiple of the modulus is taken as 1
+  std::minstd_rand random(getTileSeed(objs.posx, objs.posy));
+
+  const auto random01 = [&random] () -> float {
+    return (float)(random() - std::minstd_rand::min()) /
+      (float)(std::minstd_rand::max() - std::minstd_rand::min());
+  };
+
+  objs.foliage.resize(foliageband.size());
+  objs.straight.clear();
+
+  for (unsigned int b = 0; b < foliageband.size(); b++) {
+    const float rigidityvalue = rigidity.getRigidity(foliageband[b].sprite_name);
+
+    objs.foliage[b].clear();
+
+    for (int i = 0; i < foliageband[b].trycount; i++) {
+      const float tryx = random01();
+      const float tryy = random01();
+
+      vec2f ftry = vec2f(
+        (float)((objs.posx * tilesize) + tryx * tilesize) * scale_hz,
+        (float)((objs.posy * tilesize) + tryy * tilesize) * scale_hz);
+
+      float fol = getFoliageLevel(ftry.x, ftry.y);
+
+      if ((1.0 - fabs((fol - foliageband[b].middle) / foliageband[b].range)) < random01()) continue;
+
+      PTerrainFoliage inst;
+      inst.pos.x = ftry.x;
+      inst.pos.y = ftry.y;
+      inst.pos.z = getHeight(ftry.x, ftry.y);
+      inst.ang = random01() * PI*2.0f;
+
+      const float size = random01();
+      inst.scale = (foliageband[b].scale + fol * 0.5f) * (size * random01() + 0.5) * 1.4;
+      inst.rigidity = rigidityvalue;
+
+      objs.foliage[b].push_back(inst);
+
+      if (rigidityvalue != 0.0f)
+        objs.straight.push_back(inst);
+    }
+  }
+
+  objs.roadsign.resize(roadsigns.size());
+
+  vec2f tilemin = vec2f(
+    objs.posx * tilesize * scale_hz,
+    objs.posy * tilesize * scale_hz);
+  vec2f tilemax = vec2f(
+    (objs.posx * tilesize + tilesize) * scale_hz,
+    (objs.posy * tilesize + tilesize) * scale_hz);
+
+  for (unsigned int b=0; b < roadsigns.size(); ++b) {
+    vec2f ftry = vec2f(
+      roadsigns[b].x * scale_hz,
+      roadsigns[b].y * scale_hz);
+
+    objs.roadsign[b].clear();
+
+    if (ftry.x >= tilemin.x && ftry.x <= tilemax.x && ftry.y >= tilemin.y && ftry.y <= tilemax.y) {
+      PTerrainFoliage inst;
+      inst.pos.x    = ftry.x;
+      inst.pos.y    = ftry.y;
+      inst.pos.z    = getHeight(ftry.x, ftry.y);
+      inst.ang      = roadsigns[b].deg;
+      inst.scale    = roadsigns[b].scale;
+      inst.rigidity = rigidity.getRigidity(roadsigns[b].sprite_name);
+
+      objs.roadsign[b].push_back(inst);
+
+      if (inst.rigidity != 0.0f)
+        objs.straight.push_back(inst);
+    }
+  }
+
+  // sort the rigid objects by collision grid cell (counting sort)
+
+  const int cells = PTerrainTileObjects::gridsize * PTerrainTileObjects::gridsize;
+  const float tileside = (float)tilesize * scale_hz;
+  const float cellscale = (float)PTerrainTileObjects::gridsize / tileside;
+
+  std::vector<unsigned int> cell(objs.straight.size());
+
+  objs.cellstart.assign(cells + 1, 0);
+
+  for (unsigned int i = 0; i < objs.straight.size(); ++i) {
+    // same arithmetic as findObjects(), so both agree on the cell
+    const int cx = getObjectCell((objs.straight[i].pos.x - (float)objs.posx * tileside) * cellscale);
+    const int cy = getObjectCell((objs.straight[i].pos.y - (float)objs.posy * tileside) * cellscale);
+
+    cell[i] = cy * PTerrainTileObjects::gridsize + cx;
+    ++objs.cellstart[cell[i] + 1];
+  }
+
+  objs.maxcell = *std::max_element(objs.cellstart.begin(), objs.cellstart.end());
+
+  for (int c = 0; c < cells; ++c)
+    objs.cellstart[c + 1] += objs.cellstart[c];
+
+  std::vector<PTerrainFoliage> sorted(objs.straight.size());
+  std::vector<unsigned int> next(objs.cellstart.begin(), objs.cellstart.end() - 1);
+
+  for (unsigned int i = 0; i < objs.straight.size(); ++i)
+    sorted[next[cell[i]]++] = objs.straight[i];
+
+  objs.straight.swap(sorted);
+}
@@ -0,0 +1,131 @@
+// terrainhorizon.cpp [pengine]
+
+// License: GPL version 2 (see included gpl.txt)
+
+#include "terrainhorizon.h"
+#include <algorithm>
+#include <limits>
+
+// directions the horizon around the camera is kept for
+#define HORIZON_BINS  256
+
+///
+/// @brief Drops the passes of the tiles of a square that nearer terrain hides
+/// @details Walks square rings of tiles outwards from the camera, keeping for
+///  each direction the steepest slope up from the camera that terrain
+///  reaches, the horizon. A tile is hidden if in every direction it spans
+///  its top stays under the horizon. Only the lowest point of a tile counts
+///  when it hides others, and only from two rings out: along any direction
+///  the tiles of ring r are no nearer than those of ring r - 2, so no tile
+///  is hidden by terrain behind it. Rings within two of the camera are
+///  always drawn.
+/// @param campos = position of the camera
+/// @param radius = tiles on each side of the camera tile
+/// @param tile = bounds of the tiles of the square, row by row, with the
+///  camera tile in the middle
+/// @param pass = PASS_TERRAIN and PASS_OBJECTS of each tile, cleared for
+///  the hidden ones
+///
+void PTerrainHorizon::cull(const vec3f &campos, int radius,
+  const std::vector<const PTerrainTileBounds *> &tile, std::vector<uint8> &pass)
+{
+  const int side = 2 * radius + 1;
+  const float binangle = 2.0f * PI / (float)HORIZON_BINS;
+
+  horizon.assign(HORIZON_BINS, std::numeric_limits<float>::lowest());
+
+  // range of directions a box spans, in bins, and its horizontal distance
+  // from the camera, nearest and furthest
+  const auto span = [&] (const vec3f &mins, const vec3f &maxs,
+      float &first, float &last, float &dnear, float &dfar) {
+    const vec2f corner[4] = {
+      vec2f(mins.x - campos.x, mins.y - campos.y),
+      vec2f(maxs.x - campos.x, mins.y - campos.y),
+      vec2f(mins.x - campos.x, maxs.y - campos.y),
+      vec2f(maxs.x - campos.x, maxs.y - campos.y)
+    };
+
+    const vec2f middle = (corner[0] + corner[3]) * 0.5f;
+    const float midangle = atan2f(middle.y, middle.x);
+    float lo = 0.0f, hi = 0.0f;
+
+    dfar = 0.0f;
+
+    for (int c = 0; c < 4; ++c) {
+      float delta = atan2f(corner[c].y, corner[c].x) - midangle;
+      if (delta > PI) delta -= 2.0f * PI;
+      if (delta < -PI) delta += 2.0f * PI;
+
+      lo = std::min(lo, delta);
+      hi = std::max(hi, delta);
+      dfar = std::max(dfar, corner[c].length());
+    }
+
+    first = (midangle + lo) / binangle;
+    last = (midangle + hi) / binangle;
+
+    vec2f nearest(0.0f, 0.0f);
+    CLAMP(nearest.x, corner[0].x, corner[3].x);
+    CLAMP(nearest.y, corner[0].y, corner[3].y);
+    dnear = std::max(nearest.length(), 0.001f);
+  };
+
+  const auto bin = [] (int b) -> int {
+    return ((b % HORIZON_BINS) + HORIZON_BINS) % HORIZON_BINS;
+  };
+
+  // the tiles of ring r, camera tile at 0, as indices into tile
+  const auto ring = [&] (int r, std::vector<int> &out) {
+    out.clear();
+
+    for (int y = -r; y <= r; ++y)
+      for (int x = -r; x <= r; x += (y == -r || y == r) ? 1 : 2 * r)
+        out.push_back((radius + y) * side + radius + x);
+  };
+
+  // whether a box reaches above the horizon in any direction it spans
+  const auto hidden = [&] (const vec3f &mins, const vec3f &maxs) -> bool {
+    float first, last, dnear, dfar;
+    span(mins, maxs, first, last, dnear, dfar);
+
+    const float rise = maxs.z - campos.z;
+    const float slope = rise / (rise >= 0.0f ? dnear : dfar);
+
+    for (int b = (int)floorf(first); b <= (int)floorf(last); ++b)
+      if (slope >= horizon[bin(b)]) return false;
+
+    return true;
+  };
+
+  for (int r = 3; r <= radius; ++r) {
+    ring(r, ringtile);
+
+    // foliage and road signs may stick out of their tile towards the
+    // camera, so they only go against the horizon up to ring r - 3
+    for (int i : ringtile)
+      if ((pass[i] & PASS_OBJECTS) && hidden(tile[i]->objmins, tile[i]->objmaxs))
+        pass[i] &= ~PASS_OBJECTS;
+
+    // the lowest slope each tile of ring r - 2 surely reaches
+    ring(r - 2, ringtile);
+
+    for (int i : ringtile) {
+      const PTerrainTileBounds *t = tile[i];
+      float first, last, dnear, dfar;
+      span(t->mins, t->maxs, first, last, dnear, dfar);
+
+      const float rise = t->mins.z - campos.z;
+      const float slope = rise / (rise >= 0.0f ? dfar : dnear);
+
+      // only the directions wholly inside the tile's span cross it
+      for (int b = (int)ceilf(first); b + 1 <= (int)floorf(last); ++b)
+        horizon[bin(b)] = std::max(horizon[bin(b)], slope);
+    }
+
+    ring(r, ringtile);
+
+    for (int i : ringtile)
+      if ((pass[i] & PASS_TERRAIN) && hidden(tile[i]->mins, tile[i]->maxs))
+        pass[i] &= ~PASS_TERRAIN;
+  }
+}
@@ -0,0 +1,122 @@
+// terrainlod.cpp [pengine]
+
+// License: GPL version 2 (see included gpl.txt)
+
+#include "terrainlod.h"
+#include <algorithm>
+
+///
+/// @brief Builds the index sets tiles are drawn with
+/// @details Level l draws one vertex in 2^l along x and y, down to two
+///  triangles for the whole tile. A side that meets a tile drawn one level
+///  coarser moves its extra vertices onto the previous vertex of the
+///  coarser level, so that both tiles have the same edge and no cracks
+///  show; the triangles that this flattens are left out.
+/// @param tilesize = quads along each side of a tile, a power of two
+/// @param index = gets the indices of all the sets, into the
+///  (tilesize + 1)^2 vertices of a tile, row by row
+///
+void PTerrainLod::build(int tilesize, std::vector<uint16> &index)
+{
+  const int tilesizep1 = tilesize + 1;
+
+  levels = 1;
+  while ((1 << (levels - 1)) < tilesize)
+    ++levels;
+
+  first.assign(levels * SIDE_MASKS, 0);
+  count.assign(levels * SIDE_MASKS, 0);
+
+  index.clear();
+
+  for (int level = 0; level < levels; ++level) {
+    const int step = 1 << level;
+    const int coarse = step * 2;
+
+    // the coarsest level has no coarser neighbor
+    const int masks = level + 1 < levels ? SIDE_MASKS : 1;
+
+    for (int mask = 0; mask < masks; ++mask) {
+      const auto vertex = [&] (int x, int y) -> uint16 {
+        if (y == 0 && (mask & SIDE_MINY)) x = x / coarse * coarse;
+        else if (x == tilesize && (mask & SIDE_MAXX)) y = y / coarse * coarse;
+        else if (y == tilesize && (mask & SIDE_MAXY)) x = x / coarse * coarse;
+        else if (x == 0 && (mask & SIDE_MINX)) y = y / coarse * coarse;
+        return y * tilesizep1 + x;
+      };
+
+      const auto triangle = [&] (uint16 a, uint16 b, uint16 c) {
+        if (a == b || b == c || c == a) return;
+        index.push_back(a);
+        index.push_back(b);
+        index.push_back(c);
+      };
+
+      first[level * SIDE_MASKS + mask] = index.size();
+
+      // split along the same diagonal as the full detail strips were
+      for (int y = 0; y < tilesize; y += step) {
+        for (int x = 0; x < tilesize; x += step) {
+          triangle(vertex(x, y + step), vertex(x, y), vertex(x + step, y + step));
+          triangle(vertex(x, y), vertex(x + step, y), vertex(x + step, y + step));
+        }
+      }
+
+      count[level * SIDE_MASKS + mask] = index.size() - first[level * SIDE_MASKS + mask];
+    }
+  }
+}
+
+///
+/// @brief Keeps neighboring tiles at most one level apart, which the index
+///  sets can stitch
+/// @details Refining a tile can make a neighbor too coarse in turn, so this
+///  goes over the square until nothing changes. Levels only ever go down.
+/// @param level = detail level of each tile, row by row
+/// @param side = tiles along each side of the square
+///
+void PTerrainLod::stitchLevels(std::vector<int> &level, int side)
+{
+  for (bool changed = true; changed; ) {
+    changed = false;
+
+    for (int ty = 0; ty < side; ++ty) {
+      for (int tx = 0; tx < side; ++tx) {
+        int &tile = level[ty * side + tx];
+        int finest = tile;
+
+        if (tx > 0) finest = std::min(finest, level[ty * side + tx - 1]);
+        if (tx + 1 < side) finest = std::min(finest, level[ty * side + tx + 1]);
+        if (ty > 0) finest = std::min(finest, level[(ty - 1) * side + tx]);
+        if (ty + 1 < side) finest = std::min(finest, level[(ty + 1) * side + tx]);
+
+        if (tile > finest + 1) {
+          tile = finest + 1;
+          changed = true;
+        }
+      }
+    }
+  }
+}
+
+///
+/// @brief Gets the sides of a tile that meet a coarser tile
+/// @param level = detail level of each tile, row by row, as left by
+///  stitchLevels()
+/// @param side = tiles along each side of the square
+/// @param tx = column of the tile
+/// @param ty = row of the tile
+/// @retval mask of SIDE_MINY, SIDE_MAXX, SIDE_MAXY and SIDE_MINX
+///
+int PTerrainLod::getSideMask(const std::vector<int> &level, int side, int tx, int ty)
+{
+  const int tile = level[ty * side + tx];
+  int mask = 0;
+
+  if (ty > 0 && level[(ty - 1) * side + tx] > tile) mask |= SIDE_MINY;
+  if (tx + 1 < side && level[ty * side + tx + 1] > tile) mask |= SIDE_MAXX;
+  if (ty + 1 < side && level[(ty + 1) * side + tx] > tile) mask |= SIDE_MAXY;
+  if (tx > 0 && level[ty * side + tx - 1] > tile) mask |= SIDE_MINX;
+
+  return mask;
+}
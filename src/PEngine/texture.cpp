@@ -7,10 +7,7 @@
 #include "exception.h"
 #include "main.h"
 #include "pengine.h"
-#include "physfs_utils.h"
-#include <SDL2/SDL_image.h>
 
-// SDL_image doesn't need init/shutdown code
 
 PSSTexture::PSSTexture(PApp &parentApp) : PSubsystem(parentApp)
 {
@@ -48,81 +45,6 @@ PTexture *PSSTexture::loadTexture(const std::string &name, bool genMipmaps, bool
 
 
 
-PImage::~PImage()
-{
-  unload ();
-}
-
-void PImage::unload ()
-{
-  delete[] data;
-  data = nullptr;
-}
-
-void PImage::load (const std::string &filename)
-{
-  data = nullptr;
-  
-  if (PUtil::isDebugLevel(DEBUGLEVEL_TEST))
-    PUtil::outLog() << "Loading image \"" << filename << "\"" << std::endl;
-
-  // PhysFS / SDL integration with SDL_rwops
-  
-  PHYSFS_file *pfile = PHYSFS_openRead(filename.c_str());
-  
-  if (pfile == nullptr) {
-    throw MakePException (filename + ", PhysFS: " + physfs_getErrorString());
-  }
-  
-  SDL_RWops *rwops = PUtil::allocPhysFSops(pfile);
-  
-  SDL_Surface *img = IMG_Load_RW(rwops, 1); // this closes file and frees rwops
-  
-  if (!img) {
-    throw MakePException (filename + ", SDL_image: " + IMG_GetError ());
-  }
-  
-  if (SDL_MUSTLOCK(img)) SDL_LockSurface(img);
-  
-  // TGA COLOUR SWITCH HACK
-  int colmap_normal[] = { 0,1,2,3 };
-  int colmap_flipped[] = { 2,1,0,3 };
-  int *colmap = colmap_normal;
-  const char *fname = filename.c_str();
-  int len = strlen(fname);
-  if (len > 4) {
-    if (!strcmp(fname+len-4,".tga")) colmap = colmap_flipped;
-  }
-  
-  cx = img->w;
-  cy = img->h;
-  cc = img->format->BytesPerPixel;
-  data = new uint8 [cx * cy * cc];
-  
-  for (int y=0; y<cy; y++) {
-    for (int x=0; x<cx; x++) {
-      for (int c=0; c<cc; c++) {
-        //data[(y*cx+x)*cc+c] = ((uint8*)img->pixels)[(cy-y-1)*img->pitch + x*cc + c];
-        data[(y*cx+x)*cc+c] = ((uint8*)img->pixels)[(cy-y-1)*img->pitch + x*cc + colmap[c]];
-      }
-    }
-  }
-  
-  if (SDL_MUSTLOCK(img)) SDL_UnlockSurface(img);
-  SDL_FreeSurface(img);
-}
-
-void PImage::load (int _cx, int _cy, int _cc)
-{
-  cx = _cx;
-  cy = _cy;
-  cc = _cc;
-  
-  data = new uint8 [cx * cy * cc];
-}
-
-
-
 void PTexture::unload()
 {
   if (texid)
@@ -0,0 +1,179 @@
+// tilebuilder.cpp [pengine]
+
+// License: GPL version 2 (see included gpl.txt)
+
+#include "pengine.h"
+#include "render.h"
+#include "tilebuilder.h"
+#include <algorithm>
+
+// more threads than this only build tiles nobody will draw
+#define TILE_BUILD_THREADS_MAX  2
+
+static bool sameTile(const vec2i &a, const vec2i &b)
+{
+  return a.x == b.x && a.y == b.y;
+}
+
+///
+/// @brief constructor, starts the worker threads
+/// @param threads = worker threads, 0 means tiles are only built on demand
+/// @param build = fills in a tile whose posx and posy are set
+///
+PTileBuilder::PTileBuilder(unsigned int threads, const std::function<void (PTerrainTileBuild &)> &build) :
+  build(build),
+  nextwaiting(0),
+  quit(false)
+{
+  for (unsigned int i=0; i<threads; ++i)
+    workers.push_back(std::thread(&PTileBuilder::workerMain, this));
+}
+
+///
+/// @brief destructor, lets the workers finish their tile and joins them
+///
+PTileBuilder::~PTileBuilder()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    quit = true;
+  }
+  wake.notify_all();
+
+  for (unsigned int i=0; i<workers.size(); ++i)
+    workers[i].join();
+}
+
+///
+/// @brief One worker for every spare core, up to a couple
+/// @details A couple of threads keep well ahead of a car at full speed;
+///  the rest of the cores are left to the simulation.
+///
+unsigned int PTileBuilder::getDefaultThreadCount()
+{
+  const unsigned int cores = std::thread::hardware_concurrency();
+
+  return std::min(cores > 1 ? cores - 1 : 0, (unsigned int)TILE_BUILD_THREADS_MAX);
+}
+
+///
+/// @brief Replaces the tiles waiting to be built
+/// @details Tiles no longer wanted are dropped unless a worker has started
+///  them already. Tiles being built or waiting to be taken are skipped, and
+///  so are repeats, which two workers would otherwise build at once.
+/// @param tiles = tiles to build, the most urgent first
+///
+void PTileBuilder::setRequests(const std::vector<vec2i> &tiles)
+{
+  if (workers.empty()) return;
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    waiting.clear();
+    nextwaiting = 0;
+
+    for (const vec2i &t : tiles) {
+      if (std::any_of(building.begin(), building.end(),
+        [&t] (const vec2i &b) { return sameTile(t, b); }))
+        continue;
+
+      if (std::any_of(built.begin(), built.end(),
+        [&t] (const std::unique_ptr<PTerrainTileBuild> &b) { return b->posx == t.x && b->posy == t.y; }))
+        continue;
+
+      if (std::any_of(waiting.begin(), waiting.end(),
+        [&t] (const vec2i &w) { return sameTile(t, w); }))
+        continue;
+
+      waiting.push_back(t);
+    }
+  }
+  wake.notify_all();
+}
+
+///
+/// @brief Takes the oldest finished tile
+/// @retval the tile, or nullptr if no tile is finished
+///
+std::unique_ptr<PTerrainTileBuild> PTileBuilder::takeBuilt()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  if (built.empty()) return nullptr;
+
+  std::unique_ptr<PTerrainTileBuild> result = std::move(built.front());
+  built.erase(built.begin());
+  return result;
+}
+
+///
+/// @brief Takes a tile, building it if needed
+/// @details Waits for the tile if a worker is on it, rather than building it
+///  twice; otherwise it is taken off the requests and built by the caller.
+/// @param tilex = tile x coordinate
+/// @param tiley = tile y coordinate
+/// @retval the finished tile
+///
+std::unique_ptr<PTerrainTileBuild> PTileBuilder::takeNow(int tilex, int tiley)
+{
+  const vec2i t(tilex, tiley);
+
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    for (;;) {
+      for (unsigned int i=0; i<built.size(); ++i) {
+        if (built[i]->posx == tilex && built[i]->posy == tiley) {
+          std::unique_ptr<PTerrainTileBuild> result = std::move(built[i]);
+          built.erase(built.begin() + i);
+          return result;
+        }
+      }
+
+      if (std::none_of(building.begin(), building.end(),
+        [&t] (const vec2i &b) { return sameTile(t, b); }))
+        break;
+
+      finished.wait(lock);
+    }
+
+    waiting.erase(std::remove_if(waiting.begin() + nextwaiting, waiting.end(),
+      [&t] (const vec2i &w) { return sameTile(t, w); }), waiting.end());
+  }
+
+  std::unique_ptr<PTerrainTileBuild> result(new PTerrainTileBuild());
+  result->posx = tilex;
+  result->posy = tiley;
+  build(*result);
+  return result;
+}
+
+void PTileBuilder::workerMain()
+{
+  std::unique_lock<std::mutex> lock(mutex);
+
+  for (;;) {
+    wake.wait(lock, [this] { return quit || nextwaiting < waiting.size(); });
+
+    if (quit) return;
+
+    const vec2i t = waiting[nextwaiting++];
+    building.push_back(t);
+
+    lock.unlock();
+
+    std::unique_ptr<PTerrainTileBuild> result(new PTerrainTileBuild());
+    result->posx = t.x;
+    result->posy = t.y;
+    build(*result);
+
+    lock.lock();
+
+    building.erase(std::find_if(building.begin(), building.end(),
+      [&t] (const vec2i &b) { return sameTile(t, b); }));
+    built.push_back(std::move(result));
+
+    finished.notify_all();
+  }
+}
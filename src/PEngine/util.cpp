@@ -8,6 +8,8 @@
 #include "pengine.h"
 #include "physfs_utils.h"
 
+int PUtil::deblev = DEBUGLEVEL_ENDUSER;
+
 ///
 /// @brief Returns the road surface based on the RGB color.
 ///
@@ -21,17 +23,45 @@ TerrainType PUtil::decideRoadSurface(const rgbcolor &c)
     return TerrainType::Unknown;
 }
 
+namespace
+{
+
 ///
-/// @brief Returns the road surface friction coefficient.
+/// @brief Friction and resistance of each terrain type, indexed by TerrainType.
+/// @details These are asked for by every wheel in every simulation step.
 ///
-float PUtil::decideFrictionCoef(TerrainType tt)
+struct SurfaceTables
 {
+#define X(Name, RgbColor, Friction, Resistance, DirtInfo) + 1
+    static const int count = 1 TERRAINMAP_MATERIALS; // Unknown + materials
+#undef X
+
+    float friction[count];
+    float resistance[count];
+
+    SurfaceTables()
+    {
+        friction[static_cast<int> (TerrainType::Unknown)] = 1.00f;
+        resistance[static_cast<int> (TerrainType::Unknown)] = 0.00f;
+
 #define X(Name, RgbColor, Friction, Resistance, DirtInfo) \
-    if (tt == TerrainType::Name) return Friction;
-    TERRAINMAP_MATERIALS
+        friction[static_cast<int> (TerrainType::Name)] = Friction; \
+        resistance[static_cast<int> (TerrainType::Name)] = Resistance;
+        TERRAINMAP_MATERIALS
 #undef X
+    }
+};
+
+const SurfaceTables surfacetables;
 
-    return 1.00f; // tt == TerrainType::Unknown
+}
+
+///
+/// @brief Returns the road surface friction coefficient.
+///
+float PUtil::decideFrictionCoef(TerrainType tt)
+{
+    return surfacetables.friction[static_cast<int> (tt)];
 }
 
 ///
@@ -39,12 +69,7 @@ float PUtil::decideFrictionCoef(TerrainType tt)
 ///
 float PUtil::decideResistance(TerrainType tt)
 {
-#define X(Name, RgbColor, Friction, Resistance, DirtInfo) \
-    if (tt == TerrainType::Name) return Resistance;
-    TERRAINMAP_MATERIALS
-#undef X
-
-    return 0.00f; // tt == TerrainType::Unknown
+    return surfacetables.resistance[static_cast<int> (tt)];
 }
 
 ///
@@ -60,26 +60,15 @@ template frustum<double> &frustum<double>::construct(const mat44<double> &mat);
 template <class T>
 bool frustum<T>::isAABBOutside(const vec3<T> &mins, const vec3<T> &maxs) const
 {
-    vec3<T> pts[8] = {
-        vec3<T>(mins.x, mins.y, mins.z),
-        vec3<T>(maxs.x, mins.y, mins.z),
-        vec3<T>(mins.x, maxs.y, mins.z),
-        vec3<T>(maxs.x, maxs.y, mins.z),
-        vec3<T>(mins.x, mins.y, maxs.z),
-        vec3<T>(maxs.x, mins.y, maxs.z),
-        vec3<T>(mins.x, maxs.y, maxs.z),
-        vec3<T>(maxs.x, maxs.y, maxs.z)
-    };
-    for (int s = 0; s < 1; ++s) {
-        bool outside = true;
-        for (int p = 0; p < 8; ++p) {
-            //if (side[s].normal * pts[p] + side[s].offset >= 0.0) {
-            if (side[s].normal * pts[p] >= 0.0) {
-                outside = false;
-                break;
-            }
-        }
-        if (outside) return true;
+    for (int s = 0; s < SideCount; ++s) {
+        // the corner furthest in, if it is out the whole box is
+        const vec3<T> &n = side[s].normal;
+        const vec3<T> corner(
+            n.x >= 0.0 ? maxs.x : mins.x,
+            n.y >= 0.0 ? maxs.y : mins.y,
+            n.z >= 0.0 ? maxs.z : mins.z);
+
+        if (n * corner + side[s].offset < 0.0) return true;
     }
 
     return false;
@@ -0,0 +1,54 @@
+
+// alloccount.cpp [psim]
+
+// License: GPL version 2 (see included gpl.txt)
+
+//
+// Replaces the global operator new and delete to count heap allocations,
+// in builds defining PSIM_COUNT_ALLOCATIONS only. They live in their own
+// file so that they are never inlined into their callers.
+//
+
+#ifdef PSIM_COUNT_ALLOCATIONS
+
+#include "alloccount.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+static std::atomic<unsigned long> allocations(0);
+
+///
+/// @brief Global operator new, counting the allocations
+///
+void *operator new(std::size_t size)
+{
+  allocations.fetch_add(1, std::memory_order_relaxed);
+
+  if (size == 0) size = 1;
+
+  for (;;) {
+    void *ptr = malloc(size);
+    if (ptr) return ptr;
+
+    std::new_handler handler = std::get_new_handler();
+    if (!handler) throw std::bad_alloc();
+    handler();
+  }
+}
+
+void operator delete(void *ptr) noexcept
+{
+  free(ptr);
+}
+
+///
+/// @brief Heap allocations made so far, by any thread
+///
+unsigned long getAllocationCount()
+{
+  return allocations.load(std::memory_order_relaxed);
+}
+
+#endif // PSIM_COUNT_ALLOCATIONS
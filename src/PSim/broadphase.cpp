@@ -0,0 +1,89 @@
+
+// broadphase.cpp [psim]
+
+// License: GPL version 2 (see included gpl.txt)
+
+#include "broadphase.h"
+#include <algorithm>
+
+///
+/// @brief Change the number of boxes
+/// @details Boxes that remain keep their place in the sorted order; new ones
+///  go at the end and get sorted in by the next findPairs().
+/// @param count = new number of boxes
+///
+void PBroadphase::resize(unsigned int count)
+{
+  const unsigned int oldcount = boxmin.size();
+
+  if (count == oldcount) return;
+
+  boxmin.resize(count, vec3f::zero());
+  boxmax.resize(count, vec3f::zero());
+
+  if (count < oldcount) {
+    order.erase(std::remove_if(order.begin(), order.end(),
+      [count] (unsigned int i) { return i >= count; }), order.end());
+  } else {
+    for (unsigned int i=oldcount; i<count; ++i)
+      order.push_back(i);
+  }
+}
+
+///
+/// @brief Drop all the boxes
+///
+void PBroadphase::clear()
+{
+  boxmin.clear();
+  boxmax.clear();
+  order.clear();
+  pair.clear();
+}
+
+///
+/// @brief Find the pairs of boxes that overlap
+/// @retval the pairs, sorted by first then second index
+///
+const std::vector<PBroadphase::Pair> &PBroadphase::findPairs()
+{
+  // insertion sort, the order of the last call is nearly right
+  for (unsigned int i=1; i<order.size(); ++i) {
+    const unsigned int moving = order[i];
+    const float x = boxmin[moving].x;
+
+    unsigned int j = i;
+
+    for (; j > 0 && boxmin[order[j - 1]].x > x; --j)
+      order[j] = order[j - 1];
+
+    order[j] = moving;
+  }
+
+  pair.clear();
+
+  for (unsigned int i=0; i<order.size(); ++i) {
+    const unsigned int a = order[i];
+
+    // the following boxes start further along x, stop at the first one
+    // starting past the end of this one
+    for (unsigned int j=i+1; j<order.size() && boxmin[order[j]].x <= boxmax[a].x; ++j) {
+      const unsigned int b = order[j];
+
+      if (boxmin[a].y > boxmax[b].y || boxmin[b].y > boxmax[a].y ||
+        boxmin[a].z > boxmax[b].z || boxmin[b].z > boxmax[a].z)
+        continue;
+
+      Pair p;
+      p.a = std::min(a, b);
+      p.b = std::max(a, b);
+      pair.push_back(p);
+    }
+  }
+
+  std::sort(pair.begin(), pair.end(), [] (const Pair &p, const Pair &q) {
+    return p.a < q.a || (p.a == q.a && p.b < q.b);
+  });
+
+  return pair;
+}
@@ -17,7 +17,7 @@
 //
 
 #include "collision.h"
-#include "render.h"
+#include "terraindata.h"
 #include <limits>
 
 ///
@@ -55,26 +55,13 @@ PCollision::PCollision(const std::vector<vehicle_clip_s> &clip, PReferenceFrame
 }
 
 ///
-/// @brief Returns objects inside AABB box
-/// @param foliage = vector of world objects
-/// @retval vector of inside objects
+/// @brief Finds the world objects inside AABB box
+/// @param terrain = terrain holding the objects
+/// @param contact = filled with the objects inside, reused between calls
 ///
-const std::vector<PTerrainFoliage> PCollision::checkContact(const std::vector<PTerrainFoliage> *foliage) const
+void PCollision::checkContact(PTerrainData &terrain, PTerrainObjectQuery &contact) const
 {
-  std::vector<PTerrainFoliage> contact;
-
-  for (std::vector<PTerrainFoliage>::const_iterator iter = foliage->begin(); iter != foliage->end(); ++iter) {
-    const vec3f &foliagemin = iter->pos;
-    vec3f foliagemax = iter->pos;
-
-    foliagemax.z += iter->scale;
-    if (foliagemin.x <= boxmax.x && foliagemax.x >= boxmin.x &&
-        foliagemin.y <= boxmax.y && foliagemax.y >= boxmin.y &&
-        foliagemin.z <= boxmax.z && foliagemax.z >= boxmin.z) {
-      contact.push_back(*iter);
-    }
-  }
-  return contact;
+  terrain.findObjects(boxmin, boxmax, contact);
 }
 
 ///
@@ -67,10 +67,11 @@ float PEngine::getHorsePower()
 
 ///
 /// @brief Get the engine power output at a rps
+/// @details Walks the curve, see getTorqueAtRPS() for the fast lookup.
 /// @param rps = radians per second
 /// @retval output power
 ///
-float PEngine::getPowerAtRPS(float rps)
+float PEngine::getPowerAtRPS(float rps) const
 {
 	unsigned int p;
 	float power;
@@ -94,6 +95,44 @@ float PEngine::getPowerAtRPS(float rps)
 	return power;
 }
 
+///
+/// @brief Bakes the power curve and the gearbox into lookup tables
+/// @details The engine always runs between minRPS and maxRPS, so that range
+///  is all the torque table covers. Call again after changing curve or gears.
+///
+void PEngine::buildTables()
+{
+	torque.assign(ENGINE_TORQUE_STEPS + 1, 0.0f);
+	torque_scale = 0.0f;
+
+	if (!powercurve.empty()) {
+		// a single point curve has no range, every rps is minRPS then
+		const float range = MAX(maxRPS - minRPS, 0.0f);
+
+		if (range > 0.0f)
+			torque_scale = (float)ENGINE_TORQUE_STEPS / range;
+
+		for (int i = 0; i <= ENGINE_TORQUE_STEPS; ++i) {
+			float rps = minRPS + range * ((float)i / (float)ENGINE_TORQUE_STEPS);
+			CLAMP(rps, minRPS, maxRPS);
+
+			torque[i] = getPowerAtRPS(rps) / rps;
+		}
+	}
+
+	const unsigned int gears = gear.size();
+
+	gear_inv.resize(gears);
+	gear_up.resize(gears);
+	gear_down.resize(gears);
+
+	for (unsigned int g = 0; g < gears; ++g) {
+		gear_inv[g] = 1.0f / gear[g];
+		gear_up[g] = (g + 1 < gears) ? gear[g] / gear[g + 1] : 1.0f;
+		gear_down[g] = (g > 0) ? gear[g] / gear[g - 1] : 1.0f;
+	}
+}
+
 ///
 /// @brief engine simulation tick. Decide if change gear, compute output torque
 /// @param delta = timeslice to compute
@@ -104,7 +143,7 @@ void PEngineInstance::tick(float delta, float throttle, float wheel_rps)
 {
 	// convert the rps of the wheel to the actual engine rps
 	// multiplying it for the inverse of the current gear ratio
-	rps = wheel_rps / engine->gear[currentgear];
+	rps = wheel_rps * engine->gear_inv[currentgear];
 
 	bool wasreverse = reverse;
 
@@ -132,43 +171,31 @@ void PEngineInstance::tick(float delta, float throttle, float wheel_rps)
 		currentgear = 0;
 
 	// final output engine torque
-	out_torque = engine->getPowerAtRPS(rps) / (engine->gear[currentgear] * rps);
+	out_torque = engine->getTorqueAtRPS(rps) * engine->gear_inv[currentgear];
 
 	// Change gear only if it's not reversed
 	if (!reverse)
 	{
-		// store if we should change gear (0 no, 1 go up, -1 go down)
-		int newtarget_rel = 0;
-
-		// if it's not last gear (we can go up)
-		if (currentgear < (int)engine->gear.size()-1)
-		{
-			// nextrate = rps if the gear was the next one
-			float nextrate = rps * engine->gear[currentgear] / engine->gear[currentgear+1];
-			// nextrate has to be in the rps range
-			CLAMP(nextrate, engine->minRPS, engine->maxRPS);
-			// final output engine torque if the gear was the next one
-			float nexttorque = engine->getPowerAtRPS(nextrate) / (engine->gear[currentgear+1] * nextrate);
-			// if going up we gain torque
-			if (nexttorque > out_torque)
-				// do it
-				newtarget_rel = 1;
-		}
-
-		// if the gear is not reverse and we haven't yet decided to go up
-		if (currentgear > 0 && newtarget_rel == 0)
-		{
-			// nextrate = rps if the gear was the previous one
-			float nextrate = rps * engine->gear[currentgear] / engine->gear[currentgear-1];
-			// nextrate has to be in the rps range
-			CLAMP(nextrate, engine->minRPS, engine->maxRPS);
-			// final output engine torque if the gear was the previous one
-			float nexttorque = engine->getPowerAtRPS(nextrate) / (engine->gear[currentgear-1] * nextrate);
-			// if going down we gain gear
-			if (nexttorque > out_torque)
-				// do it
-				newtarget_rel = -1;
-		}
+		// gears above and below; at either end of the gearbox the rps ratio is
+		// 1, so the missing gear gets exactly out_torque and never wins
+		const int upgear = MIN(currentgear + 1, (int)engine->gear.size() - 1);
+		const int downgear = MAX(currentgear - 1, 0);
+
+		// rps and final output engine torque if the gear was the next one
+		float uprate = rps * engine->gear_up[currentgear];
+		CLAMP(uprate, engine->minRPS, engine->maxRPS);
+		const float uptorque = engine->getTorqueAtRPS(uprate) * engine->gear_inv[upgear];
+
+		// the same if the gear was the previous one
+		float downrate = rps * engine->gear_down[currentgear];
+		CLAMP(downrate, engine->minRPS, engine->maxRPS);
+		const float downtorque = engine->getTorqueAtRPS(downrate) * engine->gear_inv[downgear];
+
+		// store if we should change gear (0 no, 1 go up, -1 go down):
+		// up if it gains torque, otherwise down if that gains torque
+		const int newtarget_rel =
+			(uptorque > out_torque) ? 1 :
+			(downtorque > out_torque) ? -1 : 0;
 
 		// if we are going to change gear and targetgear_rel is updated
 		if (newtarget_rel != 0 && newtarget_rel == targetgear_rel)
@@ -176,11 +203,8 @@ void PEngineInstance::tick(float delta, float throttle, float wheel_rps)
 			// if has passed enought time
 			if ((gearch -= delta) <= 0.0f)
 			{
-				// the rps with the new gear
-				float nextrate = rps * engine->gear[currentgear] / engine->gear[currentgear + targetgear_rel];
-				CLAMP(nextrate, engine->minRPS, engine->maxRPS);
 				// final output torque with the new gear
-				out_torque = engine->getPowerAtRPS(nextrate) / (engine->gear[currentgear + targetgear_rel] * nextrate);
+				out_torque = (targetgear_rel > 0) ? uptorque : downtorque;
 				// change gear
 				currentgear += targetgear_rel;
 				// set gearch
@@ -0,0 +1,645 @@
+
+// replay.cpp [psim]
+
+// License: GPL version 2 (see included gpl.txt)
+
+//
+// Recording and playback of the inputs of a race
+//
+// File format, all numbers little endian:
+//
+//   "TRRP", uint32 version
+//   level, vehicle: uint32 length then the characters
+//   uint32 seed, start step, end step, number of events
+//   the events, each one:
+//     varint steps since the previous event (the first one: since the start)
+//     varint vehicle
+//     uint16 flags: REPLAY_FLAG_RESET, or else one bit per control value
+//       that changed since the previous event of the same vehicle
+//     reset: position and orientation (x, y, z, w), as floats
+//     otherwise: the control values that changed, as floats
+//
+// Varints take 7 bits per byte, low bits first, the high bit set on all
+// the bytes but the last one.
+//
+
+#include "replay.h"
+#include <algorithm>
+#include <cstring>
+#include <physfs.h>
+#include "physfs_utils.h"
+
+#define REPLAY_MAGIC        "TRRP"
+#define REPLAY_VERSION      1
+
+#define REPLAY_FLAG_RESET   0x8000
+
+// no race has this many cars, a higher vehicle index means a broken file
+#define REPLAY_MAX_VEHICLES 64
+
+// throttle, brake1, brake2, turn (3), aim (2), collective
+#define REPLAY_CONTROL_FIELDS 9
+
+///
+/// @brief Lists the values of controls in file order
+/// @param ctrl = the controls
+/// @param field = where to copy their values
+///
+static void getControlFields(const v_control_s &ctrl, float field[REPLAY_CONTROL_FIELDS])
+{
+  field[0] = ctrl.throttle;
+  field[1] = ctrl.brake1;
+  field[2] = ctrl.brake2;
+  field[3] = ctrl.turn.x;
+  field[4] = ctrl.turn.y;
+  field[5] = ctrl.turn.z;
+  field[6] = ctrl.aim.x;
+  field[7] = ctrl.aim.y;
+  field[8] = ctrl.collective;
+}
+
+///
+/// @brief Sets controls from values in file order
+/// @param ctrl = the controls
+/// @param field = their new values
+///
+static void setControlFields(v_control_s &ctrl, const float field[REPLAY_CONTROL_FIELDS])
+{
+  ctrl.throttle = field[0];
+  ctrl.brake1 = field[1];
+  ctrl.brake2 = field[2];
+  ctrl.turn = vec3f(field[3], field[4], field[5]);
+  ctrl.aim = vec2f(field[6], field[7]);
+  ctrl.collective = field[8];
+}
+
+static void putU16(std::vector<uint8> &data, uint32 value)
+{
+  data.push_back(value & 0xff);
+  data.push_back((value >> 8) & 0xff);
+}
+
+static void putU32(std::vector<uint8> &data, uint32 value)
+{
+  putU16(data, value & 0xffff);
+  putU16(data, value >> 16);
+}
+
+static void putVarint(std::vector<uint8> &data, uint32 value)
+{
+  while (value >= 0x80) {
+    data.push_back((value & 0x7f) | 0x80);
+    value >>= 7;
+  }
+
+  data.push_back(value);
+}
+
+// floats are stored bit for bit, a replay must feed the same values back
+static void putFloat(std::vector<uint8> &data, float value)
+{
+  uint32 bits;
+  memcpy(&bits, &value, sizeof(bits));
+  putU32(data, bits);
+}
+
+static void putString(std::vector<uint8> &data, const std::string &value)
+{
+  putU32(data, value.size());
+  data.insert(data.end(), value.begin(), value.end());
+}
+
+///
+/// @brief Reads the file format back, failing on data that runs short
+///
+class PReplayReader {
+public:
+  explicit PReplayReader(const std::vector<uint8> &data) : data(data), pos(0) { }
+
+  bool getU16(uint32 &value) {
+    if (data.size() - pos < 2) return false;
+    value = data[pos] | (data[pos + 1] << 8);
+    pos += 2;
+    return true;
+  }
+
+  bool getU32(uint32 &value) {
+    uint32 low, high;
+    if (!getU16(low) || !getU16(high)) return false;
+    value = low | (high << 16);
+    return true;
+  }
+
+  bool getVarint(uint32 &value) {
+    value = 0;
+
+    for (unsigned int shift = 0; shift < 32; shift += 7) {
+      if (pos >= data.size()) return false;
+
+      const uint8 byte = data[pos++];
+      value |= (uint32)(byte & 0x7f) << shift;
+
+      if (!(byte & 0x80)) return true;
+    }
+
+    return false;
+  }
+
+  bool getFloat(float &value) {
+    uint32 bits;
+    if (!getU32(bits)) return false;
+    memcpy(&value, &bits, sizeof(value));
+    return true;
+  }
+
+  bool getString(std::string &value) {
+    uint32 length;
+    if (!getU32(length) || data.size() - pos < length) return false;
+    value.assign(data.begin() + pos, data.begin() + pos + length);
+    pos += length;
+    return true;
+  }
+
+  bool getMagic(const char *magic) {
+    const std::size_t length = strlen(magic);
+    if (data.size() - pos < length || memcmp(&data[pos], magic, length)) return false;
+    pos += length;
+    return true;
+  }
+
+private:
+  const std::vector<uint8> &data;
+  std::size_t pos;
+};
+
+///
+/// @brief Constructs an empty replay
+/// @param keyframetime = seconds of simulation between two keyframes
+///
+PReplay::PReplay(float keyframetime) :
+  keyframesteps(std::max(lround(keyframetime / PSim::timeslice), 1L)),
+  seed(0),
+  startstep(0),
+  endstep(0),
+  nextevent(0)
+{
+}
+
+///
+/// @brief Start recording
+/// @details The first recordInputs() stores the controls of every vehicle,
+///  whatever they were before.
+/// @param sim = the simulation to record, set up and seeded
+/// @param seed = the seed the simulation was given, for playback
+/// @param level = the level it runs, for playback
+/// @param vehicle = the vehicle of the player, for playback
+///
+void PReplay::recordStart(const PSim &sim, uint32 seed, const std::string &level, const std::string &vehicle)
+{
+  this->seed = seed;
+  startstep = endstep = sim.getStepCount();
+  levelname = level;
+  vehiclename = vehicle;
+
+  event.clear();
+  keyframe.clear();
+  nextevent = 0;
+
+  syncVehicles(sim);
+}
+
+///
+/// @brief Record the controls that changed and the resets since the last call
+/// @details Called before every tick, so that the events of a step are those
+///  made before running it. Called again before any step ran, it updates
+///  the events of the step. Takes a keyframe every keyframesteps steps.
+/// @param sim = the simulation being recorded
+///
+void PReplay::recordInputs(const PSim &sim)
+{
+  const uint32 now = sim.getStepCount();
+  bool changed = false;
+
+  if (lastctrl.size() < sim.getVehicleCount())
+    syncVehicles(sim);
+
+  for (unsigned int i=0; i<sim.getVehicleCount(); ++i) {
+    const PVehicle *vehicle = sim.getVehicle(i);
+
+    if (vehicle->resetcount != lastresetcount[i]) {
+      Event e;
+      e.step = now;
+      e.vehicle = i;
+      e.reset = true;
+      e.ctrl.setZero();
+      e.pos = vehicle->reset_pos;
+      e.ori = vehicle->reset_ori;
+      event.push_back(e);
+
+      lastresetcount[i] = vehicle->resetcount;
+      changed = true;
+    }
+
+    if (lastctrlevent[i] >= 0 && vehicle->ctrl == lastctrl[i])
+      continue;
+
+    if (lastctrlevent[i] >= 0 && event[lastctrlevent[i]].step == now) {
+      event[lastctrlevent[i]].ctrl = vehicle->ctrl;
+    } else {
+      Event e;
+      e.step = now;
+      e.vehicle = i;
+      e.reset = false;
+      e.ctrl = vehicle->ctrl;
+      e.pos = vec3f::zero();
+      e.ori = quatf::identity();
+      event.push_back(e);
+
+      lastctrlevent[i] = event.size() - 1;
+    }
+
+    lastctrl[i] = vehicle->ctrl;
+    changed = true;
+  }
+
+  if (keyframe.empty() || now >= keyframe.back().stepcount + keyframesteps)
+    saveKeyframe(sim);
+  else if (changed && keyframe.back().stepcount == now)
+    sim.saveSnapshot(keyframe.back());
+
+  endstep = now;
+}
+
+///
+/// @brief Forget the events and keyframes past the current step
+/// @param sim = the simulation being recorded, just restored to an earlier step
+///
+void PReplay::recordRewind(const PSim &sim)
+{
+  const uint32 now = sim.getStepCount();
+
+  event.erase(std::lower_bound(event.begin(), event.end(), now,
+    [] (const Event &e, uint32 step) { return e.step < step; }), event.end());
+
+  while (!keyframe.empty() && keyframe.back().stepcount >= now)
+    keyframe.pop_back();
+
+  startstep = std::min(startstep, now);
+  endstep = now;
+
+  syncVehicles(sim);
+}
+
+///
+/// @brief Stop recording at the current step
+/// @param sim = the simulation being recorded
+///
+void PReplay::recordStop(const PSim &sim)
+{
+  endstep = sim.getStepCount();
+}
+
+///
+/// @brief Get ready to play the recording from its start
+/// @details Once played, or right after recording, the first keyframe is
+///  restored. Otherwise the simulation must be as it was when the recording
+///  started: same level, same vehicles in the same order, same seed.
+/// @param sim = the simulation to play into
+/// @retval false if the simulation doesn't match the recording
+///
+bool PReplay::playStart(PSim &sim)
+{
+  if (!keyframe.empty())
+    return seek(sim, startstep);
+
+  if (sim.getStepCount() != startstep)
+    return false;
+
+  for (const Event &e: event) {
+    if (e.vehicle >= sim.getVehicleCount())
+      return false;
+  }
+
+  nextevent = 0;
+  applyEvents(sim);
+  saveKeyframe(sim);
+  return true;
+}
+
+///
+/// @brief Bring the simulation to a step of the recording
+/// @details Going back, or forward past a keyframe, restores the last
+///  keyframe before the step; the steps left are simulated again. Keyframes
+///  not taken yet are taken on the way.
+/// @param sim = the simulation, started with playStart()
+/// @param step = where to go, clamped to the recording
+/// @retval false if there was nothing to restore
+///
+bool PReplay::seek(PSim &sim, uint32 step)
+{
+  if (keyframe.empty())
+    return false;
+
+  step = std::max(std::min(step, endstep), startstep);
+
+  uint32 now = sim.getStepCount();
+
+  std::vector<PSimSnapshot>::const_iterator k = std::upper_bound(keyframe.begin(), keyframe.end(), step,
+    [] (uint32 s, const PSimSnapshot &snapshot) { return s < snapshot.stepcount; });
+
+  if (k == keyframe.begin())
+    return false;
+
+  --k;
+
+  if (step < now || k->stepcount > now) {
+    if (!sim.restoreSnapshot(*k))
+      return false;
+
+    now = k->stepcount;
+
+    // the keyframe holds the events of its own step
+    nextevent = std::upper_bound(event.begin(), event.end(), now,
+      [] (uint32 s, const Event &e) { return s < e.step; }) - event.begin();
+  }
+
+  while (now < step) {
+    uint32 next = step;
+
+    if (nextevent < event.size())
+      next = std::min(next, event[nextevent].step);
+
+    if (now >= keyframe.back().stepcount)
+      next = std::min(next, keyframe.back().stepcount + keyframesteps);
+
+    sim.tickSteps(next - now);
+    now = next;
+
+    applyEvents(sim);
+
+    if (now >= keyframe.back().stepcount + keyframesteps)
+      saveKeyframe(sim);
+  }
+
+  return true;
+}
+
+///
+/// @brief Apply the events up to the current step of the simulation
+/// @param sim = the simulation being played
+///
+void PReplay::applyEvents(PSim &sim)
+{
+  const uint32 now = sim.getStepCount();
+
+  for (; nextevent < event.size() && event[nextevent].step <= now; ++nextevent) {
+    const Event &e = event[nextevent];
+
+    if (e.vehicle >= sim.getVehicleCount())
+      continue;
+
+    PVehicle *vehicle = sim.getVehicle(e.vehicle);
+
+    // the same reset again, it gives the same result from the same state
+    if (e.reset)
+      vehicle->doReset(e.pos, e.ori);
+    else
+      vehicle->ctrl = e.ctrl;
+  }
+}
+
+///
+/// @brief Take a keyframe of the current step
+/// @param sim = the simulation
+///
+void PReplay::saveKeyframe(const PSim &sim)
+{
+  keyframe.emplace_back();
+  sim.saveSnapshot(keyframe.back());
+}
+
+///
+/// @brief Start tracking the vehicles as they are now
+/// @param sim = the simulation being recorded
+///
+void PReplay::syncVehicles(const PSim &sim)
+{
+  const unsigned int count = sim.getVehicleCount();
+
+  lastctrl.resize(count);
+  lastresetcount.resize(count);
+  lastctrlevent.assign(count, -1);
+
+  for (unsigned int i=0; i<count; ++i)
+    lastresetcount[i] = sim.getVehicle(i)->resetcount;
+}
+
+///
+/// @brief Encode the recording in the replay file format
+/// @param data = where to write it, the previous contents are replaced
+///
+void PReplay::write(std::vector<uint8> &data) const
+{
+  data.clear();
+
+  for (const char *m = REPLAY_MAGIC; *m != '\0'; ++m)
+    data.push_back(*m);
+
+  putU32(data, REPLAY_VERSION);
+  putString(data, levelname);
+  putString(data, vehiclename);
+  putU32(data, seed);
+  putU32(data, startstep);
+  putU32(data, endstep);
+  putU32(data, event.size());
+
+  // control values last written per vehicle
+  std::vector<v_control_s> prevctrl;
+  uint32 prevstep = startstep;
+
+  for (const Event &e: event) {
+    putVarint(data, e.step - prevstep);
+    putVarint(data, e.vehicle);
+    prevstep = e.step;
+
+    if (e.reset) {
+      putU16(data, REPLAY_FLAG_RESET);
+      putFloat(data, e.pos.x);
+      putFloat(data, e.pos.y);
+      putFloat(data, e.pos.z);
+      putFloat(data, e.ori.x);
+      putFloat(data, e.ori.y);
+      putFloat(data, e.ori.z);
+      putFloat(data, e.ori.w);
+      continue;
+    }
+
+    if (prevctrl.size() <= e.vehicle) {
+      v_control_s zero;
+      zero.setZero();
+      prevctrl.resize(e.vehicle + 1, zero);
+    }
+
+    float prevfield[REPLAY_CONTROL_FIELDS];
+    float field[REPLAY_CONTROL_FIELDS];
+    uint32 flags = 0;
+
+    getControlFields(prevctrl[e.vehicle], prevfield);
+    getControlFields(e.ctrl, field);
+
+    // compared bit for bit, so that -0 and 0 stay apart
+    for (unsigned int i=0; i<REPLAY_CONTROL_FIELDS; ++i) {
+      if (memcmp(&field[i], &prevfield[i], sizeof(float)))
+        flags |= 1 << i;
+    }
+
+    putU16(data, flags);
+
+    for (unsigned int i=0; i<REPLAY_CONTROL_FIELDS; ++i) {
+      if (flags & (1 << i))
+        putFloat(data, field[i]);
+    }
+
+    prevctrl[e.vehicle] = e.ctrl;
+  }
+}
+
+///
+/// @brief Decode a recording in the replay file format
+/// @details Replaces the current recording; keyframes are dropped, playStart()
+///  takes them again.
+/// @param data = the encoded recording
+/// @retval false if the data isn't a replay, is cut short or names a vehicle
+///  index no race has, nothing is changed
+///
+bool PReplay::read(const std::vector<uint8> &data)
+{
+  PReplayReader reader(data);
+
+  uint32 version, newseed, newstart, newend, count;
+  std::string newlevel, newvehicle;
+
+  if (!reader.getMagic(REPLAY_MAGIC) ||
+    !reader.getU32(version) || version != REPLAY_VERSION ||
+    !reader.getString(newlevel) ||
+    !reader.getString(newvehicle) ||
+    !reader.getU32(newseed) ||
+    !reader.getU32(newstart) ||
+    !reader.getU32(newend) ||
+    !reader.getU32(count))
+    return false;
+
+  std::vector<Event> newevent;
+  std::vector<v_control_s> prevctrl;
+  uint32 step = newstart;
+
+  for (uint32 n=0; n<count; ++n) {
+    uint32 delta, flags;
+    Event e;
+
+    if (!reader.getVarint(delta) || !reader.getVarint(e.vehicle) || !reader.getU16(flags))
+      return false;
+
+    if (e.vehicle >= REPLAY_MAX_VEHICLES)
+      return false;
+
+    step += delta;
+    e.step = step;
+    e.reset = (flags & REPLAY_FLAG_RESET) != 0;
+    e.ctrl.setZero();
+    e.pos = vec3f::zero();
+    e.ori = quatf::identity();
+
+    if (e.reset) {
+      if (!reader.getFloat(e.pos.x) || !reader.getFloat(e.pos.y) || !reader.getFloat(e.pos.z) ||
+        !reader.getFloat(e.ori.x) || !reader.getFloat(e.ori.y) || !reader.getFloat(e.ori.z) ||
+        !reader.getFloat(e.ori.w))
+        return false;
+    } else {
+      if (prevctrl.size() <= e.vehicle) {
+        v_control_s zero;
+        zero.setZero();
+        prevctrl.resize(e.vehicle + 1, zero);
+      }
+
+      float field[REPLAY_CONTROL_FIELDS];
+      getControlFields(prevctrl[e.vehicle], field);
+
+      for (unsigned int i=0; i<REPLAY_CONTROL_FIELDS; ++i) {
+        if ((flags & (1 << i)) && !reader.getFloat(field[i]))
+          return false;
+      }
+
+      setControlFields(e.ctrl, field);
+      prevctrl[e.vehicle] = e.ctrl;
+    }
+
+    newevent.push_back(e);
+  }
+
+  seed = newseed;
+  startstep = newstart;
+  endstep = std::max(newend, step);
+  levelname = newlevel;
+  vehiclename = newvehicle;
+  event.swap(newevent);
+
+  keyframe.clear();
+  lastctrl.clear();
+  lastresetcount.clear();
+  lastctrlevent.clear();
+  nextevent = 0;
+  return true;
+}
+
+///
+/// @brief Save the recording to a file
+/// @param filename = PhysFS path, in the write directory
+/// @retval true on success
+///
+bool PReplay::save(const std::string &filename) const
+{
+  std::vector<uint8> data;
+  write(data);
+
+  PHYSFS_File *pfile = PHYSFS_openWrite(filename.c_str());
+
+  if (pfile == nullptr) {
+    PUtil::outLog() << "Failed to save replay \"" << filename << "\"" << std::endl
+      << "PhysFS: " << physfs_getErrorString() << std::endl;
+    return false;
+  }
+
+  const bool written = physfs_write(pfile, data.data(), sizeof(uint8), data.size()) == (PHYSFS_sint64)data.size();
+
+  PHYSFS_close(pfile);
+  return written;
+}
+
+///
+/// @brief Load a recording from a file
+/// @param filename = PhysFS path
+/// @retval true on success
+///
+bool PReplay::load(const std::string &filename)
+{
+  PHYSFS_File *pfile = PHYSFS_openRead(filename.c_str());
+
+  if (pfile == nullptr) {
+    PUtil::outLog() << "Failed to load replay \"" << filename << "\"" << std::endl
+      << "PhysFS: " << physfs_getErrorString() << std::endl;
+    return false;
+  }
+
+  std::vector<uint8> data(PHYSFS_fileLength(pfile));
+  const bool complete = physfs_read(pfile, data.data(), sizeof(uint8), data.size()) == (PHYSFS_sint64)data.size();
+
+  PHYSFS_close(pfile);
+
+  if (!complete || !read(data)) {
+    PUtil::outLog() << "Invalid replay file \"" << filename << "\"" << std::endl;
+    return false;
+  }
+
+  return true;
+}
@@ -10,21 +10,156 @@
 //
 
 #include "psim.h"
+#include <algorithm>
+
+// Uncomment this to prevent rigid body velocity and angular velocity go too high (see PRigidBodyStore::integrateVelocities() )
+//#define CLAMPVEL
+
+///
+/// @brief Add a body at rest with unit mass
+/// @retval index of the new body
+///
+unsigned int PRigidBodyStore::add()
+{
+  ref.push_back(PReferenceFrame());
+  ref_prev.push_back(PReferenceFrame());
+
+  mass_inv.push_back(1.0f);
+  angmass_inv_x.push_back(1.0f);
+  angmass_inv_y.push_back(1.0f);
+  angmass_inv_z.push_back(1.0f);
+
+  linvel_x.push_back(0.0f);
+  linvel_y.push_back(0.0f);
+  linvel_z.push_back(0.0f);
+  angvel_x.push_back(0.0f);
+  angvel_y.push_back(0.0f);
+  angvel_z.push_back(0.0f);
+
+  force_x.push_back(0.0f);
+  force_y.push_back(0.0f);
+  force_z.push_back(0.0f);
+  torque_x.push_back(0.0f);
+  torque_y.push_back(0.0f);
+  torque_z.push_back(0.0f);
+
+  awake.push_back(1.0f);
+
+  return count++;
+}
+
+///
+/// @brief Drop all the bodies, the PRigidBody objects must go first
+///
+void PRigidBodyStore::clear()
+{
+  ref.clear();
+  ref_prev.clear();
+
+  mass_inv.clear();
+  angmass_inv_x.clear();
+  angmass_inv_y.clear();
+  angmass_inv_z.clear();
+
+  linvel_x.clear();
+  linvel_y.clear();
+  linvel_z.clear();
+  angvel_x.clear();
+  angvel_y.clear();
+  angvel_z.clear();
+
+  force_x.clear();
+  force_y.clear();
+  force_z.clear();
+  torque_x.clear();
+  torque_y.clear();
+  torque_z.clear();
+
+  awake.clear();
+
+  count = 0;
+}
+
+///
+/// @brief Apply the forces and torques accumulated by all bodies to their velocities
+/// @details One loop per vector component, with no dependency between bodies,
+///  so each one compiles to packed SIMD code. Sleeping bodies get no change.
+/// @param gravity = the gravity vector
+/// @param delta = the time slice to compute
+///
+void PRigidBodyStore::integrateVelocities(const vec3f &gravity, float delta)
+{
+  // update the linear velocity of the bodies
+  for (unsigned int i=0; i<count; ++i)
+    linvel_x[i] += (force_x[i] * mass_inv[i] + gravity.x) * (delta * awake[i]);
+  for (unsigned int i=0; i<count; ++i)
+    linvel_y[i] += (force_y[i] * mass_inv[i] + gravity.y) * (delta * awake[i]);
+  for (unsigned int i=0; i<count; ++i)
+    linvel_z[i] += (force_z[i] * mass_inv[i] + gravity.z) * (delta * awake[i]);
+
+  // update the angular velocity
+  for (unsigned int i=0; i<count; ++i)
+    angvel_x[i] += torque_x[i] * angmass_inv_x[i] * (delta * awake[i]);
+  for (unsigned int i=0; i<count; ++i)
+    angvel_y[i] += torque_y[i] * angmass_inv_y[i] * (delta * awake[i]);
+  for (unsigned int i=0; i<count; ++i)
+    angvel_z[i] += torque_z[i] * angmass_inv_z[i] * (delta * awake[i]);
+
+#ifdef CLAMPVEL
+  // Keep linvel and angvel inside a range of values
+  for (unsigned int i=0; i<count; ++i) {
+    CLAMP(linvel_x[i], -20.0f, 20.0f);
+    CLAMP(linvel_y[i], -20.0f, 20.0f);
+    CLAMP(linvel_z[i], -20.0f, 20.0f);
+    CLAMP(angvel_x[i], -20.0f, 20.0f);
+    CLAMP(angvel_y[i], -20.0f, 20.0f);
+    CLAMP(angvel_z[i], -20.0f, 20.0f);
+  }
+#endif
+
+  // resetting
+  std::fill(force_x.begin(), force_x.end(), 0.0f);
+  std::fill(force_y.begin(), force_y.end(), 0.0f);
+  std::fill(force_z.begin(), force_z.end(), 0.0f);
+  std::fill(torque_x.begin(), torque_x.end(), 0.0f);
+  std::fill(torque_y.begin(), torque_y.end(), 0.0f);
+  std::fill(torque_z.begin(), torque_z.end(), 0.0f);
+}
+
+///
+/// @brief Move the bodies along the velocities integrateVelocities() has updated
+/// @details Positions, then orientations, one body after the other in the
+///  order of the store; sleeping bodies stay where they are.
+/// @param delta = the time slice to compute
+///
+void PRigidBodyStore::integratePoses(float delta)
+{
+  for (unsigned int i=0; i<count; ++i) {
+    if (awake[i] == 0.0f) continue;
+
+    PReferenceFrame &r = ref[i];
+
+    // update the position of the body
+    r.setPosition(r.getPosition() + vec3f(linvel_x[i], linvel_y[i], linvel_z[i]) * delta);
+
+    // update the orientation
+    quatf angdelta;
+    angdelta.fromThreeAxisAngle(vec3f(angvel_x[i], angvel_y[i], angvel_z[i]) * delta);
+    r.setOrientation(r.getOrientation() * angdelta);
+
+    r.updateMatrices();
+  }
+}
 
 ///
 /// @brief initialize PRigidBody
+/// @param store_parent = where to keep the velocities and forces
 ///
-PRigidBody::PRigidBody(const vec3f &gravity_parent):
-	PReferenceFrame(),
-	gravity(gravity_parent),
+PRigidBody::PRigidBody(PRigidBodyStore &store_parent):
+	store(store_parent),
+	index(store_parent.add()),
 	mass(1.0),
-	mass_inv(1.0),
-	angmass(vec3f(1.0,1.0,1.0)),
-	angmass_inv(vec3f(1.0,1.0,1.0)),
-	linvel(vec3f::zero()),
-	angvel(vec3f::zero()),
-	accum_force(vec3f::zero()),
-	accum_torque(vec3f::zero())
+	angmass(vec3f(1.0,1.0,1.0))
 {}
 
 PRigidBody::~PRigidBody()
@@ -38,21 +173,21 @@ PRigidBody::~PRigidBody()
 void PRigidBody::setMassCuboid(float _mass, const vec3f &rad)
 {
   // if there is no mass or a dimension is zero or less return
-  if (mass <= 0.0 ||
+  if (_mass <= 0.0 ||
     rad.x <= 0.0 ||
     rad.y <= 0.0 ||
     rad.z <= 0.0) return;
 
   // set mass
   mass = _mass;
-  mass_inv = 1.0 / mass;
+  store.mass_inv[index] = 1.0 / mass;
 
   // set angular mass
   angmass = vec3f(rad.y*rad.z, rad.z*rad.x, rad.x*rad.y) * (mass * 0.4);
 
-  angmass_inv.x = 1.0 / angmass.x;
-  angmass_inv.y = 1.0 / angmass.y;
-  angmass_inv.z = 1.0 / angmass.z;
+  store.angmass_inv_x[index] = 1.0 / angmass.x;
+  store.angmass_inv_y[index] = 1.0 / angmass.y;
+  store.angmass_inv_z[index] = 1.0 / angmass.z;
 }
 
 ///
@@ -61,7 +196,10 @@ void PRigidBody::setMassCuboid(float _mass, const vec3f &rad)
 ///
 void PRigidBody::addForce(const vec3f &frc)
 {
-  accum_force += frc;
+  store.awake[index] = 1.0f;
+  store.force_x[index] += frc.x;
+  store.force_y[index] += frc.y;
+  store.force_z[index] += frc.z;
 }
 
 ///
@@ -80,11 +218,11 @@ void PRigidBody::addLocForce(const vec3f &frc)
 ///
 void PRigidBody::addForceAtPoint(const vec3f &frc, const vec3f &pt)
 {
-  accum_force += frc;
+  addForce(frc);
 
   vec3f wdiff = pt - getPosition();
 
-  accum_torque += frc ^ wdiff;
+  addTorque(frc ^ wdiff);
   //accum_torque -= wdiff ^ frc;
 }
 
@@ -124,7 +262,10 @@ void PRigidBody::addLocForceAtLocPoint(const vec3f &frc, const vec3f &pt)
 ///
 void PRigidBody::addTorque(const vec3f &trq)
 {
-  accum_torque += trq;
+  store.awake[index] = 1.0f;
+  store.torque_x[index] += trq.x;
+  store.torque_y[index] += trq.y;
+  store.torque_z[index] += trq.z;
 }
 
 ///
@@ -136,6 +277,65 @@ void PRigidBody::addLocTorque(const vec3f &trq)
   addTorque(getLocToWorldVector(trq));
 }
 
+///
+/// @brief Put the rigid body to sleep or wake it up
+/// @details Going to sleep stops the body and drops the forces and torques
+///  accumulated so far.
+/// @param sleeping = true to put it to sleep
+///
+void PRigidBody::setSleeping(bool sleeping)
+{
+  if (sleeping) {
+    setLinearVel(vec3f::zero());
+    setAngularVel(vec3f::zero());
+
+    store.force_x[index] = store.force_y[index] = store.force_z[index] = 0.0f;
+    store.torque_x[index] = store.torque_y[index] = store.torque_z[index] = 0.0f;
+  }
+
+  store.awake[index] = sleeping ? 0.0f : 1.0f;
+}
+
+///
+/// @brief Copy the pose and the dynamic state of the body out
+/// @param state = where to copy it
+///
+void PRigidBody::saveState(PRigidBodyState &state) const
+{
+  state.ref = store.ref[index];
+  state.ref_prev = store.ref_prev[index];
+
+  state.linvel = getLinearVel();
+  state.angvel = getAngularVel();
+  state.force = vec3f(store.force_x[index], store.force_y[index], store.force_z[index]);
+  state.torque = vec3f(store.torque_x[index], store.torque_y[index], store.torque_z[index]);
+  state.awake = store.awake[index];
+}
+
+///
+/// @brief Put back a state saved by saveState()
+/// @details The matrices are copied rather than rebuilt from the orientation,
+///  so that the following steps repeat the saved ones bit for bit.
+/// @param state = the saved state
+///
+void PRigidBody::restoreState(const PRigidBodyState &state)
+{
+  store.ref[index] = state.ref;
+  store.ref_prev[index] = state.ref_prev;
+
+  setLinearVel(state.linvel);
+  setAngularVel(state.angvel);
+
+  store.force_x[index] = state.force.x;
+  store.force_y[index] = state.force.y;
+  store.force_z[index] = state.force.z;
+  store.torque_x[index] = state.torque.x;
+  store.torque_y[index] = state.torque.y;
+  store.torque_z[index] = state.torque.z;
+
+  store.awake[index] = state.awake;
+}
+
 ///
 /// @brief get the linear velocity of a point
 /// @details it's linear velocity is derived from rigid body's linear velocity plus his angular velocity cross product with the distance from the rotation center
@@ -144,7 +344,7 @@ void PRigidBody::addLocTorque(const vec3f &trq)
 vec3f PRigidBody::getLinearVelAtPoint(const vec3f &pt)
 {
   vec3f usept = pt - getPosition();
-  return (linvel + (usept ^ angvel));
+  return (getLinearVel() + (usept ^ getAngularVel()));
 }
 
 /// @brief get the linear velocity of a point
@@ -156,67 +356,3 @@ vec3f PRigidBody::getLinearVelAtLocPoint(const vec3f &pt)
   return getLinearVelAtPoint(getLocToWorldPoint(pt));
 }
 
-// Uncomment this to prevent rigid body velocity and angular velocity go too high (see PRigidBody::tick() )
-//#define CLAMPVEL
-
-///
-/// @brief Apply forces and torque accumulated, update the body accordingly
-/// @param delta = the time slice to compute
-///
-void PRigidBody::tick(float delta)
-{
-  // update the linear velocity of the body
-  linvel += (accum_force * mass_inv + gravity) * delta;
-
-#ifdef CLAMPVEL
-  // Keep linvel inside a range of values
-  CLAMP(linvel.x, -20.0, 20.0);
-  CLAMP(linvel.y, -20.0, 20.0);
-  CLAMP(linvel.z, -20.0, 20.0);
-#endif
-
-  // update the position of the body
-  setPosition(getPosition() + linvel * delta);
-
-#if 0
-  mat44f ori_mat2;
-  ori_mat2.assemble(
-    vec3f(ori_mat.row[0][0]*0.5+0.5, ori_mat.row[0][1]*0.5+0.5, ori_mat.row[0][2]*0.5+0.5),
-    vec3f(ori_mat.row[1][0]*0.5+0.5, ori_mat.row[1][1]*0.5+0.5, ori_mat.row[1][2]*0.5+0.5),
-    vec3f(ori_mat.row[2][0]*0.5+0.5, ori_mat.row[2][1]*0.5+0.5, ori_mat.row[2][2]*0.5+0.5));
-
-  vec3f angmass_inv_world = ori_mat2.transform2(angmass_inv);
-#else
-  vec3f angmass_inv_world = angmass_inv;
-#endif
-
-  vec3f ang_accel = vec3f(
-    accum_torque.x * angmass_inv_world.x,
-    accum_torque.y * angmass_inv_world.y,
-    accum_torque.z * angmass_inv_world.z);
-
-  // update the angular velocity
-  angvel += ang_accel * delta;
-
-#ifdef CLAMPVEL
-  // keep angular velocity inside a range a value
-  CLAMP(angvel.x, -20.0, 20.0);
-  CLAMP(angvel.y, -20.0, 20.0);
-  CLAMP(angvel.z, -20.0, 20.0);
-#endif
-
-  // update the orientation
-  quatf angdelta;
-  angdelta.fromThreeAxisAngle(angvel * delta);
-  setOrientation(getOrientation() * angdelta);
-  //ori = angdelta * ori;
-
-  //PULLTOWARD(linvel, vec3f::zero(), delta * 0.1);
-  //PULLTOWARD(angvel, vec3f::zero(), delta * 0.1);
-
-  // resetting
-  accum_force = vec3f::zero();
-  accum_torque = vec3f::zero();
-
-  PReferenceFrame::updateMatrices();
-}
@@ -9,17 +9,26 @@
 // Among others here we have creation of PVehicles and PRigidBody, loading of PVehicleType and simulation tick
 //
 
+#include "alloccount.h"
 #include "psim.h"
-#include "render.h"
+#include "simsnapshot.h"
+#include "terraindata.h"
 #include "vehicle.h"
 
 ///
 /// @brief constructor
 ///
-PSim::PSim() : terrain(nullptr), gravity(vec3f::zero())
+PSim::PSim() :
+  terrain(nullptr),
+  gravity(vec3f::zero()),
+  accumulator(0.0f),
+  stepcount(0),
+  jobpool(new PJobPool(PJobPool::getDefaultThreadCount()))
 {
 }
 
+constexpr float PSim::timeslice;
+
 ///
 /// @brief destructor
 ///
@@ -31,10 +40,10 @@ PSim::~PSim()
 ///
 /// @brief Load a vehicle type from a file
 /// @param filename = name of the file to load from
-/// @param ssModel = the PSSModel of the vehicle type
+/// @param ssModel = the model list to load the vehicle models into
 /// @retval the newly loaded vehicle type, or nullptr if failed to load
 ///
-PVehicleType *PSim::loadVehicleType(const std::string &filename, PSSModel &ssModel)
+PVehicleType *PSim::loadVehicleType(const std::string &filename, PModelList &ssModel)
 {
   PVehicleType *vtype = vtypelist.find(filename);
   if (!vtype) {
@@ -55,18 +64,16 @@ PVehicleType *PSim::loadVehicleType(const std::string &filename, PSSModel &ssMod
 ///
 PRigidBody *PSim::createRigidBody()
 {
-  PRigidBody *newbody = new PRigidBody(gravity);
-
-  body.push_back(newbody);
+  body.emplace_back(bodystore);
 
-  return newbody;
+  return &body.back();
 }
 
 ///
 /// @brief Create a new vehicle and put it in the vehicle vector
 /// @retval the pointer to the newly created vehicle, nullptr if problems occurred
 ///
-PVehicle *PSim::createVehicle(XMLElement *element, const std::string &filepath, PSSModel &ssModel)
+PVehicle *PSim::createVehicle(XMLElement *element, const std::string &filepath, PModelList &ssModel)
 {
   const char *val;
 
@@ -93,7 +100,7 @@ PVehicle *PSim::createVehicle(XMLElement *element, const std::string &filepath,
 /// @brief Create a new vehicle and put it in the vehicle vector
 /// @retval the pointer to the newly created vehicle, nullptr if problems occurred
 ///
-PVehicle *PSim::createVehicle(const std::string &type, const vec3f &pos, const quatf &ori, const std::string &filepath, PSSModel &ssModel)
+PVehicle *PSim::createVehicle(const std::string &type, const vec3f &pos, const quatf &ori, const std::string &filepath, PModelList &ssModel)
 {
   PVehicleType *vtype = loadVehicleType(PUtil::assemblePath(type, filepath), ssModel);
 
@@ -104,7 +111,7 @@ PVehicle *PSim::createVehicle(const std::string &type, const vec3f &pos, const q
 /// @brief Create a new vehicle and put it in the vehicle vector
 /// @retval the pointer to the newly created vehicle, nullptr if problems occurred
 ///
-PVehicle *PSim::createVehicle(PVehicleType *type, const vec3f &pos, const quatf &ori /*, PSSModel &ssModel */)
+PVehicle *PSim::createVehicle(PVehicleType *type, const vec3f &pos, const quatf &ori /*, PModelList &ssModel */)
 {
   if (!type) return nullptr;
 
@@ -119,6 +126,12 @@ PVehicle *PSim::createVehicle(PVehicleType *type, const vec3f &pos, const quatf
 
   newvehicle->updateParts();
 
+  newvehicle->random.setSeed(random.getNext());
+
+  // nothing to interpolate from yet
+  newvehicle->getBody().savePrevious();
+  newvehicle->savePrevious();
+
   vehicle.push_back(newvehicle);
   return newvehicle;
 }
@@ -129,21 +142,103 @@ PVehicle *PSim::createVehicle(PVehicleType *type, const vec3f &pos, const quatf
 void PSim::clear()
 {
   // clear bodies
-  for (unsigned int i=0; i<body.size(); ++i)
-    delete body[i];
   body.clear();
+  bodystore.clear();
 
   // clear vehicles
   for (unsigned int i=0; i<vehicle.size(); ++i)
     delete vehicle[i];
   vehicle.clear();
+  broadphase.clear();
 
   // clear vehicle types
   vtypelist.clear();
 }
 
+///
+/// @brief Reseed the random generators and restart counting steps
+/// @details Each vehicle gets a seed drawn from the simulation's own
+///  generator, in creation order. Also drops any time left over from previous tick() calls, so that
+///  the following steps don't depend on what happened before.
+/// @param seed = new seed of the random generator
+///
+void PSim::setSeed(uint32 seed)
+{
+  random.setSeed(seed);
+
+  for (unsigned int i=0; i<vehicle.size(); ++i)
+    vehicle[i]->random.setSeed(random.getNext());
+
+  accumulator = 0.0f;
+  stepcount = 0;
+}
+
+///
+/// @brief Copy the state of the simulation into a snapshot
+/// @param snapshot = where to copy it, its previous contents are replaced
+///
+void PSim::saveSnapshot(PSimSnapshot &snapshot) const
+{
+  snapshot.random = random;
+  snapshot.accumulator = accumulator;
+  snapshot.stepcount = stepcount;
+
+  snapshot.body.resize(body.size());
+
+  for (unsigned int i=0; i<body.size(); ++i)
+    body[i].saveState(snapshot.body[i]);
+
+  snapshot.vehicle.clear();
+  snapshot.part.clear();
+  snapshot.wheel.clear();
+
+  for (unsigned int i=0; i<vehicle.size(); ++i)
+    vehicle[i]->saveState(snapshot);
+}
+
+///
+/// @brief Put the simulation back as it was when a snapshot was saved
+/// @param snapshot = a snapshot saved by this simulation
+/// @retval false if the bodies, vehicles, parts or wheels don't match the
+///  snapshot any more, in which case nothing is changed
+///
+bool PSim::restoreSnapshot(const PSimSnapshot &snapshot)
+{
+  if (snapshot.body.size() != body.size() || snapshot.vehicle.size() != vehicle.size())
+    return false;
+
+  unsigned int parts = 0;
+  unsigned int wheels = 0;
+
+  for (unsigned int i=0; i<vehicle.size(); ++i) {
+    parts += vehicle[i]->part.size();
+
+    for (unsigned int j=0; j<vehicle[i]->part.size(); ++j)
+      wheels += vehicle[i]->part[j].wheel.size();
+  }
+
+  if (snapshot.part.size() != parts || snapshot.wheel.size() != wheels)
+    return false;
+
+  random = snapshot.random;
+  accumulator = snapshot.accumulator;
+  stepcount = snapshot.stepcount;
+
+  for (unsigned int i=0; i<body.size(); ++i)
+    body[i].restoreState(snapshot.body[i]);
+
+  unsigned int nextpart = 0;
+  unsigned int nextwheel = 0;
+
+  for (unsigned int i=0; i<vehicle.size(); ++i)
+    vehicle[i]->restoreState(snapshot, i, nextpart, nextwheel);
+
+  return true;
+}
+
 ///
 /// @brief Calls the vehicles and bodies ticks and update the parts of the vehicles
+/// @details Time that doesn't fill a whole step is kept for the next call.
 /// @param delta = how much time to compute
 ///
 void PSim::tick(float delta)
@@ -160,29 +255,110 @@ void PSim::tick(float delta)
 	// do 'num' ticks each of 'timeslice' length
 	for (int timestep=0; timestep<num; ++timestep) {
 	*/
-	
-	// size of a step
-	const float timeslice = 0.004;
-
-	// how much time remains to simulate
-	static float t = 0;
-	t += delta;
-	
-	while(t >= timeslice)
+
+	accumulator += delta;
+
+	while (accumulator >= timeslice)
 	{
 		// update time
-		t -= timeslice;
-		
-		// tick for vehicles
-		for (unsigned int i=0; i<vehicle.size(); ++i)
-			vehicle[i]->tick(timeslice);
-		
-		// tick for rigid bodies
-		for (unsigned int i=0; i<body.size(); ++i)
-			body[i]->tick(timeslice);
-		
-		// Update vehicles parts
-		for (unsigned int i=0; i<vehicle.size(); ++i)
+		accumulator -= timeslice;
+
+		step();
+	}
+}
+
+///
+/// @brief Runs an exact number of steps, ignoring any leftover time
+/// @param steps = how many steps of timeslice seconds to run
+///
+void PSim::tickSteps(unsigned int steps)
+{
+	for (unsigned int i=0; i<steps; ++i)
+		step();
+}
+
+///
+/// @brief Calls the vehicles and bodies ticks for one timeslice
+/// @details In builds defining PSIM_COUNT_ALLOCATIONS the heap allocations
+///  made during the step are added to getAllocations().
+///
+void PSim::step()
+{
+#ifdef PSIM_COUNT_ALLOCATIONS
+	const unsigned long allocations_before = getAllocationCount();
+	const unsigned int tiles_before = terrain ? terrain->getGeneratedTileCount() : 0;
+#endif
+
+	// keep the poses from before this step for rendering
+	bodystore.savePrevious();
+
+	// tick for vehicles, which only share the read-only terrain;
+	// parallelFor() returns when all of them are done
+	jobpool->parallelFor(vehicle.size(), [this] (unsigned int i) {
+		vehicle[i]->savePrevious();
+		vehicle[i]->tick(timeslice);
+	});
+
+	// add the forces between vehicles to those of their ticks
+	collideVehicles();
+
+	// tick for rigid bodies: velocities of all of them in one go, then the poses
+	bodystore.integrateVelocities(gravity, timeslice);
+	bodystore.integratePoses(timeslice);
+
+	// Update vehicles parts, sleeping ones haven't moved unless another
+	// vehicle has just woken their body up
+	for (unsigned int i=0; i<vehicle.size(); ++i) {
+		if (!vehicle[i]->getBody().isSleeping())
 			vehicle[i]->updateParts();
 	}
+
+	++stepcount;
+
+#ifdef PSIM_COUNT_ALLOCATIONS
+	const unsigned long stepallocations = getAllocationCount() - allocations_before;
+
+	if (terrain && terrain->getGeneratedTileCount() != tiles_before) {
+		++allocations.tilesteps;
+		allocations.tileallocations += stepallocations;
+	} else {
+		++allocations.steps;
+		allocations.allocations += stepallocations;
+	}
+#endif
+}
+
+///
+/// @brief Finds the vehicles that touch and pushes them apart
+/// @details Each vehicle is boxed by a cube around its body that holds its
+///  cuboid and clips whatever the orientation, so the boxes don't need any
+///  rotating. The pairs come sorted, which keeps the sum of the forces the
+///  same from run to run.
+///
+void PSim::collideVehicles()
+{
+	if (vehicle.size() < 2) return;
+
+	broadphase.resize(vehicle.size());
+
+	for (unsigned int i=0; i<vehicle.size(); ++i) {
+		const vec3f pos = vehicle[i]->getBody().getPosition();
+		const float radius = vehicle[i]->type->bound_radius;
+		const vec3f extent(radius, radius, radius);
+
+		broadphase.setBox(i, pos - extent, pos + extent);
+	}
+
+	const std::vector<PBroadphase::Pair> &pairs = broadphase.findPairs();
+
+	for (unsigned int i=0; i<pairs.size(); ++i) {
+		PVehicle &a = *vehicle[pairs[i].a];
+		PVehicle &b = *vehicle[pairs[i].b];
+
+		// neither of them is moving
+		if (a.isSleeping() && b.isSleeping()) continue;
+
+		a.collideWith(b);
+		b.collideWith(a);
+	}
 }
@@ -8,6 +8,7 @@
 #include "collision.h"
 #include "psim.h"
 #include "render.h"
+#include "simsnapshot.h"
 
 // default vehicle type values
 #define DEF_VEHICLE_NAME "Vehicle"
@@ -41,10 +42,19 @@
 // When a car is upside down, how much time to wait before resetting
 #define VEHICLE_UPSIDEDOWN_RESET_TIME 4
 
+// Below which linear [m/s] and angular [rad/s] speeds a car is resting, and
+// for how many simulation steps it has to rest before going to sleep
+#define VEHICLE_SLEEP_LINVEL 0.05f
+#define VEHICLE_SLEEP_ANGVEL 0.05f
+#define VEHICLE_SLEEP_STEPS 125
+
 // This is a coefficent used to get the friction of a wheel or a clip with the ground
 #define FRICTION_MAGIC_COEFF_CLIP 10000
 #define FRICTION_MAGIC_COEFF_WHEEL (FRICTION_MAGIC_COEFF_CLIP * 50)
 
+// Most friction between two cars, as a fraction of the force pushing them apart
+#define VEHICLE_CONTACT_FRICTION 0.5f
+
 // How much of the wheel radius can the suspension be compressed
 #define MAX_SUSPENSION_DEPTH_COEFF 0.7
 
@@ -85,7 +95,7 @@ void PVehicleWheel::reset()
 ///
 /// @brief load a vehicle type from a file
 ///
-bool PVehicleType::load(const std::string &filename, PSSModel &ssModel)
+bool PVehicleType::load(const std::string &filename, PModelList &ssModel)
 {
   if (PUtil::isDebugLevel(DEBUGLEVEL_TEST))
     PUtil::outLog() << "Loading vehicle type \"" << filename << "\"\n";
@@ -100,6 +110,7 @@ bool PVehicleType::load(const std::string &filename, PSSModel &ssModel)
 
   mass = DEF_VEHICLE_MASS;
   dims = DEF_VEHICLE_DIMS;
+  dims_center = vec3f::zero();
 
   wheelscale = DEF_VEHICLE_WHEELSCALE;
   wheelmodel = nullptr;
@@ -512,6 +523,9 @@ bool PVehicleType::load(const std::string &filename, PSSModel &ssModel)
 	break;
   }
   
+  // the simulation reads the engine through these tables
+  engine.buildTables();
+
   // get pstat of engine
   pstat_enginepower = std::to_string(engine.getHorsePower());
   // remove decimals
@@ -586,6 +600,22 @@ bool PVehicleType::load(const std::string &filename, PSSModel &ssModel)
 		dims.x = (extents.second.x - extents.first.x) * part[0].scale;
 		dims.y = (extents.second.y - extents.first.y) * part[0].scale;
 		dims.z = (extents.second.z - extents.first.z) * part[0].scale;
+		dims_center = (extents.first + extents.second) * (0.5f * part[0].scale);
+	}
+
+	// a sphere around the body holding the cuboid and all the clips,
+	// however the parts are turned; the cuboid sits in the frame of the
+	// first part, which may be off the body origin
+	bound_radius = dims_center.length() + (dims * 0.5f).length();
+
+	if (!part.empty())
+		bound_radius += part[0].ref_local.getPosition().length();
+
+	for (unsigned int i=0; i<part.size(); ++i) {
+		const float partdist = part[i].ref_local.getPosition().length();
+
+		for (unsigned int j=0; j<part[i].clip.size(); ++j)
+			CLAMP_LOWER(bound_radius, partdist + part[i].clip[j].pt.length());
 	}
 	
 	// linear drag coefficent
@@ -701,8 +731,11 @@ PVehicle::PVehicle(PSim &sim_parent, PVehicleType *_type) :
 	currentlap(1),
 	reset_trigger_time(0.0f),
 	reset_time(0.0f),
+	resetcount(0),
 	crunch_level(0.0f),
 	crunch_level_prev(0.0f),
+	sleeping(false),
+	sleep_steps(0),
 	forwardspeed(0.0f),
 	wheel_angvel(0.0f),
 	offroadtime_begin(0),
@@ -715,6 +748,7 @@ PVehicle::PVehicle(PSim &sim_parent, PVehicleType *_type) :
 	// set control
 	state.setZero();
 	ctrl.setZero();
+	sleep_ctrl.setZero();
 
 	// Set parts and wheels
 	part.resize(type->part.size());
@@ -727,8 +761,21 @@ PVehicle::PVehicle(PSim &sim_parent, PVehicleType *_type) :
 			part[i].wheel[j].ref_world.setPosition(vec3f(0,0,1000000)); // FIXME
 		}
 		part[i].damage.setClip(type->part[i].clip);
+
+		// size the scratch buffers of tick() up front, it shouldn't allocate
+		const unsigned int contacts = type->part[i].clip.size() + type->part[i].wheel.size();
+		if (contact_pos.size() < contacts) {
+			contact_pos.resize(contacts);
+			contact_info.resize(contacts);
+		}
 	}
 
+	// a box smaller than a tile overlaps at most four of them; the hits
+	// get more room whenever a tile with fuller cells shows up
+	contact_objects.tile.reserve(4);
+	if (sim.getTerrain())
+		sim.getTerrain()->reserveObjectQuery(vec3f(1.0f, 1.0f, 1.0f) * (type->bound_radius * 2.0f), contact_objects);
+
 	updateParts();
 
 	//mNetFlags.set(Ghostable);
@@ -784,8 +831,11 @@ void PVehicle::doReset(const vec3f &pos, const quatf &ori)
 
 void PVehicle::reset()
 {
+	wakeUp();
+
 	// set a reset time
 	reset_time = VEHICLE_RESET_TIME;
+	++resetcount;
 
 	// reset noise level
 	crunch_level = 0;
@@ -820,6 +870,14 @@ void PVehicle::tick(const float& delta)
   // ensure control values are in valid range
   ctrl.clamp();
 
+  // a sleeping car stays put until its controls change or something pushes
+  // its body, which wakes the body up
+  if (sleeping) {
+    if (body->isSleeping() && ctrl == sleep_ctrl) return;
+
+    wakeUp();
+  }
+
   // handle crunch noise level
   PULLTOWARD(crunch_level_prev, crunch_level, delta * 5.0f);
   PULLTOWARD(crunch_level, 0.0f, delta * 5.0f);
@@ -999,19 +1057,30 @@ void PVehicle::tick(const float& delta)
 
   // the parts
   for (unsigned int i=0; i<part.size(); ++i) {
+    const unsigned int numclips = type->part[i].clip.size();
+    const unsigned int numwheels = type->part[i].wheel.size();
+
+    // the world clip coordinates, then where the wheels might touch the ground
+    contact_pos.resize(numclips + numwheels);
+    contact_info.resize(numclips + numwheels);
+
+    for (unsigned int j=0; j<numclips; ++j)
+      contact_pos[j] = part[i].ref_world.getLocToWorldPoint(type->part[i].clip[j].pt);
+
+    for (unsigned int j=0; j<numwheels; ++j)
+      contact_pos[numclips + j] = part[i].wheel[j].getLowestPoint();
+
+    // ask the terrain about all of them in one go
+    sim.getTerrain()->getContactInfoBatch(contact_pos.data(), contact_info.data(), contact_pos.size());
+
     // the clips of the part
-    for (unsigned int j=0; j<type->part[i].clip.size(); ++j) {
+    for (unsigned int j=0; j<numclips; ++j) {
 
-      // the local clip coordinate
-      vec3f lclip = type->part[i].clip[j].pt;
       // the world clip coordinate
-      vec3f wclip = part[i].ref_world.getLocToWorldPoint(lclip);
+      vec3f wclip = contact_pos[j];
 
       // where the clip *might* touch the ground
-      PTerrain::ContactInfo tci;
-      tci.pos.x = wclip.x;
-      tci.pos.y = wclip.y;
-      sim.getTerrain()->getContactInfo(tci);
+      PTerrainData::ContactInfo tci = contact_info[j];
 
       // if the clip hovers let it hover
       if (type->part[i].clip[j].type == v_clip_type::hover) {
@@ -1139,7 +1208,7 @@ void PVehicle::tick(const float& delta)
     }
 
     // The wheels
-    for (unsigned int j=0; j<type->part[i].wheel.size(); ++j) {
+    for (unsigned int j=0; j<numwheels; ++j) {
 
       PVehicleWheel &wheel = part[i].wheel[j];
       PVehicleTypeWheel &typewheel = type->part[i].wheel[j];
@@ -1150,7 +1219,7 @@ void PVehicle::tick(const float& delta)
       const float mf_resis    = PUtil::decideResistance(mf_tt);
 
       // where the wheel might touch the ground
-      vec3f wclip = wheel.getLowestPoint();
+      vec3f wclip = contact_pos[numclips + j];
 
       wheel.spin_vel += drivetorque * typewheel.drive * delta * (1.0f - mf_resis);
 
@@ -1188,11 +1257,7 @@ void PVehicle::tick(const float& delta)
       wheel.ride_pos += wheel.ride_vel * delta;
 
       // tci = the terrain point that shares the vertical with wclip
-      PTerrain::ContactInfo tci;
-      tci.pos.x = wclip.x;
-      tci.pos.y = wclip.y;
-
-      sim.getTerrain()->getContactInfo(tci);
+      PTerrainData::ContactInfo tci = contact_info[numclips + j];
 	  
 	  // apply a bit of sinking depending of the material
 	  tci.pos.z -= SINK_COEFF * mf_resis;
@@ -1208,7 +1273,9 @@ void PVehicle::tick(const float& delta)
           wheel.bumplast = wheel.bumpnext;
           wheel.bumptravel -= (int)wheel.bumptravel;
 
-          wheel.bumpnext = randm11 * rand01 * typewheel.radius * 0.1f;
+          // two statements, so the order of the random draws is fixed
+          const float bumpsign = random.getFloatM11();
+          wheel.bumpnext = bumpsign * random.getFloat01() * typewheel.radius * 0.1f;
         }
 
         // how much wheel is below the ground along the normal
@@ -1342,36 +1409,36 @@ void PVehicle::tick(const float& delta)
 
     // Calculate collisions with world objects
     PCollision collision(type->part[i].clip, part[i].ref_world);
-    const std::vector<PTerrainFoliage> *foliage = sim.getTerrain()->getFoliageAtPos(body->getPosition());
-
-    if (foliage) {
-      const std::vector<PTerrainFoliage> contact = collision.checkContact(foliage);
-
-      for (unsigned int j = 0; j < contact.size(); ++j) {
-        vec3f crashforce = vec3f::zero();
-        vec3f ptvel = body->getLinearVelAtPoint(body->getPosition());
-
-        // Prevent that vehicle gets stuck in an object
-        if (collision.towardsContact(body->getPosition(), contact[j].pos, ptvel * delta)) {
-          const float crashthreshold = 0.025f;
-          vec3f crashpoint = collision.getCrashPoint(body->getPosition(), contact[j]);
-
-          ptvel.x = -ptvel.x * contact[j].rigidity;
-          ptvel.y = -ptvel.y * contact[j].rigidity;
-          ptvel.z = 0.0f;
-
-          // apply crash force [N] at center of object in X/Y direction (F=v*m/t)
-          if (delta != 0.0f)
-            crashforce = ptvel * type->mass / delta;
-          body->addForceAtPoint(crashforce, crashpoint);
-          part[i].damage.addDamage(crashpoint, crashforce.length() * 0.0000001f, part[i].ref_world);
-
-          // Trigger crash sound or amplify gravel sound
-          if (contact[j].rigidity > crashthreshold)
-            CLAMP_LOWER(crunch_level, crashforce.length() * 0.00001f);
-          else
-            skid_level += crashforce.length();
-        }
+    collision.checkContact(*sim.getTerrain(), contact_objects);
+
+    // the query may have generated a tile with fuller cells than before
+    sim.getTerrain()->reserveObjectQuery(vec3f(1.0f, 1.0f, 1.0f) * (type->bound_radius * 2.0f), contact_objects);
+
+    for (unsigned int j = 0; j < contact_objects.size(); ++j) {
+      const PTerrainFoliage &contact = contact_objects[j];
+      vec3f crashforce = vec3f::zero();
+      vec3f ptvel = body->getLinearVelAtPoint(body->getPosition());
+
+      // Prevent that vehicle gets stuck in an object
+      if (collision.towardsContact(body->getPosition(), contact.pos, ptvel * delta)) {
+        const float crashthreshold = 0.025f;
+        vec3f crashpoint = collision.getCrashPoint(body->getPosition(), contact);
+
+        ptvel.x = -ptvel.x * contact.rigidity;
+        ptvel.y = -ptvel.y * contact.rigidity;
+        ptvel.z = 0.0f;
+
+        // apply crash force [N] at center of object in X/Y direction (F=v*m/t)
+        if (delta != 0.0f)
+          crashforce = ptvel * type->mass / delta;
+        body->addForceAtPoint(crashforce, crashpoint);
+        part[i].damage.addDamage(crashpoint, crashforce.length() * 0.0000001f, part[i].ref_world);
+
+        // Trigger crash sound or amplify gravel sound
+        if (contact.rigidity > crashthreshold)
+          CLAMP_LOWER(crunch_level, crashforce.length() * 0.00001f);
+        else
+          skid_level += crashforce.length();
       }
     }
   }
@@ -1381,6 +1448,57 @@ void PVehicle::tick(const float& delta)
   wheel_speed *= type->wheel_speed_multiplier;
 
   skid_level *= type->wheel_speed_multiplier;
+
+  updateSleep();
+}
+
+///
+/// @brief Counts the steps the car has been resting and puts it to sleep
+/// @details Resting means moving slower than the thresholds, right side up,
+///  with controls that didn't change. The forces of the current step are
+///  dropped when the car falls asleep.
+///
+void PVehicle::updateSleep()
+{
+  const bool resting =
+    body->getLinearVel().lengthsq() < SQUARED(VEHICLE_SLEEP_LINVEL) &&
+    body->getAngularVel().lengthsq() < SQUARED(VEHICLE_SLEEP_ANGVEL) &&
+    reset_trigger_time == 0.0f &&
+    ctrl == sleep_ctrl;
+
+  if (!resting) {
+    sleep_steps = 0;
+    sleep_ctrl = ctrl;
+    return;
+  }
+
+  if (++sleep_steps < VEHICLE_SLEEP_STEPS) return;
+
+  sleeping = true;
+  body->setSleeping(true);
+
+  // nothing turns or makes noise while asleep
+  for (unsigned int i=0; i<part.size(); ++i) {
+    for (unsigned int j=0; j<part[i].wheel.size(); ++j)
+      part[i].wheel[j].spin_vel = 0.0f;
+  }
+
+  wheel_angvel = 0.0f;
+  wheel_speed = 0.0f;
+  skid_level = 0.0f;
+  crunch_level = 0.0f;
+  crunch_level_prev = 0.0f;
+}
+
+///
+/// @brief Gets a sleeping car simulated again
+///
+void PVehicle::wakeUp()
+{
+  sleeping = false;
+  sleep_steps = 0;
+  sleep_ctrl = ctrl;
+  body->setSleeping(false);
 }
 
 ///
@@ -1395,7 +1513,7 @@ bool PVehicle::canHaveDustTrail()
         {
             vec3f wclip = part[i].wheel[j].getLowestPoint();
 
-            PTerrain::ContactInfo tci;
+            PTerrainData::ContactInfo tci;
 
             tci.pos.x = wclip.x;
             tci.pos.y = wclip.y;
@@ -1420,7 +1538,7 @@ void PVehicle::updateParts()
     if (type->part[i].parent > -1)
       parent = &part[type->part[i].parent].ref_world;
     else
-      parent = body;
+      parent = &body->getFrame();
 
     part[i].ref_world.setOrientation(part[i].ref_local.getOrientation() * parent->getOrientation());
 
@@ -1448,6 +1566,40 @@ void PVehicle::updateParts()
   }
 }
 
+///
+/// @brief Save the world reference of parts and wheels as the previous one
+/// @details The body is saved by PSim along with the other rigid bodies.
+///
+void PVehicle::savePrevious()
+{
+  for (unsigned int i=0; i<part.size(); ++i) {
+    part[i].ref_world_prev = part[i].ref_world;
+
+    for (unsigned int j=0; j<part[i].wheel.size(); j++)
+      part[i].wheel[j].ref_world_prev = part[i].wheel[j].ref_world;
+  }
+}
+
+///
+/// @brief Get the world references of a part as they were between the previous and the current step
+/// @details Only the world references of the part and of its wheels are set,
+///  so a part kept by the caller from frame to frame is filled in without
+///  allocating once it has room for the wheels.
+/// @param i = index of the part
+/// @param t = 0 for the previous pose, 1 for the current one
+/// @param ipart = part to get the interpolated world references
+///
+void PVehicle::getInterpolatedPart(unsigned int i, float t, PVehiclePart &ipart) const
+{
+  ipart.ref_world.setInterpolated(part[i].ref_world_prev, part[i].ref_world, t);
+
+  if (ipart.wheel.size() < part[i].wheel.size())
+    ipart.wheel.resize(part[i].wheel.size());
+
+  for (unsigned int j=0; j<part[i].wheel.size(); j++)
+    ipart.wheel[j].ref_world.setInterpolated(part[i].wheel[j].ref_world_prev, part[i].wheel[j].ref_world, t);
+}
+
 ///
 /// @brief Get the lowest point of the wheel, where it would touch the ground
 ///
@@ -1459,3 +1611,213 @@ vec3f PVehicleWheel::getLowestPoint()
 	
 	return wclip;
 }
+
+///
+/// @brief Append the state of the vehicle, its parts and their wheels to a snapshot
+/// @details The body is left to PSim::saveSnapshot(), and the per tick
+///  scratch buffers aren't state.
+/// @param snapshot = where to append it
+///
+void PVehicle::saveState(PSimSnapshot &snapshot) const
+{
+  snapshot.vehicle.emplace_back();
+  PVehicleState &vs = snapshot.vehicle.back();
+
+  vs.state = state;
+  vs.ctrl = ctrl;
+  iengine.saveState(vs.engine);
+
+  vs.blade_ang1 = blade_ang1;
+
+  vs.nextcp = nextcp;
+  vs.nextcdcp = nextcdcp;
+  vs.currentlap = currentlap;
+
+  vs.reset_trigger_time = reset_trigger_time;
+  vs.reset_pos = reset_pos;
+  vs.reset_ori = reset_ori;
+  vs.reset_time = reset_time;
+
+  vs.crunch_level = crunch_level;
+  vs.crunch_level_prev = crunch_level_prev;
+
+  vs.random = random;
+
+  vs.sleeping = sleeping;
+  vs.sleep_steps = sleep_steps;
+  vs.sleep_ctrl = sleep_ctrl;
+
+  vs.forwardspeed = forwardspeed;
+  vs.wheel_angvel = wheel_angvel;
+  vs.wheel_speed = wheel_speed;
+  vs.skid_level = skid_level;
+
+  vs.offroadtime_begin = offroadtime_begin;
+  vs.offroadtime_end = offroadtime_end;
+  vs.offroadtime_total = offroadtime_total;
+
+  for (unsigned int i=0; i<part.size(); ++i) {
+    snapshot.part.emplace_back();
+    PVehiclePartState &ps = snapshot.part.back();
+
+    ps.ref_local = part[i].ref_local;
+    ps.ref_world = part[i].ref_world;
+    ps.ref_world_prev = part[i].ref_world_prev;
+    ps.damage = part[i].damage;
+
+    snapshot.wheel.insert(snapshot.wheel.end(), part[i].wheel.begin(), part[i].wheel.end());
+  }
+}
+
+///
+/// @brief Put back a state saved by saveState()
+/// @param snapshot = the snapshot holding it
+/// @param index = which of the snapshot's vehicles
+/// @param nextpart = first part of the vehicle in the snapshot, moved past its parts
+/// @param nextwheel = first wheel of the vehicle in the snapshot, moved past its wheels
+///
+void PVehicle::restoreState(const PSimSnapshot &snapshot, unsigned int index,
+  unsigned int &nextpart, unsigned int &nextwheel)
+{
+  const PVehicleState &vs = snapshot.vehicle[index];
+
+  state = vs.state;
+  ctrl = vs.ctrl;
+  iengine.restoreState(vs.engine);
+
+  blade_ang1 = vs.blade_ang1;
+
+  nextcp = vs.nextcp;
+  nextcdcp = vs.nextcdcp;
+  currentlap = vs.currentlap;
+
+  reset_trigger_time = vs.reset_trigger_time;
+  reset_pos = vs.reset_pos;
+  reset_ori = vs.reset_ori;
+  reset_time = vs.reset_time;
+
+  crunch_level = vs.crunch_level;
+  crunch_level_prev = vs.crunch_level_prev;
+
+  random = vs.random;
+
+  sleeping = vs.sleeping;
+  sleep_steps = vs.sleep_steps;
+  sleep_ctrl = vs.sleep_ctrl;
+
+  forwardspeed = vs.forwardspeed;
+  wheel_angvel = vs.wheel_angvel;
+  wheel_speed = vs.wheel_speed;
+  skid_level = vs.skid_level;
+
+  offroadtime_begin = vs.offroadtime_begin;
+  offroadtime_end = vs.offroadtime_end;
+  offroadtime_total = vs.offroadtime_total;
+
+  for (unsigned int i=0; i<part.size(); ++i) {
+    const PVehiclePartState &ps = snapshot.part[nextpart++];
+
+    part[i].ref_local = ps.ref_local;
+    part[i].ref_world = ps.ref_world;
+    part[i].ref_world_prev = ps.ref_world_prev;
+    part[i].damage = ps.damage;
+
+    for (unsigned int j=0; j<part[i].wheel.size(); ++j)
+      part[i].wheel[j] = snapshot.wheel[nextwheel++];
+  }
+}
+
+///
+/// @brief Pushes the clips of this vehicle out of the cuboid of another one
+/// @details A clip inside the other vehicle's dims is pushed out through the
+///  nearest face, with the clip's own force and dampening as against the
+///  ground, and the opposite force goes to the other vehicle. PSim calls it
+///  both ways round for every pair of vehicles that might touch.
+///  The dims are the extents of the model of the first part, so the cuboid
+///  is placed in the body by that part's local reference. The damage goes
+///  to the part owning the clip, and to the part of the other vehicle
+///  nearest the contact.
+/// @param other = the vehicle that might be hit
+///
+void PVehicle::collideWith(PVehicle &other)
+{
+  const vec3f half = other.type->dims * 0.5f;
+  PReferenceFrame &box = other.part[0].ref_local;
+
+  for (unsigned int i=0; i<part.size(); ++i) {
+    for (unsigned int j=0; j<type->part[i].clip.size(); ++j) {
+      const vehicle_clip_s &clip = type->part[i].clip[j];
+
+      const vec3f wclip = part[i].ref_world.getLocToWorldPoint(clip.pt);
+
+      // the clip in the frame of the other cuboid
+      const vec3f lclip = box.getWorldToLocPoint(other.body->getWorldToLocPoint(wclip)) -
+        other.type->dims_center;
+
+      // how far inside from each pair of faces
+      const vec3f depth(
+        half.x - fabsf(lclip.x),
+        half.y - fabsf(lclip.y),
+        half.z - fabsf(lclip.z));
+
+      if (depth.x <= 0.0f || depth.y <= 0.0f || depth.z <= 0.0f) continue;
+
+      // out through the nearest face
+      vec3f lnormal;
+      float penetration;
+
+      if (depth.x <= depth.y && depth.x <= depth.z) {
+        lnormal = vec3f(lclip.x < 0.0f ? -1.0f : 1.0f, 0.0f, 0.0f);
+        penetration = depth.x;
+      } else if (depth.y <= depth.z) {
+        lnormal = vec3f(0.0f, lclip.y < 0.0f ? -1.0f : 1.0f, 0.0f);
+        penetration = depth.y;
+      } else {
+        lnormal = vec3f(0.0f, 0.0f, lclip.z < 0.0f ? -1.0f : 1.0f);
+        penetration = depth.z;
+      }
+
+      const vec3f normal = other.body->getLocToWorldVector(box.getLocToWorldVector(lnormal));
+
+      // velocity of the clip relative to the other vehicle
+      const vec3f relvel = body->getLinearVelAtPoint(wclip) - other.body->getLinearVelAtPoint(wclip);
+      const float normvel = relvel * normal;
+
+      const float perpforce = penetration * clip.force - normvel * clip.dampening;
+
+      if (perpforce <= 0.0f) continue;
+
+      // sliding along the other car
+      vec3f friction = (relvel - normal * normvel) * -FRICTION_MAGIC_COEFF_CLIP;
+
+      const float maxfriction = perpforce * VEHICLE_CONTACT_FRICTION;
+      const float leng = friction.length();
+
+      if (leng > maxfriction)
+        friction *= (maxfriction / leng);
+
+      const vec3f frc = normal * perpforce + friction;
+
+      body->addForceAtPoint(frc, wclip);
+      other.body->addForceAtPoint(frc * -1.0f, wclip);
+
+      // the part of the other vehicle the clip ran into
+      unsigned int hit = 0;
+      float hitdist = (other.part[0].ref_world.getPosition() - wclip).lengthsq();
+
+      for (unsigned int k=1; k<other.part.size(); ++k) {
+        const float dist = (other.part[k].ref_world.getPosition() - wclip).lengthsq();
+        if (dist < hitdist) {
+          hit = k;
+          hitdist = dist;
+        }
+      }
+
+      part[i].damage.addDamage(wclip, perpforce * 0.0000001f, part[i].ref_world);
+      other.part[hit].damage.addDamage(wclip, perpforce * 0.0000001f, other.part[hit].ref_world);
+
+      CLAMP_LOWER(crunch_level, perpforce * 0.00001f);
+      CLAMP_LOWER(other.crunch_level, perpforce * 0.00001f);
+    }
+  }
+}
@@ -40,6 +40,8 @@ PControl::PControl(Gui &parent, PConfig &config) :
   controls.push_back({ PConfig::ActionHandbrake, "handbrake" });
   controls.push_back({ PConfig::ActionRecover, "reset car" });
   controls.push_back({ PConfig::ActionRecoverAtCheckpoint, "reset on road" });
+  controls.push_back({ PConfig::ActionRestart, "restart race" });
+  controls.push_back({ PConfig::ActionRewind, "rewind" });
   controls.push_back({ PConfig::ActionCamMode, "toggle camera" });
   controls.push_back({ PConfig::ActionCamRight, "view right" });
   controls.push_back({ PConfig::ActionCamLeft, "view left" });
@@ -116,10 +118,11 @@ void PControl::addControl(Control &control, bool active)
       transform(keyname.begin(), keyname.end(), keyname.begin(), ::tolower);
   }
 
-  parent.addLabel(80.0f, 490.0f - (float)pos * 30.0f,
+  // 16 rows have to fit in the frame above the back button
+  parent.addLabel(80.0f, 490.0f - (float)pos * 26.0f,
       control.text, PTEXT_HZA_LEFT | PTEXT_VTA_TOP, 22.0f, LabelStyle::Regular);
   parent.makeClickable(
-      parent.addLabel(340.0f, 490.0f - (float)pos * 30.0f, keyname,
+      parent.addLabel(340.0f, 490.0f - (float)pos * 26.0f, keyname,
           PTEXT_HZA_LEFT | PTEXT_VTA_TOP, 22.0f, LabelStyle::Regular),
       AA_PICK_CTRL, pos);
   ++pos;
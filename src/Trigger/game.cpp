@@ -8,6 +8,7 @@
 #include "main.h"
 #include "psim.h"
 #include "vehicle.h"
+#include <algorithm>
 
 // size of the checkpoints
 #define CODRIVER_CHECKPOINT_RADIUS 20
@@ -36,6 +37,18 @@
 // When the race finishes, how much time to wait before quitting
 #define ENDGAME_TIMER 5
 
+// Rewind snapshots: one every quarter of a second for the last 30 seconds,
+// and how far back a rewind goes at least
+#define REWIND_INTERVAL 0.25f
+#define REWIND_SNAPSHOTS 120
+#define REWIND_MIN_TIME 1.0f
+
+// seed of the simulation at the start of every race, replays need it
+#define RACE_SEED 1000
+
+// seconds between two keyframes of the replay
+#define REPLAY_KEYFRAME_TIME 5.0f
+
 
 TriggerGame::TriggerGame(MainApp *parent):
 	app(parent),
@@ -44,7 +57,11 @@ TriggerGame::TriggerGame(MainApp *parent):
 	terrain(nullptr),
 	cdvoice(app->getCodriverWords(), app->getCodriverVolume()),
 	cdsigns(app->getCodriverSigns(), app->getCodriverUserConfig()),
-	rigidity()
+	rigidity(),
+	offroad_earlier(false),
+	rewindbuffer(REWIND_SNAPSHOTS),
+	rewindtimer(0.0f),
+	replay(REPLAY_KEYFRAME_TIME)
 {}
 
 TriggerGame::~TriggerGame()
@@ -125,6 +142,8 @@ bool TriggerGame::loadLevel(const std::string &filename)
 	if (PUtil::isDebugLevel(DEBUGLEVEL_TEST))
 		PUtil::outLog() << "Loading level \"" << filename << "\"\n";
 
+	levelname = filename;
+
 	// create a new PSim if there is no one
 	if (sim == nullptr)
 		sim = new PSim();
@@ -174,6 +193,10 @@ bool TriggerGame::loadLevel(const std::string &filename)
 			{
 				terrain = new PTerrain (walk, filename, app->getSSTexture (), rigidity,
 				    app->cfg.getFoliage(), app->cfg.getRoadsigns());
+				terrain->setTileCacheBudget(app->cfg.getTileCache());
+				terrain->setViewRadius(app->cfg.getViewRadius());
+				terrain->setLodTolerance(app->cfg.getTerrainError());
+				terrain->setHorizonCulling(app->cfg.getHorizonCulling());
 			}
 			catch (PException &e)
 			{
@@ -443,6 +466,9 @@ bool TriggerGame::loadLevel(const std::string &filename)
   
 	// do two seconds of simulations to have fine cars on ground
 	sim->tick(2);
+
+	// start the race from a known simulation state
+	sim->setSeed(RACE_SEED);
   
   /*
   for (int i=1; i<vehicle.size(); i++) {
@@ -477,6 +503,15 @@ void TriggerGame::chooseVehicle(PVehicleType *type)
 		vehicle.push_back(vh);
 	else
 		PUtil::outLog() << "Warning: failed to load vehicle\n";
+
+	// everything is in place, this is where restart() goes back to; the
+	// rewind snapshots get all their memory now, so that taking them during
+	// the race doesn't allocate
+	saveSnapshot(startsnapshot);
+	rewindbuffer.fill(startsnapshot);
+	rewindtimer = 0.0f;
+
+	replay.recordStart(*sim, RACE_SEED, levelname, type->getName());
 }
 
 ///
@@ -537,7 +572,8 @@ void TriggerGame::tick(float delta)
 			break;
 	}
   
-	// do the simulation
+	// do the simulation, the controls are final by now
+	replay.recordInputs(*sim);
 	sim->tick(delta);
   
 	for (unsigned int i=0; i<vehicle.size(); i++)
@@ -547,9 +583,6 @@ void TriggerGame::tick(float delta)
 		// line starting from the next checkpoint to the current position of the vehicle
     	vec2f diff = makevec2f(checkpt[vehicle[i]->nextcp].pt) - makevec2f(bodypos);
 
-		// if the car was offroad in previous iteration
-		static bool offroad_earlier = false;
-		
 		// if the car is currently offroad
 		const bool offroad_now = !terrain->getRmapOnRoad(bodypos);
 
@@ -655,6 +688,18 @@ void TriggerGame::tick(float delta)
 			}
 		}
 	}
+
+	// keep the last seconds of the race for rewind()
+	if (gamestate == Gamestate::racing)
+	{
+		rewindtimer += delta;
+
+		if (rewindtimer >= REWIND_INTERVAL)
+		{
+			rewindtimer -= REWIND_INTERVAL;
+			saveSnapshot(rewindbuffer.push());
+		}
+	}
   
   /*
   for (int i=0; i<aid.size(); i++) {
@@ -709,6 +754,107 @@ void TriggerGame::resetAtCheckpoint(PVehicle *veh)
     veh->doReset(lastCkptPos, lastCkptOri);
 }
 
+///
+/// @brief Copy the state of the race into a snapshot
+/// @param [out] snapshot   Where to copy it, the previous contents are replaced
+///
+void TriggerGame::saveSnapshot(TriggerGameSnapshot &snapshot) const
+{
+    sim->saveSnapshot(snapshot.sim);
+
+    snapshot.gamestate = gamestate;
+    snapshot.coursetime = coursetime;
+    snapshot.othertime = othertime;
+    snapshot.cptime = cptime;
+    snapshot.lastCkptPos = lastCkptPos;
+    snapshot.lastCkptOri = lastCkptOri;
+    snapshot.offroad_earlier = offroad_earlier;
+}
+
+///
+/// @brief Put the race back as it was when a snapshot was saved
+/// @param [in] snapshot    A snapshot saved by this game
+/// @returns Whether the snapshot could be restored
+/// @retval false           The vehicles changed since, nothing was restored
+///
+bool TriggerGame::restoreSnapshot(const TriggerGameSnapshot &snapshot)
+{
+    if (!sim->restoreSnapshot(snapshot.sim))
+        return false;
+
+    gamestate = snapshot.gamestate;
+    coursetime = snapshot.coursetime;
+    othertime = snapshot.othertime;
+    cptime = snapshot.cptime;
+    lastCkptPos = snapshot.lastCkptPos;
+    lastCkptOri = snapshot.lastCkptOri;
+    offroad_earlier = snapshot.offroad_earlier;
+    return true;
+}
+
+///
+/// @brief Start the race over from the countdown
+/// @details Restores the snapshot taken when the vehicle was chosen, which is
+///  much faster than loading the level again.
+/// @returns Whether the race was restarted
+///
+bool TriggerGame::restart()
+{
+    if (!restoreSnapshot(startsnapshot))
+        return false;
+
+    rewindbuffer.clear();
+    rewindtimer = 0.0f;
+    replay.recordRewind(*sim);
+    return true;
+}
+
+///
+/// @brief Go back to the newest rewind snapshot at least REWIND_MIN_TIME old
+/// @details Newer snapshots are dropped. The one restored is kept, so that
+///  rewinding again right away goes further back.
+/// @returns How many seconds of simulation were undone, 0 if none
+///
+float TriggerGame::rewind()
+{
+    const uint32 now = sim->getStepCount();
+
+    while (!rewindbuffer.empty())
+    {
+        const TriggerGameSnapshot &snapshot = rewindbuffer.back();
+        const float age = (now - snapshot.sim.stepcount) * PSim::timeslice;
+
+        if (age >= REWIND_MIN_TIME)
+        {
+            if (!restoreSnapshot(snapshot))
+                return 0.0f;
+
+            rewindtimer = 0.0f;
+            replay.recordRewind(*sim);
+            return age;
+        }
+
+        rewindbuffer.pop();
+    }
+
+    return 0.0f;
+}
+
+///
+/// @brief Save the inputs of the race so far, replacing the last replay of the level
+/// @details The file goes in the user directory, named after the level like
+///  the ghosts; "trigger-sim --replay" plays it.
+/// @returns Whether the replay could be saved
+///
+bool TriggerGame::saveReplay()
+{
+    std::string filename = levelname + ".replay";
+    std::replace(filename.begin(), filename.end(), '/', '_');
+
+    replay.recordStop(*sim);
+    return replay.save(filename);
+}
+
 ///
 /// @brief Place vehicle at reset position
 ///
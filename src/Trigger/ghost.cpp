@@ -22,29 +22,41 @@
 #include "psim.h"
 #include "vehicle.h"
 #include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <functional>
 #include <istream>
 #include <limits>
 #include <physfs.h>
 #include <ostream>
 #include <sstream>
 
+namespace
+{
+
 ///
-/// @brief Writes a GhostWheel object to an output stream.
-/// @param [in,out] os  Output stream
-/// @param [in] gw      Ghost wheel to be written
-/// @return The output stream
+/// @brief Wheel of a sample of a text ghost file
 ///
-inline std::ostream & operator << (std::ostream &os, const PGhost::GhostWheel &gw)
-{
-  os << ',' << gw.pos.x << ',';
-  os << gw.pos.y << ',';
-  os << gw.pos.z << ',';
-  os << gw.ori.x << ',';
-  os << gw.ori.y << ',';
-  os << gw.ori.z << ',';
-  os << gw.ori.w;
-  return os;
-}
+struct GhostWheel {
+  // Position in world coordinates
+  vec3f pos;
+  // Orientation of the wheel
+  quatf ori;
+};
+
+///
+/// @brief Sample of a text ghost file, only used by PGhost::loadText()
+///
+struct GhostData {
+  // Time stamp in seconds in game time
+  float time;
+  // Position in world coordinates
+  vec3f pos;
+  // Orientation of the vehicle
+  quatf ori;
+  // Status of the wheels
+  std::vector<GhostWheel> wheel;
+};
 
 ///
 /// @brief Reads a GhostData object from an input stream.
@@ -52,7 +64,7 @@ inline std::ostream & operator << (std::ostream &os, const PGhost::GhostWheel &g
 /// @param [out] gd     Ghost data to be read
 /// @returns The input stream
 ///
-inline std::istream & operator >> (std::istream &is, PGhost::GhostData &gd)
+std::istream & operator >> (std::istream &is, GhostData &gd)
 {
   std::string line;
   std::string cell;
@@ -77,7 +89,7 @@ inline std::istream & operator >> (std::istream &is, PGhost::GhostData &gd)
 
     gd.wheel.clear();
     for (unsigned int i = 8; i < result.size(); i = i + 7) {
-      PGhost::GhostWheel gw;
+      GhostWheel gw;
       gw.pos.x = std::stof(result[i]);
       gw.pos.y = std::stof(result[i + 1]);
       gw.pos.z = std::stof(result[i + 2]);
@@ -94,27 +106,237 @@ inline std::istream & operator >> (std::istream &is, PGhost::GhostData &gd)
   return is;
 }
 
+}
+
+//
+// Binary ghost files, all numbers little endian:
+//
+//   "TRGH", uint16 version, uint16 wheels per sample
+//   uint32 samples, uint32 keyframes, float race time of the ghost
+//   uint16 length then the characters of the vehicle name
+//   the keyframes: uint32 sample, uint32 time in ms, then the position of
+//     the vehicle and of each wheel as three int32
+//   the samples, all the same size: uint16 ms since the previous sample,
+//     then for the vehicle and each wheel the change of position since the
+//     previous sample as three int16 and the orientation as a uint32
+//
+// Positions are in 1/GHOST_POSITION_SCALE meters. A keyframe replaces the
+// change of position of its sample; there is one every GHOST_KEYFRAME_SAMPLES
+// samples and one wherever a change doesn't fit 16 bits, as after a reset.
+// Orientations keep the three smallest components of the quaternion in 10
+// bits each and the index of the largest one, which is rebuilt from them.
+//
+// Files without the header are read as the older text format.
+//
+
+#define GHOST_MAGIC             "TRGH"
+#define GHOST_VERSION           1
+#define GHOST_HEADER_SIZE       22
+#define GHOST_POSITION_SCALE    1024.0f
+#define GHOST_KEYFRAME_SAMPLES  64
+#define GHOST_SQRT2             1.41421356f
+
+// samples read or written at once
+#define GHOST_CHUNK_SAMPLES     256
+
+// ghosts played back at once
+#define GHOST_MAX_REPLAYS       8
+
+// samples the playback cursor steps forward before it searches instead
+#define GHOST_CURSOR_STEPS      4
+
+static void putU16(uint8 *&out, uint32 value)
+{
+  *out++ = value & 0xff;
+  *out++ = (value >> 8) & 0xff;
+}
+
+static void putU32(uint8 *&out, uint32 value)
+{
+  putU16(out, value & 0xffff);
+  putU16(out, value >> 16);
+}
+
+static uint32 getU16(const uint8 *&in)
+{
+  const uint32 value = in[0] | (in[1] << 8);
+  in += 2;
+  return value;
+}
+
+static uint32 getU32(const uint8 *&in)
+{
+  const uint32 low = getU16(in);
+  return low | (getU16(in) << 16);
+}
+
+static int32 quantizePosition(float value)
+{
+  return lround(value * GHOST_POSITION_SCALE);
+}
+
+///
+/// @brief Packs a unit quaternion into 32 bits, smallest three style
+/// @param [in] q       Quaternion, q and -q being the same orientation
+/// @returns The index of the largest component in the top two bits, then
+///  the other three, scaled from [-1/sqrt(2), 1/sqrt(2)] to 10 bits each
+///
+static uint32 packOrientation(const quatf &q)
+{
+  const float c[4] = { q.x, q.y, q.z, q.w };
+  unsigned int largest = 0;
+
+  for (unsigned int i = 1; i < 4; ++i)
+    if (fabsf(c[i]) > fabsf(c[largest]))
+      largest = i;
+
+  // the largest component is rebuilt as positive
+  const float sign = c[largest] < 0.0f ? -1.0f : 1.0f;
+  uint32 bits = largest << 30;
+  int shift = 20;
+
+  for (unsigned int i = 0; i < 4; ++i) {
+    if (i == largest) continue;
+
+    long v = lround((c[i] * sign * GHOST_SQRT2 + 1.0f) * 0.5f * 1023.0f);
+    CLAMP(v, 0L, 1023L);
+    bits |= uint32(v) << shift;
+    shift -= 10;
+  }
+
+  return bits;
+}
+
+///
+/// @brief Unpacks a quaternion packed by packOrientation()
+/// @param [in] bits    Packed quaternion
+/// @param [in] prev    Orientation of the previous sample; the result is
+///                     flipped to its side so that the two interpolate
+/// @returns The quaternion
+///
+static quatf unpackOrientation(uint32 bits, const quatf &prev)
+{
+  const unsigned int largest = bits >> 30;
+  float c[4];
+  float sumsq = 0.0f;
+  int shift = 20;
+
+  for (unsigned int i = 0; i < 4; ++i) {
+    if (i == largest) continue;
+
+    c[i] = (((bits >> shift) & 1023) / 1023.0f * 2.0f - 1.0f) / GHOST_SQRT2;
+    sumsq += c[i] * c[i];
+    shift -= 10;
+  }
+
+  c[largest] = sqrtf(std::max(1.0f - sumsq, 0.0f));
+
+  quatf q(c[0], c[1], c[2], c[3]);
+
+  if (q.dot(prev) < 0.0f)
+    q = q * -1.0f;
+
+  return q;
+}
+
+///
+/// @brief Drops all samples.
+/// @param [in] wheels  Wheels per sample from now on
+///
+void PGhost::GhostTrack::clear(unsigned int wheels)
+{
+  wheelcount = wheels;
+  time.clear();
+  pos.clear();
+  ori.clear();
+  wheelpos.clear();
+  wheelori.clear();
+}
+
+///
+/// @brief Makes room for samples, so that adding them doesn't allocate.
+/// @param [in] samples Total number of samples
+///
+void PGhost::GhostTrack::reserve(unsigned int samples)
+{
+  time.reserve(samples);
+  pos.reserve(samples);
+  ori.reserve(samples);
+  wheelpos.reserve(samples * wheelcount);
+  wheelori.reserve(samples * wheelcount);
+}
+
+///
+/// @brief Adds a sample; its wheels are left to be filled in.
+/// @param [in] newtime Time stamp in seconds
+/// @param [in] newpos  Position of the vehicle
+/// @param [in] newori  Orientation of the vehicle
+///
+void PGhost::GhostTrack::push(float newtime, const vec3f &newpos, const quatf &newori)
+{
+  time.push_back(newtime);
+  pos.push_back(newpos);
+  ori.push_back(newori);
+  wheelpos.resize(wheelpos.size() + wheelcount, vec3f::zero());
+  wheelori.resize(wheelori.size() + wheelcount, quatf::identity());
+}
+
+///
+/// @brief Drops the last sample.
+///
+void PGhost::GhostTrack::popBack()
+{
+  if (time.empty())
+    return;
+
+  time.pop_back();
+  pos.pop_back();
+  ori.pop_back();
+  wheelpos.resize(time.size() * wheelcount);
+  wheelori.resize(time.size() * wheelcount);
+}
+
 ///
-/// @brief Writes a GhostData object to an output stream.
-/// @param [in,out] os  Output stream
-/// @param [in] gd      Ghost data to be written
-/// @returns The output stream
+/// @brief Moves a cursor to the last sample at or before a time.
+/// @details Steps forward up to GHOST_CURSOR_STEPS samples, which is all it
+///  takes frame to frame; after a rewind or a long frame the sample is
+///  found by binary search.
+/// @param [in] racetime    Time, no earlier than the first sample
+/// @param [in] cursor      Sample the cursor was on
+/// @returns The last sample at or before racetime
 ///
-inline std::ostream & operator << (std::ostream &os, const PGhost::GhostData &gd)
+unsigned int PGhost::GhostTrack::seek(float racetime, unsigned int cursor) const
 {
-  os << gd.time << ',';
-  os << gd.pos.x << ',';
-  os << gd.pos.y << ',';
-  os << gd.pos.z << ',';
-  os << gd.ori.x << ',';
-  os << gd.ori.y << ',';
-  os << gd.ori.z << ',';
-  os << gd.ori.w;
-  for (unsigned int i = 0; i < gd.wheel.size(); ++i) {
-    os << gd.wheel[i];
+  unsigned int steps = 0;
+
+  if (cursor < time.size() && time[cursor] <= racetime) {
+    while (cursor + 1 < time.size() && time[cursor + 1] <= racetime && steps < GHOST_CURSOR_STEPS) {
+      ++cursor;
+      ++steps;
+    }
   }
-  os << std::endl;
-  return os;
+
+  if (cursor >= time.size() || time[cursor] > racetime ||
+    (cursor + 1 < time.size() && time[cursor + 1] <= racetime))
+    cursor = std::upper_bound(time.begin(), time.end(), racetime) - time.begin() - 1;
+
+  return cursor;
+}
+
+///
+/// @brief Makes a name usable in a file name.
+/// @param [in] name    Player or class name
+/// @returns The name with anything but letters and digits replaced by '_'
+///
+static std::string fileSafe(const std::string &name)
+{
+  std::string result(name);
+
+  for (char &c : result)
+    if (!isalnum(static_cast<unsigned char>(c)))
+      c = '_';
+
+  return result;
 }
 
 ///
@@ -122,65 +344,291 @@ inline std::ostream & operator << (std::ostream &os, const PGhost::GhostData &gd
 /// @param [in] sampletime  Time in seconds after which ghost is sampled
 ///
 PGhost::PGhost(float sampletime) :
-    mapname(""),
+    besttime(std::numeric_limits<float>::max()),
+    playertime(std::numeric_limits<float>::max()),
+    classtime(std::numeric_limits<float>::max()),
     vehiclename(""),
     sampletime(sampletime),
     lastsample(std::numeric_limits<float>::lowest()),
-    recordeddata(std::vector<GhostData>()),
-    replaydata(std::vector<GhostData>()),
-    racetime(0.0f),
-    replayvehicle(""),
-    replaytime(std::numeric_limits<float>::max())
+    racetime(0.0f)
 {
 }
 
 ///
 /// @brief Start recording the next race for later replay
-/// @param [in] map     Name of the map to store ghost data
-/// @param [in] vehicle Name of the vehicle on the race
+/// @details Loads the ghosts to race against: the best of the map, the best
+///  of the player, the best of the class of the vehicle and the bests of the
+///  other players, skipping any that is the same race as one already loaded.
+/// @param [in] map             Name of the map to store ghost data
+/// @param [in] vehicle         Name of the vehicle on the race
+/// @param [in] player          Name of the player
+/// @param [in] carclass        Class of the vehicle
+/// @param [in] otherplayers    Players whose ghosts to show too
 ///
-void PGhost::recordStart(const std::string &map, const std::string &vehicle)
+void PGhost::recordStart(const std::string &map, const std::string &vehicle,
+  const std::string &player, const std::string &carclass,
+  const std::vector<std::string> &otherplayers)
 {
-  PHYSFS_File *physfile = nullptr;
-  std::string readdata = "";
-  std::istringstream inputstream;
-  GhostData data;
-  std::string replaytimestring;
+  std::string base = map;
+  std::replace(base.begin(), base.end(), '/', '_');
 
-  mapname = map + ".ghost";
-  std::replace(mapname.begin(), mapname.end(), '/', '_');
+  bestfile = base + ".ghost";
+  playerfile = player.empty() ? "" : base + ".player." + fileSafe(player) + ".ghost";
+  classfile = carclass.empty() ? "" : base + ".class." + fileSafe(carclass) + ".ghost";
 
   vehiclename = vehicle;
   lastsample = std::numeric_limits<float>::lowest();
-  recordeddata.clear();
-  replaydata.clear();
+  recordeddata.clear(0);
+  replay.clear();
   racetime = 0.0f;
-  replayvehicle = "";
-  replaytime = std::numeric_limits<float>::max();
 
-  if (PHYSFS_isInit() == 0)
-    return;
+  besttime = loadReplay(bestfile);
+  playertime = loadReplay(playerfile);
+  classtime = loadReplay(classfile);
 
-  physfile = PHYSFS_openRead(mapname.c_str());
+  for (const std::string &other : otherplayers) {
+    if (replay.size() >= GHOST_MAX_REPLAYS)
+      break;
+
+    if (other != player)
+      loadReplay(base + ".player." + fileSafe(other) + ".ghost");
+  }
+}
+
+///
+/// @brief Adds the ghost of a file to those played back.
+/// @param [in] filename    Ghost file, binary or text
+/// @returns The race time of the ghost, or the largest float if there is none
+///
+float PGhost::loadReplay(const std::string &filename)
+{
+  PHYSFS_File *physfile = nullptr;
+  char magic[sizeof(GHOST_MAGIC) - 1];
+
+  if (filename.empty() || PHYSFS_isInit() == 0)
+    return std::numeric_limits<float>::max();
+
+  physfile = PHYSFS_openRead(filename.c_str());
   if (physfile == nullptr)
-    return;
+    return std::numeric_limits<float>::max();
+
+  const bool binary = physfs_read(physfile, magic, sizeof(magic), 1) == 1 &&
+    !memcmp(magic, GHOST_MAGIC, sizeof(magic));
+
+  PHYSFS_seek(physfile, 0);
+
+  replay.emplace_back();
+
+  const bool loaded = binary ? loadBinary(physfile, replay.back()) : loadText(physfile, replay.back());
+
+  PHYSFS_close(physfile);
+
+  if (!loaded) {
+    PUtil::outLog() << "Invalid data format in \"" << filename << "\"" << std::endl;
+    replay.pop_back();
+    return std::numeric_limits<float>::max();
+  }
+
+  const float time = replay.back().time;
+
+  // the best of the map is often also the best of the player and of the class
+  for (unsigned int i = 0; i + 1 < replay.size(); ++i) {
+    if (replay[i].time == time && replay[i].vehicle == replay.back().vehicle) {
+      replay.pop_back();
+      break;
+    }
+  }
+
+  if (replay.size() > GHOST_MAX_REPLAYS)
+    replay.pop_back();
+
+  return time;
+}
+
+///
+/// @brief Loads the replay from a binary ghost file.
+/// @param [in] physfile    File, at its start
+/// @param [out] out        Ghost read
+/// @returns Whether the file was read whole
+///
+bool PGhost::loadBinary(PHYSFS_File *physfile, GhostReplay &out) const
+{
+  const PHYSFS_sint64 filelength = PHYSFS_fileLength(physfile);
+
+  if (filelength < 0)
+    return false;
+
+  return readBinary([physfile] (uint8 *data, uint32 size) {
+    return physfs_read(physfile, data, size, 1) == 1;
+  }, filelength, out);
+}
+
+///
+/// @brief Decodes a binary ghost file.
+/// @details The samples are read GHOST_CHUNK_SAMPLES at a time into one
+///  buffer and decoded straight into the track, sized up front.
+/// @param [in] read        Reads the next so many bytes of the file,
+///                         returns false if there aren't as many
+/// @param [in] length      Size of the whole file
+/// @param [out] out        Ghost read
+/// @returns Whether the file was read whole, false too if its header
+///  counts more samples than the file holds
+///
+bool PGhost::readBinary(const std::function<bool (uint8 *, uint32)> &read,
+  uint64_t length, GhostReplay &out)
+{
+  uint8 header[GHOST_HEADER_SIZE];
+
+  if (!read(header, sizeof(header)))
+    return false;
+
+  const uint8 *in = header + sizeof(GHOST_MAGIC) - 1;
+  const uint32 version = getU16(in);
+  const uint32 wheels = getU16(in);
+  const uint32 samples = getU32(in);
+  const uint32 keyframes = getU32(in);
+  const uint32 timebits = getU32(in);
+  const uint32 namelength = getU16(in);
+
+  if (version != GHOST_VERSION || (samples > 0 && keyframes == 0) || keyframes > samples)
+    return false;
+
+  const unsigned int parts = 1 + wheels;
+  const unsigned int keyframesize = 8 + 12 * parts;
+  const unsigned int samplesize = 2 + 10 * parts;
+
+  // the counts must fit in the file before anything is sized from them
+  const uint64_t bodysize = namelength +
+    (uint64_t)keyframes * keyframesize + (uint64_t)samples * samplesize;
+
+  if (length < GHOST_HEADER_SIZE || bodysize > length - GHOST_HEADER_SIZE)
+    return false;
+
+  std::string name(namelength, '\0');
+  if (namelength > 0 && !read((uint8 *)&name.front(), namelength))
+    return false;
+
+  std::vector<uint8> keyframedata(keyframes * keyframesize);
+  if (keyframes > 0 && !read(keyframedata.data(), keyframes * keyframesize))
+    return false;
+
+  std::vector<uint8> chunk(GHOST_CHUNK_SAMPLES * samplesize);
+
+  // decoded position of the vehicle and of each wheel, and time, in file units
+  std::vector<int32> position(3 * parts, 0);
+  uint32 timems = 0;
+
+  const uint8 *nextkeyframe = keyframedata.data();
+  uint32 keyframesleft = keyframes;
+
+  GhostTrack &track = out.track;
+
+  track.clear(wheels);
+  track.reserve(samples);
+
+  for (uint32 first = 0; first < samples; first += GHOST_CHUNK_SAMPLES) {
+    const uint32 count = std::min<uint32>(samples - first, GHOST_CHUNK_SAMPLES);
+
+    if (!read(chunk.data(), count * samplesize))
+      return false;
+
+    in = chunk.data();
+
+    for (uint32 s = first; s < first + count; ++s) {
+      const uint32 dt = getU16(in);
+      bool keyframe = false;
+
+      if (keyframesleft > 0) {
+        const uint8 *k = nextkeyframe;
+
+        if (getU32(k) == s) {
+          timems = getU32(k);
+
+          for (unsigned int i = 0; i < 3 * parts; ++i)
+            position[i] = getU32(k);
+
+          nextkeyframe = k;
+          --keyframesleft;
+          keyframe = true;
+        }
+      }
+
+      // the first sample has nothing to start from
+      if (s == 0 && !keyframe)
+        return false;
+
+      if (!keyframe)
+        timems += dt;
+
+      for (unsigned int p = 0; p < parts; ++p) {
+        int32 *v = &position[3 * p];
+
+        for (unsigned int i = 0; i < 3; ++i) {
+          const int16 delta = getU16(in);
+          if (!keyframe) v[i] += delta;
+        }
+
+        const vec3f newpos = vec3f(v[0], v[1], v[2]) * (1.0f / GHOST_POSITION_SCALE);
+        const uint32 bits = getU32(in);
+
+        if (p == 0) {
+          const quatf prev = s > 0 ? track.ori.back() : quatf::identity();
+          track.push(timems * 0.001f, newpos, unpackOrientation(bits, prev));
+        } else {
+          const unsigned int w = s * wheels + p - 1;
+          const quatf prev = s > 0 ? track.wheelori[w - wheels] : quatf::identity();
+          track.wheelpos[w] = newpos;
+          track.wheelori[w] = unpackOrientation(bits, prev);
+        }
+      }
+    }
+  }
+
+  out.vehicle = name;
+  memcpy(&out.time, &timebits, sizeof(out.time));
+  return true;
+}
+
+///
+/// @brief Loads the replay from a text ghost file, of older versions.
+/// @param [in] physfile    File, at its start
+/// @param [out] out        Ghost read
+/// @returns Whether the file was read whole
+///
+bool PGhost::loadText(PHYSFS_File *physfile, GhostReplay &out) const
+{
+  std::string readdata(PHYSFS_fileLength(physfile), '\0');
+  std::string replaytimestring;
+  GhostData data;
+  GhostTrack &track = out.track;
 
-  readdata = std::string(PHYSFS_fileLength(physfile), '\0');
   physfs_read(physfile, &readdata.front(), sizeof(char), readdata.size());
 
-  inputstream = std::istringstream(readdata);
-  std::getline(inputstream, replayvehicle, ',');
+  std::istringstream inputstream(readdata);
+  std::getline(inputstream, out.vehicle, ',');
   std::getline(inputstream, replaytimestring);
   try {
-    replaytime = std::stof(replaytimestring);
+    out.time = std::stof(replaytimestring);
 
-    while (inputstream >> data)
-      replaydata.push_back(data);
-    PHYSFS_close(physfile);
+    while (inputstream >> data) {
+      if (track.size() == 0)
+        track.clear(data.wheel.size());
+
+      track.push(data.time, data.pos, data.ori);
+
+      const unsigned int first = (track.size() - 1) * track.wheelcount;
+
+      for (unsigned int i = 0; i < track.wheelcount && i < data.wheel.size(); ++i) {
+        track.wheelpos[first + i] = data.wheel[i].pos;
+        track.wheelori[first + i] = data.wheel[i].ori;
+      }
+    }
   }
   catch (...) {
-    PUtil::outLog() << "Invalid data format in *.ghost file." << std::endl;
+    return false;
   }
+
+  return true;
 }
 
 ///
@@ -194,85 +642,289 @@ void PGhost::recordSample(float delta, const PVehiclePart &part)
 
   racetime += delta;
   if (firstsample || racetime >= lastsample + sampletime) {
-    GhostData data;
+    if (recordeddata.size() == 0)
+      recordeddata.clear(part.wheel.size());
 
     lastsample = racetime;
-    data.time = racetime;
-    data.pos = part.ref_world.getPosition();
-    data.ori = part.ref_world.getOrientation();
-    for (unsigned int i = 0; i < part.wheel.size(); ++i) {
-      GhostWheel wheel;
-
-      wheel.pos = part.wheel[i].ref_world.getPosition();
-      wheel.ori = part.wheel[i].ref_world.getOrientation();
-      data.wheel.push_back(wheel);
+    recordeddata.push(racetime, part.ref_world.getPosition(), part.ref_world.getOrientation());
+
+    const unsigned int first = (recordeddata.size() - 1) * recordeddata.wheelcount;
+
+    for (unsigned int i = 0; i < recordeddata.wheelcount && i < part.wheel.size(); ++i) {
+      recordeddata.wheelpos[first + i] = part.wheel[i].ref_world.getPosition();
+      recordeddata.wheelori[first + i] = part.wheel[i].ref_world.getOrientation();
     }
-    recordeddata.push_back(data);
   }
 }
 
 ///
-/// @brief Store ghost at end of the race if best time achieved.
+/// @brief Drops the end of the recording after the race was rewound.
+/// @param [in] seconds Race time that was undone
+///
+void PGhost::recordRewind(float seconds)
+{
+  racetime = std::max(racetime - seconds, 0.0f);
+
+  while (recordeddata.size() > 0 && recordeddata.time.back() > racetime)
+    recordeddata.popBack();
+
+  if (recordeddata.size() == 0)
+    lastsample = std::numeric_limits<float>::lowest();
+  else
+    lastsample = recordeddata.time.back();
+}
+
+///
+/// @brief Store ghost at end of the race as each of the bests it beats.
 /// @param [in] time    Time achieved during race in seconds
 ///
 void PGhost::recordStop(float time)
 {
-  if (time <= replaytime) {
-    PHYSFS_File *physfile = nullptr;
-    std::ostringstream outputstream;
+  if (PHYSFS_isInit() == 0)
+    return;
+
+  saveIfBest(bestfile, besttime, time);
+  saveIfBest(playerfile, playertime, time);
+  saveIfBest(classfile, classtime, time);
+}
+
+///
+/// @brief Writes the recording to a ghost file if the race beat its ghost.
+/// @param [in] filename    Ghost file
+/// @param [in] besttime    Race time of the ghost in the file
+/// @param [in] time        Race time achieved
+///
+void PGhost::saveIfBest(const std::string &filename, float besttime, float time) const
+{
+  PHYSFS_File *physfile = nullptr;
+
+  if (filename.empty() || time > besttime)
+    return;
 
-    if (mapname.empty())
-      return;
-    if (PHYSFS_isInit() == 0)
-      return;
+  physfile = PHYSFS_openWrite(filename.c_str());
+  if (physfile == nullptr)
+    return;
 
-    physfile = PHYSFS_openWrite(mapname.c_str());
-    if (physfile == nullptr)
-      return;
+  if (!saveBinary(physfile, time))
+    PUtil::outLog() << "Failed to write \"" << filename << "\"" << std::endl;
 
-    outputstream << vehiclename << ',' << time << std::endl;
-    for (const GhostData &data: recordeddata)
-      outputstream << data;
+  PHYSFS_close(physfile);
+}
 
-    physfs_write(physfile, outputstream.str().data(), sizeof(char), outputstream.str().size());
-    PHYSFS_close(physfile);
-  }
+///
+/// @brief Writes the recording as a binary ghost file.
+/// @param [in] physfile    File, empty
+/// @param [in] time        Race time achieved
+/// @returns Whether everything was written
+///
+bool PGhost::saveBinary(PHYSFS_File *physfile, float time) const
+{
+  return writeBinary(recordeddata, vehiclename, time, [physfile] (const uint8 *data, uint32 size) {
+    return physfs_write(physfile, data, size, 1) == 1;
+  });
 }
 
 ///
-/// @brief Get ghost state based on current race time.
-/// @param [out] data       Ghost position and orientation
-/// @param [out] vehicle    Name of the ghost vehicle
-/// @returns Data returned in output arguments is valid
+/// @brief Encodes a track as a binary ghost file.
+/// @details The keyframes are found first, then the samples are encoded
+///  GHOST_CHUNK_SAMPLES at a time into one buffer and handed over.
+/// @param [in] track       Samples to write
+/// @param [in] vehicle     Name of the vehicle
+/// @param [in] time        Race time achieved
+/// @param [in] write       Writes the next bytes of the file, returns false
+///                         if it couldn't
+/// @returns Whether everything was written
 ///
-bool PGhost::getReplayData(GhostData &data, std::string &vehicle) const
+bool PGhost::writeBinary(const GhostTrack &track, const std::string &vehicle, float time,
+  const std::function<bool (const uint8 *, uint32)> &write)
 {
-  vehicle = replayvehicle;
+  const uint32 samples = track.size();
+  const uint32 wheels = track.wheelcount;
+  const unsigned int parts = 1 + wheels;
+  const unsigned int keyframesize = 8 + 12 * parts;
+  const unsigned int samplesize = 2 + 10 * parts;
+
+  // quantized positions of the vehicle then its wheels, of one sample
+  std::vector<int32> position(3 * parts);
+  std::vector<int32> prevposition(3 * parts);
 
-  for(unsigned int i = 0; i < replaydata.size(); ++i) {
-    if (i == replaydata.size()-1 && racetime >= replaydata[i].time) {
-      data = replaydata[i];
-      return true;
+  const auto quantizeSample = [&] (uint32 s, std::vector<int32> &out) {
+    for (unsigned int p = 0; p < parts; ++p) {
+      const vec3f &v = p == 0 ? track.pos[s] : track.wheelpos[s * wheels + p - 1];
+
+      out[3 * p] = quantizePosition(v.x);
+      out[3 * p + 1] = quantizePosition(v.y);
+      out[3 * p + 2] = quantizePosition(v.z);
     }
-    else if (racetime >= replaydata[i].time && racetime < replaydata[i+1].time) {
-      float interptime = 0.0f;
+  };
 
-      if (replaydata[i+1].time - replaydata[i].time != 0.0f)
-        interptime = (racetime - replaydata[i].time) / (replaydata[i+1].time - replaydata[i].time);
+  const auto sampleMs = [&] (uint32 s) -> uint32 {
+    return std::max(lround(track.time[s] * 1000.0f), 0L);
+  };
 
-      data.time = racetime;
-      data.pos = INTERP(replaydata[i].pos, replaydata[i+1].pos, interptime);
-      data.ori = INTERP(replaydata[i].ori, replaydata[i+1].ori, interptime);
+  // samples starting over from absolute positions
+  std::vector<uint32> keyframe;
 
-      for (unsigned int j = 0; j < replaydata[i].wheel.size(); ++j) {
-        GhostWheel wheel;
+  for (uint32 s = 0; s < samples; ++s) {
+    quantizeSample(s, position);
 
-        wheel.pos = INTERP(replaydata[i].wheel[j].pos, replaydata[i+1].wheel[j].pos, interptime);
-        wheel.ori = INTERP(replaydata[i].wheel[j].ori, replaydata[i+1].wheel[j].ori, interptime);
-        data.wheel.push_back(wheel);
-      }
-      return true;
+    bool fits = s % GHOST_KEYFRAME_SAMPLES != 0;
+
+    for (unsigned int i = 0; fits && i < 3 * parts; ++i)
+      fits = abs(position[i] - prevposition[i]) <= std::numeric_limits<int16>::max();
+
+    if (!fits)
+      keyframe.push_back(s);
+
+    prevposition.swap(position);
+  }
+
+  std::vector<uint8> chunk(GHOST_CHUNK_SAMPLES * std::max(keyframesize, samplesize) +
+    GHOST_HEADER_SIZE + vehicle.size());
+  uint8 *out = chunk.data();
+
+  const auto flush = [&] () -> bool {
+    const PHYSFS_uint32 size = out - chunk.data();
+    out = chunk.data();
+    return size == 0 || write(chunk.data(), size);
+  };
+
+  uint32 timebits;
+  memcpy(&timebits, &time, sizeof(timebits));
+
+  memcpy(out, GHOST_MAGIC, sizeof(GHOST_MAGIC) - 1);
+  out += sizeof(GHOST_MAGIC) - 1;
+  putU16(out, GHOST_VERSION);
+  putU16(out, wheels);
+  putU32(out, samples);
+  putU32(out, keyframe.size());
+  putU32(out, timebits);
+  putU16(out, vehicle.size());
+  memcpy(out, vehicle.data(), vehicle.size());
+  out += vehicle.size();
+
+  if (!flush())
+    return false;
+
+  for (uint32 k = 0; k < keyframe.size(); ++k) {
+    quantizeSample(keyframe[k], position);
+
+    putU32(out, keyframe[k]);
+    putU32(out, sampleMs(keyframe[k]));
+
+    for (unsigned int i = 0; i < 3 * parts; ++i)
+      putU32(out, position[i]);
+
+    if ((k + 1) % GHOST_CHUNK_SAMPLES == 0 && !flush())
+      return false;
+  }
+
+  if (!flush())
+    return false;
+
+  // the time as the reader will add it up, so that rounding doesn't drift
+  uint32 timems = 0;
+  uint32 nextkeyframe = 0;
+
+  for (uint32 s = 0; s < samples; ++s) {
+    quantizeSample(s, position);
+
+    const bool iskeyframe = nextkeyframe < keyframe.size() && keyframe[nextkeyframe] == s;
+
+    if (iskeyframe) {
+      ++nextkeyframe;
+      timems = sampleMs(s);
+      putU16(out, 0);
+    } else {
+      const uint32 dt = std::min<uint32>(std::max<int32>(sampleMs(s) - timems, 0), 0xffff);
+      timems += dt;
+      putU16(out, dt);
+    }
+
+    for (unsigned int p = 0; p < parts; ++p) {
+      for (unsigned int i = 3 * p; i < 3 * p + 3; ++i)
+        putU16(out, iskeyframe ? 0 : uint16(position[i] - prevposition[i]));
+
+      putU32(out, packOrientation(p == 0 ? track.ori[s] : track.wheelori[s * wheels + p - 1]));
+    }
+
+    prevposition.swap(position);
+
+    if ((s + 1) % GHOST_CHUNK_SAMPLES == 0 && !flush())
+      return false;
+  }
+
+  return flush();
+}
+
+///
+/// @brief Get the poses of all the ghosts at the current race time.
+/// @details Each ghost keeps a cursor on its last sample at or before the
+///  race time. As the race goes on it steps forward a sample or two per
+///  frame, so finding the samples costs the same whatever the length of the
+///  race; after a rewind or a long frame it is found by binary search.
+///  The poses are then interpolated in one pass over all the ghosts, and
+///  one over all their wheels. Ghosts whose race hasn't started yet are
+///  left out; those whose race is over hold their last sample.
+/// @param [out] poses  Poses of the ghosts
+///
+void PGhost::getReplayPoses(GhostPoses &poses)
+{
+  unsigned int count = 0;
+  unsigned int wheels = 0;
+
+  posesample.resize(replay.size());
+  posenext.resize(replay.size());
+  posefactor.resize(replay.size());
+  poses.ghost.resize(replay.size());
+  poses.wheelfirst.resize(replay.size());
+
+  for (unsigned int g = 0; g < replay.size(); ++g) {
+    GhostReplay &r = replay[g];
+    const std::vector<float> &time = r.track.time;
+    unsigned int &cursor = r.cursor;
+
+    if (time.empty() || racetime < time.front())
+      continue;
+
+    cursor = r.track.seek(racetime, cursor);
+
+    const unsigned int next = std::min<unsigned int>(cursor + 1, time.size() - 1);
+
+    posesample[count] = cursor;
+    posenext[count] = next;
+    posefactor[count] = time[next] > time[cursor] ?
+      (racetime - time[cursor]) / (time[next] - time[cursor]) : 0.0f;
+    poses.ghost[count] = g;
+    poses.wheelfirst[count] = wheels;
+    wheels += r.track.wheelcount;
+    ++count;
+  }
+
+  poses.ghost.resize(count);
+  poses.wheelfirst.resize(count);
+  poses.pos.resize(count);
+  poses.ori.resize(count);
+  poses.wheelpos.resize(wheels);
+  poses.wheelori.resize(wheels);
+
+  for (unsigned int k = 0; k < count; ++k) {
+    const GhostTrack &track = replay[poses.ghost[k]].track;
+
+    poses.pos[k] = INTERP(track.pos[posesample[k]], track.pos[posenext[k]], posefactor[k]);
+    poses.ori[k] = INTERP(track.ori[posesample[k]], track.ori[posenext[k]], posefactor[k]);
+  }
+
+  for (unsigned int k = 0; k < count; ++k) {
+    const GhostTrack &track = replay[poses.ghost[k]].track;
+    const unsigned int wc = track.wheelcount;
+    const unsigned int sample = posesample[k] * wc;
+    const unsigned int next = posenext[k] * wc;
+    const unsigned int first = poses.wheelfirst[k];
+
+    for (unsigned int j = 0; j < wc; ++j) {
+      poses.wheelpos[first + j] = INTERP(track.wheelpos[sample + j], track.wheelpos[next + j], posefactor[k]);
+      poses.wheelori[first + j] = INTERP(track.wheelori[sample + j], track.wheelori[next + j], posefactor[k]);
     }
   }
-  return false;
 }
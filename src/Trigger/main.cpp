@@ -14,6 +14,7 @@
 
 #include <cctype>
 #include <regex>
+#include <sstream>
 
 void MainApp::config()
 {
@@ -21,6 +22,8 @@ void MainApp::config()
 
     cfg.loadConfig();
     setScreenMode(cfg.getVideoCx(), cfg.getVideoCy(), cfg.getVideoFullscreen());
+    setTimeScale(cfg.getTimeScale());
+    setMaxThroughput(cfg.getMaxThroughput());
     calcScreenRatios();
 
     if (cfg.getDatadirs().empty())
@@ -590,8 +593,7 @@ bool MainApp::startGame(const std::string &filename)
     appstate = AS_CHOOSE_VEHICLE;
   } else {
     game->chooseVehicle(game->vehiclechoices[choose_type]);
-    if (cfg.getEnableGhost())
-      ghost.recordStart(filename, game->vehiclechoices[choose_type]->getName());
+    startGhost(*game->vehiclechoices[choose_type]);
 
     if (lss.state == AM_TOP_LVL_PREP)
     {
@@ -637,6 +639,56 @@ bool MainApp::startGame(const std::string &filename)
   return true;
 }
 
+///
+/// @brief Starts the current race over, without loading the level again
+///
+void MainApp::restartGame()
+{
+  if (!game->restart())
+    return;
+
+  startGhost(*game->vehicle[0]->type);
+}
+
+///
+/// @brief Starts recording the ghost of the race and loads those to race against
+/// @param vehicle = vehicle of the player
+///
+void MainApp::startGhost(const PVehicleType &vehicle)
+{
+  if (!cfg.getEnableGhost())
+    return;
+
+  ghost.recordStart(race_data.mapname, vehicle.getName(), cfg.getPlayername(),
+    vehicle.proper_class, best_times.getPlayerNames(race_data.mapname));
+
+  ghosttypes.assign(ghost.getReplayCount(), nullptr);
+  ghostparts.resize(ghost.getReplayCount());
+
+  // Theoretically there can be multiple vehicles with multiple parts.
+  // However, the assumption is, that the model of the first part is relevant.
+  for (unsigned int g = 0; g < ghost.getReplayCount(); ++g) {
+    for (unsigned int i = 0; i < game->vehiclechoices.size(); ++i) {
+      if (game->vehiclechoices[i]->getName() == ghost.getReplay(g).vehicle) {
+        ghosttypes[g] = game->vehiclechoices[i];
+        ghostparts[g].wheel.resize(game->vehiclechoices[i]->part[0].wheel.size());
+        break;
+      }
+    }
+  }
+}
+
+///
+/// @brief Takes the current race a second or more back
+///
+void MainApp::rewindGame()
+{
+  const float seconds = game->rewind();
+
+  if (seconds > 0.0f && cfg.getEnableGhost())
+    ghost.recordRewind(seconds);
+}
+
 ///
 /// @brief Turns game sound effects on or off.
 /// @note Codriver voice unaffected.
@@ -725,6 +777,13 @@ void MainApp::endGame(Gamefinish state)
     ghost.recordStop(race_data.totaltime);
   }
 
+  if (state != Gamefinish::not_finished) {
+    if (cfg.getSaveReplays())
+      game->saveReplay();
+
+    writeRaceReport(state);
+  }
+
   if (audinst_engine) {
     delete audinst_engine;
     audinst_engine = nullptr;
@@ -746,6 +805,14 @@ void MainApp::endGame(Gamefinish state)
   audinst.clear();
 
   if (game) {
+#ifdef PSIM_COUNT_ALLOCATIONS
+    const PSimAllocations &allocations = game->sim->getAllocations();
+
+    PUtil::outLog() << "Simulation allocations: " << allocations.allocations << " in "
+      << allocations.steps << " steps, " << allocations.tileallocations << " in "
+      << allocations.tilesteps << " steps generating tiles" << std::endl;
+#endif
+
     delete game;
     game = nullptr;
   }
@@ -753,6 +820,47 @@ void MainApp::endGame(Gamefinish state)
   finishRace(state, coursetime);
 }
 
+///
+/// @brief Appends the result of a finished race to the race report, if any
+/// @details One line per race, of space separated key=value fields, in the
+///  file named by the "racereport" parameter in the user directory.
+/// @param state        How the race finished
+///
+void MainApp::writeRaceReport(Gamefinish state)
+{
+  if (cfg.getRaceReport().empty())
+    return;
+
+  PHYSFS_file *pfile = PHYSFS_openAppend(cfg.getRaceReport().c_str());
+
+  if (pfile == nullptr) {
+    PUtil::outLog() << "Failed to write race report \"" << cfg.getRaceReport() << "\"" << std::endl
+      << "PhysFS: " << physfs_getErrorString() << std::endl;
+    return;
+  }
+
+  const PVehicle *vehic = game->uservehicle;
+  std::ostringstream line;
+
+  line << "level=" << race_data.mapname
+    << " vehicle=" << vehic->type->getName()
+    << " result=" << (state == Gamefinish::pass ? "pass" : "fail")
+    << " lap=" << vehic->currentlap
+    << " coursetime=" << game->coursetime
+    << " offroadtime=" << vehic->offroadtime_total
+    << " totaltime=" << game->coursetime + vehic->offroadtime_total * game->offroadtime_penalty_multiplier
+    << " timescale=";
+
+  if (getMaxThroughput())
+    line << "max\n";
+  else
+    line << getTimeScale() << "\n";
+
+  const std::string text = line.str();
+  physfs_write(pfile, text.data(), sizeof(char), text.size());
+  PHYSFS_close(pfile);
+}
+
 ///
 /// @brief Calculate screen ratios from the current screen width and height.
 /// @details Sets `hratio` and `vratio` member data in accordance to the values of
@@ -1043,8 +1151,12 @@ void MainApp::tickStateGame(float delta)
 
   campos_prev = campos;
 
+  // follow the same interpolated pose the car is drawn with
+  PReferenceFrame rf_interp;
+  rf_interp.setInterpolated(vehic->getBody().getPrevious(), vehic->getBody().getFrame(), game->sim->getInterpolation());
+
   //PReferenceFrame *rf = &vehic->part[2].ref_world;
-  PReferenceFrame *rf = &vehic->getBody();
+  PReferenceFrame *rf = &rf_interp;
 
   vec3f forw = makevec3f(rf->getOrientationMatrix().row[0]);
   float forwangle = atan2(forw.y, forw.x);
@@ -1429,8 +1541,7 @@ void MainApp::keyEvent(const SDL_KeyboardEvent &ke)
         if (!game->vehiclechoices[choose_type]->getLocked()) {
           initAudio();
           game->chooseVehicle(game->vehiclechoices[choose_type]);
-          if (cfg.getEnableGhost())
-            ghost.recordStart(race_data.mapname, game->vehiclechoices[choose_type]->getName());
+          startGhost(*game->vehiclechoices[choose_type]);
 
           if (lss.state == AM_TOP_LVL_PREP)
           {
@@ -1467,6 +1578,18 @@ void MainApp::keyEvent(const SDL_KeyboardEvent &ke)
           game->resetAtCheckpoint(game->vehicle[0]);
           return;
       }
+      if (cfg.getCtrl().map[PConfig::ActionRestart].type == PConfig::UserControl::TypeKey &&
+          cfg.getCtrl().map[PConfig::ActionRestart].key.sym == ke.keysym.sym)
+      {
+          restartGame();
+          return;
+      }
+      if (cfg.getCtrl().map[PConfig::ActionRewind].type == PConfig::UserControl::TypeKey &&
+          cfg.getCtrl().map[PConfig::ActionRewind].key.sym == ke.keysym.sym)
+      {
+          rewindGame();
+          return;
+      }
       if (cfg.getCtrl().map[PConfig::ActionCamMode].type == PConfig::UserControl::TypeKey &&
           cfg.getCtrl().map[PConfig::ActionCamMode].key.sym == ke.keysym.sym) {
         cameraview = static_cast<CameraMode>((static_cast<int>(cameraview) + 1) % static_cast<int>(CameraMode::count));
@@ -1583,6 +1706,18 @@ void MainApp::joyButtonEvent(int which, int button, bool down)
           game->resetAtCheckpoint(game->vehicle[0]);
           return;
       }
+      if (cfg.getCtrl().map[PConfig::ActionRestart].type == PConfig::UserControl::TypeJoyButton &&
+          cfg.getCtrl().map[PConfig::ActionRestart].joybutton.button == button)
+      {
+          restartGame();
+          return;
+      }
+      if (cfg.getCtrl().map[PConfig::ActionRewind].type == PConfig::UserControl::TypeJoyButton &&
+          cfg.getCtrl().map[PConfig::ActionRewind].joybutton.button == button)
+      {
+          rewindGame();
+          return;
+      }
       if (cfg.getCtrl().map[PConfig::ActionCamMode].type == PConfig::UserControl::TypeJoyButton &&
           cfg.getCtrl().map[PConfig::ActionCamMode].joybutton.button == button) {
 		cameraview = static_cast<CameraMode>((static_cast<int>(cameraview) + 1) % static_cast<int>(CameraMode::count));
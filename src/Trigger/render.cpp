@@ -786,10 +786,50 @@ glMatrixMode(GL_PROJECTION);
     glMatrixMode(GL_MODELVIEW);
 }
 
+///
+/// @brief Draws the ghosts at the current race time, half transparent
+/// @details The parts they are drawn with are set up by startGhost() and
+///  only get their poses updated here.
+///
+void MainApp::renderGhosts()
+{
+    ghost.getReplayPoses(ghostposes);
+
+    for (unsigned int k = 0; k < ghostposes.ghost.size(); ++k)
+    {
+        const unsigned int g = ghostposes.ghost[k];
+
+        if (g >= ghosttypes.size() || ghosttypes[g] == nullptr)
+            continue;
+
+        PVehiclePart &part = ghostparts[g];
+        const unsigned int wheels = std::min<unsigned int>(part.wheel.size(),
+            ghost.getReplay(g).track.wheelcount);
+
+        part.ref_world.setPosition(ghostposes.pos[k]);
+        part.ref_world.setOrientation(ghostposes.ori[k]);
+        part.ref_world.updateMatrices();
+
+        for (unsigned int i = 0; i < wheels; ++i)
+        {
+            PVehicleWheel &wheel = part.wheel[i];
+
+            wheel.ref_world.setPosition(ghostposes.wheelpos[ghostposes.wheelfirst[k] + i]);
+            wheel.ref_world.setOrientation(ghostposes.wheelori[ghostposes.wheelfirst[k] + i]);
+            wheel.ref_world.updateMatrices();
+        }
+
+        renderVehiclePart(*ghosttypes[g], part, ghosttypes[g]->part[0], 0.5f);
+    }
+}
+
 void MainApp::renderStateGame(float eyetranslation)
 {
     PVehicle *vehic = game->vehicle[0];
 
+    // the frame usually falls between two simulation steps
+    const float interp = game->sim->getInterpolation();
+
     glClear(GL_DEPTH_BUFFER_BIT);
     //glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
 
@@ -845,7 +885,7 @@ void MainApp::renderStateGame(float eyetranslation)
     glActiveTextureARB(GL_TEXTURE0_ARB);
 
     // draw terrain
-    game->terrain->render(campos, cammat_inv);
+    game->terrain->render(campos, cammat_inv, vehic->body->getLinearVel());
 
     glDisable(GL_TEXTURE_GEN_S);
     glDisable(GL_TEXTURE_GEN_T);
@@ -862,8 +902,11 @@ void MainApp::renderStateGame(float eyetranslation)
 
         glColor4f(1.0f, 1.0f, 1.0f, 0.7f);
 
-        vec3f vpos = game->vehicle[0]->body->getPosition();
-        vec3f forw = makevec3f(game->vehicle[0]->body->getOrientationMatrix().row[0]);
+        PReferenceFrame vref;
+        vref.setInterpolated(game->vehicle[0]->body->getPrevious(), game->vehicle[0]->body->getFrame(), interp);
+
+        vec3f vpos = vref.getPosition();
+        vec3f forw = makevec3f(vref.getOrientationMatrix().row[0]);
         float forwangle = atan2(forw.y, forw.x);
         game->terrain->drawSplat(vpos.x, vpos.y, 1.4f, forwangle + PI*0.5f);
 
@@ -881,43 +924,15 @@ void MainApp::renderStateGame(float eyetranslation)
         PVehicle *vehic = game->vehicle[v];
         for (unsigned int i=0; i<vehic->part.size(); ++i)
         {
-            renderVehiclePart(*vehic->type, vehic->part[i], vehic->type->part[i], 1.0f);
+            vehic->getInterpolatedPart(i, interp, drawpart);
+            renderVehiclePart(*vehic->type, drawpart, vehic->type->part[i], 1.0f);
         }
     }
 
     glDisable(GL_LIGHTING);
 
-    PGhost::GhostData ghostdata;
-    std::string vehiclename = "";
-
-    if (cfg.getEnableGhost() && ghost.getReplayData(ghostdata, vehiclename))
-    {
-        PVehiclePart vehiclepart;
-
-        vehiclepart.ref_world.setPosition(ghostdata.pos);
-        vehiclepart.ref_world.setOrientation(ghostdata.ori);
-        vehiclepart.ref_world.updateMatrices();
-
-        for (unsigned int i = 0; i < ghostdata.wheel.size(); ++i)
-        {
-            PVehicleWheel wheel;
-
-            wheel.ref_world.setPosition(ghostdata.wheel[i].pos);
-            wheel.ref_world.setOrientation(ghostdata.wheel[i].ori);
-            wheel.ref_world.updateMatrices();
-            vehiclepart.wheel.push_back(wheel);
-        }
-
-        // Theoretically there can be multiple vehicles with multiple parts.
-        // However, the assumption is, that the model of the first part is relevant.
-        for (unsigned int i = 0; i < game->vehiclechoices.size(); ++i) {
-          if (game->vehiclechoices[i]->getName() == vehiclename) {
-            renderVehiclePart(*game->vehiclechoices[i], vehiclepart,
-                game->vehiclechoices[i]->part[0], 0.5f);
-            break;
-          }
-        }
-    }
+    if (cfg.getEnableGhost())
+        renderGhosts();
 
     glDepthMask(GL_FALSE);
     glDisable(GL_CULL_FACE);
@@ -0,0 +1,798 @@
+
+// main.cpp [trigger-sim]
+
+// License: GPL version 2 (see included gpl.txt)
+
+//
+// Headless simulator: loads a level and a vehicle, drives the vehicle from
+// a scripted input file and runs PSim as fast as the CPU allows.
+// No window, no OpenGL and no audio are needed.
+//
+// Input file format, one keyframe per line ('#' starts a comment):
+//
+//   <time> <throttle> <brake> <handbrake> <steer>
+//
+// Each keyframe holds until the next one; time is measured in seconds from
+// the start of the race (the end of the countdown).
+//
+// The simulation runs in deterministic lockstep: inputs are applied every
+// `--step` seconds (rounded to whole simulation steps), so the same level,
+// vehicle, inputs and seed always give bit-identical results.
+//
+// Once the countdown is over the simulation shouldn't touch the heap, except
+// to generate the objects of tiles it hasn't visited yet. Built with
+// PSIM_COUNT_ALLOCATIONS, as by `make check`, PSim counts the allocations of
+// its steps: those of the steps that generated tiles are reported as
+// tileallocations, the others as tickallocations; with `--check-alloc` any
+// of the latter makes the run fail.
+//
+// With `--check-snapshot` the simulation is saved after the countdown and,
+// once the race is over, restored and raced again; both runs must end in the
+// same place, bit for bit.
+//
+// `--record` saves the inputs of the race as a replay, and `--replay` drives
+// the vehicle from a replay instead of a script. With `--seek` the replay is
+// then taken back to a point of the race and forward to its end again, which
+// must end in the same place as playing it straight through.
+//
+// `--self-check` runs the checks of simcheck.cpp instead of a race; they
+// need no data files. `--vmath-dump` and `--check-vmath` compare the SSE
+// code of vmath.h against the generic code of a VMATH_SCALAR build:
+//
+//   trigger-sim-scalar --vmath-dump | trigger-sim-check --check-vmath
+//
+
+#include "exception.h"
+#include "pengine.h"
+#include "physfs_utils.h"
+#include "psim.h"
+#include "render.h"
+#include "replay.h"
+#include "rigidity.h"
+#include "simcheck.h"
+#include "simsnapshot.h"
+#include "terraindata.h"
+#include "vehicle.h"
+
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#define CHECKPOINT_RADIUS 30
+
+// same as in the game
+#define COUNTDOWN_TIME  3.0f
+#define REPLAY_KEYFRAME_TIME 5.0f
+
+///
+/// @brief One line of the input script
+///
+struct SimInputKey {
+  float time;
+  float throttle;
+  float brake;
+  float handbrake;
+  float steer;
+};
+
+///
+/// @brief The parts of a .level the simulation needs
+///
+struct SimLevel {
+  PTerrainData *terrain = nullptr;
+  vec3f start_pos = vec3f::zero();
+  quatf start_ori = quatf::identity();
+  std::vector<vec3f> checkpt;
+  int number_of_laps = 1;
+
+  ~SimLevel() { delete terrain; }
+};
+
+///
+/// @brief Loads terrain, start position and checkpoints of a level
+/// @param filename = PhysFS path of the .level file
+/// @param rigidity = rigidity map for foliage and road signs
+/// @param level = where to store the results
+/// @retval true on success
+///
+static bool loadLevel(const std::string &filename, const PRigidity &rigidity, SimLevel &level)
+{
+  XMLDocument xmlfile;
+  XMLElement *rootelem = PUtil::loadRootElement(xmlfile, filename, "level");
+  if (!rootelem) return false;
+
+  const char *val;
+
+  for (XMLElement *walk = rootelem->FirstChildElement();
+    walk; walk = walk->NextSiblingElement()) {
+
+    if (!strcmp(walk->Value(), "terrain")) {
+      try
+      {
+        level.terrain = new PTerrainData(walk, filename, rigidity, true, true);
+      }
+      catch (PException &e)
+      {
+        PUtil::outLog() << "Terrain problem: " << e.what() << std::endl;
+        return false;
+      }
+    }
+    else if (!strcmp(walk->Value(), "race")) {
+      if (!level.terrain) {
+        PUtil::outLog() << "Level has race before terrain" << std::endl;
+        return false;
+      }
+
+      vec2f coordscale = vec2f(1.0f, 1.0f);
+      val = walk->Attribute("coordscale");
+      if (val) sscanf(val, "%f , %f", &coordscale.x, &coordscale.y);
+
+      val = walk->Attribute("laps");
+      if (val) level.number_of_laps = std::max(atoi(val), 1);
+
+      for (XMLElement *walk2 = walk->FirstChildElement();
+        walk2; walk2 = walk2->NextSiblingElement()) {
+
+        // codriver checkpoints have notes and don't count
+        if (!strcmp(walk2->Value(), "checkpoint") && !walk2->Attribute("notes")) {
+          vec2f coords = vec2f::zero();
+          val = walk2->Attribute("coords");
+          if (val) sscanf(val, "%f , %f", &coords.x, &coords.y);
+          coords.x *= coordscale.x;
+          coords.y *= coordscale.y;
+          level.checkpt.push_back(vec3f(coords.x, coords.y,
+            level.terrain->getHeight(coords.x, coords.y)));
+        }
+        else if (!strcmp(walk2->Value(), "startposition")) {
+          val = walk2->Attribute("pos");
+          if (val) sscanf(val, "%f , %f , %f", &level.start_pos.x, &level.start_pos.y, &level.start_pos.z);
+          level.start_pos.x *= coordscale.x;
+          level.start_pos.y *= coordscale.y;
+
+          val = walk2->Attribute("oridegrees");
+          if (val) level.start_ori.fromZAngle(-RADIANS(atof(val)));
+
+          val = walk2->Attribute("ori");
+          if (val) sscanf(val, "%f , %f , %f , %f", &level.start_ori.w, &level.start_ori.x, &level.start_ori.y, &level.start_ori.z);
+        }
+      }
+    }
+  }
+
+  if (!level.terrain) {
+    PUtil::outLog() << "Level has no terrain" << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+///
+/// @brief Loads the input script from the native filesystem
+/// @param filename = path of the script
+/// @param keys = where to store the keyframes, sorted by time
+/// @retval true on success
+///
+static bool loadInputs(const std::string &filename, std::vector<SimInputKey> &keys)
+{
+  std::ifstream in(filename);
+
+  if (!in) {
+    PUtil::outLog() << "Couldn't open input file \"" << filename << "\"" << std::endl;
+    return false;
+  }
+
+  std::string line;
+  int linenum = 0;
+
+  while (std::getline(in, line)) {
+    ++linenum;
+
+    std::string::size_type comment = line.find('#');
+    if (comment != std::string::npos) line.erase(comment);
+
+    std::istringstream ls(line);
+    SimInputKey key;
+
+    if (!(ls >> key.time)) continue;
+
+    if (!(ls >> key.throttle >> key.brake >> key.handbrake >> key.steer)) {
+      PUtil::outLog() << filename << ":" << linenum << ": expected 5 values" << std::endl;
+      return false;
+    }
+
+    if (!keys.empty() && key.time < keys.back().time) {
+      PUtil::outLog() << filename << ":" << linenum << ": time goes backwards" << std::endl;
+      return false;
+    }
+
+    keys.push_back(key);
+  }
+
+  return true;
+}
+
+///
+/// @brief Runs one race
+/// @param levelname = PhysFS path of the .level file
+/// @param vehiclename = PhysFS path of the .vehicle file
+/// @param keys = scripted inputs
+/// @param steps = simulation steps per input sample
+/// @param timeout = maximum race time
+/// @param seed = seed of the simulation random generator
+/// @param threads = worker threads for the simulation
+/// @param checkalloc = fail if a step past the countdown that didn't generate a
+///  tile allocates, in builds with PSIM_COUNT_ALLOCATIONS
+/// @param checksnapshot = run the race again from a snapshot taken after the countdown
+/// @param timescale = race seconds per real second, 0 to run as fast as possible
+/// @param report = file to append a line of results to, empty for none
+/// @param recordfile = file to save a replay of the race to, empty for none
+/// @param playback = replay to drive the vehicle with instead of keys, or nullptr
+/// @param seektime = with playback, race time to seek back to once at the end, negative for none
+/// @retval 0 if the race was finished, 2 on timeout, 3 if checkalloc failed,
+///  4 if the second run of checksnapshot or the seek differs, 1 on load errors
+///
+static int runSim(const std::string &levelname, const std::string &vehiclename,
+  const std::vector<SimInputKey> &keys, unsigned int steps, float timeout, uint32 seed,
+  unsigned int threads, bool checkalloc, bool checksnapshot, float timescale,
+  const std::string &report, const std::string &recordfile, PReplay *playback, float seektime)
+{
+  const float step = steps * PSim::timeslice;
+
+  PRigidity rigidity;
+  PModelList models;
+  SimLevel level;
+  PSim sim;
+
+  if (!loadLevel(levelname, rigidity, level)) return 1;
+
+  level.terrain->buildRoadDistance();
+
+  sim.setThreadCount(threads);
+  sim.setGravity(vec3f(0.0f, 0.0f, -9.81f));
+  sim.setTerrain(level.terrain);
+
+  PVehicleType *vtype = sim.loadVehicleType(vehiclename, models);
+  if (!vtype) return 1;
+
+  PVehicle *vehicle = sim.createVehicle(vtype, level.start_pos, level.start_ori);
+  if (!vehicle) return 1;
+
+  const std::chrono::steady_clock::time_point walltime_start = std::chrono::steady_clock::now();
+
+  sim.setSeed(seed);
+
+  const unsigned int countdownsteps = lround(COUNTDOWN_TIME / PSim::timeslice);
+
+  // only the first run is recorded
+  PReplay record(REPLAY_KEYFRAME_TIME);
+  bool recording = !recordfile.empty();
+
+  if (playback) {
+    if (!playback->playStart(sim)) {
+      PUtil::outLog() << "The replay doesn't fit the level and vehicle" << std::endl;
+      return 1;
+    }
+
+    playback->seek(sim, sim.getStepCount() + countdownsteps);
+  } else {
+    // countdown: brakes on, no input
+    vehicle->ctrl.setZero();
+    vehicle->ctrl.brake1 = 1.0f;
+    vehicle->ctrl.brake2 = 1.0f;
+
+    if (recording) {
+      record.recordStart(sim, seed, levelname, vehiclename);
+      record.recordInputs(sim);
+    }
+
+    sim.tickSteps(countdownsteps);
+  }
+
+  // the race is run a second time from this snapshot with --check-snapshot
+  PSimSnapshot snapshot;
+  double snapshotsave = 0.0;
+  double snapshotrestore = 0.0;
+
+  if (checksnapshot) {
+    const std::chrono::steady_clock::time_point save_start = std::chrono::steady_clock::now();
+    sim.saveSnapshot(snapshot);
+    snapshotsave = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - save_start).count();
+  }
+
+  float coursetime = 0.0f;
+  float offroadtime = 0.0f;
+  float maxroaddistance = 0.0f;
+  bool finished = false;
+
+  const auto race = [&] () {
+    const std::chrono::steady_clock::time_point racestart = std::chrono::steady_clock::now();
+    unsigned int nextkey = 0;
+
+    coursetime = 0.0f;
+    offroadtime = 0.0f;
+    maxroaddistance = 0.0f;
+    finished = level.checkpt.empty();
+    sim.resetAllocations();
+
+    while (!finished && coursetime < timeout &&
+      !(playback && sim.getStepCount() >= playback->getEndStep())) {
+      while (nextkey < keys.size() && keys[nextkey].time <= coursetime) {
+        vehicle->ctrl.throttle = keys[nextkey].throttle;
+        vehicle->ctrl.brake1 = keys[nextkey].brake;
+        vehicle->ctrl.brake2 = keys[nextkey].handbrake;
+        vehicle->ctrl.turn.z = keys[nextkey].steer;
+        ++nextkey;
+      }
+
+      if (recording)
+        record.recordInputs(sim);
+
+      if (playback)
+        playback->seek(sim, sim.getStepCount() + steps);
+      else
+        sim.tickSteps(steps);
+
+      coursetime += step;
+
+      // hold back to the requested pace
+      if (timescale > 0.0f)
+        std::this_thread::sleep_until(racestart +
+          std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(coursetime / timescale)));
+
+      const vec3f bodypos = vehicle->body->getPosition();
+
+      if (!level.terrain->getRmapOnRoad(bodypos))
+        offroadtime += step;
+
+      maxroaddistance = std::max(maxroaddistance, level.terrain->getRoadDistance(bodypos));
+
+      vec2f diff = makevec2f(level.checkpt[vehicle->nextcp]) - makevec2f(bodypos);
+
+      if (diff.lengthsq() < CHECKPOINT_RADIUS * CHECKPOINT_RADIUS) {
+        if (++vehicle->nextcp >= (int)level.checkpt.size()) {
+          vehicle->nextcp = 0;
+          if (++vehicle->currentlap > level.number_of_laps) finished = true;
+        }
+      }
+    }
+  };
+
+  race();
+
+  // the time of the first run only
+  const std::chrono::duration<double> walltime =
+    std::chrono::steady_clock::now() - walltime_start;
+
+  std::vector<uint8> recorddata;
+
+  if (recording) {
+    record.recordStop(sim);
+    record.write(recorddata);
+    recording = false;
+
+    std::ofstream out(recordfile, std::ios::binary);
+    out.write(reinterpret_cast<const char *>(recorddata.data()), recorddata.size());
+
+    if (!out) {
+      PUtil::outLog() << "Couldn't write replay file \"" << recordfile << "\"" << std::endl;
+      return 1;
+    }
+  }
+
+  bool seekmatch = true;
+  double seekduration = 0.0;
+
+  if (playback && seektime >= 0.0f) {
+    const vec3f firstpos = vehicle->body->getPosition();
+    const quatf firstori = vehicle->body->getOrientation();
+    const uint32 laststep = sim.getStepCount();
+
+    // back to the point of the race, then forward to where it stopped
+    const std::chrono::steady_clock::time_point seek_start = std::chrono::steady_clock::now();
+    playback->seek(sim, playback->getStartStep() + countdownsteps + lround(seektime / PSim::timeslice));
+    seekduration = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - seek_start).count();
+
+    playback->seek(sim, laststep);
+
+    const vec3f pos = vehicle->body->getPosition();
+    const quatf ori = vehicle->body->getOrientation();
+
+    seekmatch = sim.getStepCount() == laststep &&
+      !memcmp(&pos, &firstpos, sizeof(pos)) && !memcmp(&ori, &firstori, sizeof(ori));
+  }
+
+  bool snapshotmatch = true;
+
+  if (checksnapshot) {
+    const vec3f firstpos = vehicle->body->getPosition();
+    const quatf firstori = vehicle->body->getOrientation();
+    const uint32 firststeps = sim.getStepCount();
+
+    const std::chrono::steady_clock::time_point restore_start = std::chrono::steady_clock::now();
+    sim.restoreSnapshot(snapshot);
+    snapshotrestore = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - restore_start).count();
+
+    race();
+
+    // the second run must end exactly where the first one did
+    const vec3f pos = vehicle->body->getPosition();
+    const quatf ori = vehicle->body->getOrientation();
+
+    snapshotmatch = sim.getStepCount() == firststeps &&
+      !memcmp(&pos, &firstpos, sizeof(pos)) && !memcmp(&ori, &firstori, sizeof(ori));
+  }
+
+  const double simtime = COUNTDOWN_TIME + coursetime;
+  const vec3f endpos = vehicle->body->getPosition();
+
+  std::cout << "finished " << (finished ? "yes" : "no") << "\n"
+    << "coursetime " << coursetime << "\n"
+    << "offroadtime " << offroadtime << "\n"
+    << "maxroaddistance " << maxroaddistance << "\n"
+    << "checkpoint " << vehicle->nextcp << "\n"
+    << "lap " << vehicle->currentlap << "\n"
+    << "position " << endpos.x << " " << endpos.y << " " << endpos.z << "\n"
+    << "simtime " << simtime << "\n"
+    << "walltime " << walltime.count() << "\n"
+    << "speedup " << (walltime.count() > 0.0 ? simtime / walltime.count() : 0.0) << std::endl;
+
+  if (!report.empty()) {
+    std::ofstream out(report, std::ios::app);
+
+    out << "level=" << levelname
+      << " vehicle=" << vehiclename
+      << " result=" << (finished ? "finished" : "timeout")
+      << " lap=" << vehicle->currentlap
+      << " coursetime=" << coursetime
+      << " offroadtime=" << offroadtime
+      << " walltime=" << walltime.count()
+      << " speedup=" << (walltime.count() > 0.0 ? simtime / walltime.count() : 0.0)
+      << " timescale=";
+
+    if (timescale > 0.0f)
+      out << timescale << "\n";
+    else
+      out << "max\n";
+
+    if (!out)
+      PUtil::outLog() << "Couldn't write report file \"" << report << "\"" << std::endl;
+  }
+
+  if (!recordfile.empty()) {
+    std::cout << "replayevents " << record.getEvents().size() << "\n"
+      << "replaybytes " << recorddata.size() << std::endl;
+  }
+
+  if (playback && seektime >= 0.0f) {
+    std::cout << "replayseek " << seekduration << "\n"
+      << "replaymatch " << (seekmatch ? "yes" : "no") << std::endl;
+
+    if (!seekmatch) {
+      PUtil::outLog() << "The replay took a different course after seeking" << std::endl;
+      return 4;
+    }
+  }
+
+  if (checksnapshot) {
+    std::cout << "snapshotbytes " << snapshot.getSize() << "\n"
+      << "snapshotsave " << snapshotsave << "\n"
+      << "snapshotrestore " << snapshotrestore << "\n"
+      << "snapshotmatch " << (snapshotmatch ? "yes" : "no") << std::endl;
+
+    if (!snapshotmatch) {
+      PUtil::outLog() << "The race took a different course after restoring the snapshot" << std::endl;
+      return 4;
+    }
+  }
+
+#ifdef PSIM_COUNT_ALLOCATIONS
+  const PSimAllocations &allocations = sim.getAllocations();
+
+  std::cout << "tickallocations " << allocations.allocations << "\n"
+    << "tilesteps " << allocations.tilesteps << "\n"
+    << "tileallocations " << allocations.tileallocations << std::endl;
+
+  if (checkalloc && allocations.allocations != 0) {
+    PUtil::outLog() << "The simulation allocated " << allocations.allocations
+      << " times in " << allocations.steps << " steps past the countdown that didn't generate tiles"
+      << std::endl;
+    return 3;
+  }
+#else
+  (void)checkalloc;
+#endif
+
+  return finished ? 0 : 2;
+}
+
+///
+/// @brief Times the engine torque table against walking the power curve
+/// @details Both paths compute the torque out of every gear for the same
+///  evenly spaced engine speeds, as PEngineInstance::tick() does.
+/// @param vehiclename = PhysFS path of the .vehicle file
+/// @retval 0 on success, 1 on load errors
+///
+static int benchEngine(const std::string &vehiclename)
+{
+  PModelList models;
+  PSim sim;
+
+  PVehicleType *vtype = sim.loadVehicleType(vehiclename, models);
+  if (!vtype) return 1;
+
+  const PEngine &engine = vtype->engine;
+
+  if (!engine.hasGears() || engine.getMaxRPS() <= engine.getMinRPS()) {
+    PUtil::outLog() << "Vehicle has no gears or no power curve range" << std::endl;
+    return 1;
+  }
+
+  const unsigned int samples = 4096;
+  const unsigned int rounds = 500;
+  const unsigned int gears = engine.getGearCount();
+
+  std::vector<float> rps(samples);
+
+  for (unsigned int i = 0; i < samples; ++i)
+    rps[i] = engine.getMinRPS() + (engine.getMaxRPS() - engine.getMinRPS()) * i / (samples - 1);
+
+  // the sums keep the compiler from dropping the loops
+  float curvesum = 0.0f;
+  float tablesum = 0.0f;
+
+  const std::chrono::steady_clock::time_point curve_start = std::chrono::steady_clock::now();
+
+  for (unsigned int r = 0; r < rounds; ++r)
+    for (unsigned int g = 0; g < gears; ++g)
+      for (unsigned int i = 0; i < samples; ++i)
+        curvesum += engine.getPowerAtRPS(rps[i]) / (engine.getGearRatio(g) * rps[i]);
+
+  const std::chrono::steady_clock::time_point table_start = std::chrono::steady_clock::now();
+
+  for (unsigned int r = 0; r < rounds; ++r)
+    for (unsigned int g = 0; g < gears; ++g) {
+      const float ratio_inv = 1.0f / engine.getGearRatio(g);
+
+      for (unsigned int i = 0; i < samples; ++i)
+        tablesum += engine.getTorqueAtRPS(rps[i]) * ratio_inv;
+    }
+
+  const std::chrono::steady_clock::time_point table_end = std::chrono::steady_clock::now();
+
+  // largest difference between the two, relative to the peak torque
+  float maxtorque = 0.0f;
+  float maxerror = 0.0f;
+
+  for (unsigned int i = 0; i < samples; ++i) {
+    const float curve = engine.getPowerAtRPS(rps[i]) / rps[i];
+
+    maxtorque = std::max(maxtorque, fabsf(curve));
+    maxerror = std::max(maxerror, fabsf(engine.getTorqueAtRPS(rps[i]) - curve));
+  }
+
+  const double lookups = (double)rounds * gears * samples;
+  const std::chrono::duration<double, std::nano> curvetime = table_start - curve_start;
+  const std::chrono::duration<double, std::nano> tabletime = table_end - table_start;
+
+  std::cout << "lookups " << lookups << "\n"
+    << "curvetime " << curvetime.count() / lookups << "\n"
+    << "tabletime " << tabletime.count() / lookups << "\n"
+    << "speedup " << (tabletime.count() > 0.0 ? curvetime.count() / tabletime.count() : 0.0) << "\n"
+    << "maxerror " << (maxtorque > 0.0f ? maxerror / maxtorque : 0.0f) << "\n"
+    << "checksum " << curvesum << " " << tablesum << std::endl;
+
+  return 0;
+}
+
+///
+/// @brief Loads a replay from the native filesystem
+/// @param filename = path of the replay
+/// @param replay = where to load it
+/// @retval true on success
+///
+static bool loadReplay(const std::string &filename, PReplay &replay)
+{
+  std::ifstream in(filename, std::ios::binary);
+
+  if (!in) {
+    PUtil::outLog() << "Couldn't open replay file \"" << filename << "\"" << std::endl;
+    return false;
+  }
+
+  const std::vector<uint8> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+  if (!replay.read(data)) {
+    PUtil::outLog() << "Invalid replay file \"" << filename << "\"" << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+static void printUsage(const char *argv0)
+{
+  PUtil::outLog() << "Usage: " << argv0 << " [options] <level> <vehicle> <inputs>\n"
+    "       " << argv0 << " [options] --replay <file> [<level> <vehicle>]\n"
+    "       " << argv0 << " [options] --bench-engine <vehicle>\n"
+    "       " << argv0 << " --self-check\n"
+    "       " << argv0 << " --vmath-dump | <other build> --check-vmath\n"
+    "\n"
+    "  <level> and <vehicle> are paths inside the data directory,\n"
+    "  e.g. /maps/aegyptian/aegyptian.level /vehicles/fox_wrc/fox_wrc.vehicle\n"
+    "\n"
+    "Options:\n"
+    "  --datadir <dir>   data directory (default: ../data next to the executable)\n"
+    "  --step <seconds>  simulated time per input sample, a multiple of 0.004 (default: 0.008)\n"
+    "  --timeout <secs>  give up after this much race time (default: 600)\n"
+    "  --seed <number>   seed of the simulation random generator (default: 1000)\n"
+    "  --timescale <x>   race seconds per real second, 0 runs flat out (default: 0)\n"
+    "  --report <file>   append a line with the results of the race to a file\n"
+    "  --threads <n>     worker threads besides the main one (default: one per extra core)\n"
+    "  --check-alloc     fail if the simulation allocates memory past the countdown,\n"
+    "                    other than for new tiles (builds with PSIM_COUNT_ALLOCATIONS)\n"
+    "  --check-snapshot  run the race twice from a snapshot and fail if the runs differ\n"
+    "  --record <file>   save the inputs of the race as a replay\n"
+    "  --replay <file>   drive the vehicle from a replay, by default on its own level and vehicle\n"
+    "  --seek <seconds>  with --replay, seek back to this race time at the end and fail\n"
+    "                    if playing on from there doesn't end in the same place\n"
+    "  --bench-engine    time the engine torque table against the power curve, in ns per lookup\n"
+    "  --self-check      check the engine parts that need no data: terrain index sets, culling,\n"
+    "                    the tile builder and cache, ghost playback and files, foliage LOD,\n"
+    "                    the vehicle broadphase and the terrain contact batch\n"
+    "  --vmath-dump      write the results of the vmath members that have SSE versions\n"
+    "  --check-vmath     check the vmath members against a dump read from the standard input\n"
+    "  --verbose         log loading progress\n";
+}
+
+int main(int argc, char *argv[])
+{
+  std::string datadir;
+  float step = 0.008f;
+  float timeout = 600.0f;
+  uint32 seed = 1000;
+  unsigned int threads = PJobPool::getDefaultThreadCount();
+  float timescale = 0.0f;
+  std::string report;
+  bool checkalloc = false;
+  bool checksnapshot = false;
+  bool benchengine = false;
+  bool selfcheck = false;
+  bool vmathdump = false;
+  bool checkvmath = false;
+  std::string recordfile;
+  std::string replayfile;
+  float seektime = -1.0f;
+  std::vector<std::string> args;
+
+  PUtil::setDebugLevel(DEBUGLEVEL_CRITICAL);
+
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "--datadir") && i + 1 < argc)
+      datadir = argv[++i];
+    else if (!strcmp(argv[i], "--step") && i + 1 < argc)
+      step = atof(argv[++i]);
+    else if (!strcmp(argv[i], "--timeout") && i + 1 < argc)
+      timeout = atof(argv[++i]);
+    else if (!strcmp(argv[i], "--seed") && i + 1 < argc)
+      seed = strtoul(argv[++i], nullptr, 10);
+    else if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+      threads = strtoul(argv[++i], nullptr, 10);
+    else if (!strcmp(argv[i], "--timescale") && i + 1 < argc)
+      timescale = atof(argv[++i]);
+    else if (!strcmp(argv[i], "--report") && i + 1 < argc)
+      report = argv[++i];
+    else if (!strcmp(argv[i], "--record") && i + 1 < argc)
+      recordfile = argv[++i];
+    else if (!strcmp(argv[i], "--replay") && i + 1 < argc)
+      replayfile = argv[++i];
+    else if (!strcmp(argv[i], "--seek") && i + 1 < argc)
+      seektime = atof(argv[++i]);
+    else if (!strcmp(argv[i], "--check-alloc"))
+      checkalloc = true;
+    else if (!strcmp(argv[i], "--check-snapshot"))
+      checksnapshot = true;
+    else if (!strcmp(argv[i], "--bench-engine"))
+      benchengine = true;
+    else if (!strcmp(argv[i], "--self-check"))
+      selfcheck = true;
+    else if (!strcmp(argv[i], "--vmath-dump"))
+      vmathdump = true;
+    else if (!strcmp(argv[i], "--check-vmath"))
+      checkvmath = true;
+    else if (!strcmp(argv[i], "--verbose"))
+      PUtil::setDebugLevel(DEBUGLEVEL_TEST);
+    else if (argv[i][0] == '-') {
+      printUsage(argv[0]);
+      return 1;
+    }
+    else
+      args.push_back(argv[i]);
+  }
+
+  if (selfcheck || vmathdump || checkvmath) {
+    if (!args.empty() || selfcheck + vmathdump + checkvmath > 1) {
+      printUsage(argv[0]);
+      return 1;
+    }
+
+    if (vmathdump) {
+      dumpVmath(std::cout);
+      return 0;
+    }
+
+    if (checkvmath) {
+      const bool ok = checkVmath(std::cin);
+
+      std::cout << "selfcheck vmath" << (ok ? " ok" : " failed") << std::endl;
+      return ok ? 0 : 5;
+    }
+
+    return runSelfChecks() ? 0 : 5;
+  }
+
+  const long int steps = lround(step / PSim::timeslice);
+
+  const bool replaying = !replayfile.empty();
+
+  if (replaying ? (args.size() != 0 && args.size() != 2) || benchengine :
+    args.size() != (benchengine ? 1u : 3u)) {
+    printUsage(argv[0]);
+    return 1;
+  }
+
+  if (steps < 1 || (replaying && checksnapshot)) {
+    printUsage(argv[0]);
+    return 1;
+  }
+
+#ifndef PSIM_COUNT_ALLOCATIONS
+  if (checkalloc) {
+    PUtil::outLog() << "--check-alloc needs a build defining PSIM_COUNT_ALLOCATIONS, "
+      "such as the one of \"make check\"" << std::endl;
+    return 1;
+  }
+#endif
+
+  std::vector<SimInputKey> keys;
+  if (!benchengine && !replaying && !loadInputs(args[2], keys)) return 1;
+
+  PReplay replay(REPLAY_KEYFRAME_TIME);
+
+  if (replaying) {
+    if (!loadReplay(replayfile, replay)) return 1;
+
+    if (args.empty()) {
+      args.push_back(replay.getLevel());
+      args.push_back(replay.getVehicle());
+    }
+
+    seed = replay.getSeed();
+  }
+
+  if (PHYSFS_init(argv[0]) == 0) {
+    PUtil::outLog() << "PhysFS: " << physfs_getErrorString() << std::endl;
+    return 1;
+  }
+
+  if (datadir.empty())
+    datadir = std::string(PHYSFS_getBaseDir()) + "../data";
+
+  if (PHYSFS_mount(datadir.c_str(), NULL, 1) == 0) {
+    PUtil::outLog() << "Failed to add PhysFS search directory \"" << datadir << "\"" << std::endl
+      << "PhysFS: " << physfs_getErrorString() << std::endl;
+    PHYSFS_deinit();
+    return 1;
+  }
+
+  const int result = benchengine ?
+    benchEngine(args[0]) :
+    runSim(args[0], args[1], keys, steps, timeout, seed, threads, checkalloc, checksnapshot,
+      timescale, report, recordfile, replaying ? &replay : nullptr, seektime);
+
+  PHYSFS_deinit();
+  return result;
+}
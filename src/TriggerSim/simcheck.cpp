@@ -0,0 +1,1427 @@
+// simcheck.cpp [trigger-sim]
+
+// License: GPL version 2 (see included gpl.txt)
+
+//
+// Checks of engine parts whose results are easy to get subtly wrong and
+// hard to see going wrong in a race: they build their own inputs and test
+// the results against what they must be, so they need no data files.
+//
+
+#include "broadphase.h"
+#include "ghost.h"
+#include "pengine.h"
+#include "render.h"
+#include "simcheck.h"
+#include "terraincontact.h"
+#include "terraindata.h"
+#include "terrainhorizon.h"
+#include "terrainlod.h"
+#include "tilecache.h"
+#include "tilebuilder.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <list>
+#include <map>
+#include <mutex>
+#include <random>
+#include <thread>
+
+// largest tile size the index sets are checked for; 256 would overflow
+// the 16 bit indices
+#define CHECK_LOD_TILESIZE_MAX  128
+
+#define CHECK_STITCH_TRIALS  200
+
+#define CHECK_FRUSTUM_TRIALS  20000
+
+// the horizon is checked on random heightfields of this many tiles around
+// the camera tile, of this many cells of this size
+#define CHECK_HORIZON_TRIALS    40
+#define CHECK_HORIZON_RADIUS    6
+#define CHECK_HORIZON_TILESIZE  8
+#define CHECK_HORIZON_CELL      4.0f
+
+// how far a line of sight has to stay above the ground to count as clear,
+// so that rays grazing the ground don't decide anything
+#define CHECK_HORIZON_CLEARANCE  0.01f
+
+// the tile builder is asked for tiles of a square of this size around a
+// moving point, this many times, and given this long to hand over the last
+// of them
+#define CHECK_BUILDER_ROUNDS   3000
+#define CHECK_BUILDER_SQUARE   12
+#define CHECK_BUILDER_DRAIN    10.0
+
+// ghost tracks of up to this many samples are played back over this many
+// frames each
+#define CHECK_GHOST_TRACKS   50
+#define CHECK_GHOST_SAMPLES  2000
+#define CHECK_GHOST_FRAMES   20000
+
+// ghost files are written of this many samples of a car with this many
+// wheels, which jumps this far once, as a reset does, and must come back
+// within a step of the position grid and this close in orientation, as
+// 1 - |dot| of the quaternions
+#define CHECK_GHOST_FILE_SAMPLES  700
+#define CHECK_GHOST_FILE_WHEELS   4
+#define CHECK_GHOST_FILE_JUMP     100.0f
+#define CHECK_GHOST_FILE_TURN     0.00001f
+
+// foliage bands are checked at this many distances each, for tiles of up
+// to this many instances
+#define CHECK_FOLIAGE_BANDS      200
+#define CHECK_FOLIAGE_DISTANCES  200
+#define CHECK_FOLIAGE_INSTANCES  300
+
+// distances this close to the cut of an instance, relative to the band,
+// are left out, as rounding may go either way there
+#define CHECK_FOLIAGE_TIE  0.0001f
+
+// the broadphase is given up to this many boxes moving about a square of
+// this size for this many frames
+#define CHECK_BROADPHASE_FRAMES  3000
+#define CHECK_BROADPHASE_BOXES   80
+#define CHECK_BROADPHASE_AREA    100.0f
+
+// the tile cache is put through this many finds and inserts of tiles up to
+// this far from the origin either way, with up to this many slots
+#define CHECK_CACHE_STEPS     200000
+#define CHECK_CACHE_RANGE     20
+#define CHECK_CACHE_CAPACITY  64
+
+// the contact batch is checked on a random field of this many heights
+// along each side, up to this high, for points up to this many turns of
+// the field either way, in batches of up to this many points
+#define CHECK_CONTACT_FIELD    64
+#define CHECK_CONTACT_HEIGHT   10.0f
+#define CHECK_CONTACT_TURNS    2
+#define CHECK_CONTACT_BATCHES  20000
+#define CHECK_CONTACT_POINTS   23
+
+// how far the batch may be from the scalar code, in height and in each
+// component of the normal; built with -O2 they agree to a few ulps, but
+// -Ofast may fuse the scaling of a point into taking its fraction, which
+// moves it by an ulp of its coordinate and the height by that times the
+// slope
+#define CHECK_CONTACT_HEIGHT_TOLERANCE  0.001f
+#define CHECK_CONTACT_NORMAL_TOLERANCE  0.00001f
+
+// each vmath member is dumped for this many random inputs, and may be off
+// by this much plus this share of the result, as -Ofast lets the compiler
+// fuse and reorder the generic code
+#define CHECK_VMATH_TRIALS    2000
+#define CHECK_VMATH_ABSOLUTE  0.0001f
+#define CHECK_VMATH_RELATIVE  0.00001f
+
+///
+/// @brief Checks the index sets of one tile size
+/// @details Every set must cover the tile once: its triangles keep the
+///  winding of the full detail ones, none is flat, they add up to the area
+///  of the tile and every edge inside the tile is shared by exactly two of
+///  them. Along each side, a set must have its vertices where those of the
+///  sets it can meet there have theirs, so that no cracks open between
+///  tiles.
+/// @param tilesize = quads along each side of a tile
+/// @retval true if the sets are right
+///
+static bool checkLodSets(int tilesize)
+{
+  const int tilesizep1 = tilesize + 1;
+  const int sides[4] = { SIDE_MINY, SIDE_MAXX, SIDE_MAXY, SIDE_MINX };
+
+  PTerrainLod lod;
+  std::vector<uint16> index;
+  bool ok = true;
+
+  lod.build(tilesize, index);
+
+  const auto fail = [&] (int level, int mask, const char *what) {
+    PUtil::outLog() << "lod: tile size " << tilesize << ", level " << level <<
+      ", mask " << mask << ": " << what << std::endl;
+    ok = false;
+  };
+
+  if (1 << (lod.getLevels() - 1) != tilesize) {
+    fail(lod.getLevels(), 0, "wrong number of levels");
+    return false;
+  }
+
+  // vertices of each set along each side, as distances from the start of
+  // the side
+  std::vector<std::vector<int>> border(lod.getLevels() * SIDE_MASKS * 4);
+  std::vector<uint32> edge;
+
+  for (int level = 0; level < lod.getLevels(); ++level) {
+    const int masks = level + 1 < lod.getLevels() ? SIDE_MASKS : 1;
+
+    for (int mask = 0; mask < masks; ++mask) {
+      const int first = lod.getFirst(level, mask);
+      const int count = lod.getCount(level, mask);
+
+      if (count % 3 != 0 || first + count > (int)index.size()) {
+        fail(level, mask, "index range out of the array");
+        continue;
+      }
+
+      long area2 = 0;
+      edge.clear();
+
+      for (int i = first; i < first + count; i += 3) {
+        const int v[3] = { index[i], index[i + 1], index[i + 2] };
+
+        if (v[0] >= tilesizep1 * tilesizep1 ||
+          v[1] >= tilesizep1 * tilesizep1 ||
+          v[2] >= tilesizep1 * tilesizep1) {
+          fail(level, mask, "vertex out of the tile");
+          return false;
+        }
+
+        const int ax = v[0] % tilesizep1, ay = v[0] / tilesizep1;
+        const int bx = v[1] % tilesizep1, by = v[1] / tilesizep1;
+        const int cx = v[2] % tilesizep1, cy = v[2] / tilesizep1;
+
+        // twice the area, positive for the winding of full detail
+        const int cross = (bx - ax) * (cy - ay) - (by - ay) * (cx - ax);
+
+        if (cross <= 0) fail(level, mask, "triangle flat or flipped");
+
+        area2 += cross;
+
+        for (int e = 0; e < 3; ++e)
+          edge.push_back((uint32)v[e] << 16 | v[(e + 1) % 3]);
+      }
+
+      if (area2 != 2L * tilesize * tilesize)
+        fail(level, mask, "triangles don't add up to the tile");
+
+      std::sort(edge.begin(), edge.end());
+
+      if (std::adjacent_find(edge.begin(), edge.end()) != edge.end())
+        fail(level, mask, "edge shared by two triangles of the same winding");
+
+      for (uint32 e : edge) {
+        const uint32 reverse = (e & 0xffff) << 16 | e >> 16;
+
+        if (std::binary_search(edge.begin(), edge.end(), reverse))
+          continue;
+
+        // an edge of only one triangle must be on a side of the tile
+        const int a = e >> 16, b = e & 0xffff;
+        const int ax = a % tilesizep1, ay = a / tilesizep1;
+        const int bx = b % tilesizep1, by = b / tilesizep1;
+        int s;
+
+        if (ay == 0 && by == 0) s = 0;
+        else if (ax == tilesize && bx == tilesize) s = 1;
+        else if (ay == tilesize && by == tilesize) s = 2;
+        else if (ax == 0 && bx == 0) s = 3;
+        else {
+          fail(level, mask, "crack inside the tile");
+          continue;
+        }
+
+        std::vector<int> &along = border[(level * SIDE_MASKS + mask) * 4 + s];
+        along.push_back(s % 2 ? ay : ax);
+        along.push_back(s % 2 ? by : bx);
+      }
+
+      for (int s = 0; s < 4; ++s) {
+        std::vector<int> &along = border[(level * SIDE_MASKS + mask) * 4 + s];
+        std::sort(along.begin(), along.end());
+        along.erase(std::unique(along.begin(), along.end()), along.end());
+
+        if (along.empty() || along.front() != 0 || along.back() != tilesize)
+          fail(level, mask, "side not covered");
+      }
+    }
+  }
+
+  // a side with its bit set meets the next level, otherwise the same one;
+  // either way the neighbor doesn't have its facing side set
+  for (int level = 0; level < lod.getLevels(); ++level) {
+    const int masks = level + 1 < lod.getLevels() ? SIDE_MASKS : 1;
+
+    for (int mask = 0; mask < masks; ++mask) {
+      for (int s = 0; s < 4; ++s) {
+        const int facing = (s + 2) % 4;
+        const int nlevel = (mask & sides[s]) ? level + 1 : level;
+        const int nmasks = nlevel + 1 < lod.getLevels() ? SIDE_MASKS : 1;
+
+        for (int nmask = 0; nmask < nmasks; ++nmask) {
+          if (nmask & sides[facing]) continue;
+
+          if (border[(level * SIDE_MASKS + mask) * 4 + s] !=
+            border[(nlevel * SIDE_MASKS + nmask) * 4 + facing]) {
+            fail(level, mask, "side doesn't match its neighbor");
+            break;
+          }
+        }
+      }
+    }
+  }
+
+  return ok;
+}
+
+///
+/// @brief Checks PTerrainLod::stitchLevels() and getSideMask() on random
+///  squares of tiles
+/// @details Afterwards neighbors must be at most one level apart, no tile
+///  may have got coarser nor finer than its neighbors needed, and the side
+///  masks must pick index sets that exist.
+/// @retval true if they are right
+///
+static bool checkLodStitching()
+{
+  const int levels = 7;
+
+  std::minstd_rand random(1);
+  std::vector<int> wanted, level;
+
+  for (int trial = 0; trial < CHECK_STITCH_TRIALS; ++trial) {
+    const int side = 1 + random() % 11;
+
+    wanted.resize(side * side);
+    for (int &l : wanted)
+      l = random() % levels;
+
+    level = wanted;
+    PTerrainLod::stitchLevels(level, side);
+
+    for (int ty = 0; ty < side; ++ty) {
+      for (int tx = 0; tx < side; ++tx) {
+        const int i = ty * side + tx;
+        const int n[4] = {
+          ty > 0 ? level[i - side] : -1,
+          tx + 1 < side ? level[i + 1] : -1,
+          ty + 1 < side ? level[i + side] : -1,
+          tx > 0 ? level[i - 1] : -1
+        };
+        const int bit[4] = { SIDE_MINY, SIDE_MAXX, SIDE_MAXY, SIDE_MINX };
+        const int mask = PTerrainLod::getSideMask(level, side, tx, ty);
+        int finest = wanted[i];
+
+        for (int s = 0; s < 4; ++s) {
+          if (n[s] < 0) continue;
+
+          finest = std::min(finest, n[s] + 1);
+
+          if (abs(n[s] - level[i]) > 1 ||
+            ((mask & bit[s]) != 0) != (n[s] > level[i])) {
+            PUtil::outLog() << "lod: stitching trial " << trial << ", tile " << tx << " " << ty <<
+              ": level " << level[i] << ", neighbor " << n[s] << ", mask " << mask << std::endl;
+            return false;
+          }
+        }
+
+        if (level[i] != finest || (mask != 0 && level[i] + 1 >= levels)) {
+          PUtil::outLog() << "lod: stitching trial " << trial << ", tile " << tx << " " << ty <<
+            ": level " << level[i] << " wanted " << wanted[i] << std::endl;
+          return false;
+        }
+      }
+    }
+  }
+
+  return true;
+}
+
+///
+/// @brief Checks the terrain index sets and the levels they are picked by
+///
+static bool checkTerrainLod()
+{
+  bool ok = true;
+
+  for (int tilesize = 1; tilesize <= CHECK_LOD_TILESIZE_MAX; tilesize *= 2)
+    ok = checkLodSets(tilesize) && ok;
+
+  return checkLodStitching() && ok;
+}
+
+///
+/// @brief Checks frustumf::isAABBOutside() against the clip volume
+/// @details Random boxes are set before random cameras, with matrices laid
+///  out as PTerrain::render() reads them from GL. A box with a point well
+///  inside the clip volume must be kept, and a box wholly beyond one of its
+///  planes must be culled.
+/// @retval true if it is right
+///
+static bool checkFrustum()
+{
+  std::minstd_rand random(1);
+  std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+  int culled = 0, kept = 0;
+
+  for (int trial = 0; trial < CHECK_FRUSTUM_TRIALS; ++trial) {
+    quatf ori(unit(random), unit(random), unit(random), unit(random));
+    ori.normalize();
+    const mat44f axes = ori.getMatrix();
+    const vec3f campos(unit(random) * 50.0f, unit(random) * 50.0f, unit(random) * 50.0f);
+
+    // glLoadMatrix() order: each row of mat44f is a column of the GL matrix
+    mat44f mat_mv, mat_p;
+    for (int i = 0; i < 3; ++i) {
+      for (int j = 0; j < 3; ++j)
+        mat_mv.row[i][j] = axes.row[j][i];
+      mat_mv.row[3][i] = -(vec3f(axes.row[i].x, axes.row[i].y, axes.row[i].z) * campos);
+    }
+
+    const float f = 1.0f / tanf((50.0f + 25.0f * unit(random)) * PI / 360.0f);
+    const float aspect = 1.25f + 0.75f * unit(random);
+    const float znear = 1.0f + 0.9f * unit(random), zfar = 250.0f + 200.0f * unit(random);
+
+    mat_p.assemble(
+      vec4f(f / aspect, 0.0f, 0.0f, 0.0f),
+      vec4f(0.0f, f, 0.0f, 0.0f),
+      vec4f(0.0f, 0.0f, (zfar + znear) / (znear - zfar), -1.0f),
+      vec4f(0.0f, 0.0f, 2.0f * zfar * znear / (znear - zfar), 0.0f));
+
+    const mat44f mat_c = mat_mv.concatenate(mat_p);
+    const frustumf frust(mat_c);
+
+    const vec3f middle = campos +
+      vec3f(unit(random), unit(random), unit(random)) * 200.0f;
+    const vec3f size =
+      vec3f(unit(random) + 1.0f, unit(random) + 1.0f, unit(random) + 1.0f) * 30.0f;
+    const vec3f mins = middle - size * 0.5f, maxs = middle + size * 0.5f;
+
+    const auto clip = [&mat_c] (const vec3f &p) -> vec4f {
+      vec4f c;
+      for (int j = 0; j < 4; ++j)
+        c[j] = p.x * mat_c.row[0][j] + p.y * mat_c.row[1][j] + p.z * mat_c.row[2][j] + mat_c.row[3][j];
+      return c;
+    };
+
+    // a grid of points of the box, corners included
+    bool inside = false;
+    int beyond[6] = { 0, 0, 0, 0, 0, 0 };
+
+    for (int k = 0; k <= 5; ++k) {
+      for (int j = 0; j <= 5; ++j) {
+        for (int i = 0; i <= 5; ++i) {
+          const vec3f p(
+            mins.x + size.x * (float)i / 5.0f,
+            mins.y + size.y * (float)j / 5.0f,
+            mins.z + size.z * (float)k / 5.0f);
+          const vec4f c = clip(p);
+          const float margin = 0.001f * fabsf(c.w);
+
+          if (c.w > 0.0f &&
+            fabsf(c.x) < c.w - margin && fabsf(c.y) < c.w - margin && fabsf(c.z) < c.w - margin)
+            inside = true;
+
+          const bool corner = (i == 0 || i == 5) && (j == 0 || j == 5) && (k == 0 || k == 5);
+
+          if (corner) {
+            if (c.x > c.w + margin) ++beyond[0];
+            if (c.x < -c.w - margin) ++beyond[1];
+            if (c.y > c.w + margin) ++beyond[2];
+            if (c.y < -c.w - margin) ++beyond[3];
+            if (c.z > c.w + margin) ++beyond[4];
+            if (c.z < -c.w - margin) ++beyond[5];
+          }
+        }
+      }
+    }
+
+    const bool outside = frust.isAABBOutside(mins, maxs);
+
+    if (inside && outside) {
+      PUtil::outLog() << "frustum: trial " << trial << ": box in view culled" << std::endl;
+      return false;
+    }
+
+    if (!outside && std::find(beyond, beyond + 6, 8) != beyond + 6) {
+      PUtil::outLog() << "frustum: trial " << trial << ": box out of view kept" << std::endl;
+      return false;
+    }
+
+    if (outside) ++culled;
+    if (inside) ++kept;
+  }
+
+  if (culled == 0 || kept == 0) {
+    PUtil::outLog() << "frustum: the boxes didn't test both ways" << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+///
+/// @brief Checks PTerrainHorizon::cull() against lines of sight
+/// @details The tiles of random hilly heightfields are culled as seen from
+///  random places just above the ground. No vertex of a tile whose terrain
+///  pass was culled may be seen from the camera, nor any point of the top
+///  of an object box whose object pass was, where seen means the line of
+///  sight stays clear of the ground all the way.
+/// @retval true if nothing visible is culled, and something is
+///
+static bool checkHorizon()
+{
+  const int radius = CHECK_HORIZON_RADIUS;
+  const int side = 2 * radius + 1;
+  const int cells = side * CHECK_HORIZON_TILESIZE;
+  const float tilewidth = CHECK_HORIZON_TILESIZE * CHECK_HORIZON_CELL;
+
+  std::minstd_rand random(1);
+  std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+  std::vector<float> hmap((cells + 1) * (cells + 1));
+  std::vector<PTerrainTileBounds> bounds(side * side);
+  std::vector<const PTerrainTileBounds *> tile(side * side);
+  std::vector<uint8> pass;
+  PTerrainHorizon horizon;
+  int culled = 0, total = 0;
+
+  for (unsigned int i = 0; i < bounds.size(); ++i)
+    tile[i] = &bounds[i];
+
+  // ground height, interpolated like the terrain is drawn
+  const auto height = [&] (float x, float y) -> float {
+    const float gx = x / CHECK_HORIZON_CELL, gy = y / CHECK_HORIZON_CELL;
+    const int cx = std::max(0, std::min(cells - 1, (int)floorf(gx)));
+    const int cy = std::max(0, std::min(cells - 1, (int)floorf(gy)));
+    const float u = gx - (float)cx, v = gy - (float)cy;
+    const float h00 = hmap[cy * (cells + 1) + cx], h10 = hmap[cy * (cells + 1) + cx + 1];
+    const float h01 = hmap[(cy + 1) * (cells + 1) + cx], h11 = hmap[(cy + 1) * (cells + 1) + cx + 1];
+
+    return u >= v ?
+      h00 + (h10 - h00) * u + (h11 - h10) * v :
+      h00 + (h11 - h01) * u + (h01 - h00) * v;
+  };
+
+  const auto visible = [&] (const vec3f &from, const vec3f &to) -> bool {
+    const vec3f d = to - from;
+    const int steps = (int)(d.length() / (CHECK_HORIZON_CELL * 0.25f)) + 1;
+
+    for (int i = 1; i < steps; ++i) {
+      const vec3f p = from + d * ((float)i / (float)steps);
+      if (p.z < height(p.x, p.y) + CHECK_HORIZON_CLEARANCE) return false;
+    }
+
+    return true;
+  };
+
+  for (int trial = 0; trial < CHECK_HORIZON_TRIALS; ++trial) {
+    struct Hill { float x, y, width, height; } hill[16];
+
+    for (Hill &h : hill) {
+      h.x = unit(random) * cells * CHECK_HORIZON_CELL;
+      h.y = unit(random) * cells * CHECK_HORIZON_CELL;
+      h.width = 10.0f + 70.0f * unit(random);
+      h.height = -20.0f + 80.0f * unit(random);
+    }
+
+    for (int y = 0; y <= cells; ++y) {
+      for (int x = 0; x <= cells; ++x) {
+        float h = 2.0f * unit(random);
+
+        for (const Hill &hl : hill) {
+          const float dx = x * CHECK_HORIZON_CELL - hl.x, dy = y * CHECK_HORIZON_CELL - hl.y;
+          h += hl.height * expf(-(dx * dx + dy * dy) / (hl.width * hl.width));
+        }
+
+        hmap[y * (cells + 1) + x] = h;
+      }
+    }
+
+    // objects reach half a tile out and a few units up
+    for (int ty = 0; ty < side; ++ty) {
+      for (int tx = 0; tx < side; ++tx) {
+        PTerrainTileBounds &b = bounds[ty * side + tx];
+
+        b.mins = vec3f(tx * tilewidth, ty * tilewidth, 1000000000.0f);
+        b.maxs = vec3f((tx + 1) * tilewidth, (ty + 1) * tilewidth, -1000000000.0f);
+
+        for (int y = 0; y <= CHECK_HORIZON_TILESIZE; ++y) {
+          for (int x = 0; x <= CHECK_HORIZON_TILESIZE; ++x) {
+            const float h = hmap[(ty * CHECK_HORIZON_TILESIZE + y) * (cells + 1) +
+              tx * CHECK_HORIZON_TILESIZE + x];
+            b.mins.z = std::min(b.mins.z, h);
+            b.maxs.z = std::max(b.maxs.z, h);
+          }
+        }
+
+        b.objmins = b.mins - vec3f(0.5f, 0.5f, 0.0f) * tilewidth;
+        b.objmaxs = b.maxs + vec3f(0.5f * tilewidth, 0.5f * tilewidth, 5.0f);
+      }
+    }
+
+    vec3f campos((radius + unit(random)) * tilewidth, (radius + unit(random)) * tilewidth, 0.0f);
+    campos.z = height(campos.x, campos.y) + 1.0f + 10.0f * unit(random);
+
+    pass.assign(side * side, PASS_TERRAIN | PASS_OBJECTS);
+    horizon.cull(campos, radius, tile, pass);
+
+    for (int i = 0; i < side * side; ++i) {
+      const PTerrainTileBounds &b = bounds[i];
+      const int tx = i % side, ty = i / side;
+
+      total += 2;
+
+      if (!(pass[i] & PASS_TERRAIN)) {
+        ++culled;
+
+        for (int y = 0; y <= CHECK_HORIZON_TILESIZE; ++y) {
+          for (int x = 0; x <= CHECK_HORIZON_TILESIZE; ++x) {
+            const int gx = tx * CHECK_HORIZON_TILESIZE + x, gy = ty * CHECK_HORIZON_TILESIZE + y;
+            const vec3f p(gx * CHECK_HORIZON_CELL, gy * CHECK_HORIZON_CELL, hmap[gy * (cells + 1) + gx]);
+
+            if (visible(campos, p)) {
+              PUtil::outLog() << "horizon: trial " << trial << ", tile " << tx << " " << ty <<
+                ": terrain culled but vertex " << x << " " << y << " in sight" << std::endl;
+              return false;
+            }
+          }
+        }
+      }
+
+      if (!(pass[i] & PASS_OBJECTS)) {
+        ++culled;
+
+        for (int y = 0; y <= 8; ++y) {
+          for (int x = 0; x <= 8; ++x) {
+            const vec3f p(
+              b.objmins.x + (b.objmaxs.x - b.objmins.x) * (float)x / 8.0f,
+              b.objmins.y + (b.objmaxs.y - b.objmins.y) * (float)y / 8.0f,
+              b.objmaxs.z);
+
+            if (visible(campos, p)) {
+              PUtil::outLog() << "horizon: trial " << trial << ", tile " << tx << " " << ty <<
+                ": objects culled but their box in sight" << std::endl;
+              return false;
+            }
+          }
+        }
+      }
+    }
+  }
+
+  if (culled == 0) {
+    PUtil::outLog() << "horizon: nothing was culled" << std::endl;
+    return false;
+  }
+
+  if (PUtil::isDebugLevel(DEBUGLEVEL_TEST))
+    PUtil::outLog() << "horizon: culled " << culled << " passes of " << total << std::endl;
+
+  return true;
+}
+
+///
+/// @brief Stress tests PTileBuilder with a number of worker threads
+/// @details The main thread keeps changing the requests, taking finished
+///  tiles and asking for tiles right away, the way PTerrain does, while the
+///  build function takes a varying while. Every tile must come back built
+///  for its own place, a tile mustn't be built again while a copy of it is
+///  being built or waits to be taken, and every tile built must be handed
+///  over once the requests stop.
+/// @param threads = worker threads
+/// @retval true if the builder behaved
+///
+static bool checkTileBuilderThreads(unsigned int threads)
+{
+  std::mutex mutex;
+  std::map<std::pair<int, int>, int> outstanding;
+  unsigned long built = 0, taken = 0;
+  bool ok = true;
+
+  const auto fail = [&] (const char *what, int tilex, int tiley) {
+    PUtil::outLog() << "tilebuilder: " << threads << " threads, tile " << tilex << " " << tiley <<
+      ": " << what << std::endl;
+    ok = false;
+  };
+
+  const auto build = [&] (PTerrainTileBuild &tile) {
+    unsigned long n;
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+
+      if (outstanding[std::make_pair(tile.posx, tile.posy)]++ != 0)
+        fail("built while another copy was not taken yet", tile.posx, tile.posy);
+
+      n = built++;
+    }
+
+    std::this_thread::sleep_for(std::chrono::microseconds(n * 37 % 150));
+
+    tile.vert.assign(3, vec3f((float)tile.posx, (float)tile.posy, (float)(tile.posx ^ tile.posy)));
+  };
+
+  const auto take = [&] (std::unique_ptr<PTerrainTileBuild> tile) {
+    if (tile->vert.size() != 3 ||
+      tile->vert[2].x != (float)tile->posx ||
+      tile->vert[2].y != (float)tile->posy ||
+      tile->vert[2].z != (float)(tile->posx ^ tile->posy))
+      fail("built wrong", tile->posx, tile->posy);
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (--outstanding[std::make_pair(tile->posx, tile->posy)] != 0)
+      fail("handed over twice", tile->posx, tile->posy);
+
+    ++taken;
+  };
+
+  {
+    PTileBuilder builder(threads, build);
+    std::minstd_rand random(threads + 1);
+    std::vector<vec2i> request;
+    vec2i centre(0, 0);
+
+    for (int round = 0; round < CHECK_BUILDER_ROUNDS && ok; ++round) {
+      // wander, asking for a random part of the square around, which
+      // overlaps what was asked before
+      centre.x += (int)(random() % 3) - 1;
+      centre.y += (int)(random() % 3) - 1;
+
+      request.clear();
+      for (int i = random() % (CHECK_BUILDER_SQUARE * 2); i > 0; --i)
+        request.push_back(vec2i(
+          centre.x + (int)(random() % CHECK_BUILDER_SQUARE) - CHECK_BUILDER_SQUARE / 2,
+          centre.y + (int)(random() % CHECK_BUILDER_SQUARE) - CHECK_BUILDER_SQUARE / 2));
+
+      builder.setRequests(request);
+
+      for (std::unique_ptr<PTerrainTileBuild> tile; (tile = builder.takeBuilt()) != nullptr; )
+        take(std::move(tile));
+
+      // the tiles of the view, some of them built already, some requested
+      // or being built and some not even requested
+      for (int i = random() % 4; i > 0; --i) {
+        const int tilex = centre.x + (int)(random() % CHECK_BUILDER_SQUARE) - CHECK_BUILDER_SQUARE / 2;
+        const int tiley = centre.y + (int)(random() % CHECK_BUILDER_SQUARE) - CHECK_BUILDER_SQUARE / 2;
+        std::unique_ptr<PTerrainTileBuild> tile = builder.takeNow(tilex, tiley);
+
+        if (tile->posx != tilex || tile->posy != tiley)
+          fail("handed over for another tile", tilex, tiley);
+
+        take(std::move(tile));
+      }
+    }
+
+    // no more requests: the tiles started must all come out
+    builder.setRequests(std::vector<vec2i>());
+
+    const auto start = std::chrono::steady_clock::now();
+
+    for (;;) {
+      for (std::unique_ptr<PTerrainTileBuild> tile; (tile = builder.takeBuilt()) != nullptr; )
+        take(std::move(tile));
+
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (taken == built) break;
+      }
+
+      if (std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() >
+        CHECK_BUILDER_DRAIN) {
+        PUtil::outLog() << "tilebuilder: " << threads << " threads: " << built - taken <<
+          " tiles built but never handed over" << std::endl;
+        return false;
+      }
+
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+
+  if (PUtil::isDebugLevel(DEBUGLEVEL_TEST))
+    PUtil::outLog() << "tilebuilder: " << threads << " threads built " << built << " tiles" << std::endl;
+
+  return ok;
+}
+
+///
+/// @brief Checks PTileBuilder without workers, with the usual ones and with
+///  more than there are likely cores
+///
+static bool checkTileBuilder()
+{
+  bool ok = true;
+
+  ok = checkTileBuilderThreads(0) && ok;
+  ok = checkTileBuilderThreads(PTileBuilder::getDefaultThreadCount()) && ok;
+  ok = checkTileBuilderThreads(8) && ok;
+
+  return ok;
+}
+
+///
+/// @brief Checks PGhost::GhostTrack::seek() against a linear scan
+/// @details Random tracks, some with samples at the same time, are played
+///  back the way the game does: frame by frame, with the odd long frame,
+///  rewinds, and times before the start and past the end. After every frame
+///  the cursor must be on the last sample at or before the race time.
+/// @retval true if it always is
+///
+static bool checkGhostSeek()
+{
+  std::minstd_rand random(1);
+  std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+  PGhost::GhostTrack track;
+
+  for (int t = 0; t < CHECK_GHOST_TRACKS; ++t) {
+    const unsigned int samples = t < 3 ? t + 1 : 1 + random() % CHECK_GHOST_SAMPLES;
+
+    track.clear(0);
+
+    float sampletime = unit(random) * 0.5f;
+    for (unsigned int i = 0; i < samples; ++i) {
+      track.push(sampletime, vec3f::zero(), quatf::identity());
+      if (random() % 10 != 0) sampletime += 0.1f + unit(random) * 0.05f;
+    }
+
+    const float start = track.time.front(), end = track.time.back();
+    float racetime = 0.0f;
+    unsigned int cursor = 0;
+
+    for (int frame = 0; frame < CHECK_GHOST_FRAMES; ++frame) {
+      const unsigned int what = random() % 100;
+
+      if (what < 3) racetime = std::max(racetime - unit(random) * 10.0f, 0.0f);
+      else if (what < 6) racetime += unit(random) * 5.0f;
+      else if (what < 7) racetime = end + unit(random);
+      else racetime += 1.0f / 60.0f;
+
+      if (racetime > end + 2.0f) racetime = 0.0f;
+
+      // as PGhost::getReplayPoses(), which leaves ghosts that haven't
+      // started alone
+      if (racetime < start) continue;
+
+      cursor = track.seek(racetime, cursor);
+
+      unsigned int last = 0;
+      while (last + 1 < track.size() && track.time[last + 1] <= racetime)
+        ++last;
+
+      if (cursor != last) {
+        PUtil::outLog() << "ghost: track " << t << " of " << samples << " samples, frame " << frame <<
+          ", time " << racetime << ": cursor on " << cursor << ", not " << last << std::endl;
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+///
+/// @brief Checks the share of foliage drawn against the distance
+/// @details The share must fall from all of a band at lodnear to none at
+///  lodfar, the cut distance of an instance must be where the share drops
+///  below its rank, and the count drawn on a tile must be exactly its
+///  instances whose cut is farther, which is what the foliage fades with.
+/// @retval true if all bands passed
+///
+static bool checkFoliageLod()
+{
+  std::minstd_rand random(1);
+  std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+  for (int b = 0; b < CHECK_FOLIAGE_BANDS; ++b) {
+    PTerrainFoliageBand band;
+
+    band.lodnear = unit(random) * 200.0f;
+    band.lodfar = b % 10 == 0 ? 0.0f : band.lodnear + 1.0f + unit(random) * 500.0f;
+    band.lodfalloff = 0.25f + unit(random) * 4.0f;
+
+    const float span = band.lodfar > 0.0f ? band.lodfar - band.lodnear : 1000.0f;
+    float lastshare = 1.0f;
+
+    for (int d = 0; d <= CHECK_FOLIAGE_DISTANCES; ++d) {
+      const float dist = band.lodnear + span * (1.2f * d / CHECK_FOLIAGE_DISTANCES - 0.1f);
+      const float share = band.getShare(dist);
+
+      bool ok = share >= 0.0f && share <= 1.0f && share <= lastshare;
+      if (dist <= band.lodnear || band.lodfar <= 0.0f) ok = ok && share == 1.0f;
+      else if (dist >= band.lodfar) ok = ok && share == 0.0f;
+
+      if (!ok) {
+        PUtil::outLog() << "foliage: band " << b << " draws a share of " << share <<
+          " at " << dist << ", after " << lastshare << std::endl;
+        return false;
+      }
+
+      lastshare = share;
+
+      if (band.lodfar > 0.0f && share > 0.0f && share < 1.0f &&
+        fabsf(band.getShare(band.getCut(share)) - share) > 0.001f) {
+        PUtil::outLog() << "foliage: band " << b << " cuts a share of " << share <<
+          " at " << band.getCut(share) << ", not " << dist << std::endl;
+        return false;
+      }
+
+      const int instances = 1 + random() % CHECK_FOLIAGE_INSTANCES;
+      const int count = band.getCount(dist, instances);
+
+      for (int j = 0; j < instances; ++j) {
+        const float cut = band.getCut(((float)j + 0.5f) / (float)instances);
+
+        if (fabsf(cut - dist) < span * CHECK_FOLIAGE_TIE) continue;
+
+        if ((dist < cut) != (j < count)) {
+          PUtil::outLog() << "foliage: band " << b << " draws " << count << " of " << instances <<
+            " instances at " << dist << ", but instance " << j << " is cut at " << cut << std::endl;
+          return false;
+        }
+      }
+    }
+  }
+
+  return true;
+}
+
+///
+/// @brief Checks the pairs of the broadphase against comparing every box
+///  with every other
+/// @details Boxes mostly drift a little each frame, which the insertion sort
+///  is made for, but also jump, line up on the same x and come and go, which
+///  it has to survive.
+/// @retval true if every frame gave the right pairs
+///
+static bool checkBroadphase()
+{
+  std::minstd_rand random(1);
+  std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+  PBroadphase broadphase;
+  std::vector<vec3f> pos, size;
+  std::vector<PBroadphase::Pair> expect;
+
+  const auto place = [&] (unsigned int i) {
+    pos[i] = vec3f(unit(random), unit(random), unit(random) * 0.1f) * CHECK_BROADPHASE_AREA;
+    size[i] = vec3f(unit(random), unit(random), unit(random)) * 10.0f;
+
+    // some boxes on the same x, and some just touching the first one
+    if (random() % 8 == 0) pos[i].x = 50.0f;
+    else if (i > 0 && random() % 8 == 0) pos[i] = pos[0] + vec3f(size[0].x, 0.0f, 0.0f);
+  };
+
+  for (int frame = 0; frame < CHECK_BROADPHASE_FRAMES; ++frame) {
+    if (frame % 50 == 0) {
+      const unsigned int oldcount = pos.size();
+      const unsigned int count = random() % (CHECK_BROADPHASE_BOXES + 1);
+
+      broadphase.resize(count);
+      pos.resize(count);
+      size.resize(count);
+
+      for (unsigned int i = oldcount; i < count; ++i) place(i);
+    }
+
+    for (unsigned int i = 0; i < pos.size(); ++i) {
+      if (random() % 100 == 0) place(i);
+      else pos[i] += vec3f(unit(random) - 0.5f, unit(random) - 0.5f, unit(random) - 0.5f);
+
+      broadphase.setBox(i, pos[i], pos[i] + size[i]);
+    }
+
+    expect.clear();
+
+    for (unsigned int a = 0; a < pos.size(); ++a) {
+      for (unsigned int b = a + 1; b < pos.size(); ++b) {
+        const vec3f amax = pos[a] + size[a], bmax = pos[b] + size[b];
+
+        if (pos[a].x > bmax.x || pos[b].x > amax.x ||
+          pos[a].y > bmax.y || pos[b].y > amax.y ||
+          pos[a].z > bmax.z || pos[b].z > amax.z)
+          continue;
+
+        PBroadphase::Pair p;
+        p.a = a;
+        p.b = b;
+        expect.push_back(p);
+      }
+    }
+
+    const std::vector<PBroadphase::Pair> &pair = broadphase.findPairs();
+
+    unsigned int same = 0;
+    while (same < pair.size() && same < expect.size() &&
+      pair[same].a == expect[same].a && pair[same].b == expect[same].b)
+      ++same;
+
+    if (same < pair.size() || same < expect.size()) {
+      PUtil::outLog() << "broadphase: frame " << frame << " of " << pos.size() << " boxes gives " <<
+        pair.size() << " pairs, not " << expect.size() << ", the first " << same << " right" << std::endl;
+      return false;
+    }
+  }
+
+  return true;
+}
+
+///
+/// @brief Checks the tile cache against a plain list, most recent first
+/// @details Tiles far outnumber the hash buckets, so chains are long, and
+///  some lie far out, where the hash wraps. Every so often each tile of the
+///  list is looked up from the oldest to the newest, which leaves the order
+///  as it was, and the capacity changes.
+/// @retval true if the cache always held the same tiles as the list
+///
+static bool checkTileCache()
+{
+  struct Tile {
+    int x, y, value;
+  };
+
+  std::minstd_rand random(1);
+  PTileCache<int> cache(1);
+  std::list<Tile> expect;
+  unsigned int capacity = 1;
+
+  for (int step = 0; step < CHECK_CACHE_STEPS; ++step) {
+    if (step % 5000 == 0) {
+      capacity = 1 + random() % CHECK_CACHE_CAPACITY;
+      cache.setCapacity(capacity);
+      expect.clear();
+
+      if (cache.getCapacity() != capacity || cache.getCount() != 0) {
+        PUtil::outLog() << "tilecache: step " << step << ", capacity " << cache.getCapacity() <<
+          " with " << cache.getCount() << " tiles after setting it to " << capacity << std::endl;
+        return false;
+      }
+    }
+
+    int x = (int)(random() % (CHECK_CACHE_RANGE * 2 + 1)) - CHECK_CACHE_RANGE;
+    int y = (int)(random() % (CHECK_CACHE_RANGE * 2 + 1)) - CHECK_CACHE_RANGE;
+    if (random() % 16 == 0) x += 0x40000000;
+    if (random() % 16 == 0) y -= 0x40000000;
+
+    const auto cached = std::find_if(expect.begin(), expect.end(),
+      [x, y] (const Tile &t) { return t.x == x && t.y == y; });
+
+    int *found = cache.find(x, y);
+
+    if ((found != nullptr) != (cached != expect.end()) || (found && *found != cached->value)) {
+      PUtil::outLog() << "tilecache: step " << step << ", tile " << x << "," << y <<
+        (found ? " found" : " not found") << ", " << expect.size() << " of " << capacity << " cached" << std::endl;
+      return false;
+    }
+
+    if (found) {
+      expect.splice(expect.begin(), expect, cached);
+    } else {
+      int &value = cache.insert(x, y);
+
+      // a full cache hands over the slot of the least recently used tile
+      if (expect.size() == capacity) {
+        if (value != expect.back().value) {
+          PUtil::outLog() << "tilecache: step " << step << ", evicted " << value <<
+            ", not the oldest " << expect.back().value << std::endl;
+          return false;
+        }
+
+        expect.pop_back();
+      }
+
+      value = step;
+      expect.push_front(Tile{ x, y, step });
+    }
+
+    if (cache.getCount() != expect.size()) {
+      PUtil::outLog() << "tilecache: step " << step << ", " << cache.getCount() <<
+        " tiles, not " << expect.size() << std::endl;
+      return false;
+    }
+
+    if (step % 100 == 0) {
+      for (auto t = expect.rbegin(); t != expect.rend(); ++t) {
+        found = cache.find(t->x, t->y);
+
+        if (!found || *found != t->value) {
+          PUtil::outLog() << "tilecache: step " << step << ", lost tile " << t->x << "," << t->y << std::endl;
+          return false;
+        }
+      }
+    }
+  }
+
+  return true;
+}
+
+///
+/// @brief Checks the contact batch against getContactInfo() one point at
+///  a time
+/// @details The points spread over a few turns of the field either way,
+///  and some are picked where the code branches: on grid lines, on the
+///  diagonal of a square and a hair below a row, where the fraction of y
+///  rounds up to 1. Batches of every size up to CHECK_CONTACT_POINTS cover
+///  the points left over past the last four.
+/// @retval true if every point matched
+///
+static bool checkContactBatch()
+{
+  std::minstd_rand random(1);
+  std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+  std::vector<float> field(CHECK_CONTACT_FIELD * CHECK_CONTACT_FIELD);
+  const float scale = 2.5f;
+  float worstheight = 0.0f, worstnormal = 0.0f;
+
+  for (auto &h : field) h = unit(random) * CHECK_CONTACT_HEIGHT;
+
+  PTerrainContact contact;
+  contact.setField(field.data(), CHECK_CONTACT_FIELD, scale);
+
+  std::vector<vec3f> pos(CHECK_CONTACT_POINTS);
+  std::vector<PTerrainContact::ContactInfo> batch(CHECK_CONTACT_POINTS);
+
+  for (int b = 0; b < CHECK_CONTACT_BATCHES; ++b) {
+    const unsigned int n = b % (CHECK_CONTACT_POINTS + 1);
+
+    for (unsigned int i = 0; i < n; ++i) {
+      // whole squares, and the spot within one
+      const int squares = CHECK_CONTACT_FIELD * CHECK_CONTACT_TURNS;
+      float sx = (float)((int)(random() % (squares * 2)) - squares);
+      float sy = (float)((int)(random() % (squares * 2)) - squares);
+      float fx = unit(random), fy = unit(random);
+
+      switch (random() % 8) {
+      case 0: fx = 0.0f; break;
+      case 1: fy = 0.0f; break;
+      case 2: fy = fx; break;
+      // so little below a row that the fraction of y rounds up to 1
+      case 3: sy = 0.0f; fy = -unit(random) * 1e-9f; break;
+      default: break;
+      }
+
+      pos[i] = vec3f((sx + fx) * scale, (sy + fy) * scale, 0.0f);
+    }
+
+    contact.getContactInfoBatch(pos.data(), batch.data(), n);
+
+    for (unsigned int i = 0; i < n; ++i) {
+      PTerrainContact::ContactInfo expect;
+      expect.pos = pos[i];
+      contact.getContactInfo(expect);
+
+      const float height = fabsf(batch[i].pos.z - expect.pos.z);
+      const float normal = std::max(fabsf(batch[i].normal.x - expect.normal.x), std::max(
+        fabsf(batch[i].normal.y - expect.normal.y),
+        fabsf(batch[i].normal.z - expect.normal.z)));
+
+      worstheight = std::max(worstheight, height);
+      worstnormal = std::max(worstnormal, normal);
+
+      if (batch[i].pos.x != pos[i].x || batch[i].pos.y != pos[i].y ||
+        !(height <= CHECK_CONTACT_HEIGHT_TOLERANCE) || !(normal <= CHECK_CONTACT_NORMAL_TOLERANCE)) {
+        PUtil::outLog() << "contact: point " << i << " of " << n << " at " << pos[i].x << "," << pos[i].y <<
+          " has height " << batch[i].pos.z << " for " << expect.pos.z << ", normal " << batch[i].normal.x <<
+          "," << batch[i].normal.y << "," << batch[i].normal.z << " for " << expect.normal.x << "," <<
+          expect.normal.y << "," << expect.normal.z << std::endl;
+        return false;
+      }
+    }
+  }
+
+  if (PUtil::isDebugLevel(DEBUGLEVEL_TEST))
+    PUtil::outLog() << "contact: heights off by up to " << worstheight <<
+      ", normals by up to " << worstnormal << std::endl;
+
+  return true;
+}
+
+///
+/// @brief Checks that a ghost track comes back from a binary ghost file
+/// @details The track wanders about from far out, with a jump that doesn't
+///  fit a change of position, so that a keyframe has to be added for it.
+///  Files cut short and headers counting more than the file holds must be
+///  turned down.
+/// @retval true if the file read back right
+///
+static bool checkGhostBinary()
+{
+  std::minstd_rand random(1);
+  std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+  PGhost::GhostTrack track;
+
+  const auto randomOrientation = [&] () {
+    quatf q(unit(random), unit(random), unit(random), unit(random));
+    q.normalize();
+    return q;
+  };
+
+  track.clear(CHECK_GHOST_FILE_WHEELS);
+
+  vec3f pos(-1500.0f, 800.0f, 60.0f);
+
+  for (unsigned int s = 0; s < CHECK_GHOST_FILE_SAMPLES; ++s) {
+    if (s == CHECK_GHOST_FILE_SAMPLES / 2 + 7) pos.x += CHECK_GHOST_FILE_JUMP;
+    else pos += vec3f(unit(random), unit(random), unit(random) * 0.1f) * 2.0f;
+
+    track.push(s * 0.05f + 0.001f, pos, randomOrientation());
+
+    for (unsigned int w = 0; w < CHECK_GHOST_FILE_WHEELS; ++w) {
+      track.wheelpos[s * CHECK_GHOST_FILE_WHEELS + w] = pos + vec3f(unit(random), unit(random), unit(random));
+      track.wheelori[s * CHECK_GHOST_FILE_WHEELS + w] = randomOrientation();
+    }
+  }
+
+  std::vector<uint8> file;
+
+  PGhost::writeBinary(track, "/vehicles/test/test.vehicle", 34.5f, [&] (const uint8 *data, uint32 size) {
+    file.insert(file.end(), data, data + size);
+    return true;
+  });
+
+  const auto readFile = [] (const std::vector<uint8> &bytes, PGhost::GhostReplay &out) {
+    size_t at = 0;
+
+    return PGhost::readBinary([&] (uint8 *data, uint32 size) {
+      if (size > bytes.size() - at) return false;
+      std::copy(bytes.begin() + at, bytes.begin() + at + size, data);
+      at += size;
+      return true;
+    }, bytes.size(), out);
+  };
+
+  // one keyframe every 64 samples, and one for the jump; the count is the
+  // little endian uint32 at byte 12
+  const uint32 keyframes = file.size() > 15 ? file[12] | file[13] << 8 | file[14] << 16 | file[15] << 24 : 0;
+  const uint32 expectkeyframes = (CHECK_GHOST_FILE_SAMPLES + 63) / 64 + 1;
+
+  if (keyframes != expectkeyframes) {
+    PUtil::outLog() << "ghost-binary: " << keyframes << " keyframes, not " << expectkeyframes << std::endl;
+    return false;
+  }
+
+  PGhost::GhostReplay replay;
+
+  if (!readFile(file, replay) || replay.vehicle != "/vehicles/test/test.vehicle" || replay.time != 34.5f ||
+    replay.track.size() != track.size() || replay.track.wheelcount != track.wheelcount) {
+    PUtil::outLog() << "ghost-binary: the file of " << file.size() << " bytes doesn't read back" << std::endl;
+    return false;
+  }
+
+  const PGhost::GhostTrack &back = replay.track;
+
+  const auto samePosition = [] (const vec3f &a, const vec3f &b) {
+    return fabsf(a.x - b.x) <= 1.0f / 1024.0f && fabsf(a.y - b.y) <= 1.0f / 1024.0f &&
+      fabsf(a.z - b.z) <= 1.0f / 1024.0f;
+  };
+
+  const auto sameOrientation = [] (const quatf &a, const quatf &b) {
+    return 1.0f - fabsf(a.dot(b)) <= CHECK_GHOST_FILE_TURN;
+  };
+
+  for (unsigned int s = 0; s < track.size(); ++s) {
+    // times are kept in whole milliseconds
+    const char *wrong = fabsf(back.time[s] - track.time[s]) > 0.0011f ? "time" : nullptr;
+
+    for (unsigned int p = 0; p <= track.wheelcount && !wrong; ++p) {
+      const unsigned int w = s * track.wheelcount + p - 1;
+
+      if (!samePosition(p == 0 ? back.pos[s] : back.wheelpos[w], p == 0 ? track.pos[s] : track.wheelpos[w]))
+        wrong = p == 0 ? "position" : "wheel position";
+      else if (!sameOrientation(p == 0 ? back.ori[s] : back.wheelori[w], p == 0 ? track.ori[s] : track.wheelori[w]))
+        wrong = p == 0 ? "orientation" : "wheel orientation";
+    }
+
+    if (wrong) {
+      PUtil::outLog() << "ghost-binary: sample " << s << " at " << track.time[s] << " reads back with the wrong " <<
+        wrong << std::endl;
+      return false;
+    }
+  }
+
+  // cut anywhere, from within the header to the last byte
+  for (size_t cut = 1; cut < file.size(); cut += 1 + cut / 8) {
+    const std::vector<uint8> part(file.begin(), file.begin() + (file.size() - cut));
+
+    if (readFile(part, replay)) {
+      PUtil::outLog() << "ghost-binary: the file reads with " << cut << " bytes cut off" << std::endl;
+      return false;
+    }
+  }
+
+  // one sample or keyframe more, or a count that would take all memory,
+  // at bytes 8 and 12
+  for (int field = 8; field <= 12; field += 4) {
+    for (uint32 more : { 1u, 0x10000000u }) {
+      std::vector<uint8> inflated(file);
+      uint32 count = inflated[field] | inflated[field + 1] << 8 | inflated[field + 2] << 16 | inflated[field + 3] << 24;
+
+      count += more;
+      for (int i = 0; i < 4; ++i) inflated[field + i] = (count >> (8 * i)) & 0xff;
+
+      if (readFile(inflated, replay)) {
+        PUtil::outLog() << "ghost-binary: the file reads with " << more << " more counted at byte " << field << std::endl;
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+bool runSelfChecks()
+{
+  const struct {
+    const char *name;
+    bool (*run)();
+  } check[] = {
+    { "lod", checkTerrainLod },
+    { "frustum", checkFrustum },
+    { "horizon", checkHorizon },
+    { "tilebuilder", checkTileBuilder },
+    { "ghost", checkGhostSeek },
+    { "ghost-binary", checkGhostBinary },
+    { "foliage", checkFoliageLod },
+    { "broadphase", checkBroadphase },
+    { "tilecache", checkTileCache },
+    { "contact", checkContactBatch }
+  };
+
+  bool ok = true;
+
+  for (const auto &c : check) {
+    const bool passed = c.run();
+
+    std::cout << "selfcheck " << c.name << (passed ? " ok" : " failed") << std::endl;
+    ok = ok && passed;
+  }
+
+  return ok;
+}
+
+static mat44f getCheckMatrix(const float *in)
+{
+  mat44f mat;
+
+  std::copy(in, in + 16, (float *)mat);
+  return mat;
+}
+
+///
+/// @brief The vmath members that have SSE versions, as functions of the
+///  floats they are given to the floats they give back
+///
+static const struct {
+  const char *name;
+  int inputs;
+  int outputs;
+  void (*run)(const float *in, float *out);
+} vmathcheck[] = {
+  { "concatenate", 32, 16, [] (const float *in, float *out) {
+    const mat44f mat = getCheckMatrix(in).concatenate(getCheckMatrix(in + 16));
+    std::copy((const float *)mat, (const float *)mat + 16, out);
+  } },
+  { "transpose", 16, 16, [] (const float *in, float *out) {
+    const mat44f mat = getCheckMatrix(in).transpose();
+    std::copy((const float *)mat, (const float *)mat + 16, out);
+  } },
+  { "transform1-vec3", 19, 3, [] (const float *in, float *out) {
+    const vec3f vec = getCheckMatrix(in).transform1(vec3f(in[16], in[17], in[18]));
+    std::copy(&vec.x, &vec.x + 3, out);
+  } },
+  { "transform1-vec4", 20, 4, [] (const float *in, float *out) {
+    const vec4f vec = getCheckMatrix(in).transform1(vec4f(in[16], in[17], in[18], in[19]));
+    std::copy(&vec.x, &vec.x + 4, out);
+  } },
+  { "transform2-vec3", 19, 3, [] (const float *in, float *out) {
+    const vec3f vec = getCheckMatrix(in).transform2(vec3f(in[16], in[17], in[18]));
+    std::copy(&vec.x, &vec.x + 3, out);
+  } },
+  { "transform2-vec4", 20, 4, [] (const float *in, float *out) {
+    const vec4f vec = getCheckMatrix(in).transform2(vec4f(in[16], in[17], in[18], in[19]));
+    std::copy(&vec.x, &vec.x + 4, out);
+  } },
+  { "transformNormal", 19, 3, [] (const float *in, float *out) {
+    const vec3f vec = getCheckMatrix(in).transformNormal(vec3f(in[16], in[17], in[18]));
+    std::copy(&vec.x, &vec.x + 3, out);
+  } },
+  { "quat-getMatrix", 4, 16, [] (const float *in, float *out) {
+    const mat44f mat = quatf(in[0], in[1], in[2], in[3]).getMatrix();
+    std::copy((const float *)mat, (const float *)mat + 16, out);
+  } },
+  { "quat-normalize", 4, 4, [] (const float *in, float *out) {
+    quatf rot(in[0], in[1], in[2], in[3]);
+    rot.normalize();
+    std::copy(&rot.x, &rot.x + 4, out);
+  } }
+};
+
+void dumpVmath(std::ostream &out)
+{
+  std::minstd_rand random(1);
+  std::uniform_real_distribution<float> unit(-2.0f, 2.0f);
+  float in[32], res[16];
+
+  // nine digits bring a float back exactly
+  out << std::setprecision(9);
+
+  for (const auto &op : vmathcheck) {
+    for (int t = 0; t < CHECK_VMATH_TRIALS; ++t) {
+      // the first quaternions are zero and tiny, which the members handle
+      // apart
+      for (int i = 0; i < op.inputs; ++i)
+        in[i] = t == 0 ? 0.0f : t == 1 ? unit(random) * 1e-12f : unit(random);
+
+      op.run(in, res);
+
+      out << op.name;
+      for (int i = 0; i < op.inputs; ++i) out << ' ' << in[i];
+      for (int i = 0; i < op.outputs; ++i) out << ' ' << res[i];
+      out << '\n';
+    }
+  }
+
+  out << "end" << std::endl;
+}
+
+bool checkVmath(std::istream &in)
+{
+  std::map<std::string, int> checked;
+  float input[32], res[16], expect[16];
+  std::string name;
+  int line = 0;
+
+  for (in >> name; in && name != "end"; in >> name) {
+    ++line;
+
+    const auto *op = std::begin(vmathcheck);
+    while (op != std::end(vmathcheck) && name != op->name) ++op;
+
+    if (op == std::end(vmathcheck)) {
+      PUtil::outLog() << "vmath: line " << line << " has unknown member \"" << name << "\"" << std::endl;
+      return false;
+    }
+
+    for (int i = 0; i < op->inputs; ++i) in >> input[i];
+    for (int i = 0; i < op->outputs; ++i) in >> expect[i];
+
+    if (!in) break;
+
+    op->run(input, res);
+
+    for (int i = 0; i < op->outputs; ++i) {
+      if (fabsf(res[i] - expect[i]) > CHECK_VMATH_ABSOLUTE + CHECK_VMATH_RELATIVE * fabsf(expect[i])) {
+        PUtil::outLog() << "vmath: line " << line << ", " << name << " gives " << res[i] <<
+          " for result " << i << ", not " << expect[i] << std::endl;
+        return false;
+      }
+    }
+
+    ++checked[name];
+  }
+
+  // a dump cut short, such as from a build that failed, doesn't pass
+  bool ok = in && name == "end";
+  if (!ok) PUtil::outLog() << "vmath: the dump ends after line " << line << std::endl;
+
+  for (const auto &op : vmathcheck) {
+    if (checked[op.name] != CHECK_VMATH_TRIALS) {
+      PUtil::outLog() << "vmath: " << checked[op.name] << " results of " << op.name <<
+        ", not " << CHECK_VMATH_TRIALS << std::endl;
+      ok = false;
+    }
+  }
+
+  return ok;
+}
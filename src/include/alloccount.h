@@ -0,0 +1,10 @@
+
+// alloccount.h [psim]
+
+// License: GPL version 2 (see included gpl.txt)
+
+#pragma once
+
+// Heap allocations made so far by any thread, counted by the global
+// operator new of builds defining PSIM_COUNT_ALLOCATIONS
+unsigned long getAllocationCount();
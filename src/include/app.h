@@ -80,6 +80,11 @@ class PApp
 
         bool exit_requested, screenshot_requested;
 
+        // game time per real time, and whether game time is run as fast as
+        // possible instead of following the clock
+        float timescale;
+        bool maxthroughput;
+
         PSSRender *ssrdr;
         PSSTexture *sstex;
         PSSEffect *ssfx;
@@ -254,6 +259,29 @@ class PApp
         void setScreenModeAutoWindow();
         void setScreenModeFastFullScreen();
 
+        // How many seconds of game time pass for each real second
+        void setTimeScale(float scale)
+        {
+            timescale = (scale > 0.0f) ? scale : 1.0f;
+        }
+
+        float getTimeScale() const
+        {
+            return timescale;
+        }
+
+        // Tick fixed slices of game time back to back, as fast as the CPU
+        // allows, and only draw a few frames per second
+        void setMaxThroughput(bool enable)
+        {
+            maxthroughput = enable;
+        }
+
+        bool getMaxThroughput() const
+        {
+            return maxthroughput;
+        }
+
         // callbacks for derived classes
         virtual void config() /* throw (PUserException) */ ; // very light setup/config func
         virtual void load() /* throw (PUserException) */ ; // main resource loading
@@ -0,0 +1,51 @@
+
+// broadphase.h [psim]
+
+// License: GPL version 2 (see included gpl.txt)
+
+#pragma once
+
+#include "vmath.h"
+#include <vector>
+
+///
+/// @brief Finds which of a set of boxes overlap, by sweep and prune
+/// @details The boxes are kept sorted by their lowest x, and a sweep along x
+///  only compares boxes whose x ranges meet. The order is kept from one call
+///  to the next and fixed with an insertion sort; between two simulation
+///  steps bodies barely move, so the sort is close to linear and so is the
+///  whole search, unless many boxes share the same stretch of x.
+///  The pairs come out sorted, whatever the order of the boxes, so that
+///  callers applying forces pair by pair stay deterministic.
+///
+class PBroadphase {
+public:
+  struct Pair {
+    // box indices, a < b
+    unsigned int a, b;
+  };
+
+  // Change the number of boxes; the new ones must be set before findPairs()
+  void resize(unsigned int count);
+
+  // Drop all the boxes
+  void clear();
+
+  unsigned int size() const { return boxmin.size(); }
+
+  void setBox(unsigned int i, const vec3f &newmin, const vec3f &newmax) {
+    boxmin[i] = newmin;
+    boxmax[i] = newmax;
+  }
+
+  // The pairs of boxes that overlap, valid until the next call
+  const std::vector<Pair> &findPairs();
+
+private:
+  std::vector<vec3f> boxmin, boxmax;
+
+  // box indices by increasing boxmin.x, as of the last findPairs()
+  std::vector<unsigned int> order;
+
+  std::vector<Pair> pair;
+};
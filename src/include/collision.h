@@ -22,6 +22,8 @@
 #include "vehicle.h"
 
 class PTerrainFoliage;
+class PTerrainData;
+struct PTerrainObjectQuery;
 
 ///
 /// @brief Handling of collisions with world objects
@@ -29,7 +31,7 @@ class PTerrainFoliage;
 class PCollision {
 public:
   PCollision(const std::vector<vehicle_clip_s> &clip, PReferenceFrame &ref_world);
-  const std::vector<PTerrainFoliage> checkContact(const std::vector<PTerrainFoliage> *foliage) const;
+  void checkContact(PTerrainData &terrain, PTerrainObjectQuery &contact) const;
   bool towardsContact(const vec3f &body, const vec3f &contact, const vec3f &diff) const;
   const vec3f &getCrashPoint(const vec3f &body, const PTerrainFoliage &foliage);
 
@@ -74,6 +74,8 @@ public:
     ActionHandbrake,
     ActionRecover,
     ActionRecoverAtCheckpoint,
+    ActionRestart,
+    ActionRewind,
     ActionCamMode,
     ActionCamLeft,
     ActionCamRight,
@@ -97,6 +99,10 @@ public:
   bool getFoliage() const;
   bool getRoadsigns() const;
   bool getWeather() const;
+  int getTileCache() const;
+  int getViewRadius() const;
+  float getTerrainError() const;
+  bool getHorizonCulling() const;
   int getVideoCx() const;
   int getVideoCy() const;
   bool getVideoFullscreen() const;
@@ -112,6 +118,10 @@ public:
   const std::string &getCodrivername() const;
   bool getDirteffect() const;
   bool getEnableGhost() const;
+  float getTimeScale() const;
+  bool getMaxThroughput() const;
+  const std::string &getRaceReport() const;
+  bool getSaveReplays() const;
   float getDrivingassist() const;
   float getVolumeEngine() const;
   float getVolumeSfx() const;
@@ -161,6 +171,11 @@ private:
   bool cfg_enable_fps;
   bool cfg_enable_ghost;
 
+  float cfg_timescale;          ///< Game seconds per real second.
+  bool cfg_maxthroughput;       ///< Run races as fast as the CPU allows.
+  std::string cfg_racereport;   ///< File in the user directory race results are appended to, if any.
+  bool cfg_savereplays;         ///< Save the inputs of each finished race as a replay.
+
   long int cfg_skip_saves;
 
   /// Basic volume control.
@@ -195,6 +210,10 @@ private:
   bool cfg_foliage = true;          ///< Foliage on/off flag.
   bool cfg_roadsigns = true;        ///< Road signs on/off flag.
   bool cfg_weather = true;          ///< Weather on/off flag.
+  int cfg_tilecache = 64;           ///< Memory budget of the terrain tile cache, in megabytes.
+  int cfg_viewradius = 3;           ///< Terrain tiles drawn on each side of the camera.
+  float cfg_terrainerror = 2.0f;    ///< Largest terrain detail error on screen, in pixels.
+  bool cfg_horizonculling = true;   ///< Skip terrain hidden behind nearer terrain.
 
   struct Control ctrl;
 };
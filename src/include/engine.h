@@ -28,6 +28,9 @@
 #define RPM_TO_RPS(x) ((x) * (PI / 30.0f))
 #define RPS_TO_RPM(x) ((x) * (30.0f / PI))
 
+// intervals of the torque table, between minRPS and maxRPS
+#define ENGINE_TORQUE_STEPS 512
+
 ///
 /// @brief Datas about performances of an engine
 ///
@@ -50,16 +53,48 @@ class PEngine {
   
 	// engine minimum and maximum radians per second angular speed
 	float minRPS, maxRPS;
-  
-protected:
-	float getPowerAtRPS(float rps);
-  
+
+	// torque at the crankshaft (power / rps) sampled at ENGINE_TORQUE_STEPS + 1
+	// evenly spaced rps from minRPS to maxRPS, see buildTables()
+	std::vector<float> torque;
+
+	// torque table intervals per radian per second
+	float torque_scale;
+
+	// for each gear: 1 / ratio, and how the engine rps scales when shifting
+	// to the gear above and to the gear below (1 when there is none)
+	std::vector<float> gear_inv;
+	std::vector<float> gear_up;
+	std::vector<float> gear_down;
+
 public:
 	PEngine():
 		gearch_first(0.4f),
 		gearch_repeat(0.15f),
 		minRPS(10000000.0f),
-		maxRPS(0.0f) { }
+		maxRPS(0.0f),
+		torque_scale(0.0f) { }
+
+	// Power from the curve itself, slow: the simulation uses getTorqueAtRPS()
+	float getPowerAtRPS(float rps) const;
+
+	///
+	/// @brief Get the torque at the crankshaft, from the table
+	/// @param rps = radians per second, clamped to the engine range
+	/// @retval torque before the gearbox, linearly interpolated
+	///
+	float getTorqueAtRPS(float rps) const
+	{
+		float pos = (rps - minRPS) * torque_scale;
+		CLAMP(pos, 0.0f, (float)ENGINE_TORQUE_STEPS);
+
+		const int i = MIN((int)pos, ENGINE_TORQUE_STEPS - 1);
+
+		return torque[i] + (torque[i + 1] - torque[i]) * (pos - (float)i);
+	}
+
+	// Build the torque and gear tables, once curve and gears are loaded
+	void buildTables();
   
 	///
 	/// @brief Add a point to the power curve
@@ -75,8 +110,13 @@ public:
 	///
 	void addGear(const float& ratio);
   
-	bool hasGears() { return !gear.empty(); }
-	float getLastGearRatio() { return gear.back(); }
+	bool hasGears() const { return !gear.empty(); }
+	float getLastGearRatio() const { return gear.back(); }
+	unsigned int getGearCount() const { return gear.size(); }
+	float getGearRatio(unsigned int g) const { return gear[g]; }
+
+	float getMinRPS() const { return minRPS; }
+	float getMaxRPS() const { return maxRPS; }
   
 	// get engine horse power
 	float getHorsePower();
@@ -84,6 +124,20 @@ public:
 	friend class PEngineInstance;
 };
 
+///
+/// @brief Copy of the changing part of a PEngineInstance, for simulation snapshots
+///
+struct PEngineState {
+	float rps;
+	int currentgear;
+	int targetgear_rel;
+	float gearch;
+	bool reverse;
+	float out_torque;
+	bool flag_gearchange;
+	int shiftdirection;
+};
+
 ///
 /// @brief current status of the engine
 ///
@@ -167,4 +221,27 @@ public:
 		gearch = 0.0f;
 		out_torque = 0.0f;
 	}
+
+	// Copy the state out and back in, the engine type is left alone
+	void saveState(PEngineState &state) const {
+		state.rps = rps;
+		state.currentgear = currentgear;
+		state.targetgear_rel = targetgear_rel;
+		state.gearch = gearch;
+		state.reverse = reverse;
+		state.out_torque = out_torque;
+		state.flag_gearchange = flag_gearchange;
+		state.shiftdirection = shiftdirection;
+	}
+
+	void restoreState(const PEngineState &state) {
+		rps = state.rps;
+		currentgear = state.currentgear;
+		targetgear_rel = state.targetgear_rel;
+		gearch = state.gearch;
+		reverse = state.reverse;
+		out_torque = state.out_torque;
+		flag_gearchange = state.flag_gearchange;
+		shiftdirection = state.shiftdirection;
+	}
 };
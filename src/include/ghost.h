@@ -18,11 +18,14 @@
 
 #pragma once
 
+#include <cstdint>
+#include <functional>
 #include <string>
 #include <vector>
 #include "vmath.h"
 
 class PSSModel;
+struct PHYSFS_File;
 struct PVehiclePart;
 
 ///
@@ -31,42 +34,88 @@ struct PVehiclePart;
 class PGhost {
 public:
   ///
-  /// @brief Wheels of the ghost
+  /// @brief Samples of a ghost, as parallel arrays
+  /// @details The wheels of a sample are wheelcount entries in wheelpos and
+  ///  wheelori, starting at sample * wheelcount; no sample owns a buffer.
   ///
-  struct GhostWheel {
-    // Position in world coordinates
-    vec3f pos;
-    // Orientation of the wheel
-    quatf ori;
+  struct GhostTrack {
+    unsigned int wheelcount = 0;
+    std::vector<float> time;
+    std::vector<vec3f> pos;
+    std::vector<quatf> ori;
+    std::vector<vec3f> wheelpos;
+    std::vector<quatf> wheelori;
+
+    unsigned int size() const { return time.size(); }
+    void clear(unsigned int wheels);
+    void reserve(unsigned int samples);
+    void push(float newtime, const vec3f &newpos, const quatf &newori);
+    void popBack();
+    unsigned int seek(float racetime, unsigned int cursor) const;
+  };
+
+  ///
+  /// @brief A ghost loaded for play back
+  ///
+  struct GhostReplay {
+    // Name of the vehicle
+    std::string vehicle;
+    // Race time of the ghost
+    float time = 0.0f;
+    // Samples
+    GhostTrack track;
+    // Last sample at or before the race time, as of the last getReplayPoses()
+    unsigned int cursor = 0;
   };
 
   ///
-  /// @brief State of the ghost vehicle
+  /// @brief Poses of the ghosts at the race time, as parallel arrays
+  /// @details Entry k is the pose of replay ghost[k]; its wheels start at
+  ///  wheelfirst[k]. The arrays are resized on every call, which doesn't
+  ///  allocate once they have grown to the number of ghosts.
   ///
-  struct GhostData {
-    // Time stamp in seconds in game time
-    float time;
-    // Position in world coordinates
-    vec3f pos;
-    // Orientation of the vehicle
-    quatf ori;
-    // Status of the wheels
-    std::vector<GhostWheel> wheel;
+  struct GhostPoses {
+    std::vector<unsigned int> ghost;
+    std::vector<vec3f> pos;
+    std::vector<quatf> ori;
+    std::vector<unsigned int> wheelfirst;
+    std::vector<vec3f> wheelpos;
+    std::vector<quatf> wheelori;
   };
 
   PGhost(float sampletime);
-  void recordStart(const std::string &map, const std::string &vehicle);
+  void recordStart(const std::string &map, const std::string &vehicle,
+    const std::string &player, const std::string &carclass,
+    const std::vector<std::string> &otherplayers);
   void recordSample(float delta, const PVehiclePart &part);
+  void recordRewind(float seconds);
   void recordStop(float time);
-  bool getReplayData(GhostData &data, std::string &vehicle) const;
+
+  unsigned int getReplayCount() const { return replay.size(); }
+  const GhostReplay &getReplay(unsigned int i) const { return replay[i]; }
+  void getReplayPoses(GhostPoses &poses);
+
+  // The binary ghost file format, apart from where the bytes go
+  static bool readBinary(const std::function<bool (uint8 *, uint32)> &read,
+    uint64_t length, GhostReplay &out);
+  static bool writeBinary(const GhostTrack &track, const std::string &vehicle, float time,
+    const std::function<bool (const uint8 *, uint32)> &write);
 
 private:
   PGhost();
   PGhost(const PGhost&);
   PGhost& operator=(const PGhost&);
 
-  // Map related to the ghost car
-  std::string mapname;
+  float loadReplay(const std::string &filename);
+  bool loadBinary(PHYSFS_File *physfile, GhostReplay &out) const;
+  bool loadText(PHYSFS_File *physfile, GhostReplay &out) const;
+  void saveIfBest(const std::string &filename, float besttime, float time) const;
+  bool saveBinary(PHYSFS_File *physfile, float time) const;
+
+  // Files of the best ghost of the map, of the player and of the class
+  // of the vehicle, and their race times
+  std::string bestfile, playerfile, classfile;
+  float besttime, playertime, classtime;
   // Name of the vehicle for recording
   std::string vehiclename;
   // Minimum time after which a sample is taken
@@ -74,13 +123,13 @@ private:
   // To check if time since last has passed
   float lastsample;
   // Recorded data samples
-  std::vector<GhostData> recordeddata;
-  // Replay data samples
-  std::vector<GhostData> replaydata;
+  GhostTrack recordeddata;
+  // Ghosts to play back
+  std::vector<GhostReplay> replay;
   // Accumulated race time
   float racetime;
-  // Ghost vehicle for replay
-  std::string replayvehicle;
-  // Total race time of replay vehicle
-  float replaytime;
+  // For each pose of getReplayPoses(), the samples it is between and how
+  // far it is from the first to the second
+  std::vector<unsigned int> posesample, posenext;
+  std::vector<float> posefactor;
 };
@@ -390,6 +390,42 @@ public:
         return bct;
     }
 
+    ///
+    /// @brief Retrieves the players who have a time for `mapname`.
+    /// @param [in] mapname         Map for which to get the players.
+    /// @returns Names of the players, fastest first.
+    ///
+    std::vector<std::string> getPlayerNames(const std::string &mapname) const
+    {
+        const auto range = alltimes.equal_range(mapname);
+
+        std::unordered_map<std::string, float> besttimes;
+
+        for (auto i = range.first; i != range.second; ++i)
+        {
+            const auto bt = besttimes.find(i->second.playername);
+
+            if (bt == besttimes.end())
+                besttimes[i->second.playername] = i->second.totaltime;
+            else
+                bt->second = std::min(bt->second, i->second.totaltime);
+        }
+
+        std::vector<std::string> names;
+
+        for (const auto &bt: besttimes)
+            names.push_back(bt.first);
+
+        std::sort(names.begin(), names.end(),
+            [&besttimes](const std::string &a, const std::string &b) -> bool
+            {
+                return besttimes.at(a) < besttimes.at(b) ||
+                    (besttimes.at(a) == besttimes.at(b) && a < b);
+            });
+
+        return names;
+    }
+
     ///
     /// @brief Retrieves best times list for `mapname`, sorted by `sortmethod`.
     /// @param [in] mapname         Map for which to get the times.
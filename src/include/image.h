@@ -0,0 +1,61 @@
+
+// image.h [pengine]
+
+// Copyright 2004-2006 Jasmine Langridge, jas@jareiko.net
+// License: GPL version 2 (see included gpl.txt)
+
+//
+// PImage holds decoded pixel data in main memory; it has no dependency on
+// OpenGL so that it can be used by the headless simulator as well
+//
+
+#pragma once
+
+#include "vmath.h"
+#include <string>
+
+class PImage {
+private:
+  uint8 *data;
+  int cx,cy,cc;
+
+public:
+  PImage () : data (nullptr) { }
+  PImage (const std::string &filename) : data (nullptr) { load (filename); }
+  PImage (int _cx, int _cy, int _cc) : data (nullptr) { load (_cx, _cy, _cc); }
+  ~PImage ();
+
+  void load (const std::string &filename);
+  void load (int _cx, int _cy, int _cc);
+  void unload ();
+
+  void expandChannels();
+
+  int getcx() const { return cx; }
+  int getcy() const { return cy; }
+  int getcc() const { return cc; }
+  uint8 *getData() { return data; }
+
+  const uint8 * getData() const
+  {
+    return data;
+  }
+
+  uint8 & getByte(int i)
+  {
+      return data[i];
+  }
+
+  uint8 getByte(int i) const
+  {
+      return data[i];
+  }
+
+  void swap (PImage &other) throw ()
+  {
+    { uint8 *tmp = data; data = other.data; other.data = tmp; }
+    { int tmp = cx; cx = other.cx; other.cx = tmp; }
+    { int tmp = cy; cy = other.cy; other.cy = tmp; }
+    { int tmp = cc; cc = other.cc; other.cc = tmp; }
+  }
+};
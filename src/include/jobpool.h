@@ -0,0 +1,71 @@
+
+// jobpool.h [pengine]
+
+// License: GPL version 2 (see included gpl.txt)
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+///
+/// @brief Fixed pool of worker threads running batches of independent jobs
+/// @details parallelFor() spreads the job indices over one queue per thread.
+///  Each thread takes work from the front of its own queue and, once that is
+///  empty, steals from the back of the others, so uneven jobs still keep all
+///  threads busy. The calling thread works too, and parallelFor() returns
+///  only when every job has finished, so it doubles as a barrier.
+///  Threads are started on the first batch that needs them.
+///
+class PJobPool {
+public:
+  // threads = worker threads besides the caller, 0 runs everything serially
+  PJobPool(unsigned int threads);
+  ~PJobPool();
+
+  // Worker threads that would suit this machine
+  static unsigned int getDefaultThreadCount();
+
+  unsigned int getThreadCount() const { return threadcount; }
+
+  // Call job(0) ... job(count - 1), in any order and on any thread
+  void parallelFor(unsigned int count, const std::function<void (unsigned int)> &job);
+
+private:
+  PJobPool(const PJobPool &);
+  PJobPool &operator=(const PJobPool &);
+
+  // items[first] to items.back() are waiting; a plain vector rather than a
+  // deque so that, once grown, batches don't allocate
+  struct Queue {
+    std::mutex mutex;
+    std::vector<unsigned int> items;
+    unsigned int first = 0;
+  };
+
+  void start();
+  void workerMain(unsigned int home);
+  bool runOne(unsigned int home);
+
+  unsigned int threadcount;
+
+  std::vector<std::thread> workers;
+
+  // one queue per worker, the last one belongs to the caller
+  std::vector<std::unique_ptr<Queue>> queues;
+
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable done;
+
+  // batch being run, and how many of its jobs haven't finished yet
+  const std::function<void (unsigned int)> *current;
+  std::atomic<unsigned int> remaining;
+  unsigned int batch;
+  bool quit;
+};
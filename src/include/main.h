@@ -27,6 +27,9 @@
 #include "hiscore1.h"
 #include "option.h"
 #include "rigidity.h"
+#include "replay.h"
+#include "ringbuffer.h"
+#include "simsnapshot.h"
 #include "vmath.h"
 #include <unordered_map>
 
@@ -89,6 +92,23 @@ enum class Gamestate {
 	// race ended
 	finished
 };
+///
+/// @brief Race state saved by TriggerGame, to restart or rewind the race
+///
+struct TriggerGameSnapshot {
+	PSimSnapshot sim;
+
+	Gamestate gamestate;
+	float coursetime;
+	float othertime;
+	float cptime;
+
+	vec3f lastCkptPos;
+	quatf lastCkptOri;
+
+	bool offroad_earlier;
+};
+
 ///
 /// @brief Camera view mode
 ///
@@ -179,6 +199,23 @@ private:
     vec3f lastCkptPos;
     quatf lastCkptOri;
 
+	// if the user vehicle was offroad after the last tick
+	bool offroad_earlier;
+
+	// the race as it was before the countdown, for restart()
+	TriggerGameSnapshot startsnapshot;
+
+	// the race every REWIND_INTERVAL seconds, for rewind(), and the time
+	// since the last one was taken
+	PRingBuffer<TriggerGameSnapshot> rewindbuffer;
+	float rewindtimer;
+
+	// the .level file of the race
+	std::string levelname;
+
+	// the inputs of the race since the countdown, saved by saveReplay()
+	PReplay replay;
+
 	// Structure that stores the current weather
 	struct {
 		struct {
@@ -219,6 +256,19 @@ public:
 
 	void resetAtCheckpoint(PVehicle *veh);
 
+	// Copy the race state out and back in
+	void saveSnapshot(TriggerGameSnapshot &snapshot) const;
+	bool restoreSnapshot(const TriggerGameSnapshot &snapshot);
+
+	// Start the race over without loading the level again
+	bool restart();
+
+	// Go back a second or more in the race, returns how far it went back
+	float rewind();
+
+	// Save the inputs of the race so far to "<level>.replay"
+	bool saveReplay();
+
 	void renderCodriverSigns();
 
 	bool loadVehicles();
@@ -477,6 +527,13 @@ private:
 
 	// Record and display of ghost vehicles
 	PGhost ghost;
+	// Poses of the ghosts this frame, and the vehicle types and parts to
+	// draw them with, kept from frame to frame
+	PGhost::GhostPoses ghostposes;
+	std::vector<const PVehicleType *> ghosttypes;
+	std::vector<PVehiclePart> ghostparts;
+	// Part the cars are drawn with, between their last two steps
+	PVehiclePart drawpart;
 
 	void loadCodriversigns();
 	void loadCodrivername();
@@ -487,9 +544,13 @@ protected:
 	void renderSky(const mat44f &cammat);
 
 	bool startGame(const std::string &filename);
+	void restartGame();
+	void rewindGame();
 	void toggleSounds(bool to);
 	void initAudio();
 	void endGame(Gamefinish state);
+	void startGhost(const PVehicleType &vehicle);
+	void writeRaceReport(Gamefinish state);
 
 	void quitGame()
 	{
@@ -539,6 +600,7 @@ public:
 	void renderStateChoose(float eyetranslation);
 	void tickStateGame(float delta);
 	void renderStateGame(float eyetranslation);
+	void renderGhosts();
 
 	void renderDamageIndicator(
 	    const PTexture *texture, float posx, float posy, float scalex, float scaley, float damage);
@@ -10,18 +10,23 @@
 
 #pragma once
 
+#include "broadphase.h"
+#include "jobpool.h"
 #include "subsys.h"
 #include "vmath.h"
+#include <deque>
+#include <memory>
 
 class PSim;
-class PSSModel;
-class PTerrain;
+struct PSimSnapshot;
+class PModelList;
+class PTerrainData;
 class PVehicle;
 class PVehicleType;
 
 ///
 /// @brief Store a Reference oriented point (stores coordinates and orientation)
-/// @details It is the base class for more advanced classes such as PRigidBody
+/// @details PRigidBody keeps one in its simulation's PRigidBodyStore
 ///
 class PReferenceFrame {
 private:
@@ -69,42 +74,149 @@ public:
   vec3f getWorldToLocPoint(const vec3f &pt) {
     return ori_mat.transform2(pt - pos);
   }
+
+  // Blend between two frames: t = 0 gives 'a', t = 1 gives 'b'
+  void setInterpolated(const PReferenceFrame &a, const PReferenceFrame &b, float t) {
+    pos = a.pos + (b.pos - a.pos) * t;
+    // q and -q are the same rotation, take the short way round
+    quatf ori_b = b.ori;
+    if (a.ori.dot(ori_b) < 0.0f) ori_b = ori_b * -1.0f;
+    ori = a.ori * (1.0f - t) + ori_b * t;
+    updateMatrices();
+  }
 };
 
 ///
-/// @brief A Rigid body with mass, position, velocity, and angular mass, position, and velocity
-/// @todo: intelligent friction calculation
+/// @brief Poses, velocities, forces and inverse masses of all the rigid bodies of a simulation
+/// @details Velocities, forces and masses are stored as a structure of
+///  arrays, one array per vector component, so that integrateVelocities()
+///  runs over every body in a few tight loops the compiler can vectorize.
+///  The poses are one array of PReferenceFrame, matrices included, which the
+///  vehicle code reads in place through PRigidBody; integratePoses() walks
+///  it in order. PRigidBody objects address their slot by index. Slots are
+///  only ever added, or all dropped at once by clear().
 ///
-class PRigidBody : public PReferenceFrame {
+class PRigidBodyStore {
+  friend class PRigidBody;
+
 private:
-  // the gravity vector
-  const vec3f &gravity;
+  unsigned int count;
+
+  // position and orientation, and the same before the last step for rendering
+  std::vector<PReferenceFrame> ref, ref_prev;
 
-  // mass and 1/mass
-  float mass, mass_inv;
-  // inertial tensor (angular mass) and 1/angmass (usually just approximately computed)
-  vec3f angmass, angmass_inv;
+  // 1/mass and 1/angmass (inertial tensor)
+  std::vector<float> mass_inv;
+  std::vector<float> angmass_inv_x, angmass_inv_y, angmass_inv_z;
 
   // linear and angular velocity
-  vec3f linvel;
-  vec3f angvel;
+  std::vector<float> linvel_x, linvel_y, linvel_z;
+  std::vector<float> angvel_x, angvel_y, angvel_z;
 
   // the force and the torque accumuled during a slice of time
-  vec3f accum_force;
-  vec3f accum_torque;
+  std::vector<float> force_x, force_y, force_z;
+  std::vector<float> torque_x, torque_y, torque_z;
+
+  // 1 for moving bodies, 0 for sleeping ones; a factor rather than a flag
+  // so that integrateVelocities() stays branch free
+  std::vector<float> awake;
 
 public:
-  PRigidBody(const vec3f &gravity_parent);
+  PRigidBodyStore() : count(0) { }
+
+  // Add a body at rest with unit mass, returns its index
+  unsigned int add();
+
+  // Drop all the bodies
+  void clear();
+
+  unsigned int size() const { return count; }
+
+  // Remember the current poses of all bodies as the previous ones
+  void savePrevious() { ref_prev = ref; }
+
+  // Apply the accumulated forces and torques of all bodies, then reset them
+  void integrateVelocities(const vec3f &gravity, float delta);
+
+  // Move the bodies that aren't sleeping along their velocities, after
+  // integrateVelocities() has updated them
+  void integratePoses(float delta);
+};
+
+///
+/// @brief Copy of everything about a PRigidBody that changes while it is simulated
+///
+struct PRigidBodyState {
+  PReferenceFrame ref, ref_prev;
+  vec3f linvel, angvel;
+  vec3f force, torque;
+  float awake;
+};
+
+///
+/// @brief A Rigid body with mass, position, velocity, and angular mass, position, and velocity
+/// @details A handle on a slot of the simulation's PRigidBodyStore, which
+///  holds the pose, the velocities and the accumulated forces. The pose is
+///  reached through the same calls as on a PReferenceFrame.
+/// @todo: intelligent friction calculation
+///
+class PRigidBody {
+private:
+  // where the state lives, and which slot is ours
+  PRigidBodyStore &store;
+  const unsigned int index;
+
+  // mass and angular mass, their inverses are in the store
+  float mass;
+  vec3f angmass;
+
+public:
+  PRigidBody(PRigidBodyStore &store_parent);
   ~PRigidBody();
 
+private:
+  PRigidBody(const PRigidBody &);
+  PRigidBody &operator=(const PRigidBody &);
+
 public:
   void setMassCuboid(float _mass, const vec3f &dim);
 
-  void setLinearVel(const vec3f &vel) { linvel = vel; }
-  const vec3f &getLinearVel() { return linvel; }
+  // Position and orientation, kept in the store
+  PReferenceFrame &getFrame() { return store.ref[index]; }
+  const PReferenceFrame &getFrame() const { return store.ref[index]; }
+
+  void setPosition(const vec3f &pos) { getFrame().setPosition(pos); }
+  vec3f getPosition() const { return getFrame().getPosition(); }
+
+  void setOrientation(const quatf &ori) { getFrame().setOrientation(ori); }
+  quatf getOrientation() const { return getFrame().getOrientation(); }
+  mat44f getOrientationMatrix() const { return getFrame().getOrientationMatrix(); }
+  mat44f getInverseOrientationMatrix() const { return getFrame().getInverseOrientationMatrix(); }
+
+  void updateMatrices() { getFrame().updateMatrices(); }
+
+  vec3f getLocToWorldVector(const vec3f &pt) { return getFrame().getLocToWorldVector(pt); }
+  vec3f getWorldToLocVector(const vec3f &pt) { return getFrame().getWorldToLocVector(pt); }
+  vec3f getLocToWorldPoint(const vec3f &pt) { return getFrame().getLocToWorldPoint(pt); }
+  vec3f getWorldToLocPoint(const vec3f &pt) { return getFrame().getWorldToLocPoint(pt); }
 
-  void setAngularVel(const vec3f &vel) { angvel = vel; }
-  const vec3f &getAngularVel() { return angvel; }
+  void setLinearVel(const vec3f &vel) {
+    store.linvel_x[index] = vel.x;
+    store.linvel_y[index] = vel.y;
+    store.linvel_z[index] = vel.z;
+  }
+  vec3f getLinearVel() const {
+    return vec3f(store.linvel_x[index], store.linvel_y[index], store.linvel_z[index]);
+  }
+
+  void setAngularVel(const vec3f &vel) {
+    store.angvel_x[index] = vel.x;
+    store.angvel_y[index] = vel.y;
+    store.angvel_z[index] = vel.z;
+  }
+  vec3f getAngularVel() const {
+    return vec3f(store.angvel_x[index], store.angvel_y[index], store.angvel_z[index]);
+  }
 
   void addForce(const vec3f &frc);
   void addLocForce(const vec3f &frc);
@@ -116,53 +228,184 @@ public:
   void addTorque(const vec3f &trq);
   void addLocTorque(const vec3f &trq);
 
+  // A sleeping body is left out of the integration, with no velocity, until
+  // setSleeping(false) or any force or torque applied to it wakes it up
+  void setSleeping(bool sleeping);
+  bool isSleeping() const { return store.awake[index] == 0.0f; }
+
   vec3f getLinearVelAtPoint(const vec3f &pt);
   vec3f getLinearVelAtLocPoint(const vec3f &pt);
 
-  // Step the simulation delta seconds
-  void tick(float delta);
+  // Remember the current position and orientation as the previous one
+  void savePrevious() { store.ref_prev[index] = store.ref[index]; }
+  const PReferenceFrame &getPrevious() const { return store.ref_prev[index]; }
+
+  // Copy the pose and the dynamic state out and back in; the mass is left alone
+  void saveState(PRigidBodyState &state) const;
+  void restoreState(const PRigidBodyState &state);
+};
+
+///
+/// @brief Random number generator owned by a simulation
+/// @details A 32 bit xorshift generator. Unlike rand() its sequence is the
+///  same on every platform and isn't disturbed by other code calling srand(),
+///  so a simulation seeded with the same value always repeats itself.
+///
+class PSimRandom {
+private:
+  uint32 state;
+
+public:
+  PSimRandom(uint32 seed = 1) { setSeed(seed); }
+
+  // zero is a fixed point of xorshift, so it is replaced
+  void setSeed(uint32 seed) { state = seed ? seed : 0x9E3779B9u; }
+
+  uint32 getNext() {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+  }
+
+  // random number in [0, 1)
+  float getFloat01() { return (float)(getNext() >> 8) * (1.0f / 16777216.0f); }
+
+  // random number in [-1, 1)
+  float getFloatM11() { return getFloat01() * 2.0f - 1.0f; }
+};
+
+///
+/// @brief Heap allocations made by the steps of a PSim
+/// @details Only counted in builds defining PSIM_COUNT_ALLOCATIONS, which
+///  also replaces the global operator new with a counting one, and zero
+///  otherwise. The count takes in every thread, so it is only exact where
+///  nothing else runs alongside the simulation, as in trigger-sim. Steps
+///  that generated the objects of a terrain tile allocate by design and are
+///  counted apart from the others, which shouldn't allocate at all.
+///
+struct PSimAllocations {
+  unsigned long steps, allocations;
+  unsigned long tilesteps, tileallocations;
+
+  PSimAllocations() : steps(0), allocations(0), tilesteps(0), tileallocations(0) { }
 };
 
 ///
 /// @brief class that stores information about a physic simulation instance
+/// @details The simulation always advances in fixed steps of `timeslice`
+///  seconds. tick() runs as many steps as fit in the time passed and keeps
+///  the remainder for the next call; tickSteps() runs an exact number of
+///  steps. After setSeed(), feeding the same controls before the same
+///  tickSteps() calls gives bit-identical results (deterministic lockstep).
+///  Every step keeps the poses from before it, so that a frame drawn in the
+///  middle of a step can use getInterpolation() to place bodies smoothly.
+///  Vehicles don't affect each other within a step, so their ticks are shared
+///  out to a job pool; each vehicle draws from its own random generator, so
+///  the results don't depend on which thread ran what. Collisions between
+///  vehicles are handled afterwards, on the calling thread.
 ///
 class PSim {
+public:
+  // size of a simulation step, in seconds
+  static constexpr float timeslice = 0.004f;
+
 private:
   // the terrain class
-  PTerrain *terrain;
+  PTerrainData *terrain;
 
   // the various types of vehicles
   PResourceList<PVehicleType> vtypelist;
 
-  // the various bodyes inside the simulation
-  std::vector<PRigidBody *> body;
+  // the various bodyes inside the simulation, a deque so that they keep
+  // their address, and their dynamic state
+  std::deque<PRigidBody> body;
+  PRigidBodyStore bodystore;
 
   // the various vehicles inside the simulation
   std::vector<PVehicle *> vehicle;
 
   // the gravity vector
   vec3f gravity;
-  
+
+  // time passed to tick() not yet simulated, always less than timeslice
+  float accumulator;
+
+  // steps simulated since creation or the last setSeed()
+  uint32 stepcount;
+
+  // seeds the random generators of the vehicles
+  PSimRandom random;
+
+  // runs the vehicle ticks of a step in parallel
+  std::unique_ptr<PJobPool> jobpool;
+
+  // finds the vehicles close enough to touch, one box per vehicle
+  PBroadphase broadphase;
+
+  // allocations made by the steps since resetAllocations()
+  PSimAllocations allocations;
+
+  // run a single step of timeslice seconds
+  void step();
+
+  // push apart the vehicles that run into each other
+  void collideVehicles();
+
 public:
   PSim();
   ~PSim();
 
-  inline void setTerrain(PTerrain *new_terrain) { terrain = new_terrain; }
-  inline PTerrain *getTerrain() { return terrain; }
+  inline void setTerrain(PTerrainData *new_terrain) { terrain = new_terrain; }
+  inline PTerrainData *getTerrain() { return terrain; }
 
   inline void setGravity(const vec3f &new_gravity) { gravity = new_gravity; }
 
-  PVehicleType *loadVehicleType(const std::string &filename, PSSModel &ssModel);
+  PVehicleType *loadVehicleType(const std::string &filename, PModelList &ssModel);
 
   PRigidBody *createRigidBody();
 
-  PVehicle *createVehicle(XMLElement *element, const std::string &filepath, PSSModel &ssModel);
-  PVehicle *createVehicle(const std::string &type, const vec3f &pos, const quatf &ori, const std::string &filepath, PSSModel &ssModel);
-  PVehicle *createVehicle(PVehicleType *type, const vec3f &pos, const quatf &ori /* , PSSModel &ssModel */);
+  PVehicle *createVehicle(XMLElement *element, const std::string &filepath, PModelList &ssModel);
+  PVehicle *createVehicle(const std::string &type, const vec3f &pos, const quatf &ori, const std::string &filepath, PModelList &ssModel);
+  PVehicle *createVehicle(PVehicleType *type, const vec3f &pos, const quatf &ori /* , PModelList &ssModel */);
+
+  // The vehicles, in creation order
+  unsigned int getVehicleCount() const { return vehicle.size(); }
+  PVehicle *getVehicle(unsigned int i) const { return vehicle[i]; }
 
   // Remove all bodies and vehicles
   void clear();
 
+  // Restart the random sequence and the step counter, drop leftover time
+  void setSeed(uint32 seed);
+
+  PSimRandom &getRandom() { return random; }
+
+  // Copy the state of every body and vehicle, and of the step counting, into
+  // a snapshot. Vectors in the snapshot are reused, so saving again into the
+  // same one doesn't allocate.
+  void saveSnapshot(PSimSnapshot &snapshot) const;
+
+  // Put the simulation back as it was when the snapshot was saved; false,
+  // leaving everything untouched, if bodies or vehicles were added since
+  bool restoreSnapshot(const PSimSnapshot &snapshot);
+
+  // Worker threads used besides the calling one, 0 ticks everything serially
+  void setThreadCount(unsigned int threads) { jobpool.reset(new PJobPool(threads)); }
+  unsigned int getThreadCount() const { return jobpool->getThreadCount(); }
+  uint32 getStepCount() const { return stepcount; }
+
+  // Heap allocations made by the steps, see PSimAllocations
+  const PSimAllocations &getAllocations() const { return allocations; }
+  void resetAllocations() { allocations = PSimAllocations(); }
+
+  // How far the leftover time is into the next step, from 0 to 1.
+  // Renderers blend the previous and the current poses with it.
+  float getInterpolation() const { return accumulator / timeslice; }
+
   // Step the simulation delta seconds
   void tick(float delta);
+
+  // Step the simulation exactly 'steps' times timeslice seconds
+  void tickSteps(unsigned int steps);
 };
@@ -6,9 +6,14 @@
 
 #pragma once
 
+#include "image.h"
 #include "subsys.h"
+#include "terraindata.h"
+#include "terrainhorizon.h"
+#include "terrainlod.h"
 #include "vbuffer.h"
 #include <cmath>
+#include <cstddef>
 
 class MainApp;
 class PEffect;
@@ -18,6 +23,7 @@ class PRigidity;
 class PSSEffect;
 class PSSTexture;
 class PTexture;
+class PTileBuilder;
 
 struct PParticle_s {
   vec3f pos,linvel;
@@ -127,51 +133,6 @@ public:
 };
 
 
-class PImage {
-private:
-  uint8 *data;
-  int cx,cy,cc;
-
-public:
-  PImage () : data (nullptr) { }
-  PImage (const std::string &filename) : data (nullptr) { load (filename); }
-  PImage (int _cx, int _cy, int _cc) : data (nullptr) { load (_cx, _cy, _cc); }
-  ~PImage ();
-
-  void load (const std::string &filename);
-  void load (int _cx, int _cy, int _cc);
-  void unload ();
-
-  void expandChannels();
-
-  int getcx() const { return cx; }
-  int getcy() const { return cy; }
-  int getcc() const { return cc; }
-  uint8 *getData() { return data; }
-
-  const uint8 * getData() const
-  {
-    return data;
-  }
-
-  uint8 & getByte(int i)
-  {
-      return data[i];
-  }
-
-  uint8 getByte(int i) const
-  {
-      return data[i];
-  }
-
-  void swap (PImage &other) throw ()
-  {
-    { uint8 *tmp = data; data = other.data; other.data = tmp; }
-    { int tmp = cx; cx = other.cx; other.cx = tmp; }
-    { int tmp = cy; cy = other.cy; other.cy = tmp; }
-    { int tmp = cc; cc = other.cc; other.cc = tmp; }
-  }
-};
 
 
 class PTexture : public PResource {
@@ -322,15 +283,23 @@ private:
 
 
 
-class PSSModel : public PSubsystem {
-private:
+///
+/// @brief Loads models and keeps them cached by name
+/// @details Needs no running application, so the headless simulator can
+///  load vehicle models too.
+///
+class PModelList {
+protected:
   PResourceList<PModel> modlist;
 
+public:
+  PModel *loadModel(const std::string &name);
+};
+
+class PSSModel : public PSubsystem, public PModelList {
 public:
   PSSModel(PApp &parentApp);
   ~PSSModel();
-
-  PModel *loadModel(const std::string &name);
 };
 
 
@@ -368,33 +337,31 @@ public:
 	std::pair<vec3f, vec3f> getExtents() const;
 };
 
-struct PTerrainFoliageBand {
-  float middle, range;
-  float density;
-  int trycount;
-  float scale;
-
-  /*
-  float scalemin;
-  float scalemax;
-  */
-
-  PTexture *sprite_tex;
-  int sprite_count;
-};
-
-struct PTerrainFoliage {
+// what instanced foliage draws with, one per instance: the shared mesh of
+// the band is turned by ang, scaled and put at pos, up to a distance of cut
+// from the camera
+struct PFoliageInstance {
   vec3f pos;
   float ang;
   float scale;
-  float rigidity;
+  float cut;
 };
 
+// the vertex program reads pos and ang as its vec4 placement, and scale and
+// cut as its vec2 sizing, straight from an array of these
+static_assert(offsetof(PFoliageInstance, ang) == offsetof(PFoliageInstance, pos) + sizeof(float) * 3 &&
+  offsetof(PFoliageInstance, cut) == offsetof(PFoliageInstance, scale) + sizeof(float) &&
+  sizeof(vec3f) == sizeof(float) * 3,
+  "PFoliageInstance doesn't match the attributes of the foliage vertex program");
+
 struct PTerrainFoliageSet {
   std::vector<PTerrainFoliage> inst;
 
+  // quads and their indices, or with instancing the PFoliageInstance of
+  // each instance in buff[0]
   PVBuffer buff[2];
   int numvert, numelem;
+  int numinst;
 };
 
 struct PRoadSignSet {
@@ -404,225 +371,110 @@ struct PRoadSignSet {
     int numelem;
 };
 
-struct PTerrainTile {
+struct PTerrainTile : public PTerrainTileBounds {
   int posx, posy;
-  int lru_counter;
 
   PVBuffer vert;
   int numverts;
 
   PTexture tex;
 
-  vec3f mins,maxs; // AABB
+  // per detail level, the most the terrain drawn at that level is off
+  // from the heightmap, in world units; never decreasing
+  std::vector<float> lod_error;
 
   std::vector<PTerrainFoliageSet> foliage;
   std::vector<PRoadSignSet> roadsignset;
-  // Straight vector for rapid search by collision detection
-  std::vector<PTerrainFoliage> straight;
 };
 
 ///
-/// @brief Loads road information.
+/// @brief A terrain tile as built on the CPU, before it goes to the GPU
+/// @details Filled by PTerrain::buildTile(), on any thread, and turned into
+///  a PTerrainTile by PTerrain::uploadTile() on the thread of the GL context.
 ///
-class RoadMap
-{
-public:
+struct PTerrainTileBuild {
+  // billboard quads, as triangles
+  struct Quads {
+    std::vector<PVert_tv> vert;
+    std::vector<uint32> elem;
+  };
 
-    RoadMap() = default;
-
-    bool load(const PImage &img)
-    {
-        if (img.getData() == nullptr)
-            return false;
-
-        bx = img.getcx();
-        by = img.getcy();
-        bitmap.clear();
-        bitmap.reserve(img.getcx() * img.getcy());
-
-        const std::size_t tb = img.getcx() * img.getcy() * img.getcc(); // Total Bytes
-
-        for (auto pb = img.getData(); pb != img.getData() + tb; pb += img.getcc())
-        {
-            bool is_road = true;
-
-            for (int i=0; i < img.getcc(); ++i)
-                if (pb[i] != 0xFF) // the road is white
-                {
-                    is_road = false;
-                    break;
-                }
-
-            bitmap.push_back(is_road);
-        }
-
-        return true;
-    }
-
-    bool is_loaded() const
-    {
-        return !bitmap.empty();
-    }
-
-    ///
-    /// @brief Decides if provided point is on the road.
-    /// @param px           X coordinate of the point.
-    /// @param py           Y coordinate of the point.
-    /// @param ms           Map size.
-    /// @see `getMapSize()`.
-    /// @returns Whether or not the point is on the road.
-    /// @retval true        If no roadmap was loaded.
-    ///
-    bool isOnRoad(float px, float py, float ms) const
-    {
-        if (bitmap.empty())
-            return true;
-
-        if (px >= ms)
-        {
-            do
-                px -= ms;
-            while (px > ms);
-        }
-        else
-        if (px < 0)
-        {
-            do
-                px += ms;
-            while (px < 0);
-        }
-
-        if (py >= ms)
-        {
-            do
-                py -= ms;
-            while (py > ms);
-        }
-        else
-        if (py < 0)
-        {
-            do
-                py += ms;
-            while (py < 0);
-        }
-
-        long int x = std::lround(px * bx / ms);
-        long int y = std::lround(py * by / ms);
-
-        CLAMP_UPPER(x, bx - 1);
-        CLAMP_UPPER(y, by - 1);
-        return bitmap.at(y * bx + x);
-    }
+  int posx, posy;
 
-private:
+  std::vector<vec3f> vert;
 
-    std::vector<bool> bitmap;
-    int bx;
-    int by;
-};
+  vec3f mins, maxs;
+  vec3f objmins, objmaxs;
+  std::vector<float> lod_error;
 
-struct road_sign
-{
-public:
+  std::shared_ptr<const PTerrainTileObjects> objs;
 
-//
-// being smart here makes the rest of the code more complicated;
-// so let's be stupid for now...
-//
-#if 0
-  struct road_sign_location
-  {
-    public:
-      float x;
-      float y;
-      float deg;
-
-      road_sign_location(float x=0, float y=0, float deg=0):
-          x(x), y(y), deg(deg)
-      {
-      }
-  };
-  std::vector<road_sign_location> location;
-#endif
-
-  PTexture *sprite  = nullptr;
-  float scale   = 1.0f;
-  float x = 0.0f;
-  float y = 0.0f;
-  float deg = 0.0f;
-  int sprite_count = 1;
+  // one per foliage band and one per road sign; with instancing foliage
+  // has no quads, only foliageinst
+  std::vector<Quads> foliage;
+  std::vector<Quads> roadsign;
+  std::vector<std::vector<PFoliageInstance>> foliageinst;
 };
 
-class PTerrain // TODO: make this RAII conformant
+///
+/// @brief Renderable terrain: adds textures and vertex buffers to PTerrainData
+///
+class PTerrain : public PTerrainData
 {
 protected:
-  bool loaded;
+  // never fewer than the tiles drawn in one frame, which are all held at once
+  PTileCache<PTerrainTile> tile;
 
-  int tilesize, tilecount, totsize, totmask, totsizesq;
+  // tiles share index buffers: one index set per detail level and mask of
+  // the sides that meet a coarser tile, all in ind, as triangles
+  PVBuffer ind;
+  PTerrainLod lod;
 
-  float scale_hz, scale_vt, scale_hz_inv, scale_vt_inv, scale_tile_inv;
+  PTexture *tex_hud_map;
 
-  int cmaptotsize, cmaptilesize, cmaptotmask;
+  // tiles drawn around the camera tile, on each side
+  int viewradius;
 
-  //std::vector<uint8> hmap;
-  std::vector<float> hmap;
+  // largest error allowed on screen, in pixels; 0 draws full detail
+  float lodtolerance;
 
-  // color map
-  PImage cmap;
-  // terrain map
-  PImage tmap;
-  // road map
-  RoadMap rmap;
+  unsigned int tilecachebudget;
 
-  std::vector<float> fmap;
-  std::vector<PTerrainFoliageBand> foliageband;
-  std::vector<road_sign> roadsigns;
+  // skip tiles hidden behind nearer terrain
+  bool horizonculling;
 
-  std::list<PTerrainTile> tile;
+  // builds the tiles the camera is heading for in the background
+  std::unique_ptr<PTileBuilder> builder;
 
-  // tiles share index buffers
-  PVBuffer ind;
-  int numinds;
+  // instanced foliage, where the GL has it: the program placing the mesh,
+  // its attributes and uniforms, 0 otherwise; each band has two meshes of
+  // crossed quads, near and far, mesh b * 2 + far at foliagemeshfirst in
+  // foliagemesh, as triangles
+  GLuint foliageprogram;
+  GLint foliageplacement, foliagesizing;
+  GLint foliagelod, foliagefog;
+  PVBuffer foliagemesh[2];
+  std::vector<int> foliagemeshfirst;
+  std::vector<int> foliagemeshnuminds;
 
-  PTexture *tex_hud_map;
+  // scratch for render(): the tiles of the view and their bounds, their
+  // detail levels and which of their passes are drawn
+  std::vector<PTerrainTile *> drawtile;
+  std::vector<const PTerrainTileBounds *> drawbounds;
+  std::vector<int> drawlevel;
+  std::vector<uint8> drawpass;
+  PTerrainHorizon horizon;
+  std::vector<vec2i> prefetch;
 
 protected:
 
   PTerrainTile *getTile(int x, int y);
+  void buildTile(PTerrainTileBuild &build);
+  PTerrainTile *uploadTile(const PTerrainTileBuild &build);
+  void prefetchTiles(const vec3f &campos, const vec3f &camvel);
 
-  float getInterp(float x, float y, float *data) {
-    x *= scale_hz_inv;
-    int xi = (int)x;
-    if (x < 0.0) xi--;
-    x -= (float)xi;
-    int xiw = xi & totmask, xiw2 = (xiw+1) & totmask;
-
-    y *= scale_hz_inv;
-    int yi = (int)y;
-    if (y < 0.0) yi--;
-    y -= (float)yi;
-    int yiw = yi & totmask, yiw2 = (yiw+1) & totmask;
-
-    const int cx = totsize;
-
-    float xv1,xv2;
-    if (y > 0.0) {
-      if (y < 1.0) {
-        if (x < y) {
-          xv1 = data[yiw*cx+xiw];
-          xv2 = INTERP(data[yiw2*cx+xiw],data[yiw2*cx+xiw2],x/y);
-        } else {
-          xv1 = INTERP(data[yiw*cx+xiw],data[yiw*cx+xiw2],(x-y)/(1.0-y));
-          xv2 = data[yiw2*cx+xiw2];
-        }
-        return INTERP(xv1,xv2,y);
-      } else {
-        return INTERP(data[yiw2*cx+xiw],data[yiw2*cx+xiw2],x);
-      }
-    } else {
-      return INTERP(data[yiw*cx+xiw],data[yiw*cx+xiw2],x);
-    }
-  }
+  void buildLodIndices();
+  void initFoliageInstancing();
 
 public:
   PTerrain(XMLElement *element, const std::string &filepath, PSSTexture &ssTexture,
@@ -631,219 +483,14 @@ public:
 
   void unload();
 
-  void render(const vec3f &campos, const mat44f &camorim);
-
-  void drawSplat(float x, float y, float scale, float angle);
-
-  const std::vector<PTerrainFoliage> *getFoliageAtPos(const vec3f &pos) const;
+  void setTileCacheBudget(unsigned int megabytes);
+  void setViewRadius(int tiles);
+  void setLodTolerance(float pixels) { lodtolerance = pixels; }
+  void setHorizonCulling(bool enabled) { horizonculling = enabled; }
 
-  struct ContactInfo {
-    vec3f pos;
-    vec3f normal;
-  };
-
-    ///
-    /// @brief Returns whether or not the given position is on road.
-    /// @param [in] pos         Position to be checked.
-    /// @returns Whether or not `pos` is on the road.
-    /// @retval true            If no roadmap was loaded.
-    /// @see `RoadMap`.
-    ///
-    bool getRmapOnRoad(const vec3f &pos) const
-    {
-        return rmap.isOnRoad(pos.x, pos.y, getMapSize());
-    }
-
-    ///
-    /// @brief Returns the color of the pixel in the colormap that corresponds
-    ///  to the given position in the terrain.
-    /// @note The height component Z is ignored.
-    /// @todo Should check if cmap.getcc() returns at least 3?
-    /// @todo Should check if cmap.getcx() == cmap.getcy()?
-    /// @todo Should remove paranoid clampings?
-    /// @todo Should actually measure performance of float vs int.
-    /// @param [in] pos   Position in the terrain.
-    /// @returns Color in OpenGL-style RGB.
-    ///
-    vec3f getCmapColor(const vec3f &pos) const
-    {
-        vec3f r;
-#if 0
-        const float ms = getMapSize();
-        float px = pos.x;
-        float py = pos.y;
-#else
-        const int ms = static_cast<int> (getMapSize());
-        int px = static_cast<int> (pos.x);
-        int py = static_cast<int> (pos.y);
-#endif
-        if (px >= ms)
-        {
-            do
-                px -= ms;
-            while (px > ms);
-        }
-        else
-        if (px < 0)
-        {
-            do
-                px += ms;
-            while (px < 0);
-        }
-
-        if (py >= ms)
-        {
-            do
-                py -= ms;
-            while (py > ms);
-        }
-        else
-        if (py < 0)
-        {
-            do
-                py += ms;
-            while (py < 0);
-        }
-
-        long int x = std::lround(px * cmap.getcx() / getMapSize());
-        long int y = std::lround(py * cmap.getcy() / getMapSize());
-
-        CLAMP_UPPER(x, cmap.getcx() - 1);
-        CLAMP_UPPER(y, cmap.getcy() - 1);
-        r.x = cmap.getByte((y * cmap.getcx() + x) * cmap.getcc() + 0) / 255.0f;
-        r.y = cmap.getByte((y * cmap.getcx() + x) * cmap.getcc() + 1) / 255.0f;
-        r.z = cmap.getByte((y * cmap.getcx() + x) * cmap.getcc() + 2) / 255.0f;
-        return r;
-    }
-
-    ///
-    /// @brief Returns the road surface type corresponding to the given position
-    ///  in the terrain.
-    /// @note The height component Z is ignored.
-    /// @todo Should remove paranoid clampings?
-    /// @todo Should actually measure performance of float vs int. (int should be intrinsecally faster)
-    /// @param [in] pos   Position in the terrain.
-    /// @returns Terrain type.
-    ///
-    TerrainType getRoadSurface(const vec3f &pos) const
-    {
-        if (tmap.getData() == nullptr)
-            return TerrainType::Unknown;
-#if 0
-        const float ms = getMapSize();
-        float px = pos.x;
-        float py = pos.y;
-#else
-        const int ms = static_cast<int> (getMapSize());
-        int px = static_cast<int> (pos.x);
-        int py = static_cast<int> (pos.y);
-#endif
-        if (px >= ms)
-        {
-            do
-                px -= ms;
-            while (px > ms);
-        }
-        else
-        if (px < 0)
-        {
-            do
-                px += ms;
-            while (px < 0);
-        }
-
-        if (py >= ms)
-        {
-            do
-                py -= ms;
-            while (py > ms);
-        }
-        else
-        if (py < 0)
-        {
-            do
-                py += ms;
-            while (py < 0);
-        }
-
-        long int x = std::lround(px * tmap.getcx() / getMapSize());
-        long int y = std::lround(py * tmap.getcy() / getMapSize());
-        rgbcolor temp;
-
-        CLAMP_UPPER(x, tmap.getcx() - 1);
-        CLAMP_UPPER(y, tmap.getcy() - 1);
-        temp.r = tmap.getByte((y * tmap.getcx() + x) * tmap.getcc() + 0);
-        temp.g = tmap.getByte((y * tmap.getcx() + x) * tmap.getcc() + 1);
-        temp.b = tmap.getByte((y * tmap.getcx() + x) * tmap.getcc() + 2);
-        return PUtil::decideRoadSurface(temp);
-    }
-
-  ///
-  /// @brief get the information about a contact point (its coordinates and normal) with the ground
-  ///
-  void getContactInfo(ContactInfo &tci) {
-
-    float x = tci.pos.x * scale_hz_inv;
-    // int part of x
-    int xi = (int)x;
-    if (x < 0.0) xi--;
-    // x is the decimal part
-    x -= (float)xi;
-    int xiw = xi & totmask, xiw2 = (xi+1) & totmask;
-
-    float y = tci.pos.y * scale_hz_inv;
-    int yi = (int)y;
-    if (y < 0.0) yi--;
-    y -= (float)yi;
-    int yiw = yi & totmask, yiw2 = (yi+1) & totmask;
-
-    float *data = &hmap[0];
-    const int cx = totsize;
-
-    float xv1,xv2;
-    if (y > 0.0) {
-      if (y < 1.0) {
-        if (x < y) {
-          tci.normal.x = data[yiw2*cx+xiw] - data[yiw2*cx+xiw2];
-          tci.normal.y = data[yiw*cx+xiw] - data[yiw2*cx+xiw];
-          xv1 = data[yiw*cx+xiw];
-          xv2 = INTERP(data[yiw2*cx+xiw],data[yiw2*cx+xiw2],x/y);
-        } else {
-          tci.normal.x = data[yiw*cx+xiw] - data[yiw*cx+xiw2];
-          tci.normal.y = data[yiw*cx+xiw2] - data[yiw2*cx+xiw2];
-          xv1 = INTERP(data[yiw*cx+xiw],data[yiw*cx+xiw2],(x-y)/(1.0-y));
-          xv2 = data[yiw2*cx+xiw2];
-        }
-        tci.pos.z = INTERP(xv1,xv2,y);
-      } else {
-        tci.normal.x = data[yiw2*cx+xiw] - data[yiw2*cx+xiw2];
-        tci.normal.y = data[yiw*cx+xiw] - data[yiw2*cx+xiw];
-        tci.pos.z = INTERP(data[yiw2*cx+xiw],data[yiw2*cx+xiw2],x);
-      }
-    } else {
-      tci.normal.x = data[yiw*cx+xiw] - data[yiw*cx+xiw2];
-      tci.normal.y = data[yiw*cx+xiw2] - data[yiw2*cx+xiw2];
-      tci.pos.z = INTERP(data[yiw*cx+xiw],data[yiw*cx+xiw2],x);
-    }
-    tci.normal.z = scale_hz;
-    tci.normal.normalize();
-  }
+  void render(const vec3f &campos, const mat44f &camorim, const vec3f &camvel);
 
-  float getHeight(float x, float y) {
-    return getInterp(x, y, &hmap[0]);
-  }
-
-  float getFoliageLevel(float x, float y) {
-    return getInterp(x, y, &fmap[0]);
-  }
+  void drawSplat(float x, float y, float scale, float angle);
 
   PTexture *getHUDMapTexture() { return tex_hud_map; }
-
-  float getMapSize() const { return totsize * scale_hz; }
-
-private:
-  const PTerrainTile *getTileAtPos(const vec3f &pos) const;
-
-  // Rigidity map for foliage and road signs
-  const PRigidity &rigidity;
 };
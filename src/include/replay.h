@@ -0,0 +1,108 @@
+
+// replay.h [psim]
+
+// License: GPL version 2 (see included gpl.txt)
+
+#pragma once
+
+#include "psim.h"
+#include "simsnapshot.h"
+#include "vehicle.h"
+#include <string>
+#include <vector>
+
+///
+/// @brief Records the controls of the vehicles of a PSim, to run a race again
+/// @details Only the steps where the controls of a vehicle change are stored,
+///  with the vehicle resets, so a recording takes a few bytes per change
+///  where a ghost stores the pose of the vehicle and of every wheel.
+///  Playing back simulates the race again, so it repeats it exactly only
+///  because PSim is deterministic: it must start from the same level and
+///  vehicles with the same seed.
+///  Keyframes, snapshots of the simulation every few seconds, are taken
+///  while recording and playing; seeking restores the last one before the
+///  wanted step and simulates only from there. They aren't saved: after
+///  load() they are taken again as playback goes along.
+///
+class PReplay {
+public:
+  ///
+  /// @brief What changed at a step, before running it
+  ///
+  struct Event {
+    uint32 step;
+    uint32 vehicle;
+    // a reset to pos and ori, or else new controls
+    bool reset;
+    v_control_s ctrl;
+    vec3f pos;
+    quatf ori;
+  };
+
+  // keyframetime = seconds between two keyframes
+  explicit PReplay(float keyframetime);
+
+  // Drop everything and record from the current step of the simulation,
+  // which starts as the given level with the vehicle of the player
+  void recordStart(const PSim &sim, uint32 seed, const std::string &level, const std::string &vehicle);
+
+  // Record what changed since the last call; call before every tick
+  void recordInputs(const PSim &sim);
+
+  // Drop what was recorded past the current step, after the simulation was
+  // put back to an earlier snapshot
+  void recordRewind(const PSim &sim);
+
+  // Mark the current step as the end of the recording
+  void recordStop(const PSim &sim);
+
+  // Put the simulation at the start of the recording; with no keyframe yet
+  // it must already be there, just set up and seeded
+  bool playStart(PSim &sim);
+
+  // Bring the simulation to a step of the recording, back or forth
+  bool seek(PSim &sim, uint32 step);
+
+  uint32 getSeed() const { return seed; }
+  uint32 getStartStep() const { return startstep; }
+  uint32 getEndStep() const { return endstep; }
+  const std::string &getLevel() const { return levelname; }
+  const std::string &getVehicle() const { return vehiclename; }
+  const std::vector<Event> &getEvents() const { return event; }
+  unsigned int getKeyframeCount() const { return keyframe.size(); }
+
+  // Encode into the replay file format, or decode from it
+  void write(std::vector<uint8> &data) const;
+  bool read(const std::vector<uint8> &data);
+
+  // Save to or load from a PhysFS file
+  bool save(const std::string &filename) const;
+  bool load(const std::string &filename);
+
+private:
+  // steps between two keyframes
+  uint32 keyframesteps;
+
+  uint32 seed;
+  uint32 startstep, endstep;
+  std::string levelname, vehiclename;
+
+  // sorted by step
+  std::vector<Event> event;
+
+  // sorted by step, each taken after the events of its step were applied
+  std::vector<PSimSnapshot> keyframe;
+
+  // while recording: the controls and reset counts last seen per vehicle,
+  // and the index of its last control event
+  std::vector<v_control_s> lastctrl;
+  std::vector<uint32> lastresetcount;
+  std::vector<int> lastctrlevent;
+
+  // while playing: the first event not applied yet
+  unsigned int nextevent;
+
+  void syncVehicles(const PSim &sim);
+  void applyEvents(PSim &sim);
+  void saveKeyframe(const PSim &sim);
+};
@@ -0,0 +1,91 @@
+
+// ringbuffer.h [pengine]
+
+// License: GPL version 2 (see included gpl.txt)
+
+#pragma once
+
+#include <vector>
+
+///
+/// @brief Keeps the last few items pushed into it, dropping the oldest ones
+/// @details The items are never destroyed: push() hands out the slot of the
+///  oldest item, with its old contents, so that items owning buffers can be
+///  refilled without allocating. Slots are allocated on the first push(),
+///  or by fill().
+///
+template <typename T>
+class PRingBuffer {
+public:
+  explicit PRingBuffer(unsigned int capacity) :
+    capacity(capacity > 0 ? capacity : 1),
+    first(0),
+    count(0)
+  {
+  }
+
+  unsigned int getCapacity() const { return capacity; }
+  unsigned int size() const { return count; }
+  bool empty() const { return count == 0; }
+
+  ///
+  /// @brief Forgets all the items, keeping their slots
+  ///
+  void clear()
+  {
+    first = 0;
+    count = 0;
+  }
+
+  ///
+  /// @brief Forgets all the items and sets every slot to a copy of one
+  /// @details Lets slots owning buffers get them at a time of the caller's
+  ///  choosing, sized like those of the item, rather than as they fill.
+  /// @param item = what every slot starts as
+  ///
+  void fill(const T &item)
+  {
+    slot.assign(capacity, item);
+    clear();
+  }
+
+  ///
+  /// @brief Makes room for a new item, evicting the oldest one when full
+  /// @retval the new item, which may still hold an evicted one
+  ///
+  T &push()
+  {
+    if (slot.empty()) slot.resize(capacity);
+
+    if (count < capacity) {
+      ++count;
+    } else {
+      first = (first + 1) % capacity;
+    }
+
+    return back();
+  }
+
+  ///
+  /// @brief Forgets the newest item
+  ///
+  void pop()
+  {
+    if (count > 0) --count;
+  }
+
+  // i = 0 is the oldest item, size() - 1 the newest
+  T &operator[](unsigned int i) { return slot[(first + i) % capacity]; }
+  const T &operator[](unsigned int i) const { return slot[(first + i) % capacity]; }
+
+  T &back() { return (*this)[count - 1]; }
+  const T &back() const { return (*this)[count - 1]; }
+
+private:
+  unsigned int capacity;
+
+  std::vector<T> slot;
+
+  // slot of the oldest item, and how many there are
+  unsigned int first, count;
+};
@@ -0,0 +1,32 @@
+// simcheck.h [trigger-sim]
+
+// License: GPL version 2 (see included gpl.txt)
+
+#pragma once
+
+#include <iosfwd>
+
+///
+/// @brief Runs the checks of the engine parts that need no data files
+/// @details Each check prints a line with its name and "ok" or "failed",
+///  and logs what went wrong.
+/// @retval true if every check passed
+///
+bool runSelfChecks();
+
+///
+/// @brief Writes the results of the vmath members that have SSE versions,
+///  with their inputs, for checkVmath() of a build with the other code
+/// @param out = stream to write to
+///
+void dumpVmath(std::ostream &out);
+
+///
+/// @brief Checks the vmath members of this build against the results of
+///  dumpVmath() of another build
+/// @details Built with VMATH_SCALAR the other build runs the generic code,
+///  so this compares the SSE versions against it.
+/// @param in = stream to read the dump from
+/// @retval true if every result matched
+///
+bool checkVmath(std::istream &in);
@@ -0,0 +1,47 @@
+
+// simsnapshot.h [psim]
+
+// License: GPL version 2 (see included gpl.txt)
+
+#pragma once
+
+#include "psim.h"
+#include "vehicle.h"
+#include <vector>
+
+///
+/// @brief Everything that changes while a PSim runs, to put it back later
+/// @details Only plain data is stored: vehicle types, models and terrain
+///  aren't copied, so a snapshot can only be restored into the simulation
+///  it was saved from, with the same bodies and vehicles. Saving copies a
+///  few kilobytes per vehicle, which takes microseconds, and once the
+///  vectors have grown saving again into the same snapshot doesn't allocate.
+///  Keeping many of them, size them all up front by copying one saved from
+///  the same simulation, as the rewind buffer of TriggerGame does.
+///  Restoring and running the same steps repeats them bit for bit.
+///
+struct PSimSnapshot {
+  PSimRandom random;
+  float accumulator;
+  uint32 stepcount;
+
+  // in the order of PSim's bodies
+  std::vector<PRigidBodyState> body;
+
+  // in the order of PSim's vehicles; the parts of all the vehicles one
+  // after another, and so the wheels of all the parts
+  std::vector<PVehicleState> vehicle;
+  std::vector<PVehiclePartState> part;
+  std::vector<PVehicleWheel> wheel;
+
+  PSimSnapshot() : accumulator(0.0f), stepcount(0) { }
+
+  // Bytes of state held, not counting spare capacity
+  std::size_t getSize() const {
+    return sizeof(PSimSnapshot) +
+      body.size() * sizeof(PRigidBodyState) +
+      vehicle.size() * sizeof(PVehicleState) +
+      part.size() * sizeof(PVehiclePartState) +
+      wheel.size() * sizeof(PVehicleWheel);
+  }
+};
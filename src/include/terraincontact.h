@@ -0,0 +1,91 @@
+// terraincontact.h [pengine]
+
+// License: GPL version 2 (see included gpl.txt)
+
+#pragma once
+
+#include "vmath.h"
+#include <cstddef>
+
+///
+/// @brief Where points meet a heightfield, and its normal there
+/// @details The field is square, a power of two heights along each side,
+///  and wraps around. PTerrainData loads it from a level; it is kept apart
+///  so that the headless simulator can check the SSE2 batch against the
+///  scalar code on fields of its own.
+///
+class PTerrainContact {
+public:
+  struct ContactInfo {
+    vec3f pos;
+    vec3f normal;
+  };
+
+  // Use a field of size by size heights, scale apart; the heights aren't
+  // copied, so they must stay put for as long as they are used
+  void setField(const float *heights, int size, float scale) {
+    data = heights;
+    totsize = size;
+    totmask = size - 1;
+    scale_hz = scale;
+    scale_hz_inv = 1.0 / scale;
+  }
+
+  ///
+  /// @brief Gets the height and the normal of the field under a point
+  /// @param tci = gets pos.z and normal for pos.x and pos.y
+  ///
+  void getContactInfo(ContactInfo &tci) const {
+
+    float x = tci.pos.x * scale_hz_inv;
+    // int part of x
+    int xi = (int)x;
+    if (x < 0.0) xi--;
+    // x is the decimal part
+    x -= (float)xi;
+    int xiw = xi & totmask, xiw2 = (xi+1) & totmask;
+
+    float y = tci.pos.y * scale_hz_inv;
+    int yi = (int)y;
+    if (y < 0.0) yi--;
+    y -= (float)yi;
+    int yiw = yi & totmask, yiw2 = (yi+1) & totmask;
+
+    const int cx = totsize;
+
+    float xv1,xv2;
+    if (y > 0.0) {
+      if (y < 1.0) {
+        if (x < y) {
+          tci.normal.x = data[yiw2*cx+xiw] - data[yiw2*cx+xiw2];
+          tci.normal.y = data[yiw*cx+xiw] - data[yiw2*cx+xiw];
+          xv1 = data[yiw*cx+xiw];
+          xv2 = INTERP(data[yiw2*cx+xiw],data[yiw2*cx+xiw2],x/y);
+        } else {
+          tci.normal.x = data[yiw*cx+xiw] - data[yiw*cx+xiw2];
+          tci.normal.y = data[yiw*cx+xiw2] - data[yiw2*cx+xiw2];
+          xv1 = INTERP(data[yiw*cx+xiw],data[yiw*cx+xiw2],(x-y)/(1.0-y));
+          xv2 = data[yiw2*cx+xiw2];
+        }
+        tci.pos.z = INTERP(xv1,xv2,y);
+      } else {
+        tci.normal.x = data[yiw2*cx+xiw] - data[yiw2*cx+xiw2];
+        tci.normal.y = data[yiw*cx+xiw] - data[yiw2*cx+xiw];
+        tci.pos.z = INTERP(data[yiw2*cx+xiw],data[yiw2*cx+xiw2],x);
+      }
+    } else {
+      tci.normal.x = data[yiw*cx+xiw] - data[yiw*cx+xiw2];
+      tci.normal.y = data[yiw*cx+xiw2] - data[yiw2*cx+xiw2];
+      tci.pos.z = INTERP(data[yiw*cx+xiw],data[yiw*cx+xiw2],x);
+    }
+    tci.normal.z = scale_hz;
+    tci.normal.normalize();
+  }
+
+  void getContactInfoBatch(const vec3f *pos, ContactInfo *out, size_t n) const;
+
+private:
+  const float *data = nullptr;
+  int totsize = 0, totmask = 0;
+  float scale_hz = 1.0f, scale_hz_inv = 1.0f;
+};
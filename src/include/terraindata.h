@@ -0,0 +1,538 @@
+
+// terraindata.h [pengine]
+
+// Copyright 2004-2006 Jasmine Langridge, jas@jareiko.net
+// License: GPL version 2 (see included gpl.txt)
+
+#pragma once
+
+#include "image.h"
+#include "pengine.h"
+#include "terraincontact.h"
+#include "tilecache.h"
+#include "vmath.h"
+#include <cmath>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class PRigidity;
+class PTexture;
+
+struct PTerrainFoliageBand {
+  float middle, range;
+  float density;
+  int trycount;
+  float scale;
+
+  /*
+  float scalemin;
+  float scalemax;
+  */
+
+  // sprite path, also the key into the rigidity map
+  std::string sprite_name;
+  // loaded by PTerrain only, always nullptr in the headless simulator
+  PTexture *sprite_tex;
+  int sprite_count;
+
+  // level of detail by distance from the camera, off when lodfar is 0:
+  // past lodnear the band thins out, the share left falling as
+  // (1 - t)^lodfalloff with t going from 0 at lodnear to 1 at lodfar, and
+  // is drawn with lodsprite_count crossed quads; instances fade out over
+  // lodfade before they go
+  float lodnear, lodfar;
+  float lodfalloff;
+  float lodfade;
+  int lodsprite_count;
+
+  float getShare(float dist) const;
+  int getCount(float dist, int count) const;
+  float getCut(float rank) const;
+};
+
+struct PTerrainFoliage {
+  vec3f pos;
+  float ang;
+  float scale;
+  float rigidity;
+};
+
+///
+/// @brief Foliage and road sign instances of one terrain tile
+/// @details Generated on demand from the foliage map; the renderer builds its
+///  vertex buffers from these and collision detection uses `straight`.
+///
+struct PTerrainTileObjects {
+  int posx, posy;
+
+  // instances for each foliage band and for each road sign
+  std::vector<std::vector<PTerrainFoliage> > foliage;
+  std::vector<std::vector<PTerrainFoliage> > roadsign;
+
+  // cells per side of the collision grid laid over the tile
+  static const int gridsize = 16;
+
+  // Straight vector for rapid search by collision detection: the rigid
+  // objects sorted by grid cell, cell c holding those from cellstart[c]
+  // up to cellstart[c + 1]
+  std::vector<PTerrainFoliage> straight;
+  std::vector<unsigned int> cellstart;
+
+  // most objects in one cell of the grid
+  unsigned int maxcell;
+};
+
+///
+/// @brief Rigid objects found by PTerrainData::findObjects()
+/// @details Meant to be kept and reused, so that once its vectors have grown
+///  queries don't allocate. Keeps the tiles it refers to alive until the
+///  next query.
+///
+struct PTerrainObjectQuery {
+  struct Hit {
+    unsigned int tile;
+    unsigned int index;
+  };
+
+  // tiles the objects were found in
+  std::vector<std::shared_ptr<const PTerrainTileObjects> > tile;
+
+  // objects found, as indices into the straight vector of their tile
+  std::vector<Hit> hit;
+
+  unsigned int size() const { return hit.size(); }
+
+  const PTerrainFoliage &operator[](unsigned int i) const
+  {
+    return tile[hit[i].tile]->straight[hit[i].index];
+  }
+};
+
+///
+/// @brief Loads road information.
+/// @details The road map is kept as a bit grid whose side is a power of two,
+///  so that positions wrap around with a mask. Optionally it also holds the
+///  signed distance from every texel to the edge of the road.
+///
+class RoadMap
+{
+public:
+
+    RoadMap() = default;
+
+    ///
+    /// @brief Reads the road map from a square image.
+    /// @note Images whose side isn't a power of two are resampled to the
+    ///  next power of two.
+    /// @param img          Road map, the road is white.
+    /// @param ms           Map size.
+    /// @see `getMapSize()`.
+    /// @returns Whether or not the image could be used.
+    ///
+    bool load(const PImage &img, float ms);
+
+    bool is_loaded() const
+    {
+        return !bits.empty();
+    }
+
+    ///
+    /// @brief Decides if provided point is on the road.
+    /// @param px           X coordinate of the point.
+    /// @param py           Y coordinate of the point.
+    /// @returns Whether or not the point is on the road.
+    /// @retval true        If no roadmap was loaded.
+    ///
+    bool isOnRoad(float px, float py) const
+    {
+        if (bits.empty())
+            return true;
+
+        const int x = getTexel(px);
+        const int y = getTexel(py);
+        const int i = (y << shift) + x;
+
+        return (bits[i >> 6] >> (i & 63)) & 1;
+    }
+
+    ///
+    /// @brief Precomputes the distance to the road for every texel.
+    /// @details Takes a moment and two bytes per texel, so it's only done
+    ///  for those who need getDistance().
+    ///
+    void buildDistance();
+
+    ///
+    /// @brief Signed distance from the provided point to the edge of the road.
+    /// @param px           X coordinate of the point.
+    /// @param py           Y coordinate of the point.
+    /// @returns Distance in world units, negative on the road.
+    /// @retval 0           If no roadmap was loaded or buildDistance() wasn't called.
+    ///
+    float getDistance(float px, float py) const
+    {
+        if (distance.empty())
+            return 0.0f;
+
+        const int x = getTexel(px);
+        const int y = getTexel(py);
+
+        return distance[(y << shift) + x] * distance_scale;
+    }
+
+private:
+
+    int getTexel(float p) const
+    {
+        return static_cast<int> (std::floor(p * scale + 0.5f)) & mask;
+    }
+
+    // one bit per texel, row by row, set for road
+    std::vector<uint64_t> bits;
+    int shift = 0;
+    int mask = 0;
+
+    // texels per world unit
+    float scale = 0.0f;
+
+    // signed distance in fractions of a texel, and world units per step
+    std::vector<int16_t> distance;
+    float distance_scale = 0.0f;
+};
+
+///
+/// @brief Terrain types of the terrain map, decoded once at load.
+/// @details Keeps one byte per texel instead of the RGB image, and a table
+///  from whole world coordinates to texels, so that a query is a modulo and
+///  two lookups.
+///
+class TerrainTypeMap
+{
+public:
+
+    TerrainTypeMap() = default;
+
+    ///
+    /// @brief Decodes a terrain map image.
+    /// @param img          Terrain map, square, with RGB channels.
+    /// @param ms           Map size.
+    /// @returns Whether or not the image could be used.
+    ///
+    bool load(const PImage &img, float ms);
+
+    bool is_loaded() const
+    {
+        return !grid.empty();
+    }
+
+    ///
+    /// @brief Returns the terrain type at the given point.
+    /// @note The height component Z is ignored.
+    /// @param pos          Position in the terrain.
+    /// @retval TerrainType::Unknown    If no terrain map was loaded.
+    ///
+    TerrainType getType(const vec3f &pos) const
+    {
+        if (grid.empty())
+            return TerrainType::Unknown;
+
+        int px = static_cast<int> (pos.x) % mapsize;
+        int py = static_cast<int> (pos.y) % mapsize;
+
+        if (px < 0)
+            px += mapsize;
+
+        if (py < 0)
+            py += mapsize;
+
+        return static_cast<TerrainType> (grid[texel[py] * size + texel[px]]);
+    }
+
+private:
+
+    // TerrainType of each texel, row by row
+    std::vector<uint8_t> grid;
+    int size = 0;
+
+    // texel column (or row) of each whole world coordinate
+    std::vector<int> texel;
+    int mapsize = 0;
+};
+
+struct road_sign
+{
+public:
+
+//
+// being smart here makes the rest of the code more complicated;
+// so let's be stupid for now...
+//
+#if 0
+  struct road_sign_location
+  {
+    public:
+      float x;
+      float y;
+      float deg;
+
+      road_sign_location(float x=0, float y=0, float deg=0):
+          x(x), y(y), deg(deg)
+      {
+      }
+  };
+  std::vector<road_sign_location> location;
+#endif
+
+  std::string sprite_name;
+  PTexture *sprite  = nullptr;
+  float scale   = 1.0f;
+  float x = 0.0f;
+  float y = 0.0f;
+  float deg = 0.0f;
+  int sprite_count = 1;
+};
+
+///
+/// @brief Terrain data needed by the physics simulation
+/// @details Height, foliage, terrain and road maps plus the foliage and road
+///  sign instances used for collision detection. Nothing in here touches
+///  OpenGL, so the headless simulator can link it without a renderer.
+/// @see PTerrain for the renderable terrain.
+///
+class PTerrainData // TODO: make this RAII conformant
+{
+protected:
+  bool loaded;
+
+  int tilesize, tilecount, totsize, totmask, totsizesq;
+
+  float scale_hz, scale_vt, scale_hz_inv, scale_vt_inv, scale_tile_inv;
+
+  int cmaptotsize, cmaptilesize, cmaptotmask;
+
+  //std::vector<uint8> hmap;
+  std::vector<float> hmap;
+
+  // contact with hmap, once loaded
+  PTerrainContact contact;
+
+  // color map
+  PImage cmap;
+  // terrain map
+  TerrainTypeMap tmap;
+  // road map
+  RoadMap rmap;
+
+  std::vector<float> fmap;
+  std::vector<PTerrainFoliageBand> foliageband;
+  std::vector<road_sign> roadsigns;
+
+  // recently used tile objects; shared so that a tile dropped from the
+  // cache stays valid for whoever is still using it
+  PTileCache<std::shared_ptr<const PTerrainTileObjects> > tileobjects;
+
+  // the simulation ticks vehicles on several threads at once
+  std::mutex tileobjects_mutex;
+
+  // how many times tile objects were generated, and the most objects in a
+  // grid cell of any of them, guarded by the mutex too
+  unsigned int tileobjects_generated;
+  unsigned int tileobjects_maxcell;
+
+protected:
+
+  std::shared_ptr<const PTerrainTileObjects> getTileObjects(int tilex, int tiley);
+
+  float getInterp(float x, float y, float *data) {
+    x *= scale_hz_inv;
+    int xi = (int)x;
+    if (x < 0.0) xi--;
+    x -= (float)xi;
+    int xiw = xi & totmask, xiw2 = (xiw+1) & totmask;
+
+    y *= scale_hz_inv;
+    int yi = (int)y;
+    if (y < 0.0) yi--;
+    y -= (float)yi;
+    int yiw = yi & totmask, yiw2 = (yiw+1) & totmask;
+
+    const int cx = totsize;
+
+    float xv1,xv2;
+    if (y > 0.0) {
+      if (y < 1.0) {
+        if (x < y) {
+          xv1 = data[yiw*cx+xiw];
+          xv2 = INTERP(data[yiw2*cx+xiw],data[yiw2*cx+xiw2],x/y);
+        } else {
+          xv1 = INTERP(data[yiw*cx+xiw],data[yiw*cx+xiw2],(x-y)/(1.0-y));
+          xv2 = data[yiw2*cx+xiw2];
+        }
+        return INTERP(xv1,xv2,y);
+      } else {
+        return INTERP(data[yiw2*cx+xiw],data[yiw2*cx+xiw2],x);
+      }
+    } else {
+      return INTERP(data[yiw*cx+xiw],data[yiw*cx+xiw2],x);
+    }
+  }
+
+public:
+  PTerrainData(XMLElement *element, const std::string &filepath,
+      const PRigidity &rigidity, bool cfgFoliage, bool cfgRoadsigns);
+  virtual ~PTerrainData();
+
+  void unload();
+
+  void findObjects(const vec3f &boxmin, const vec3f &boxmax, PTerrainObjectQuery &query);
+
+  // Make room in a query for a box up to boxsize across, so that it won't
+  // need more on any tile generated so far
+  void reserveObjectQuery(const vec3f &boxsize, PTerrainObjectQuery &query);
+
+  // Tiles whose objects were generated so far, a cache miss each
+  unsigned int getGeneratedTileCount();
+
+  typedef PTerrainContact::ContactInfo ContactInfo;
+
+    ///
+    /// @brief Returns whether or not the given position is on road.
+    /// @param [in] pos         Position to be checked.
+    /// @returns Whether or not `pos` is on the road.
+    /// @retval true            If no roadmap was loaded.
+    /// @see `RoadMap`.
+    ///
+    bool getRmapOnRoad(const vec3f &pos) const
+    {
+        return rmap.isOnRoad(pos.x, pos.y);
+    }
+
+    ///
+    /// @brief Precomputes the distance field needed by getRoadDistance().
+    ///
+    void buildRoadDistance()
+    {
+        rmap.buildDistance();
+    }
+
+    ///
+    /// @brief Returns the signed distance from the given position to the
+    ///  edge of the road, negative on the road.
+    /// @note The height component Z is ignored.
+    /// @param [in] pos         Position to be checked.
+    /// @returns Distance in world units.
+    /// @retval 0               If no roadmap was loaded or
+    ///                         buildRoadDistance() wasn't called.
+    ///
+    float getRoadDistance(const vec3f &pos) const
+    {
+        return rmap.getDistance(pos.x, pos.y);
+    }
+
+    ///
+    /// @brief Returns the color of the pixel in the colormap that corresponds
+    ///  to the given position in the terrain.
+    /// @note The height component Z is ignored.
+    /// @todo Should check if cmap.getcc() returns at least 3?
+    /// @todo Should check if cmap.getcx() == cmap.getcy()?
+    /// @todo Should remove paranoid clampings?
+    /// @todo Should actually measure performance of float vs int.
+    /// @param [in] pos   Position in the terrain.
+    /// @returns Color in OpenGL-style RGB.
+    ///
+    vec3f getCmapColor(const vec3f &pos) const
+    {
+        vec3f r;
+#if 0
+        const float ms = getMapSize();
+        float px = pos.x;
+        float py = pos.y;
+#else
+        const int ms = static_cast<int> (getMapSize());
+        int px = static_cast<int> (pos.x);
+        int py = static_cast<int> (pos.y);
+#endif
+        if (px >= ms)
+        {
+            do
+                px -= ms;
+            while (px > ms);
+        }
+        else
+        if (px < 0)
+        {
+            do
+                px += ms;
+            while (px < 0);
+        }
+
+        if (py >= ms)
+        {
+            do
+                py -= ms;
+            while (py > ms);
+        }
+        else
+        if (py < 0)
+        {
+            do
+                py += ms;
+            while (py < 0);
+        }
+
+        long int x = std::lround(px * cmap.getcx() / getMapSize());
+        long int y = std::lround(py * cmap.getcy() / getMapSize());
+
+        CLAMP_UPPER(x, cmap.getcx() - 1);
+        CLAMP_UPPER(y, cmap.getcy() - 1);
+        r.x = cmap.getByte((y * cmap.getcx() + x) * cmap.getcc() + 0) / 255.0f;
+        r.y = cmap.getByte((y * cmap.getcx() + x) * cmap.getcc() + 1) / 255.0f;
+        r.z = cmap.getByte((y * cmap.getcx() + x) * cmap.getcc() + 2) / 255.0f;
+        return r;
+    }
+
+    ///
+    /// @brief Returns the road surface type corresponding to the given position
+    ///  in the terrain.
+    /// @note The height component Z is ignored.
+    /// @param [in] pos   Position in the terrain.
+    /// @returns Terrain type.
+    ///
+    TerrainType getRoadSurface(const vec3f &pos) const
+    {
+        return tmap.getType(pos);
+    }
+
+  ///
+  /// @brief get the information about a contact point (its coordinates and normal) with the ground
+  ///
+  void getContactInfo(ContactInfo &tci) const { contact.getContactInfo(tci); }
+
+  ///
+  /// @brief getContactInfo() for many points at once
+  /// @see PTerrainContact::getContactInfoBatch()
+  ///
+  void getContactInfoBatch(const vec3f *pos, ContactInfo *out, size_t n) const {
+    contact.getContactInfoBatch(pos, out, n);
+  }
+
+  float getHeight(float x, float y) {
+    return getInterp(x, y, &hmap[0]);
+  }
+
+  float getFoliageLevel(float x, float y) {
+    return getInterp(x, y, &fmap[0]);
+  }
+
+  float getMapSize() const { return totsize * scale_hz; }
+
+private:
+  void generateTileObjects(PTerrainTileObjects &objs);
+
+  // Rigidity map for foliage and road signs
+  const PRigidity &rigidity;
+};
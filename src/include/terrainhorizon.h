@@ -0,0 +1,40 @@
+// terrainhorizon.h [pengine]
+
+// License: GPL version 2 (see included gpl.txt)
+
+#pragma once
+
+#include "vmath.h"
+#include <vector>
+
+// passes of a tile that PTerrain::render() draws, as bits
+#define PASS_TERRAIN  1
+#define PASS_OBJECTS  2
+
+///
+/// @brief The boxes a terrain tile is culled by
+///
+struct PTerrainTileBounds {
+  vec3f mins, maxs; // AABB
+
+  // AABB of the terrain with its foliage and road signs
+  vec3f objmins, objmaxs;
+};
+
+///
+/// @brief Culls the tiles around the camera that nearer terrain hides
+/// @details Nothing here touches GL, so that the headless simulator can
+///  check that no visible tile is culled.
+///
+class PTerrainHorizon {
+public:
+  // Drops the passes of the hidden tiles of a square around the camera
+  void cull(const vec3f &campos, int radius,
+    const std::vector<const PTerrainTileBounds *> &tile, std::vector<uint8> &pass);
+
+private:
+  // scratch for cull(): the steepest slope in each direction, and a ring
+  // of tiles
+  std::vector<float> horizon;
+  std::vector<int> ringtile;
+};
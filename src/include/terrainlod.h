@@ -0,0 +1,50 @@
+// terrainlod.h [pengine]
+
+// License: GPL version 2 (see included gpl.txt)
+
+#pragma once
+
+#include "vmath.h"
+#include <vector>
+
+// sides of a tile, as bits of a mask of the sides that meet a coarser tile
+#define SIDE_MINY   1
+#define SIDE_MAXX   2
+#define SIDE_MAXY   4
+#define SIDE_MINX   8
+#define SIDE_MASKS  16
+
+///
+/// @brief The index sets terrain tiles are drawn with, and the detail levels
+///  of a square of tiles around the camera
+/// @details There is one index set per detail level and mask of the sides
+///  that meet a coarser tile, all in a single array of triangles that
+///  PTerrain uploads. Nothing here touches GL, so that the headless
+///  simulator can check the sets stitch.
+///
+class PTerrainLod {
+public:
+  PTerrainLod() : levels(0) { }
+
+  // Builds the index sets of tiles of tilesize by tilesize quads
+  void build(int tilesize, std::vector<uint16> &index);
+
+  // Detail levels, from 0 for full detail
+  int getLevels() const { return levels; }
+
+  // First index and index count of the set of a level and mask
+  int getFirst(int level, int mask) const { return first[level * SIDE_MASKS + mask]; }
+  int getCount(int level, int mask) const { return count[level * SIDE_MASKS + mask]; }
+
+  // Refines levels of a side by side square of tiles until neighbors are
+  // at most one level apart
+  static void stitchLevels(std::vector<int> &level, int side);
+
+  // Mask of the sides of a tile of the square that meet a coarser tile
+  static int getSideMask(const std::vector<int> &level, int side, int tx, int ty);
+
+private:
+  int levels;
+  std::vector<int> first;
+  std::vector<int> count;
+};
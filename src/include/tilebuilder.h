@@ -0,0 +1,68 @@
+// tilebuilder.h [pengine]
+
+// License: GPL version 2 (see included gpl.txt)
+
+#pragma once
+
+#include "vmath.h"
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct PTerrainTileBuild;
+
+///
+/// @brief Builds terrain tiles on background threads, ahead of need
+/// @details The renderer says which tiles it will likely want next, nearest
+///  first, and takes finished ones when it has time to upload them. A tile
+///  that is needed right away and isn't ready is waited for if a thread is
+///  already on it, and otherwise built by the caller. Only the CPU side is
+///  built here: the build function must not touch GL, and must be safe to
+///  run on several threads at once.
+///
+class PTileBuilder {
+public:
+  // threads = worker threads, 0 builds everything in takeNow()
+  // build = fills a tile, posx and posy already set
+  PTileBuilder(unsigned int threads, const std::function<void (PTerrainTileBuild &)> &build);
+  ~PTileBuilder();
+
+  // Worker threads that would suit this machine
+  static unsigned int getDefaultThreadCount();
+
+  // Replace the tiles waiting to be built, in the order to build them
+  void setRequests(const std::vector<vec2i> &tiles);
+
+  // A finished tile, or nullptr if none is ready yet
+  std::unique_ptr<PTerrainTileBuild> takeBuilt();
+
+  // A given tile, finished now whatever it takes
+  std::unique_ptr<PTerrainTileBuild> takeNow(int tilex, int tiley);
+
+private:
+  PTileBuilder(const PTileBuilder &);
+  PTileBuilder &operator=(const PTileBuilder &);
+
+  void workerMain();
+
+  std::function<void (PTerrainTileBuild &)> build;
+
+  std::vector<std::thread> workers;
+
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable finished;
+
+  // waiting[nextwaiting] to waiting.back() haven't been started
+  std::vector<vec2i> waiting;
+  unsigned int nextwaiting;
+
+  // tiles a worker is on, and tiles done but not taken yet
+  std::vector<vec2i> building;
+  std::vector<std::unique_ptr<PTerrainTileBuild>> built;
+
+  bool quit;
+};
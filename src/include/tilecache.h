@@ -0,0 +1,167 @@
+
+// tilecache.h [pengine]
+
+// License: GPL version 2 (see included gpl.txt)
+
+#pragma once
+
+#include <vector>
+
+///
+/// @brief Fixed number of terrain tiles, looked up by their tile coordinates
+/// @details Slots are allocated on the first insert() and then reused: once
+///  all of them are taken, insert() hands out the least recently used one,
+///  still holding its old contents so that its buffers can be recycled.
+///  Lookups go through a hash of the coordinates, and the recency order is a
+///  list linked through the slots, so both find() and insert() are O(1) no
+///  matter how many tiles a long drive has visited.
+///
+template <typename T>
+class PTileCache {
+public:
+  explicit PTileCache(unsigned int capacity) :
+    capacity(capacity),
+    count(0),
+    newest(-1),
+    oldest(-1)
+  {
+    if (this->capacity < 1) this->capacity = 1;
+  }
+
+  unsigned int getCapacity() const { return capacity; }
+  unsigned int getCount() const { return count; }
+
+  ///
+  /// @brief Changes how many tiles are kept, dropping all of them
+  ///
+  void setCapacity(unsigned int newcapacity)
+  {
+    clear();
+    capacity = newcapacity > 0 ? newcapacity : 1;
+  }
+
+  ///
+  /// @brief Drops all the tiles and frees the slots
+  ///
+  void clear()
+  {
+    slot.clear();
+    bucket.clear();
+    count = 0;
+    newest = oldest = -1;
+  }
+
+  ///
+  /// @brief Finds a tile and marks it as the most recently used
+  /// @retval pointer to the tile, nullptr if it isn't cached
+  ///
+  T *find(int tilex, int tiley)
+  {
+    if (bucket.empty()) return nullptr;
+
+    for (int i = bucket[hash(tilex, tiley)]; i != -1; i = slot[i].next) {
+      if (slot[i].tilex == tilex && slot[i].tiley == tiley) {
+        unlinkRecent(i);
+        linkNewest(i);
+        return &slot[i].value;
+      }
+    }
+
+    return nullptr;
+  }
+
+  ///
+  /// @brief Makes room for a tile that isn't cached yet
+  /// @details Evicts the least recently used tile when the cache is full.
+  /// @retval the tile's slot, which may still hold an evicted tile
+  ///
+  T &insert(int tilex, int tiley)
+  {
+    if (slot.empty()) {
+      // two buckets per slot keeps the chains short
+      unsigned int buckets = 1;
+      while (buckets < capacity * 2) buckets <<= 1;
+
+      slot.resize(capacity);
+      bucket.assign(buckets, -1);
+    }
+
+    int i;
+
+    if (count < capacity) {
+      i = count++;
+    } else {
+      i = oldest;
+      unlinkRecent(i);
+      unlinkBucket(i);
+    }
+
+    slot[i].tilex = tilex;
+    slot[i].tiley = tiley;
+
+    const unsigned int h = hash(tilex, tiley);
+    slot[i].next = bucket[h];
+    bucket[h] = i;
+
+    linkNewest(i);
+
+    return slot[i].value;
+  }
+
+private:
+  struct Slot {
+    T value;
+    int tilex, tiley;
+
+    // recency list, -1 at either end
+    int newer, older;
+
+    // next slot in the same bucket, -1 at the end
+    int next;
+  };
+
+  unsigned int hash(int tilex, int tiley) const
+  {
+    unsigned int h = (unsigned int)tilex * 0x9E3779B1u ^ (unsigned int)tiley * 0x85EBCA77u;
+    h ^= h >> 16;
+    return h & (bucket.size() - 1);
+  }
+
+  void unlinkRecent(int i)
+  {
+    if (slot[i].newer != -1) slot[slot[i].newer].older = slot[i].older;
+    else newest = slot[i].older;
+
+    if (slot[i].older != -1) slot[slot[i].older].newer = slot[i].newer;
+    else oldest = slot[i].newer;
+  }
+
+  void linkNewest(int i)
+  {
+    slot[i].newer = -1;
+    slot[i].older = newest;
+
+    if (newest != -1) slot[newest].newer = i;
+    else oldest = i;
+
+    newest = i;
+  }
+
+  void unlinkBucket(int i)
+  {
+    int *link = &bucket[hash(slot[i].tilex, slot[i].tiley)];
+
+    while (*link != i) link = &slot[*link].next;
+
+    *link = slot[i].next;
+  }
+
+  unsigned int capacity, count;
+
+  std::vector<Slot> slot;
+
+  // first slot of each hash chain, -1 if empty; the size is a power of two
+  std::vector<int> bucket;
+
+  int newest, oldest;
+};
@@ -14,12 +14,14 @@
 #include "engine.h"
 #include "psim.h"
 #include "subsys.h"
+#include "terraindata.h"
 #include <string>
 #include <vector>
 
 class PModel;
-class PSSModel;
-class PTerrain;
+class PModelList;
+struct PSimSnapshot;
+class PTerrainData;
 
 // vehicle core types
 enum class v_core_type{
@@ -77,6 +79,15 @@ struct v_control_s {
 
   // -- utility --
 
+  bool operator==(const v_control_s &other) const {
+    return throttle == other.throttle &&
+      brake1 == other.brake1 &&
+      brake2 == other.brake2 &&
+      turn.x == other.turn.x && turn.y == other.turn.y && turn.z == other.turn.z &&
+      aim.x == other.aim.x && aim.y == other.aim.y &&
+      collective == other.collective;
+  }
+
   void setZero() {
     throttle = 0.0f;
     brake1 = 0.0f;
@@ -185,6 +196,13 @@ public:
   
   // dimensions (aproximated as a cuboid)
   vec3f dims;
+
+  // center of the cuboid in the body frame
+  vec3f dims_center;
+
+  // radius of a sphere around the body origin that holds the cuboid and the
+  // clips of all the parts
+  float bound_radius;
   
   // parts which compose the vehicle
   std::vector<PVehicleTypePart> part;
@@ -232,7 +250,7 @@ public:
   ~PVehicleType() { unload(); }
 
 public:
-  bool load(const std::string &filename, PSSModel &ssModel);
+  bool load(const std::string &filename, PModelList &ssModel);
   void unload();
   void setLocked(bool setLocked);
   bool getLocked();
@@ -256,8 +274,8 @@ struct PVehicleWheel {
 	// steering axis rotation
 	float turn_pos;
   
-	// his reference position in the world
-	PReferenceFrame ref_world;
+	// his reference position in the world, now and before the last step
+	PReferenceFrame ref_world, ref_world_prev;
 	
 	// the reference position in the world of the lowest point of the wheel (the one touching the ground)
 	PReferenceFrame ref_world_lowest_point;
@@ -287,6 +305,9 @@ struct PVehiclePart {
 
   // reference points in the local and world system
   PReferenceFrame ref_local, ref_world;
+
+  // world reference before the last step, for rendering
+  PReferenceFrame ref_world_prev;
   
   std::vector<PVehicleWheel> wheel;
 
@@ -294,6 +315,46 @@ struct PVehiclePart {
   PDamage damage;
 };
 
+///
+/// @brief Copy of the changing part of a PVehiclePart, for simulation snapshots
+/// @details The wheels are saved on their own, PVehicleWheel has nothing to leave out.
+///
+struct PVehiclePartState {
+  PReferenceFrame ref_local, ref_world, ref_world_prev;
+  PDamage damage;
+};
+
+///
+/// @brief Copy of the changing part of a PVehicle, for simulation snapshots
+/// @details The body is saved with the other rigid bodies of the simulation.
+///
+struct PVehicleState {
+  v_state_s state;
+  v_control_s ctrl;
+  PEngineState engine;
+
+  float blade_ang1;
+
+  int nextcp, nextcdcp, currentlap;
+
+  float reset_trigger_time;
+  vec3f reset_pos;
+  quatf reset_ori;
+  float reset_time;
+
+  float crunch_level, crunch_level_prev;
+
+  PSimRandom random;
+
+  bool sleeping;
+  unsigned int sleep_steps;
+  v_control_s sleep_ctrl;
+
+  float forwardspeed, wheel_angvel, wheel_speed, skid_level;
+
+  float offroadtime_begin, offroadtime_end, offroadtime_total;
+};
+
 ///
 /// @brief store a vehicle instance
 ///
@@ -334,12 +395,32 @@ public:
   vec3f reset_pos;
   quatf reset_ori;
   float reset_time;
+
+  // resets started since the vehicle was created, for recorders to notice
+  // them; snapshots leave it alone
+  uint32 resetcount;
   
   // for body crash/impact noises
   float crunch_level, crunch_level_prev;
   
   // current controls situation (eg. brakes, turn)
   v_control_s ctrl;
+
+  // random generator for the wheel bumps, seeded by the simulation
+  PSimRandom random;
+
+  // a car at rest is put to sleep and not simulated: steps it has spent
+  // still with the same controls, and those controls
+  bool sleeping;
+  unsigned int sleep_steps;
+  v_control_s sleep_ctrl;
+
+  // terrain queries of one part in tick(), its clips then its wheels
+  std::vector<vec3f> contact_pos;
+  std::vector<PTerrainData::ContactInfo> contact_info;
+
+  // world objects touching the part being ticked
+  PTerrainObjectQuery contact_objects;
   
   // real current velocity on the y axis, from the front to the back of the car
   float forwardspeed;
@@ -381,6 +462,27 @@ public:
   
   // update world reference of parts and wheels
   void updateParts();
+
+  // true while the car rests and isn't simulated
+  bool isSleeping() const { return sleeping; }
+
+  // remember the world reference of parts and wheels before a step
+  void savePrevious();
+
+  // world references of a part and its wheels between their previous and current pose
+  void getInterpolatedPart(unsigned int i, float t, PVehiclePart &ipart) const;
+
+  // append the state of the vehicle, of its parts and of their wheels to a snapshot
+  void saveState(PSimSnapshot &snapshot) const;
+
+  // push the clips of this vehicle out of the cuboid of another one, and
+  // that one away from them
+  void collideWith(PVehicle &other);
+
+  // put back vehicle 'index' of a snapshot; its parts and wheels start at
+  // 'nextpart' and 'nextwheel', which are moved past them
+  void restoreState(const PSimSnapshot &snapshot, unsigned int index,
+    unsigned int &nextpart, unsigned int &nextwheel);
   
   // reset the car in place
   void doReset();
@@ -406,4 +508,7 @@ private:
   // subroutines that reset and stops status of the car
   // it's more low level that the doReset() one
   void reset();
+
+  void updateSleep();
+  void wakeUp();
 };
@@ -9,6 +9,13 @@
 #include <cstdlib>
 #include <math.h>
 
+// mat44<float> and quat<float> use SSE for their transforms where the
+// compiler allows it; define VMATH_SCALAR to build with the generic code only
+#if defined(__SSE__) && !defined(VMATH_SCALAR)
+#define VMATH_SSE
+#include <xmmintrin.h>
+#endif
+
 
 #define PI 3.1415926535897932384626433832795
 
@@ -446,6 +453,121 @@ public:
   }
 };
 
+#ifdef VMATH_SSE
+
+///
+/// @brief SSE versions of the mat44<float> members of the physics and render loops
+/// @details Each lane adds up its products in the same order as the generic
+///  code, so the results are the same. The storage is unchanged (rows of
+///  plain floats, not necessarily aligned), so matrices still go straight
+///  to OpenGL.
+///
+
+template<> inline mat44<float> mat44<float>::concatenate(const mat44<float> &mat) const {
+  const __m128 m0 = _mm_loadu_ps(&mat.row[0].x);
+  const __m128 m1 = _mm_loadu_ps(&mat.row[1].x);
+  const __m128 m2 = _mm_loadu_ps(&mat.row[2].x);
+  const __m128 m3 = _mm_loadu_ps(&mat.row[3].x);
+
+  mat44<float> ret;
+  for (int i = 0; i < 4; ++i) {
+    __m128 r = _mm_mul_ps(_mm_set1_ps(row[i].x), m0);
+    r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(row[i].y), m1));
+    r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(row[i].z), m2));
+    r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(row[i].w), m3));
+    _mm_storeu_ps(&ret.row[i].x, r);
+  }
+  return ret;
+}
+
+template<> inline mat44<float> mat44<float>::transpose() const {
+  __m128 r0 = _mm_loadu_ps(&row[0].x);
+  __m128 r1 = _mm_loadu_ps(&row[1].x);
+  __m128 r2 = _mm_loadu_ps(&row[2].x);
+  __m128 r3 = _mm_loadu_ps(&row[3].x);
+  _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+
+  mat44<float> ret;
+  _mm_storeu_ps(&ret.row[0].x, r0);
+  _mm_storeu_ps(&ret.row[1].x, r1);
+  _mm_storeu_ps(&ret.row[2].x, r2);
+  _mm_storeu_ps(&ret.row[3].x, r3);
+  return ret;
+}
+
+template<> inline vec3<float> mat44<float>::transform1(const vec3<float> &vec) const {
+  __m128 c0 = _mm_loadu_ps(&row[0].x);
+  __m128 c1 = _mm_loadu_ps(&row[1].x);
+  __m128 c2 = _mm_loadu_ps(&row[2].x);
+  __m128 c3 = _mm_loadu_ps(&row[3].x);
+  _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+
+  __m128 r = _mm_mul_ps(c0, _mm_set1_ps(vec.x));
+  r = _mm_add_ps(r, _mm_mul_ps(c1, _mm_set1_ps(vec.y)));
+  r = _mm_add_ps(r, _mm_mul_ps(c2, _mm_set1_ps(vec.z)));
+  r = _mm_add_ps(r, c3);
+
+  float out[4];
+  _mm_storeu_ps(out, r);
+  return vec3<float>(out[0], out[1], out[2]);
+}
+
+template<> inline vec4<float> mat44<float>::transform1(const vec4<float> &vec) const {
+  __m128 c0 = _mm_loadu_ps(&row[0].x);
+  __m128 c1 = _mm_loadu_ps(&row[1].x);
+  __m128 c2 = _mm_loadu_ps(&row[2].x);
+  __m128 c3 = _mm_loadu_ps(&row[3].x);
+  _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+
+  __m128 r = _mm_mul_ps(c0, _mm_set1_ps(vec.x));
+  r = _mm_add_ps(r, _mm_mul_ps(c1, _mm_set1_ps(vec.y)));
+  r = _mm_add_ps(r, _mm_mul_ps(c2, _mm_set1_ps(vec.z)));
+  r = _mm_add_ps(r, _mm_mul_ps(c3, _mm_set1_ps(vec.w)));
+
+  vec4<float> ret;
+  _mm_storeu_ps(&ret.x, r);
+  return ret;
+}
+
+template<> inline vec3<float> mat44<float>::transform2(const vec3<float> &vec) const {
+  __m128 r = _mm_mul_ps(_mm_loadu_ps(&row[0].x), _mm_set1_ps(vec.x));
+  r = _mm_add_ps(r, _mm_mul_ps(_mm_loadu_ps(&row[1].x), _mm_set1_ps(vec.y)));
+  r = _mm_add_ps(r, _mm_mul_ps(_mm_loadu_ps(&row[2].x), _mm_set1_ps(vec.z)));
+  r = _mm_add_ps(r, _mm_loadu_ps(&row[3].x));
+
+  float out[4];
+  _mm_storeu_ps(out, r);
+  return vec3<float>(out[0], out[1], out[2]);
+}
+
+template<> inline vec4<float> mat44<float>::transform2(const vec4<float> &vec) const {
+  __m128 r = _mm_mul_ps(_mm_loadu_ps(&row[0].x), _mm_set1_ps(vec.x));
+  r = _mm_add_ps(r, _mm_mul_ps(_mm_loadu_ps(&row[1].x), _mm_set1_ps(vec.y)));
+  r = _mm_add_ps(r, _mm_mul_ps(_mm_loadu_ps(&row[2].x), _mm_set1_ps(vec.z)));
+  r = _mm_add_ps(r, _mm_mul_ps(_mm_loadu_ps(&row[3].x), _mm_set1_ps(vec.w)));
+
+  vec4<float> ret;
+  _mm_storeu_ps(&ret.x, r);
+  return ret;
+}
+
+template<> inline vec3<float> mat44<float>::transformNormal(const vec3<float> &vec) const {
+  __m128 c0 = _mm_loadu_ps(&row[0].x);
+  __m128 c1 = _mm_loadu_ps(&row[1].x);
+  __m128 c2 = _mm_loadu_ps(&row[2].x);
+  __m128 c3 = _mm_loadu_ps(&row[3].x);
+  _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+
+  __m128 r = _mm_mul_ps(c0, _mm_set1_ps(vec.x));
+  r = _mm_add_ps(r, _mm_mul_ps(c1, _mm_set1_ps(vec.y)));
+  r = _mm_add_ps(r, _mm_mul_ps(c2, _mm_set1_ps(vec.z)));
+
+  float out[4];
+  _mm_storeu_ps(out, r);
+  return vec3<float>(out[0], out[1], out[2]);
+}
+
+#endif // VMATH_SSE
 
 ///
 /// @brief class storing a quaternion
@@ -489,7 +611,7 @@ public:
   // since quaternion mult is not commutative, it's
   // better to force the user to think about it
   
-  float dot(const quat<T> &q) {
+  float dot(const quat<T> &q) const {
     return (x * q.x + y * q.y + z * q.z + w * q.w);
   }
 
@@ -598,6 +720,68 @@ public:
   }
 };
 
+#ifdef VMATH_SSE
+
+///
+/// @brief SSE versions of the quat<float> members that rigid bodies call
+///  every step
+/// @details As with mat44<float>, each value is worked out in the same
+///  order as the generic code.
+///
+
+// x*x + y*y + z*z + w*w of a quaternion, in the first lane
+inline __m128 vmath_sse_lengthsq(__m128 q) {
+  const __m128 sq = _mm_mul_ps(q, q);
+  __m128 len = _mm_add_ss(sq, _mm_shuffle_ps(sq, sq, _MM_SHUFFLE(1, 1, 1, 1)));
+  len = _mm_add_ss(len, _mm_movehl_ps(sq, sq));
+  return _mm_add_ss(len, _mm_shuffle_ps(sq, sq, _MM_SHUFFLE(3, 3, 3, 3)));
+}
+
+template<> inline void quat<float>::normalize() {
+  const __m128 q = _mm_loadu_ps(&x);
+  const __m128 len = vmath_sse_lengthsq(q);
+
+  if (_mm_cvtss_f32(len) > 0.0f) {
+    const __m128 mult = _mm_div_ss(_mm_set_ss(1.0f), _mm_sqrt_ss(len));
+    _mm_storeu_ps(&x, _mm_mul_ps(q, _mm_shuffle_ps(mult, mult, 0)));
+  } else {
+    *this = identity();
+  }
+}
+
+template<> inline mat44<float> quat<float>::getMatrix() const {
+  const __m128 q = _mm_loadu_ps(&x);
+  const float norm = _mm_cvtss_f32(vmath_sse_lengthsq(q));
+  const __m128 s = _mm_set1_ps((norm > 0.0f) ? 2.0f / norm : 0.0f);
+
+  // (xx, yy, zz), (xy, xz, yz) and (wx, wy, wz), each times s
+  const __m128 sq = _mm_mul_ps(_mm_mul_ps(q, q), s);
+  const __m128 cross = _mm_mul_ps(_mm_mul_ps(
+    _mm_shuffle_ps(q, q, _MM_SHUFFLE(3, 1, 0, 0)),
+    _mm_shuffle_ps(q, q, _MM_SHUFFLE(3, 2, 2, 1))), s);
+  const __m128 wq = _mm_mul_ps(_mm_mul_ps(_mm_shuffle_ps(q, q, _MM_SHUFFLE(3, 3, 3, 3)), q), s);
+
+  // the diagonal, 1 - (yy + zz), 1 - (xx + zz) and 1 - (xx + yy); then
+  // xy, xz and yz plus and minus wz, wy and wx
+  float diag[4], plus[4], minus[4];
+  _mm_storeu_ps(diag, _mm_sub_ps(_mm_set1_ps(1.0f), _mm_add_ps(
+    _mm_shuffle_ps(sq, sq, _MM_SHUFFLE(3, 0, 0, 1)),
+    _mm_shuffle_ps(sq, sq, _MM_SHUFFLE(3, 1, 2, 2)))));
+  const __m128 wqr = _mm_shuffle_ps(wq, wq, _MM_SHUFFLE(3, 0, 1, 2));
+  _mm_storeu_ps(plus, _mm_add_ps(cross, wqr));
+  _mm_storeu_ps(minus, _mm_sub_ps(cross, wqr));
+
+  mat44<float> m;
+  m.assemble(
+    vec3<float>(diag[0], plus[0], minus[1]),
+    vec3<float>(minus[0], diag[1], plus[2]),
+    vec3<float>(plus[1], minus[2], diag[2]));
+
+  return m;
+}
+
+#endif // VMATH_SSE
+
 template<class T>
 class frustum {
 public: